@@ -35,7 +35,6 @@
 #include "../inc/LaunchPad.h"
 #include "../inc/PLL.h"
 #include "../inc/Timer4A.h"
-#include "../inc/Timer5A.h"
 #include "../inc/UART0int.h"
 #include "../inc/tm4c123gh6pm.h"
 
@@ -63,13 +62,7 @@ int main(void) {
                 // get a realistic analog signal
   Timer4A_Init(&DAStask, 80000000 / 10, 1);  // 10 Hz sampling, priority=1
 
-  Timer5A_Init(&OS_timer_task,
-               80000000 / 1000,  // number of clock periods
-                                 // for 1ms required period, we use the
-                                 // value
-               1);               // priority
-
-  OS_ClearMsTime();  // start a periodic interrupt to maintain time
+  OS_ClearMsTime();  // start the free-running system time counter
 
   EnableInterrupts();
 
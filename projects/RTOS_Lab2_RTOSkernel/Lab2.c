@@ -155,7 +155,8 @@ void ButtonWork(void) {
 // background threads execute once and return
 void SW1Push(void) {
   if (OS_MsTime() > 20) {  // debounce
-    if (OS_AddThread(&ButtonWork, 100, 0)) {
+    if (OS_AddBudgetThread(&ButtonWork, 100, 0, APERIODIC_BUDGET,
+                           APERIODIC_PERIOD)) {
       NumCreated++;
     }
     OS_ClearMsTime();  // at least 20ms between touches
@@ -324,7 +325,8 @@ int realmain(void) {  // realmain
   // create initial foreground threads
   NumCreated = 0;
   NumCreated += OS_AddThread(&Consumer, 128, 0);
-  NumCreated += OS_AddThread(&Interpreter, 128, 0);
+  NumCreated += OS_AddBudgetThread(&Interpreter, 128, 0, APERIODIC_BUDGET,
+                                   APERIODIC_PERIOD);
   NumCreated += OS_AddThread(&PID, 128, 0);
 
   OS_Launch(TIME_2MS);  // doesn't return, interrupts enabled in here
@@ -146,7 +146,8 @@ void ButtonWork(void) {
 // background threads execute once and return
 void SW1Push(void) {
   if (OS_MsTime() > 20) {  // debounce
-    if (OS_AddThread(&ButtonWork, 100, 2)) {
+    if (OS_AddBudgetThread(&ButtonWork, 100, 2, APERIODIC_BUDGET,
+                           APERIODIC_PERIOD)) {
       NumCreated++;
     }
     OS_ClearMsTime();  // at least 20ms between touches
@@ -159,7 +160,8 @@ void SW1Push(void) {
 // background threads execute once and return
 void SW2Push(void) {
   if (OS_MsTime() > 20) {  // debounce
-    if (OS_AddThread(&ButtonWork, 100, 2)) {
+    if (OS_AddBudgetThread(&ButtonWork, 100, 2, APERIODIC_BUDGET,
+                           APERIODIC_PERIOD)) {
       NumCreated++;
     }
     OS_ClearMsTime();  // at least 20ms between touches
@@ -320,7 +322,7 @@ void Idle(void) {
   while (1) {
     // if you do not wish to measure CPU utilization using this idle task
     // you can execute WaitForInterrupt to put processor to sleep
-    WaitForInterrupt();
+    if (!OS_RunIdleWork()) WaitForInterrupt();
   }
 }
 
@@ -354,7 +356,8 @@ int realmain(void) {  // realmain
   // create initial foreground threads
   NumCreated = 0;
   NumCreated += OS_AddThread(&Consumer, 128, 1);
-  NumCreated += OS_AddThread(&Interpreter, 128, 2);
+  NumCreated += OS_AddBudgetThread(&Interpreter, 128, 2, APERIODIC_BUDGET,
+                                   APERIODIC_PERIOD);
   NumCreated += OS_AddThread(&Idle, 128, 5);  // Lab 3, at lowest priority
 
   OS_Launch(TIME_2MS);  // doesn't return, interrupts enabled in here
@@ -91,6 +91,8 @@
 #include "../RTOS_Labs_common/UART0int.h"
 #include "../RTOS_Labs_common/eDisk.h"
 #include "../RTOS_Labs_common/eFile.h"
+#include "../RTOS_Labs_common/eFileAsync.h"
+#include "../RTOS_Labs_common/heap.h"
 #include "../inc/ADCT0ATrigger.h"
 #include "../inc/CortexM.h"
 #include "../inc/IRDistance.h"
@@ -115,8 +117,10 @@ uint32_t FilterWork;  // number of digital filter calculations finished
 
 #define TIMESLICE 2 * TIME_1MS  // thread switch time in system time units
 
-int32_t x[64], y[64];  // input and output arrays for FFT
-Sema4Type doFFT;       // set every 64 samples by DAS
+#define FFTFRAMES 2  // one filled by DAS, one waiting for or in DSP
+pool_t *FramePool;   // 64-sample FFT input frames
+int32_t y[64];       // output array for FFT
+Sema4Type doFFT;     // set every 64 samples by DAS
 uint32_t Running;      // true while robot is running
 
 void PortD_Init(void) {
@@ -135,20 +139,32 @@ void PortD_Init(void) {
 // background thread, median filter
 // inputs:  none
 // outputs: none
-uint32_t Index3;  // counts to 64 samples
+uint32_t Index3;             // counts to 64 samples
+int32_t *Frame;              // frame DAS is filling, 0 if the pool was empty
+int32_t *volatile FFTFrame;  // full frame waiting for DSP
+uint32_t FramesLost;         // full frames dropped because DSP was busy
 int32_t ADCdata, FilterOutput, Distance;
 void DAS(void) {
   PD0 ^= 0x01;
   ADCdata = ADC_In();  // channel set when calling ADC_Init
   PD0 ^= 0x01;
-  if (Index3 < 64) {
+  if (Frame == 0) Frame = Pool_Alloc(FramePool);
+  if (Frame) {
     FilterOutput = Median(ADCdata);  // 3-wide median filter
     Distance = IRDistance_Convert(FilterOutput, 0);
     FilterWork++;  // calculation finished
-    x[Index3] = Distance;
+    Frame[Index3] = Distance;
     Index3++;
-    if (Index3 == 64) {
-      OS_Signal(&doFFT);
+    if (Index3 == 64) {  // hand the frame to DSP, keep sampling in a new one
+      if (FFTFrame == 0) {
+        FFTFrame = Frame;
+        OS_Signal(&doFFT);
+      } else {
+        Pool_Free(FramePool, Frame);
+        FramesLost++;
+      }
+      Frame = 0;
+      Index3 = 0;
     }
   }
   PD0 ^= 0x01;
@@ -164,9 +180,10 @@ void DSP(void) {
   while (1) {
     OS_Wait(&doFFT);  // wait for 64 samples
     PD2 = 0x04;
-    cr4_fft_64_stm32(y, x, 64);  // complex FFT of last 64 ADC values
+    cr4_fft_64_stm32(y, FFTFrame, 64);  // complex FFT of last 64 ADC values
     PD2 = 0x00;
-    Index3 = 0;  // take another buffer
+    Pool_Free(FramePool, FFTFrame);  // DAS may hand over another frame
+    FFTFrame = 0;
     DCcomponent =
         y[0] &
         0xFFFF;  // Real part at frequency 0, imaginary part should be zero
@@ -179,36 +196,58 @@ void DSP(void) {
 // inputs:  none
 // outputs: none
 char FileName[8] = "robot0";
+efile_log_t RobotLog;  // written by eFile_DiskServer while Robot runs
+
+// add a string to a log, 1 if a write has failed
+int LogString(efile_log_t *log, const char *string) {
+  int result = 0;
+  while (*string) {
+    result |= eFile_LogPut(log, *string++);
+  }
+  return result;
+}
+
 void Robot(void) {
   uint32_t data;      // ADC sample, 0 to 1023
   uint32_t voltage;   // in mV,      0 to 3300
   uint32_t distance;  // in mm,      100 to 800
   uint32_t time;      // in 10msec,  0 to 1000
+  uint32_t idle;      // IdleCount at the start, for CPU utilization
+  char line[48];      // one line of the log
+  int fd;             // descriptor of the file
 
   DataLost = 0;  // new run with no lost data
   OS_ClearMsTime();
   OS_Fifo_Init(256);
 
   printf("Robot running...");
-  if (OS_RedirectToFile(FileName)) {  // robot0, robot1,...,robot7
-    printf(" Error redirecting to file.\n\r");
+  eFile_Create(FileName);  // robot0, robot1,...,robot7, may already exist
+  fd = eFile_Open(FileName, EFILE_WRITE);
+  if (fd < 0) {
+    printf(" Error opening file.\n\r");
     Running = 0;
     OS_Kill();
     return;
   }
-  printf("time(s)\tdata(V)\tdistance(mm)\n\r");
+  eFile_LogOpen(&RobotLog, fd);  // the disk server takes the SD card waits
+  LogString(&RobotLog, "time(s)\tdata(V)\tdistance(mm)\n\r");
+  idle = IdleCount;
   do {
     PIDWork++;                      // performance measurement
     time = OS_MsTime();             // 10ms resolution in this OS
     data = OS_Fifo_Get();           // 1000 Hz sampling get from producer
     voltage = (300 * data) / 1024;  // in mV
     distance = IRDistance_Convert(data, 1);
-    printf("%0u.%02u\t%0u.%03u \t%5u\n\r", time / 100, time % 100,
-           voltage / 1000, voltage % 1000, distance);
+    sprintf(line, "%0u.%02u\t%0u.%03u \t%5u\n\r", time / 100, time % 100,
+            voltage / 1000, voltage % 1000, distance);
+    LogString(&RobotLog, line);
   } while (time < 200);  // change this to mean 2 seconds
-  OS_EndRedirectToFile();
+  if (eFile_LogClose(&RobotLog) | eFile_Close(fd)) {
+    printf(" Error writing file.\n\r");
+  }
   ST7735_Message(0, 1, "IR0 (mm) =", distance);
-  printf("done.\n\r");
+  // compare with eDisk.c built with EDISK_DMA 1, more is less CPU on disk
+  printf("done, IdleCount %u during the run.\n\r", IdleCount - idle);
   FileName[5] = (FileName[5] + 1) & 0xF7;  // 0 to 7
   Running = 0;                             // robot no longer running
   OS_Kill();
@@ -220,7 +259,8 @@ void Robot(void) {
 void SW1Push(void) {
   if (Running == 0) {
     Running = 1;  // prevents you from starting two robot threads
-    NumCreated += OS_AddThread(&Robot, 128, 1);  // start a 2 second run
+    NumCreated += OS_AddBudgetThread(&Robot, 128, 1, APERIODIC_BUDGET,
+                                     APERIODIC_PERIOD);  // 2 second run
   }
 }
 
@@ -278,7 +318,8 @@ void Init(void) {
 // outputs: none
 void Idle(void) {
   while (1) {
-    IdleCount++;  // CPU utilizations
+    IdleCount++;       // CPU utilizations
+    OS_RunIdleWork();  // background maintenance, see OS_AddIdleWork
   }
 }
 
@@ -294,6 +335,7 @@ int realmain(void) {  // lab 4 real main
   // initialize communication channels
   OS_Fifo_Init(64);
   OS_InitSemaphore(&doFFT, 0);
+  FramePool = Pool_Create(64 * sizeof(int32_t), FFTFRAMES);
   ADC0_InitTimer0ATriggerSeq0(
       0, 50, &Producer);  // start ADC sampling, channel 0, PE3, 50 Hz
   ADC_Init(3);            // sequencer 3, channel 3, PE0, sampling in DAS()
@@ -305,11 +347,14 @@ int realmain(void) {  // lab 4 real main
                        5);     // time-out routines for disk
   OS_AddSW1Task(&SW1Push, 2);  // PF4, SW1
   OS_AddSW2Task(&SW2Push, 3);  // PF0, SW2
+  OS_AddIdleWork(&eFile_Idle, 5 * TIME_1MS);  // write back file data
 
   // create initial foreground threads
   NumCreated = 0;
   NumCreated += OS_AddThread(&Init, 128, 0);  // init process, run first
-  NumCreated += OS_AddThread(&Interpreter, 128, 4);
+  NumCreated += OS_AddThread(&eFile_DiskServer, 128, 0);  // logs for Robot
+  NumCreated += OS_AddBudgetThread(&Interpreter, 128, 4, APERIODIC_BUDGET,
+                                   APERIODIC_PERIOD);
   NumCreated += OS_AddThread(&Idle, 128, 5);  // runs when nothing useful to do
 
   OS_Launch(TIMESLICE);  // doesn't return, interrupts enabled in here
@@ -378,9 +423,21 @@ void diskError(char *errtype, uint32_t n) {
 }
 unsigned char buffer[512];  // don't put on stack
 #define MAXBLOCKS 100
+// write speed of MAXBLOCKS blocks that took time in 12.5ns units
+uint32_t KBps(uint32_t time) {
+  return (uint64_t)MAXBLOCKS * 512 * 1000 * TIME_1MS / 1024 / time;
+}
+// fill buffer with the next block of the pseudo random sequence
+void FillBlock(uint32_t *n) {
+  int i;
+  for (i = 0; i < 512; i++) {
+    *n = (16807 * *n) % 2147483647;  // pseudo random sequence
+    buffer[i] = 0xFF & *n;
+  }
+}
 void TestDisk(void) {
   DSTATUS result;
-  uint32_t block;
+  uint32_t block, start, time;
   int i;
   uint32_t n;
   // simple test of eDisk
@@ -390,16 +447,33 @@ void TestDisk(void) {
   if (result) diskError("eDisk_Init", result);
   printf("Writing blocks\n\r");
   n = 1;  // seed
+  time = 0;
   for (block = 0; block < MAXBLOCKS; block++) {
-    for (i = 0; i < 512; i++) {
-      n = (16807 * n) % 2147483647;  // pseudo random sequence
-      buffer[i] = 0xFF & n;
-    }
+    FillBlock(&n);
     PD3 = 0x08;  // PD3 high for 100 block writes
+    start = OS_Time();
     if (eDisk_WriteBlock(buffer, block))
       diskError("eDisk_WriteBlock", block);  // save to disk
+    time += OS_TimeDifference(start, OS_Time());
+    PD3 = 0x00;
+  }
+  printf("eDisk_WriteBlock %u KB/s\n\r", KBps(time));
+  printf("Streaming blocks\n\r");
+  n = 1;  // same data again, in one CMD25 stream
+  time = 0;
+  for (block = 0; block < MAXBLOCKS; block++) {
+    FillBlock(&n);
+    PD3 = 0x08;
+    start = OS_Time();
+    if ((block == 0) && eDisk_WriteBegin(0, MAXBLOCKS))
+      diskError("eDisk_WriteBegin", block);
+    if (eDisk_WriteNext(buffer)) diskError("eDisk_WriteNext", block);
+    if ((block == MAXBLOCKS - 1) && eDisk_WriteEnd())
+      diskError("eDisk_WriteEnd", block);
+    time += OS_TimeDifference(start, OS_Time());
     PD3 = 0x00;
   }
+  printf("eDisk_WriteNext %u KB/s\n\r", KBps(time));
   printf("Reading blocks\n\r");
   n = 1;  // reseed, start over to get the same sequence
   for (block = 0; block < MAXBLOCKS; block++) {
@@ -0,0 +1,134 @@
+// HeapTest.c
+// Runs on LM4F120/TM4C123
+// Heap test of Lab 5, also run by tests/RTOS_Labs_common/bench_heap
+
+// Jonathan W. Valvano 3/29/17, valvano@mail.utexas.edu
+// Andreas Gerstlauer 3/1/16, gerstl@ece.utexas.edu
+// EE445M/EE380L.6
+// You may use, edit, run or distribute this file
+// You are free to change the syntax/organization of this file
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/ST7735.h"
+#include "../RTOS_Labs_common/heap.h"
+#include "HeapTest.h"
+
+// Heap test, allocate and deallocate memory
+void heapError(const char* errtype, const char* v, uint32_t n) {
+  printf(errtype);
+  printf(" heap error %s%u", v, n);
+  OS_Kill();
+}
+heap_stats_t stats;
+void heapStats(void) {
+  if (Heap_Stats(&stats)) heapError("Heap_Stats", "", 0);
+  ST7735_Message(1, 0, "Heap size  =", stats.size);
+  ST7735_Message(1, 1, "Heap used  =", stats.used);
+  ST7735_Message(1, 2, "Heap free  =", stats.free);
+  ST7735_Message(1, 3, "Heap waste =", stats.size - stats.used - stats.free);
+}
+int16_t* ptr;  // Global so easier to see with the debugger
+int16_t* p1;   // Proper style would be to make these variables local
+int16_t* p2;
+int16_t* p3;
+uint8_t* q1;
+uint8_t* q2;
+uint8_t* q3;
+uint8_t* q4;
+uint8_t* q5;
+uint8_t* q6;
+int16_t maxBlockSize;
+uint8_t* bigBlock;
+void TestHeap(void) {
+  int16_t i;
+  ST7735_DrawString(0, 0, "Heap test            ", ST7735_WHITE);
+  printf("\n\rEE445M/EE380L, Lab 5 Heap Test\n\r");
+  if (Heap_Init()) heapError("Heap_Init", "", 0);
+
+  ptr = Heap_Malloc(sizeof(int16_t));
+  if (!ptr) heapError("Heap_Malloc", "ptr", 0);
+  *ptr = 0x1111;
+
+  if (Heap_Free(ptr)) heapError("Heap_Free", "ptr", 0);
+
+  ptr = Heap_Malloc(1);
+  if (!ptr) heapError("Heap_Malloc", "ptr", 1);
+
+  if (Heap_Free(ptr)) heapError("Heap_Free", "ptr", 1);
+
+  p1 = (int16_t*)Heap_Malloc(1 * sizeof(int16_t));
+  if (!p1) heapError("Heap_Malloc", "p", 1);
+  p2 = (int16_t*)Heap_Malloc(2 * sizeof(int16_t));
+  if (!p2) heapError("Heap_Malloc", "p", 2);
+  p3 = (int16_t*)Heap_Malloc(3 * sizeof(int16_t));
+  if (!p3) heapError("Heap_Malloc", "p", 3);
+  p1[0] = 0xAAAA;
+  p2[0] = 0xBBBB;
+  p2[1] = 0xBBBB;
+  p3[0] = 0xCCCC;
+  p3[1] = 0xCCCC;
+  p3[2] = 0xCCCC;
+  heapStats();
+
+  if (Heap_Free(p1)) heapError("Heap_Free", "p", 1);
+  if (Heap_Free(p3)) heapError("Heap_Free", "p", 3);
+
+  if (Heap_Free(p2)) heapError("Heap_Free", "p", 2);
+  heapStats();
+
+  for (i = 0; i <= (stats.size / sizeof(int32_t)); i++) {
+    ptr = Heap_Malloc(sizeof(int16_t));
+    if (!ptr) break;
+  }
+  if (ptr) heapError("Heap_Malloc", "i", i);
+  heapStats();
+
+  printf("Realloc test\n\r");
+  if (Heap_Init()) heapError("Heap_Init", "", 1);
+  q1 = Heap_Malloc(1);
+  if (!q1) heapError("Heap_Malloc", "q", 1);
+  q2 = Heap_Malloc(2);
+  if (!q2) heapError("Heap_Malloc", "q", 2);
+  q3 = Heap_Malloc(3);
+  if (!q3) heapError("Heap_Malloc", "q", 3);
+  q4 = Heap_Malloc(4);
+  if (!q4) heapError("Heap_Malloc", "q", 4);
+  q5 = Heap_Malloc(5);
+  if (!q5) heapError("Heap_Malloc", "q", 5);
+
+  *q1 = 0xDD;
+  q6 = Heap_Realloc(q1, 6);
+  heapStats();
+
+  for (i = 0; i < 6; i++) {
+    q6[i] = 0xEE;
+  }
+  q1 = Heap_Realloc(q6, 2);
+  heapStats();
+
+  printf("Large block test\n\r");
+  if (Heap_Init()) heapError("Heap_Init", "", 2);
+  heapStats();
+  maxBlockSize = stats.free;
+  bigBlock = Heap_Malloc(maxBlockSize);
+  for (i = 0; i < maxBlockSize; i++) {
+    bigBlock[i] = 0xFF;
+  }
+  heapStats();
+  if (Heap_Free(bigBlock)) heapError("Heap_Free", "bigBlock", 0);
+
+  bigBlock = Heap_Calloc(maxBlockSize);
+  if (!bigBlock) heapError("Heap_Calloc", "bigBlock", 0);
+  if (*bigBlock) heapError("Zero initialization", "bigBlock", 0);
+  heapStats();
+
+  if (Heap_Free(bigBlock)) heapError("Heap_Free", "bigBlock", 0);
+  heapStats();
+
+  printf("Successful heap test\n\r");
+  ST7735_DrawString(0, 0, "Heap test successful", ST7735_YELLOW);
+  OS_Kill();
+}
@@ -0,0 +1,17 @@
+// HeapTest.h
+// Runs on LM4F120/TM4C123
+// Heap test of Lab 5, also run by tests/RTOS_Labs_common/bench_heap
+
+// Jonathan W. Valvano 3/29/17, valvano@mail.utexas.edu
+// Andreas Gerstlauer 3/1/16, gerstl@ece.utexas.edu
+// EE445M/EE380L.6
+
+#ifndef __HEAPTEST_H
+#define __HEAPTEST_H 1
+
+// Heap test thread: allocates, reallocates and frees, showing the heap
+// statistics on the LCD. Ends with OS_Kill, after "Heap test successful"
+// on the LCD, or after printing the operation that failed.
+void TestHeap(void);
+
+#endif
@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/eCache.h"
 #include "ff.h"
 
 // Display semaphore
@@ -20,6 +21,12 @@ static FATFS g_sFatFs;
 static DIR d;
 static FIL f;
 static FILINFO fi;
+static FIL Files[EFILE_FILES];  // open files, see eFile_Open
+static int Mode[EFILE_FILES];   // EFILE_READ or EFILE_WRITE, 0 if unused
+static int Writer = -1;         // descriptor eFile_WOpen opened
+static int Reader = -1;         // descriptor eFile_ROpen opened
+static char Expected[13];       // file eFile_CreateSize made, not yet opened
+static uint32_t ExpectedSize;   // and the bytes it expects
 
 //---------- eFile_Init-----------------
 // Activate the file system, without formating
@@ -64,7 +71,7 @@ int eFile_Mount(void) {  // mount disk
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_Create(const char name[]) {  // create new file, make it empty
   OS_bWait(&LCDFree);
-  if (f_open(&f, name, FA_CREATE_NEW)) {
+  if (f_open(&f, name, FA_CREATE_NEW) || f_close(&f)) {  // frees its lock
     OS_bSignal(&LCDFree);
     return 1;
   }
@@ -72,13 +79,32 @@ int eFile_Create(const char name[]) {  // create new file, make it empty
   return 0;
 }
 
-//---------- eFile_WOpen-----------------
-// Open the file, read into RAM last block
+//---------- eFile_CreateSize-----------------
+// Create a new, empty file of a known size. When it is next opened for
+// writing, it gets consecutive clusters if there is room for them, so it
+// is written and read in long transfers.
 // Input: file name is an ASCII string up to seven characters
-// Output: 0 if successful and 1 on failure (e.g., trouble reading from flash)
-int eFile_WOpen(const char name[]) {  // open a file for writing
+//        size, the bytes expected, a hint: eFile_Close frees what is not
+//        written
+// Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
+int eFile_CreateSize(const char name[], uint32_t size) {
+  if (eFile_Create(name)) return 1;
+  OS_bWait(&LCDFree);
+  // the clusters are only allocated while the file is open, so a file on
+  // the disk never has clusters beyond its size
+  ExpectedSize = (strlen(name) < sizeof(Expected)) ? size : 0;
+  if (ExpectedSize) strcpy(Expected, name);
+  OS_bSignal(&LCDFree);
+  return 0;
+}
+
+//---------- eFile_DCreate-----------------
+// Create a new, empty subdirectory
+// Input: directory name is an ASCII string up to seven characters
+// Output: 0 if successful and 1 on failure (e.g., already exists)
+int eFile_DCreate(const char name[]) {  // create new directory
   OS_bWait(&LCDFree);
-  if (f_open(&f, name, FA_WRITE)) {
+  if (f_mkdir(name)) {
     OS_bSignal(&LCDFree);
     return 1;
   }
@@ -86,14 +112,51 @@ int eFile_WOpen(const char name[]) {  // open a file for writing
   return 0;
 }
 
-//---------- eFile_Write-----------------
-// Save at end of the open file
-// Input: data to be saved
+//---------- eFile_Open-----------------
+// Open a file for reading from its start or for writing at its end
+// Input: file name is an ASCII string up to seven characters
+//        mode, EFILE_READ or EFILE_WRITE
+// Output: descriptor, 0 to EFILE_FILES - 1, and -1 on failure (e.g., all
+//         descriptors in use)
+int eFile_Open(const char name[], int mode) {  // open a file
+  int fd;
+  OS_bWait(&LCDFree);
+  for (fd = 0; (fd < EFILE_FILES) && Mode[fd]; fd++) {
+  }
+  if ((fd == EFILE_FILES) ||
+      ((mode != EFILE_READ) && (mode != EFILE_WRITE)) ||
+      f_open(&Files[fd], name, (mode == EFILE_READ) ? FA_READ : FA_WRITE)) {
+    OS_bSignal(&LCDFree);
+    return -1;
+  }
+  if ((mode == EFILE_WRITE) && ExpectedSize && !strcmp(name, Expected) &&
+      (f_size(&Files[fd]) == 0)) {
+    // the file is ExpectedSize bytes until eFile_Close truncates it, it is
+    // written from its top; without the room, clusters as they come
+    f_expand(&Files[fd], ExpectedSize, 1);
+    ExpectedSize = 0;
+  } else if ((mode == EFILE_WRITE) &&
+             f_lseek(&Files[fd], f_size(&Files[fd]))) {
+    f_close(&Files[fd]);
+    OS_bSignal(&LCDFree);
+    return -1;
+  }
+  Mode[fd] = mode;
+  OS_bSignal(&LCDFree);
+  return fd;
+}
+
+//---------- eFile_WriteBuf-----------------
+// Save bytes at the end of an open file
+// Input: descriptor of a file open for writing
+//        buffer, bytes to save
+//        size, number of bytes
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
-int eFile_Write(char data) {
+int eFile_WriteBuf(int fd, const char buffer[], uint32_t size) {
   unsigned written;
+  if ((fd < 0) || (fd >= EFILE_FILES) || (Mode[fd] != EFILE_WRITE)) return 1;
   OS_bWait(&LCDFree);
-  if (f_write(&f, &data, 1, &written) || (written != 1)) {
+  if (f_write(&Files[fd], buffer, size, &written) || (written != size)) {
     OS_bSignal(&LCDFree);
     return 1;
   }
@@ -101,13 +164,38 @@ int eFile_Write(char data) {
   return 0;
 }
 
-//---------- eFile_WClose-----------------
-// Close the file, left disk in a state power can be removed
-// Input: none
+//---------- eFile_ReadBuf-----------------
+// Retreive bytes from an open file
+// Input: descriptor of a file open for reading
+//        buffer, room for size bytes
+//        size, number of bytes
+// Output: number of bytes read, less than size at the end of the file,
+//         and -1 on failure (e.g., not open)
+int32_t eFile_ReadBuf(int fd, char buffer[], uint32_t size) {
+  unsigned read;
+  if ((fd < 0) || (fd >= EFILE_FILES) || (Mode[fd] != EFILE_READ)) return -1;
+  OS_bWait(&LCDFree);
+  if (f_read(&Files[fd], buffer, size, &read)) {
+    OS_bSignal(&LCDFree);
+    return -1;
+  }
+  OS_bSignal(&LCDFree);
+  return read;
+}
+
+//---------- eFile_Close-----------------
+// Close a file, a file written leaves the disk in a state power can be
+// removed
+// Input: descriptor of an open file
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
-int eFile_WClose(void) {  // close the file for writing
+int eFile_Close(int fd) {  // close a file
+  int truncated;
+  if ((fd < 0) || (fd >= EFILE_FILES) || (Mode[fd] == 0)) return 1;
   OS_bWait(&LCDFree);
-  if (f_close(&f)) {
+  // clusters allocated for eFile_CreateSize and not written go back
+  truncated = (Mode[fd] != EFILE_WRITE) || (f_truncate(&Files[fd]) == FR_OK);
+  Mode[fd] = 0;
+  if (f_close(&Files[fd]) || !truncated) {
     OS_bSignal(&LCDFree);
     return 1;
   }
@@ -115,18 +203,40 @@ int eFile_WClose(void) {  // close the file for writing
   return 0;
 }
 
+//---------- eFile_WOpen-----------------
+// Open the file, read into RAM last block
+// Input: file name is an ASCII string up to seven characters
+// Output: 0 if successful and 1 on failure (e.g., trouble reading from flash)
+int eFile_WOpen(const char name[]) {  // open a file for writing
+  if (Writer >= 0) return 1;
+  Writer = eFile_Open(name, EFILE_WRITE);
+  return Writer < 0;
+}
+
+//---------- eFile_Write-----------------
+// Save at end of the open file
+// Input: data to be saved
+// Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
+int eFile_Write(char data) { return eFile_WriteBuf(Writer, &data, 1); }
+
+//---------- eFile_WClose-----------------
+// Close the file, left disk in a state power can be removed
+// Input: none
+// Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
+int eFile_WClose(void) {  // close the file for writing
+  int result = eFile_Close(Writer);
+  Writer = -1;
+  return result;
+}
+
 //---------- eFile_ROpen-----------------
 // Open the file, read first block into RAM
 // Input: file name is an ASCII string up to seven characters
 // Output: 0 if successful and 1 on failure (e.g., trouble reading from flash)
 int eFile_ROpen(const char name[]) {  // open a file for reading
-  OS_bWait(&LCDFree);
-  if (f_open(&f, name, FA_READ)) {
-    OS_bSignal(&LCDFree);
-    return 1;
-  }
-  OS_bSignal(&LCDFree);
-  return 0;
+  if (Reader >= 0) return 1;
+  Reader = eFile_Open(name, EFILE_READ);
+  return Reader < 0;
 }
 
 //---------- eFile_ReadNext-----------------
@@ -135,14 +245,7 @@ int eFile_ROpen(const char name[]) {  // open a file for reading
 // Output: return by reference data
 //         0 if successful and 1 on failure (e.g., end of file)
 int eFile_ReadNext(char *pt) {  // get next byte
-  unsigned read;
-  OS_bWait(&LCDFree);
-  if (f_read(&f, pt, 1, &read) || (read != 1)) {
-    OS_bSignal(&LCDFree);
-    return 1;
-  }
-  OS_bSignal(&LCDFree);
-  return 0;
+  return eFile_ReadBuf(Reader, pt, 1) != 1;
 }
 
 //---------- eFile_RClose-----------------
@@ -150,13 +253,9 @@ int eFile_ReadNext(char *pt) {  // get next byte
 // Input: none
 // Output: 0 if successful and 1 on failure (e.g., wasn't open)
 int eFile_RClose(void) {  // close the file for writing
-  OS_bWait(&LCDFree);
-  if (f_close(&f)) {
-    OS_bSignal(&LCDFree);
-    return 1;
-  }
-  OS_bSignal(&LCDFree);
-  return 0;
+  int result = eFile_Close(Reader);
+  Reader = -1;
+  return result;
 }
 
 //---------- eFile_Delete-----------------
@@ -219,16 +318,35 @@ int eFile_DClose(void) {  // close the directory
   return 0;
 }
 
+//---------- eFile_Check-----------------
+// Check the file system, FatFs has no check of its own
+// Input: check, to fill in
+// Output: 1, not supported
+int eFile_Check(efile_check_t *check) {
+  memset(check, 0, sizeof(*check));
+  return 1;
+}
+
+//---------- eFile_Fragments-----------------
+// Count the runs of consecutive clusters a file is in
+// Input: file name is an ASCII string up to seven characters
+// Output: -1, not supported
+int eFile_Fragments(const char name[]) { return -1; }
+
 //---------- eFile_Unmount-----------------
 // Unmount and deactivate the file system
 // Input: none
 // Output: 0 if successful and 1 on failure (not currently mounted)
 int eFile_Unmount(void) {
   OS_bWait(&LCDFree);
-  if (f_mount(NULL, "", 0)) {
+  if (eCache_Flush() || f_mount(NULL, "", 0)) {
     OS_bSignal(&LCDFree);
     return 1;
   }
+  eCache_Invalidate();  // the card may be changed now
+  memset(Mode, 0, sizeof(Mode));  // the files are closed with it
+  Writer = Reader = -1;
+  ExpectedSize = 0;
   OS_bSignal(&LCDFree);
   return 0;
 }
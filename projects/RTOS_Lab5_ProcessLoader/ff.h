@@ -98,8 +98,16 @@ typedef struct {
   DWORD dirbase;     /* Root directory start sector (FAT32:Cluster#) */
   DWORD database;    /* Data start sector */
   DWORD winsect;     /* Current sector appearing in the win[] */
+#if !_FS_READONLY
+  DWORD mirsect; /* First FAT sector not written to the FAT copies */
+  DWORD mirend;  /* Last one (mirsect > mirend:None) */
+#endif
+  DWORD wintag[2 * _FS_WINWAYS]; /* Sectors in wins[] (0xFFFFFFFF:None) */
+  BYTE winage[2 * _FS_WINWAYS];  /* Uses of the set since the last one */
   BYTE win[_MAX_SS]; /* Disk access window for Directory, FAT (and file data at
                         tiny cfg) */
+  BYTE wins[2 * _FS_WINWAYS][_MAX_SS]; /* Sectors that were in win[], the
+                                          FAT ones first */
 } FATFS;
 
 /* File object structure (FIL) */
@@ -209,6 +217,8 @@ FRESULT f_forward(FIL* fp, UINT (*func)(const BYTE*, UINT), UINT btf,
                   UINT* bf);         /* Forward data to the stream */
 FRESULT f_lseek(FIL* fp, DWORD ofs); /* Move file pointer of a file object */
 FRESULT f_truncate(FIL* fp);         /* Truncate file */
+FRESULT f_expand(FIL* fp, DWORD fsz,
+                 BYTE opt); /* Allocate a contiguous block to the file */
 FRESULT f_sync(FIL* fp);             /* Flush cached data of a writing file */
 FRESULT f_opendir(DIR* dp, const TCHAR* path); /* Open a directory */
 FRESULT f_closedir(DIR* dp);                   /* Close an open directory */
@@ -42,9 +42,18 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable)
 /  To enable it, also _FS_READONLY need to be set to 0. */
 
-#define _USE_FASTSEEK 0
+#define _USE_FASTSEEK 1
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
+#define _USE_EXPAND 1
+/* This option switches f_expand() function. (0:Disable or 1:Enable)
+/  To enable it, also _FS_READONLY need to be set to 0. */
+
+#define _FS_WINWAYS 1
+/* This option sets the number of sectors kept besides the window, each for
+/  the FAT and for the directories (1 to 8). Each takes _MAX_SS bytes of
+/  the file system object. */
+
 #define _USE_LABEL 1
 /* This option switches volume label functions, f_getlabel() and f_setlabel().
 /  (0:Disable or 1:Enable) */
@@ -197,7 +206,7 @@ be added to the project to read current time form RTC. _NORTC_MON, / _NORTC_MDAY
 and _NORTC_YEAR have no effect. /  These options have no effect at read-only
 configuration (_FS_READONLY == 1). */
 
-#define _FS_LOCK 0
+#define _FS_LOCK 8  // EFILE_FILES in eFile.h, eFile_DOpen, the loader
 /* The _FS_LOCK option switches file lock feature to control duplicated file
 open /  and illegal operation to open objects. This option must be 0 when
 _FS_READONLY /  is 1.
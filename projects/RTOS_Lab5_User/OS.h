@@ -105,4 +105,16 @@ unsigned long OS_TimeDifference(unsigned long start, unsigned long stop) {
   return start - stop;
 }
 
+// ******** Heap_Malloc ************
+// allocate memory in the heap of this process, freed when the process exits
+// input:  desired number of bytes to allocate
+// output: pointer to the allocated memory or 0 if there is no room
+void *Heap_Malloc(long desiredBytes);
+
+// ******** Heap_Free ************
+// return memory from Heap_Malloc
+// input:  pointer to memory
+// output: 0 if everything is ok, non-zero in case of error
+long Heap_Free(void *pointer);
+
 #endif
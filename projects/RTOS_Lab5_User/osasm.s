@@ -14,6 +14,8 @@
 		EXPORT	OS_Kill
 		EXPORT	OS_Time
 		EXPORT	OS_AddThread
+		EXPORT	Heap_Malloc
+		EXPORT	Heap_Free
 			
 OS_Id
 	SVC		#0
@@ -35,6 +37,14 @@ OS_AddThread
 	SVC		#4
 	BX		LR
 
+Heap_Malloc
+	SVC		#5
+	BX		LR
+
+Heap_Free
+	SVC		#6
+	BX		LR
+
 
     ALIGN
     END
@@ -89,7 +89,7 @@ void Idle(void) {
   while (1) {
     IdleCount++;
     PD0 ^= 0x01;
-    WaitForInterrupt();
+    if (!OS_RunIdleWork()) WaitForInterrupt();
   }
 }
 
@@ -110,10 +110,13 @@ int realmain(void) {  // realmain
   // attach background tasks
   OS_AddPeriodicThread(&disk_timerproc, TIME_1MS,
                        0);  // time out routines for disk
+  OS_AddIdleWork(&Interpreter_HeapWork, TIME_500US);  // heap check
+  OS_AddIdleWork(&Interpreter_TraceWork, TIME_1MS);   // "heap trace on"
 
   // create initial foreground threads
   NumCreated = 0;
-  NumCreated += OS_AddThread(&Interpreter, 128, 2);
+  NumCreated += OS_AddBudgetThread(&Interpreter, 128, 2, APERIODIC_BUDGET,
+                                   APERIODIC_PERIOD);
   NumCreated += OS_AddThread(&Idle, 128, 5);  // at lowest priority
 
   OS_Launch(TIME_2MS);  // doesn't return, interrupts enabled in here
@@ -173,7 +176,6 @@ int Testmain0(void) {  // Testmain0
 //*****************Test project 1*************************
 // CAN test, exchange CAN messages with second instance
 uint8_t XmtData[4];
-uint8_t RcvData[4];
 uint32_t RcvCount = 0;
 uint8_t sequenceNum = 0;
 
@@ -187,14 +189,17 @@ void CANSendTask(void) {
   sequenceNum++;
 }
 
-// foreground receiver task
+// foreground receiver task, works on the buffer CAN0_Handler received into;
+// blocked until a message comes, so lower priority threads run meanwhile
 void CANReceiveTask(void) {
+  uint8_t* msg;
   while (1) {
-    CAN0_GetMail(RcvData);
+    msg = CAN0_WaitMailBuffer();
     RcvCount++;
     ST7735_Message(1, 0, "RcvCount   = ", RcvCount);
-    ST7735_Message(1, 0, "RcvData[0] = ", RcvData[0]);
-    ST7735_Message(1, 0, "RcvData[1] = ", RcvData[1]);
+    ST7735_Message(1, 0, "RcvData[0] = ", msg[0]);
+    ST7735_Message(1, 0, "RcvData[1] = ", msg[1]);
+    Heap_IsrFree(msg);
   }
 }
 
@@ -216,6 +221,7 @@ void SW1Push1(void) {
 int Testmain1(void) {  // Testmain1
   OS_Init();           // initialize, disable interrupts
   PortD_Init();
+  Heap_Init();  // CAN messages are received into heap buffers
 
   // Initialize CAN with given IDs
   CAN0_Open(RCV_ID, XMT_ID);
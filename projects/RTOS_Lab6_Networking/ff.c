@@ -126,6 +126,7 @@ Patch2 applied.
 
 #include "ff.h" /* Declarations of FatFs API */
 
+#include "../RTOS_Labs_common/eCache.h" /* Sectors go through the cache */
 #include "../RTOS_Labs_common/eDisk.h"
 
 /*--------------------------------------------------------------------------
@@ -986,6 +987,92 @@ static void clear_lock(/* Clear lock entries of the volume */
 }
 #endif
 
+/*-----------------------------------------------------------------------*/
+/* Sector windows kept in the file system object                         */
+/*-----------------------------------------------------------------------*/
+/* A sector leaving fs->win[] is kept in fs->wins[], in a set of
+/  _FS_WINWAYS ways for the FAT or in one for the directories, so a chain
+/  walk does not push the directory sector out and the other way around.
+/  The copies are clean: a dirty window is written back before it moves,
+/  and a sector written drops its copy. */
+
+static void clear_windows(FATFS* fs /* File system object */
+) {
+  UINT i;
+
+  for (i = 0; i < 2 * _FS_WINWAYS; i++) {
+    fs->wintag[i] = 0xFFFFFFFF; /* Empty */
+    fs->winage[i] = 0xFF;       /* Replaced first */
+  }
+#if !_FS_READONLY
+  fs->mirsect = 0xFFFFFFFF; /* No FAT copy to write */
+  fs->mirend = 0;
+#endif
+}
+
+static UINT win_set(/* First way of the set of the sector */
+                    FATFS* fs,   /* File system object */
+                    DWORD sector /* Sector number */
+) {
+  return (sector - fs->fatbase < fs->fsize) ? 0 : _FS_WINWAYS;
+}
+
+static void win_use(FATFS* fs, /* File system object */
+                    UINT i     /* Way in fs->wins[] just used */
+) {
+  UINT j, set = (i < _FS_WINWAYS) ? 0 : _FS_WINWAYS;
+
+  for (j = set; j < set + _FS_WINWAYS; j++) { /* Age the others */
+    if (fs->winage[j] < 0xFE) fs->winage[j]++;
+  }
+  fs->winage[i] = 0;
+}
+
+static int win_find(/* Way in fs->wins[] holding the sector, -1:None */
+                    FATFS* fs,   /* File system object */
+                    DWORD sector /* Sector number */
+) {
+  UINT i, set = win_set(fs, sector);
+
+  for (i = set; i < set + _FS_WINWAYS; i++) {
+    if (fs->wintag[i] == sector) return i;
+  }
+  return -1;
+}
+
+static void win_keep(FATFS* fs /* File system object, its window clean */
+) {
+  int i;
+  UINT j, set;
+
+  if (fs->winsect == 0xFFFFFFFF) return; /* Nothing in the window */
+  i = win_find(fs, fs->winsect);
+  if (i < 0) { /* Replace the least recently used way of the set */
+    set = win_set(fs, fs->winsect);
+    for (i = set, j = set + 1; j < set + _FS_WINWAYS; j++) {
+      if (fs->winage[j] > fs->winage[i]) i = j;
+    }
+    mem_cpy(fs->wins[i], fs->win, SS(fs));
+    fs->wintag[i] = fs->winsect;
+  }
+  win_use(fs, i);
+}
+
+#if !_FS_READONLY
+static void win_drop(FATFS* fs,   /* File system object */
+                     DWORD sector /* Sector number written */
+) {
+  UINT i;
+
+  for (i = 0; i < 2 * _FS_WINWAYS; i++) { /* Any set, the copy is old */
+    if (fs->wintag[i] == sector) {
+      fs->wintag[i] = 0xFFFFFFFF;
+      fs->winage[i] = 0xFF;
+    }
+  }
+}
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window in the file system object               */
 /*-----------------------------------------------------------------------*/
@@ -993,21 +1080,19 @@ static void clear_lock(/* Clear lock entries of the volume */
 static FRESULT sync_window(FATFS* fs /* File system object */
 ) {
   DWORD wsect;
-  UINT nf;
   FRESULT res = FR_OK;
 
   if (fs->wflag) {       /* Write back the sector if it is dirty */
     wsect = fs->winsect; /* Current sector number */
-    if (eDisk_Write(fs->drv, fs->win, wsect, 1) != RES_OK) {
+    if (eCache_Write(fs->drv, fs->win, wsect, 1) != RES_OK) {
       res = FR_DISK_ERR;
     } else {
       fs->wflag = 0;
-      if (wsect - fs->fatbase < fs->fsize) { /* Is it in the FAT area? */
-        for (nf = fs->n_fats; nf >= 2;
-             nf--) { /* Reflect the change to all FAT copies */
-          wsect += fs->fsize;
-          eDisk_Write(fs->drv, fs->win, wsect, 1);
-        }
+      win_drop(fs, wsect);
+      if (wsect - fs->fatbase < fs->fsize &&
+          fs->n_fats >= 2) { /* FAT copies are written at sync_fs() */
+        if (wsect < fs->mirsect) fs->mirsect = wsect;
+        if (wsect > fs->mirend) fs->mirend = wsect;
       }
     }
   }
@@ -1020,13 +1105,19 @@ static FRESULT move_window(
     DWORD sector /* Sector number to make appearance in the fs->win[] */
 ) {
   FRESULT res = FR_OK;
+  int i;
 
   if (sector != fs->winsect) { /* Window offset changed? */
 #if !_FS_READONLY
     res = sync_window(fs); /* Write-back changes */
 #endif
     if (res == FR_OK) { /* Fill sector window with new data */
-      if (eDisk_Read(fs->drv, fs->win, sector, 1) != RES_OK) {
+      win_keep(fs);
+      i = win_find(fs, sector);
+      if (i >= 0) { /* Kept from an earlier use */
+        mem_cpy(fs->win, fs->wins[i], SS(fs));
+        win_use(fs, i);
+      } else if (eCache_Read(fs->drv, fs->win, sector, 1) != RES_OK) {
         sector = 0xFFFFFFFF; /* Invalidate window if data is not reliable */
         res = FR_DISK_ERR;
       }
@@ -1036,6 +1127,39 @@ static FRESULT move_window(
   return res;
 }
 
+/*-----------------------------------------------------------------------*/
+/* Write the FAT sectors changed to the FAT copies                       */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static FRESULT sync_mirror(FATFS* fs /* File system object */
+) {
+  DWORD wsect;
+  UINT nf;
+  FRESULT res = FR_OK;
+
+  while (res == FR_OK &&
+         fs->mirsect <= fs->mirend) { /* Reflect the changes to all FAT
+                                         copies */
+    res = move_window(fs, fs->mirsect);
+    for (nf = fs->n_fats, wsect = fs->mirsect; res == FR_OK && nf >= 2;
+         nf--) {
+      wsect += fs->fsize;
+      if (eCache_Write(fs->drv, fs->win, wsect, 1) != RES_OK)
+        res = FR_DISK_ERR;
+    }
+    if (res == FR_OK) {
+      if (fs->mirsect == fs->mirend) {
+        fs->mirsect = 0xFFFFFFFF; /* All written */
+        fs->mirend = 0;
+      } else {
+        fs->mirsect++;
+      }
+    }
+  }
+  return res;
+}
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* Synchronize file system and strage device                             */
 /*-----------------------------------------------------------------------*/
@@ -1046,6 +1170,7 @@ static FRESULT sync_fs(          /* FR_OK: successful, FR_DISK_ERR: failed */
   FRESULT res;
 
   res = sync_window(fs);
+  if (res == FR_OK) res = sync_mirror(fs);
   if (res == FR_OK) {
     /* Update FSINFO sector if needed */
     if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {
@@ -1058,11 +1183,12 @@ static FRESULT sync_fs(          /* FR_OK: successful, FR_DISK_ERR: failed */
       ST_DWORD(fs->win + FSI_Nxt_Free, fs->last_clust);
       /* Write it into the FSINFO sector */
       fs->winsect = fs->volbase + 1;
-      eDisk_Write(fs->drv, fs->win, fs->winsect, 1);
+      eCache_Write(fs->drv, fs->win, fs->winsect, 1);
+      win_drop(fs, fs->winsect);
       fs->fsi_flag = 0;
     }
     /* Make sure that no pending write process in the physical drive */
-    if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;
+    if (eCache_Ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;
   }
 
   return res;
@@ -1238,7 +1364,7 @@ static FRESULT remove_chain(FATFS* fs, /* File system object */
       } else {                       /* End of contiguous clusters */
         rt[0] = clust2sect(fs, scl); /* Start sector */
         rt[1] = clust2sect(fs, ecl) + fs->csize - 1; /* End sector */
-        disk_ioctl(fs->drv, CTRL_TRIM, rt);          /* Erase the block */
+        eCache_Ioctl(fs->drv, CTRL_TRIM, rt);        /* Erase the block */
         scl = ecl = nxt;
       }
 #endif
@@ -1332,6 +1458,27 @@ static DWORD clmt_clust(          /* <2:Error, >=2:Cluster number */
 }
 #endif /* _USE_FASTSEEK */
 
+/*-----------------------------------------------------------------------*/
+/* File access - Stretch a direct transfer over consecutive clusters     */
+/*-----------------------------------------------------------------------*/
+
+static UINT cont_sects(       /* Number of sectors to transfer at once */
+                       FIL* fp, /* Pointer to the file object */
+                       UINT cc, /* Sectors left in the current cluster */
+                       UINT max /* Sectors wanted */
+) {
+  DWORD ncl;
+
+  while (max - cc >= fp->fs->csize) { /* A whole cluster more is wanted */
+    ncl = get_fat(fp->fs, fp->clust);
+    if (ncl != fp->clust + 1) break; /* Not the next cluster, or an error the
+                                        next cluster access reports */
+    fp->clust = ncl; /* The transfer goes on into it */
+    cc += fp->fs->csize;
+  }
+  return cc;
+}
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Set directory index                              */
 /*-----------------------------------------------------------------------*/
@@ -2380,7 +2527,8 @@ static BYTE check_fs(/* 0:FAT boor sector, 1:Valid boor sector but not FAT,
                                    record or not */
 ) {
   fs->wflag = 0;
-  fs->winsect = 0xFFFFFFFF;           /* Invaidate window */
+  fs->winsect = 0xFFFFFFFF; /* Invaidate window */
+  clear_windows(fs);        /* and the sectors kept */
   if (move_window(fs, sect) != FR_OK) /* Load boot record */
     return 3;
 
@@ -2454,7 +2602,7 @@ find_volume(/* FR_OK(0): successful, !=0: any error occurred */
       (stat & STA_PROTECT)) /* Check disk write protection if needed */
     return FR_WRITE_PROTECTED;
 #if _MAX_SS != _MIN_SS /* Get sector size (multiple sector size cfg only) */
-  if (disk_ioctl(fs->drv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK ||
+  if (eCache_Ioctl(fs->drv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK ||
       SS(fs) < _MIN_SS || SS(fs) > _MAX_SS)
     return FR_DISK_ERR;
 #endif
@@ -2836,9 +2984,10 @@ FRESULT f_read(FIL* fp,    /* Pointer to the file object */
       sect += csect;
       cc = btr / SS(fp->fs); /* When remaining bytes >= sector size, */
       if (cc) {              /* Read maximum contiguous sectors directly */
-        if (csect + cc > fp->fs->csize) /* Clip at cluster boundary */
-          cc = fp->fs->csize - csect;
-        if (eDisk_Read(fp->fs->drv, rbuff, sect, cc) != RES_OK)
+        if (csect + cc > fp->fs->csize) /* Clip at cluster boundary, */
+          cc = cont_sects(fp, fp->fs->csize - csect,
+                          cc); /* or at the end of consecutive clusters */
+        if (eCache_Read(fp->fs->drv, rbuff, sect, cc) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY &&                                                         \
     _FS_MINIMIZE <= 2 /* Replace one of the read sectors with cached data if \
@@ -2860,12 +3009,12 @@ FRESULT f_read(FIL* fp,    /* Pointer to the file object */
       if (fp->dsect != sect) { /* Load data sector if not in cache */
 #if !_FS_READONLY
         if (fp->flag & FA__DIRTY) { /* Write-back dirty sector cache */
-          if (eDisk_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+          if (eCache_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
             ABORT(fp->fs, FR_DISK_ERR);
           fp->flag &= ~FA__DIRTY;
         }
 #endif
-        if (eDisk_Read(fp->fs->drv, fp->buf, sect, 1) !=
+        if (eCache_Read(fp->fs->drv, fp->buf, sect, 1) !=
             RES_OK) /* Fill sector cache */
           ABORT(fp->fs, FR_DISK_ERR);
       }
@@ -2949,7 +3098,7 @@ FRESULT f_write(FIL* fp,          /* Pointer to the file object */
         ABORT(fp->fs, FR_DISK_ERR);
 #else
       if (fp->flag & FA__DIRTY) { /* Write-back sector cache */
-        if (eDisk_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+        if (eCache_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
         fp->flag &= ~FA__DIRTY;
       }
@@ -2959,9 +3108,10 @@ FRESULT f_write(FIL* fp,          /* Pointer to the file object */
       sect += csect;
       cc = btw / SS(fp->fs); /* When remaining bytes >= sector size, */
       if (cc) {              /* Write maximum contiguous sectors directly */
-        if (csect + cc > fp->fs->csize) /* Clip at cluster boundary */
-          cc = fp->fs->csize - csect;
-        if (eDisk_Write(fp->fs->drv, wbuff, sect, cc) != RES_OK)
+        if (csect + cc > fp->fs->csize) /* Clip at cluster boundary, */
+          cc = cont_sects(fp, fp->fs->csize - csect,
+                          cc); /* or at the end of consecutive clusters */
+        if (eCache_Write(fp->fs->drv, wbuff, sect, cc) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_MINIMIZE <= 2
 #if _FS_TINY
@@ -2992,7 +3142,7 @@ FRESULT f_write(FIL* fp,          /* Pointer to the file object */
 #else
       if (fp->dsect != sect) { /* Fill sector cache with file data */
         if (fp->fptr < fp->fsize &&
-            eDisk_Read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
+            eCache_Read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
       }
 #endif
@@ -3038,7 +3188,7 @@ FRESULT f_sync(FIL* fp /* Pointer to the file object */
                                   /* Write-back dirty buffer */
 #if !_FS_TINY
       if (fp->flag & FA__DIRTY) {
-        if (eDisk_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+        if (eCache_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
           LEAVE_FF(fp->fs, FR_DISK_ERR);
         fp->flag &= ~FA__DIRTY;
       }
@@ -3287,12 +3437,12 @@ FRESULT f_lseek(FIL* fp,  /* Pointer to the file object */
 #if !_FS_TINY
 #if !_FS_READONLY
           if (fp->flag & FA__DIRTY) { /* Write-back dirty sector cache */
-            if (eDisk_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+            if (eCache_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
               ABORT(fp->fs, FR_DISK_ERR);
             fp->flag &= ~FA__DIRTY;
           }
 #endif
-          if (eDisk_Read(fp->fs->drv, fp->buf, dsc, 1) !=
+          if (eCache_Read(fp->fs->drv, fp->buf, dsc, 1) !=
               RES_OK) /* Load current sector */
             ABORT(fp->fs, FR_DISK_ERR);
 #endif
@@ -3370,12 +3520,12 @@ FRESULT f_lseek(FIL* fp,  /* Pointer to the file object */
 #if !_FS_TINY
 #if !_FS_READONLY
       if (fp->flag & FA__DIRTY) { /* Write-back dirty sector cache */
-        if (eDisk_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+        if (eCache_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
           ABORT(fp->fs, FR_DISK_ERR);
         fp->flag &= ~FA__DIRTY;
       }
 #endif
-      if (eDisk_Read(fp->fs->drv, fp->buf, nsect, 1) !=
+      if (eCache_Read(fp->fs->drv, fp->buf, nsect, 1) !=
           RES_OK) /* Fill sector cache */
         ABORT(fp->fs, FR_DISK_ERR);
 #endif
@@ -3647,7 +3797,7 @@ FRESULT f_truncate(FIL* fp /* Pointer to the file object */
       }
 #if !_FS_TINY
       if (res == FR_OK && (fp->flag & FA__DIRTY)) {
-        if (eDisk_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+        if (eCache_Write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
           res = FR_DISK_ERR;
         else
           fp->flag &= ~FA__DIRTY;
@@ -3660,6 +3810,84 @@ FRESULT f_truncate(FIL* fp /* Pointer to the file object */
   LEAVE_FF(fp->fs, res);
 }
 
+#if _USE_EXPAND
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Block to the File                               */
+/*-----------------------------------------------------------------------*/
+/* As in later FatFs revisions, the file becomes fsz bytes long. The R/W
+/  pointer stays at the top, f_write overwrites the clusters allocated
+/  here, and f_truncate frees those left past the end. */
+
+FRESULT f_expand(FIL* fp,   /* Pointer to the file object */
+                 DWORD fsz, /* Bytes to allocate */
+                 BYTE opt   /* 0:Find and prepare, 1:Find and allocate */
+) {
+  FRESULT res;
+  FATFS* fs;
+  DWORD n, clst, stcl, scl, ncl, tcl;
+
+  res = validate(fp); /* Check validity of the object */
+  if (res != FR_OK) LEAVE_FF(fp->fs, res);
+  if (fp->err) /* Check error */
+    LEAVE_FF(fp->fs, (FRESULT)fp->err);
+  fs = fp->fs;
+  if (fsz == 0 || fp->fsize != 0 || fp->sclust != 0 ||
+      !(fp->flag & FA_WRITE)) /* Only an empty file open for writing */
+    LEAVE_FF(fs, FR_DENIED);
+  n = (DWORD)fs->csize * SS(fs);     /* Cluster size */
+  tcl = fsz / n + (fsz % n ? 1 : 0); /* Number of clusters required */
+  stcl = fs->last_clust;             /* Search from the suggested point */
+  if (stcl < 2 || stcl >= fs->n_fatent) stcl = 2;
+  scl = clst = stcl;
+  ncl = 0;
+  for (;;) { /* Find a contiguous cluster block */
+    n = get_fat(fs, clst);
+    if (n == 1) {
+      res = FR_INT_ERR;
+      break;
+    }
+    if (n == 0xFFFFFFFF) {
+      res = FR_DISK_ERR;
+      break;
+    }
+    if (n == 0) {              /* Is it a free cluster? */
+      if (++ncl == tcl) break; /* Found the block scl..clst */
+    } else {
+      ncl = 0; /* Not a free cluster */
+    }
+    if (++clst >= fs->n_fatent) { /* A block cannot wrap around */
+      clst = 2;
+      ncl = 0;
+    }
+    if (ncl == 0) scl = clst; /* The next block starts here */
+    if (clst == stcl) {       /* No contiguous block that large */
+      res = FR_DENIED;
+      break;
+    }
+  }
+  if (res == FR_OK) {
+    if (opt) { /* Create a cluster chain on the FAT */
+      for (clst = scl, n = tcl; n && res == FR_OK; clst++, n--)
+        res = put_fat(fs, clst, (n == 1) ? 0x0FFFFFFF : clst + 1);
+      if (res == FR_OK) {
+        fs->last_clust = scl + tcl - 1; /* Update FSINFO */
+        if (fs->free_clust != 0xFFFFFFFF) {
+          fs->free_clust -= tcl;
+          fs->fsi_flag |= 1;
+        }
+        fp->sclust = scl; /* The file has the chain */
+        fp->fsize = fsz;
+        fp->flag |= FA__WRITTEN;
+      }
+    } else { /* Set it as the point the next allocation starts from */
+      fs->last_clust = scl - 1;
+    }
+  }
+
+  LEAVE_FF(fs, res);
+}
+#endif /* _USE_EXPAND */
+
 /*-----------------------------------------------------------------------*/
 /* Delete a File or Directory                                            */
 /*-----------------------------------------------------------------------*/
@@ -4217,13 +4445,13 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
   if (stat & STA_NOINIT) return FR_NOT_READY;
   if (stat & STA_PROTECT) return FR_WRITE_PROTECTED;
 #if _MAX_SS != _MIN_SS /* Get disk sector size */
-  if (disk_ioctl(pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK ||
+  if (eCache_Ioctl(pdrv, GET_SECTOR_SIZE, &SS(fs)) != RES_OK ||
       SS(fs) > _MAX_SS || SS(fs) < _MIN_SS)
     return FR_DISK_ERR;
 #endif
   if (_MULTI_PARTITION && part) {
     /* Get partition information from partition table in the MBR */
-    if (eDisk_Read(pdrv, fs->win, 0, 1) != RES_OK) return FR_DISK_ERR;
+    if (eCache_Read(pdrv, fs->win, 0, 1) != RES_OK) return FR_DISK_ERR;
     if (LD_WORD(fs->win + BS_55AA) != 0xAA55) return FR_MKFS_ABORTED;
     tbl = &fs->win[MBR_Table + (part - 1) * SZ_PTE];
     if (!tbl[4]) return FR_MKFS_ABORTED; /* No partition? */
@@ -4231,7 +4459,7 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
     n_vol = LD_DWORD(tbl + 12);          /* Volume size */
   } else {
     /* Create a partition in this function */
-    if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &n_vol) != RES_OK || n_vol < 128)
+    if (eCache_Ioctl(pdrv, GET_SECTOR_COUNT, &n_vol) != RES_OK || n_vol < 128)
       return FR_DISK_ERR;
     b_vol = (sfd) ? 0 : 63; /* Volume start sector */
     n_vol -= b_vol;         /* Volume size */
@@ -4272,7 +4500,8 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
     return FR_MKFS_ABORTED; /* Too small volume */
 
   /* Align data start sector to erase block boundary (for flash memory media) */
-  if (disk_ioctl(pdrv, GET_BLOCK_SIZE, &n) != RES_OK || !n || n > 32768) n = 1;
+  if (eCache_Ioctl(pdrv, GET_BLOCK_SIZE, &n) != RES_OK || !n || n > 32768)
+    n = 1;
   n = (b_data + n - 1) &
       ~(n - 1); /* Next nearest erase block from current data start */
   n = (n - b_data) / N_FATS;
@@ -4306,7 +4535,7 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
     /* Update system ID in the partition table */
     tbl = &fs->win[MBR_Table + (part - 1) * SZ_PTE];
     tbl[4] = sys;
-    if (eDisk_Write(pdrv, fs->win, 0, 1) != RES_OK) /* Write it to teh MBR */
+    if (eCache_Write(pdrv, fs->win, 0, 1) != RES_OK) /* Write it to teh MBR */
       return FR_DISK_ERR;
     md = 0xF8;
   } else {
@@ -4327,7 +4556,7 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
       ST_DWORD(tbl + 8, 63);              /* Partition start in LBA */
       ST_DWORD(tbl + 12, n_vol);          /* Partition size in LBA */
       ST_WORD(fs->win + BS_55AA, 0xAA55); /* MBR signature */
-      if (eDisk_Write(pdrv, fs->win, 0, 1) != RES_OK) /* Write it to the MBR */
+      if (eCache_Write(pdrv, fs->win, 0, 1) != RES_OK) /* Write it to the MBR */
         return FR_DISK_ERR;
       md = 0xF8;
     }
@@ -4382,11 +4611,11 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
   ST_WORD(
       tbl + BS_55AA,
       0xAA55); /* Signature (Offset is fixed here regardless of sector size) */
-  if (eDisk_Write(pdrv, tbl, b_vol, 1) !=
+  if (eCache_Write(pdrv, tbl, b_vol, 1) !=
       RES_OK) /* Write it to the VBR sector */
     return FR_DISK_ERR;
   if (fmt == FS_FAT32) /* Write backup VBR if needed (VBR+6) */
-    eDisk_Write(pdrv, tbl, b_vol + 6, 1);
+    eCache_Write(pdrv, tbl, b_vol + 6, 1);
 
   /* Initialize FAT area */
   wsect = b_fat;
@@ -4402,18 +4631,18 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
       ST_DWORD(tbl + 4, 0xFFFFFFFF);
       ST_DWORD(tbl + 8, 0x0FFFFFFF); /* Reserve cluster #2 for root directory */
     }
-    if (eDisk_Write(pdrv, tbl, wsect++, 1) != RES_OK) return FR_DISK_ERR;
+    if (eCache_Write(pdrv, tbl, wsect++, 1) != RES_OK) return FR_DISK_ERR;
     mem_set(tbl, 0, SS(fs));      /* Fill following FAT entries with zero */
     for (n = 1; n < n_fat; n++) { /* This loop may take a time on FAT32 volume
                                      due to many single sector writes */
-      if (eDisk_Write(pdrv, tbl, wsect++, 1) != RES_OK) return FR_DISK_ERR;
+      if (eCache_Write(pdrv, tbl, wsect++, 1) != RES_OK) return FR_DISK_ERR;
     }
   }
 
   /* Initialize root directory */
   i = (fmt == FS_FAT32) ? au : (UINT)n_dir;
   do {
-    if (eDisk_Write(pdrv, tbl, wsect++, 1) != RES_OK) return FR_DISK_ERR;
+    if (eCache_Write(pdrv, tbl, wsect++, 1) != RES_OK) return FR_DISK_ERR;
   } while (--i);
 
 #if _USE_TRIM /* Erase data area if needed */
@@ -4422,7 +4651,7 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
 
     eb[0] = wsect;
     eb[1] = wsect + (n_clst - ((fmt == FS_FAT32) ? 1 : 0)) * au - 1;
-    disk_ioctl(pdrv, CTRL_TRIM, eb);
+    eCache_Ioctl(pdrv, CTRL_TRIM, eb);
   }
 #endif
 
@@ -4433,11 +4662,11 @@ FRESULT f_mkfs(const TCHAR* path, /* Logical drive number */
     ST_DWORD(tbl + FSI_Free_Count, n_clst - 1); /* Number of free clusters */
     ST_DWORD(tbl + FSI_Nxt_Free, 2);            /* Last allocated cluster# */
     ST_WORD(tbl + BS_55AA, 0xAA55);
-    eDisk_Write(pdrv, tbl, b_vol + 1, 1); /* Write original (VBR+1) */
-    eDisk_Write(pdrv, tbl, b_vol + 7, 1); /* Write backup (VBR+7) */
+    eCache_Write(pdrv, tbl, b_vol + 1, 1); /* Write original (VBR+1) */
+    eCache_Write(pdrv, tbl, b_vol + 7, 1); /* Write backup (VBR+7) */
   }
 
-  return (disk_ioctl(pdrv, CTRL_SYNC, 0) == RES_OK) ? FR_OK : FR_DISK_ERR;
+  return (eCache_Ioctl(pdrv, CTRL_SYNC, 0) == RES_OK) ? FR_OK : FR_DISK_ERR;
 }
 
 #if _MULTI_PARTITION
@@ -4458,7 +4687,7 @@ FRESULT f_fdisk(
   stat = eDisk_Init(pdrv);
   if (stat & STA_NOINIT) return FR_NOT_READY;
   if (stat & STA_PROTECT) return FR_WRITE_PROTECTED;
-  if (disk_ioctl(pdrv, GET_SECTOR_COUNT, &sz_disk)) return FR_DISK_ERR;
+  if (eCache_Ioctl(pdrv, GET_SECTOR_COUNT, &sz_disk)) return FR_DISK_ERR;
 
   /* Determine CHS in the table regardless of the drive geometry */
   for (n = 16; n < 256 && sz_disk / n / 63 > 1024; n *= 2)
@@ -4504,8 +4733,8 @@ FRESULT f_fdisk(
   ST_WORD(p, 0xAA55);
 
   /* Write it to the MBR */
-  return (eDisk_Write(pdrv, buf, 0, 1) != RES_OK ||
-          disk_ioctl(pdrv, CTRL_SYNC, 0) != RES_OK)
+  return (eCache_Write(pdrv, buf, 0, 1) != RES_OK ||
+          eCache_Ioctl(pdrv, CTRL_SYNC, 0) != RES_OK)
              ? FR_DISK_ERR
              : FR_OK;
 }
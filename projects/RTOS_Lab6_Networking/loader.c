@@ -554,6 +554,25 @@ static int initElf(ELFExec_t *e, LOADER_FD_T f) {
   return 0;
 }
 
+static size_t imageSize(ELFExec_t *e) {
+  size_t size = 0;
+  int n;
+  if (e->type == ET_EXEC) {
+    for (n = 0; n < e->segments; n++) {
+      Elf32_Phdr ph;
+      if (readSegHeader(e, n, &ph) != 0) return 0;
+      if (ph.p_type == PT_LOAD) size += (ph.p_memsz + 7) & ~7;
+    }
+  } else {
+    for (n = 0; n < e->sections; n++) {
+      Elf32_Shdr sh;
+      if (readSecHeader(e, n, &sh) != 0) return 0;
+      if (sh.sh_flags & SHF_ALLOC) size += (sh.sh_size + 7) & ~7;
+    }
+  }
+  return size;
+}
+
 static void freeElf(ELFExec_t *e) {
 #ifndef VALVANOWARE
   freeSegment(&e->loadText);
@@ -618,11 +637,18 @@ int exec_elf(const char *path, const ELFEnv_t *env) {
 #else
   ELFExec_t exec;
 #endif
-  if (initElf(&exec, LOADER_OPEN_FOR_RD(path)) != 0) {
+  LOADER_FD_T fd = LOADER_OPEN_FOR_RD(path);
+  if (initElf(&exec, fd) != 0) {
     DBG("Invalid elf %s\n\r", path);
+    if (LOADER_FD_VALID(fd)) LOADER_CLOSE(fd);  // opened, but not an ELF
     return -1;
   }
   exec.env = env;
+  if (LOADER_BEGIN(imageSize(&exec)) != 0) {
+    MSG("No memory for program");
+    LOADER_CLOSE(exec.fd);
+    return -1;
+  }
 
   if (exec.type == ET_EXEC) {
     int founded = 0;
@@ -634,9 +660,12 @@ int exec_elf(const char *path, const ELFEnv_t *env) {
       }
       ret = jumpTo(exec.entry, exec.loadText.data, exec.loadData.data);
       freeElf(&exec);
+      LOADER_END(ret);
       return ret;
     } else {
       MSG("Invalid PROGRAM");
+      freeElf(&exec);
+      LOADER_END(-1);
       return -1;
     }
   } else {
@@ -645,9 +674,12 @@ int exec_elf(const char *path, const ELFEnv_t *env) {
       if (relocateSections(&exec) == 0)
         ret = jumpTo(exec.entry, exec.text.data, 0);
       freeElf(&exec);
+      LOADER_END(ret);
       return ret;
     } else {
       MSG("Invalid EXEC");
+      freeElf(&exec);
+      LOADER_END(-1);
       return -1;
     }
   }
@@ -55,10 +55,27 @@ int OS_AddProcess(void (*entry)(void), void* text, void* data,
 typedef unsigned long int off_t;
 typedef void(entry_t)(void);
 
+// The loader seeks all the time, to a string table and back. With a link
+// map of the clusters of the file (FatFs fast seek) a seek is a lookup in
+// RAM, not a walk of the FAT from the start of the file. The map comes
+// from the heap; without room for it, the file is read the slow way.
+#define LOADER_LINKMAP 16  // DWORDs first tried, FatFs asks for more
 #define LOADER_FD_T FIL*
 FIL* LOADER_OPEN_FOR_RD(const TCHAR* path) {
   static FIL fd;  // only one open file at a time
+  DWORD size = LOADER_LINKMAP, *map;
+  FRESULT result = FR_NOT_ENOUGH_CORE;
   if (f_open(&fd, path, FA_READ)) return NULL;
+  while ((result == FR_NOT_ENOUGH_CORE) &&
+         (map = Heap_Malloc(size * sizeof(DWORD))) != NULL) {
+    map[0] = size;
+    fd.cltbl = map;
+    result = f_lseek(&fd, CREATE_LINKMAP);
+    if (result == FR_OK) break;
+    size = map[0];  // what it takes
+    fd.cltbl = NULL;
+    Heap_Free(map);
+  }
   return &fd;
 }
 #define LOADER_FD_VALID(fd) (fd != NULL)
@@ -72,12 +89,41 @@ UINT LOADER_WRITE(FIL* fd, void* buffer, size_t size) {
   if (f_write(fd, buffer, size, &w)) return 0;
   return w;
 }
-#define LOADER_CLOSE(fd) f_close(fd)
+FRESULT LOADER_CLOSE(FIL* fd) {
+  FRESULT result = f_close(fd);
+  if (fd->cltbl) Heap_Free(fd->cltbl);
+  fd->cltbl = NULL;  // the FIL is static, keep no pointer to freed memory
+  return result;
+}
 #define LOADER_SEEK_FROM_START(fd, off) f_lseek(fd, off)
 #define LOADER_TELL(fd) (fd->fptr)
 
-#define LOADER_ALIGN_ALLOC(size, align, perm) Heap_Malloc(size)
-#define LOADER_FREE(ptr) Heap_Free(ptr)
+// Every program is loaded into an arena of its own. OS_AddProcess takes the
+// arena over: the stacks and Heap_Malloc calls of the process are served from
+// it, and it goes back to the heap in one piece when the process exits.
+#define LOADER_STACK 128          // stack of the first thread, see below
+#define LOADER_PROCESS_HEAP 1024  // further thread stacks and Heap_Malloc
+#define LOADER_BLOCKS 8           // allocations, each with a header word
+#define LOADER_ALIGN_MAX 256      // largest alignment honoured, see below
+static arena_t* LoaderArena;      // arena of the program being loaded
+int LOADER_BEGIN(size_t size) {
+  LoaderArena = Arena_Create(size + LOADER_STACK + LOADER_PROCESS_HEAP +
+                             LOADER_BLOCKS * 8 + LOADER_ALIGN_MAX);
+  return LoaderArena == NULL;
+}
+void LOADER_END(int ret) {
+  if (ret != 1) Arena_Destroy(LoaderArena);  // the process did not start
+  LoaderArena = NULL;
+}
+
+// Sections keep their sh_addralign, for doubles, LDRD/LDM and MPU regions.
+// Larger alignments are the page size of the linker in p_align, which means
+// nothing without virtual memory, and are capped.
+#define LOADER_ALIGN_ALLOC(size, align, perm)                                  \
+  Arena_AlignedMalloc(LoaderArena, size,                                       \
+                      (align) > LOADER_ALIGN_MAX ? LOADER_ALIGN_MAX            \
+                                                 : (align) ? (align) : 1)
+#define LOADER_FREE(ptr) Arena_Free(LoaderArena, ptr)
 void LOADER_CLEAR(void* ptr, size_t size) {
   int i;
   int32_t* p;
@@ -86,7 +132,7 @@ void LOADER_CLEAR(void* ptr, size_t size) {
 #define LOADER_STREQ(s1, s2) (strcmp(s1, s2) == 0)
 
 #define LOADER_JUMP_TO(entry, text, data) \
-  OS_AddProcess(entry, text, data, 128, 1)
+  OS_AddProcess(entry, text, data, LOADER_STACK, 1)
 
 #define DBG(msg, par)
 #define ERR(msg) UART_OutString("ELF: " msg "\n\r")
@@ -129,6 +175,9 @@ extern void *do_alloc(size_t size, size_t align, ELFSecPerm_t perm);
 
 #endif
 
+#define LOADER_BEGIN(size) 0
+#define LOADER_END(ret)
+
 extern int is_streq(const char *s1, const char *s2);
 
 #define LOADER_FREE(ptr) free(ptr)
@@ -238,6 +287,26 @@ extern void arch_jumpTo(entry_t entry);
  */
 #define LOADER_TELL(fd)
 
+/**
+ * Reserve memory for a program
+ *
+ * Called before anything is allocated with #LOADER_ALIGN_ALLOC
+ *
+ * @param size Bytes of all loaded sections or segments, each rounded up to 8
+ * @retval Zero if the program can be loaded
+ * @retval Non-zero if there is no memory for it
+ */
+#define LOADER_BEGIN(size)
+
+/**
+ * End loading a program
+ *
+ * Called after #LOADER_JUMP_TO, or instead of it when loading failed
+ *
+ * @param ret Value of #LOADER_JUMP_TO, -1 if it was not called
+ */
+#define LOADER_END(ret)
+
 /**
  * Allocate memory service
  *
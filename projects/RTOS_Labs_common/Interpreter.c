@@ -4,15 +4,18 @@
 //
 // Runs on LM4F120/TM4C123
 // Jonathan W. Valvano 1/18/20, valvano@mail.utexas.edu
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "../RTOS_Labs_common/Interpreter.h"
 #include "../RTOS_Labs_common/OS.h"
 #include "../RTOS_Labs_common/ST7735.h"
 #include "../RTOS_Labs_common/UART0int.h"
 #include "../RTOS_Labs_common/eDisk.h"
 #include "../RTOS_Labs_common/eFile.h"
+#include "../RTOS_Labs_common/heap.h"
 #include "../inc/ADCSWTrigger.h"
 #include "../inc/ADCT0ATrigger.h"
 
@@ -23,8 +26,120 @@ void Jitter(int32_t MaxJitter, uint32_t const JitterSize,
 }
 
 void help() {
-  printf("---Help---\n");
-  printf("go        -  run prog");
+  printf("---Help---\n\r");
+  printf("go        -  run prog\n\r");
+  printf("deadlines -  periodic thread misses and overruns\n\r");
+  printf("deadlines clear - restart the deadline counts\n\r");
+  printf("heap      -  heap usage, watermark and size classes\n\r");
+  printf("heap trace - drain the heap trace, for tests/replay_heap\n\r");
+  printf("heap trace on/off - drain it whenever the CPU is idle\n\r");
+  printf("idle      -  idle work calls and overruns\n\r");
+}
+
+static int TraceOn;        // "heap trace on", see Interpreter_TraceWork
+static int Checked;        // Interpreter_HeapWork has walked the heap
+static int Corrupted;      // and found it corrupted
+static uint32_t LowFree;   // fewest free bytes it found
+static uint32_t LowLargest;  // smallest largest free block it found
+
+// Print the deadline monitoring of every periodic thread
+void deadlines(void) {
+  periodic_stats_t stats;
+  uint32_t i;
+  for (i = 0; OS_GetPeriodicStats(i, &stats) == 0; i++) {
+    printf("periodic %u: period %u releases %u missed %u overruns %u\n\r",
+           (unsigned)i, (unsigned)stats.period, (unsigned)stats.releases,
+           (unsigned)stats.missed, (unsigned)stats.overruns);
+    printf("  max exec %u max lateness %u (12.5ns)\n\r",
+           (unsigned)stats.maxExec, (unsigned)stats.maxLateness);
+  }
+  if (i == 0) printf("no periodic threads\n\r");
+}
+
+// Print heap usage and, with HEAP_PROFILE, the peak and live blocks per
+// size class
+void heap(void) {
+  heap_stats_t stats;
+  heap_profile_t profile;
+  int c;
+  if (Heap_Stats(&stats) || Corrupted) {
+    printf("heap corrupted\n\r");
+    return;
+  }
+  printf("heap %u used %u free %u largest %u fragmented %u%%\n\r",
+         (unsigned)stats.size, (unsigned)stats.used, (unsigned)stats.free,
+         (unsigned)stats.largestFree, (unsigned)stats.fragmentation);
+  if (Checked) {
+    printf("while idle: fewest free %u smallest largest %u\n\r",
+           (unsigned)LowFree, (unsigned)LowLargest);
+  }
+  if (Heap_Profile(&profile)) return;  // profiler not compiled in
+  printf("peak %u failures %u trace lost %u\n\r", (unsigned)profile.peak,
+         (unsigned)profile.failures, (unsigned)profile.lost);
+  for (c = 0; c < HEAP_CLASSES; c++) {
+    if (profile.allocs[c]) {
+      printf("  %5u-%5u bytes: live %u allocated %u\n\r", 1u << c,
+             (2u << c) - 1, (unsigned)profile.live[c],
+             (unsigned)profile.allocs[c]);
+    }
+  }
+}
+
+// Print a heap trace event:
+// H op size block old thread time caller
+static void trace_event(const heap_event_t* e) {
+  printf("H %c %u %04x %04x %u %08x %08x\n\r", e->op, (unsigned)e->size,
+         (unsigned)e->block, (unsigned)e->old, (unsigned)e->id,
+         (unsigned)e->time, (unsigned)e->caller);
+}
+
+// Drain the heap trace ring, one line per event
+void heap_trace(void) {
+  heap_event_t e;
+  while (Heap_TraceGet(&e) == 0) trace_event(&e);
+}
+
+// Print the budget keeping of the idle work functions
+void idle(void) {
+  idle_work_stats_t stats;
+  uint32_t i;
+  for (i = 0; OS_GetIdleWorkStats(i, &stats) == 0; i++) {
+    printf("idle work %u: budget %u runs %u max %u overruns %u\n\r",
+           (unsigned)i, (unsigned)stats.budget, (unsigned)stats.runs,
+           (unsigned)stats.maxCycles, (unsigned)stats.overruns);
+  }
+  if (i == 0) printf("no idle work\n\r");
+}
+
+// Idle work, see OS_AddIdleWork: after "heap trace on" print trace events
+// until the budget is used, so the ring does not overflow between "heap
+// trace" commands. replay_heap skips the other lines of the output.
+int Interpreter_TraceWork(uint32_t budget) {
+  heap_event_t e;
+  uint32_t start = OS_Time();
+  while (TraceOn) {
+    if (OS_TimeDifference(start, OS_Time()) >= budget) return 1;
+    if (Heap_TraceGet(&e)) return 0;  // drained, or no profiler
+    trace_event(&e);
+  }
+  return 0;
+}
+
+// Idle work, see OS_AddIdleWork: walk the heap, which finds corruption
+// before an allocation trips over it, and keep the least free space seen
+// for the "heap" command
+int Interpreter_HeapWork(uint32_t budget) {
+  heap_stats_t stats;
+  if (Heap_Stats(&stats)) {
+    Corrupted = 1;
+    return 0;
+  }
+  if (!Checked || (stats.free < LowFree)) LowFree = stats.free;
+  if (!Checked || (stats.largestFree < LowLargest)) {
+    LowLargest = stats.largestFree;
+  }
+  Checked = 1;
+  return 0;
 }
 
 /*
@@ -36,7 +151,7 @@ void clean_input(char** shell_input) {
 
   // first remove the empty spaces in the end;
   int len = strlen(*shell_input);
-  while (len >= 0) {
+  while (len > 0) {
     if (*(*shell_input + len - 1) == ' ')  // for space characters
       *(*shell_input + len - 1) = '\0';    // replace it with null
     else
@@ -68,7 +183,26 @@ void clean_input(char** shell_input) {
  *      print an error in the console
  */
 void execute_command(char* shell_input) {
-  printf("Executing %s", shell_input);
+  if (strcmp(shell_input, "help") == 0) {
+    help();
+  } else if (strcmp(shell_input, "deadlines") == 0) {
+    deadlines();
+  } else if (strcmp(shell_input, "deadlines clear") == 0) {
+    OS_ClearPeriodicStats();
+  } else if (strcmp(shell_input, "heap") == 0) {
+    heap();
+  } else if (strcmp(shell_input, "heap trace") == 0) {
+    heap_trace();
+  } else if (strcmp(shell_input, "heap trace on") == 0) {
+    TraceOn = 1;
+  } else if (strcmp(shell_input, "heap trace off") == 0) {
+    TraceOn = 0;
+  } else if (strcmp(shell_input, "idle") == 0) {
+    idle();
+  } else if (*shell_input != '\0') {
+    printf("unknown command %s\n\r", shell_input);
+    help();
+  }
   return;
 }
 
@@ -78,22 +212,25 @@ void Interpreter(void) {
 
   // store the input here
   char shell_input[MAX_INPUT_SIZE];
+  char* command;
 
   // this is a shell. Hence, we shold never coume out of this
   for (int i = 0;; i++) {
     // print some shell identifier
     // Actually, this should go to the display
-    printf(">")
+    printf(">");
 
-        // read the input
-        UART_InString(shell_input, MAX_INPUT_SIZE);
+    // read the input
+    UART_InString(shell_input, MAX_INPUT_SIZE);
+    printf("\n\r");
 
     // clean the input
     // remove the starting and the ending spaces
     // reference to array is passed because we need to change
     // the array starting address iteself
-    clean_input(&shell_input);
+    command = shell_input;
+    clean_input(&command);
 
-    execute_command(&shell_input);
+    execute_command(command);
   }
 }
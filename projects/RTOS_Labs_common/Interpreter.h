@@ -11,6 +11,8 @@
 
  ******************************************************************************/
 
+#include <stdint.h>
+
 // Maximum size of the input lines
 #define MAX_INPUT_SIZE 30  // maximumx input size
 
@@ -21,3 +23,23 @@
  * @brief  Interpreter
  */
 void Interpreter(void);
+
+/**
+ * @details  Idle work for OS_AddIdleWork: after the command "heap trace
+ * on", print heap trace events (see Heap_TraceGet) until the budget is
+ * used.
+ * @param  budget cycles (12.5ns) for one call
+ * @return nonzero if events are left, 0 when drained
+ * @brief  Dump the heap trace when idle
+ */
+int Interpreter_TraceWork(uint32_t budget);
+
+/**
+ * @details  Idle work for OS_AddIdleWork: check the heap with Heap_Stats
+ * and keep its low-water marks for the "heap" command, which also reports
+ * corruption found this way.
+ * @param  budget cycles (12.5ns) for one call, one walk of the heap
+ * @return 0, nothing is left pending
+ * @brief  Check the heap when idle
+ */
+int Interpreter_HeapWork(uint32_t budget);
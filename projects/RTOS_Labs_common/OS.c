@@ -14,12 +14,12 @@
 #include "../RTOS_Labs_common/ST7735.h"
 #include "../RTOS_Labs_common/UART0int.h"
 #include "../RTOS_Labs_common/eFile.h"
+#include "../RTOS_Labs_common/heap.h"
 #include "../inc/ADCT0ATrigger.h"
 #include "../inc/CortexM.h"
 #include "../inc/LaunchPad.h"
 #include "../inc/PLL.h"
 #include "../inc/Timer4A.h"
-#include "../inc/WTimer0A.h"
 #include "../inc/tm4c123gh6pm.h"
 
 // Performance Measurements
@@ -27,18 +27,145 @@ int32_t MaxJitter;  // largest time jitter between interrupts in usec
 #define JITTERSIZE 64
 uint32_t const JitterSize = JITTERSIZE;
 
-uint32_t Curr_time = 0;
-
 uint32_t JitterHistogram[JITTERSIZE] = {
     0,
 };
 
+// function definitions in osasm.s
+void StartOS(void);
+void ContextSwitch(void);
+
+static void OS_ClockInit(void);
+static void Reap(void);
+static void Kill(void);
+
+#define MAXTHREADS 10     // maximum number of foreground threads
+#define STACKSIZE 256     // number of 32-bit words in each thread stack
+#define IDLEPRIORITY 255  // kernel idle thread, below every user priority
+#define MAXPROCESSES 4    // maximum number of processes, see OS_AddProcess
+#define REFILLPRIORITY 3  // below the lab threads, not below their Idle
+
+// process control block
+// a process owns its segments and, when they were loaded into an arena, all
+// stacks and Heap_Malloc memory of its threads come from that arena too
+typedef struct pcb {
+  arena_t *arena;    // arena holding the process, 0 if it has none
+  void *text;        // code segment
+  void *data;        // data segment, R9 of every thread in the process
+  uint32_t threads;  // live threads, the process ends when this reaches 0
+} pcbType;
+
+// thread control block
+// sp must stay the first field, osasm.s saves and restores it at offset 0
+typedef struct tcb {
+  int32_t *sp;        // saved stack pointer, valid when not running
+  uint32_t id;        // thread ID, 0 means this TCB is free
+  uint32_t priority;  // 0 is highest
+  uint32_t sleeping;  // 1 while in OS_Sleep
+  uint32_t wakeTime;  // SchedTime at which a sleeping thread becomes ready
+  Sema4Type *blocked;  // semaphore the thread waits on, 0 if none
+  uint32_t waitOrder;  // when it started waiting, see Wake
+  uint32_t cpu;        // cycles it has run, charged at each switch
+  // CPU budget, see OS_AddBudgetThread; budget 0 means unlimited
+  uint32_t budget;      // cycles the thread may run per period
+  uint32_t period;      // replenishment period in 12.5ns units
+  int32_t remaining;    // cycles left in the current period
+  uint32_t replenish;   // SchedTime of the next replenishment
+  uint32_t throttled;   // 1 while the budget is exhausted
+  uint32_t overruns;    // number of times the budget was exhausted
+  uint32_t overrunMax;  // largest overshoot past the budget, in cycles
+  pcbType *process;     // process the thread belongs to, 0 for none
+  int32_t *stack;       // stack allocated in the process arena, 0 for Stacks
+} tcbType;
+
+tcbType *tcbs;           // MAXTHREADS TCBs, the blocks of TcbPool
+static pool_t *TcbPool;  // free TCBs, O(1) to take one in OS_AddThread
+static tcbType *Dying;   // killed thread whose TCB is not yet back in TcbPool
+static pool_t *PcbPool;  // free PCBs
+tcbType *RunPt;   // currently running thread, used by osasm.s
+tcbType *NextPt;  // thread PendSV switches to, chosen by Scheduler
+int32_t Stacks[MAXTHREADS][STACKSIZE];
+static uint32_t NextId = 1;  // ID handed to the next thread created
+static uint32_t TimeSlice;   // SysTick reload + 1, in 12.5ns units
+static uint32_t SchedTime;   // cycles since OS_Launch, updated per switch
+static uint32_t Waits;       // OS_Wait calls that blocked, orders waiters
+
+// ******** Charge ************
+// account CPU time to the thread that was running, throttle it if it ran
+// through the rest of its budget
+// Inputs:  cycles executed since the last scheduling decision
+// Outputs: none
+// called with interrupts disabled
+static void Charge(uint32_t elapsed) {
+  SchedTime += elapsed;
+  RunPt->cpu += elapsed;
+  if (RunPt->budget == 0) return;  // not a budgeted thread
+  RunPt->remaining -= (int32_t)elapsed;
+  if ((RunPt->remaining <= 0) && !RunPt->throttled) {
+    RunPt->throttled = 1;
+    RunPt->overruns++;
+    if ((uint32_t)(-RunPt->remaining) > RunPt->overrunMax) {
+      RunPt->overrunMax = -RunPt->remaining;
+    }
+  }
+}
+
+// ******** Ready ************
+// decide whether a thread may run right now, waking sleepers and
+// replenishing budgets whose period has elapsed
+// Inputs:  pointer to TCB
+// Outputs: 1 if the thread can be scheduled, 0 otherwise
+// called with interrupts disabled
+static int Ready(tcbType *pt) {
+  if (pt->id == 0) return 0;  // free TCB
+  if (pt->blocked) return 0;  // until OS_Signal wakes it
+  if (pt->sleeping) {
+    if ((int32_t)(SchedTime - pt->wakeTime) < 0) return 0;
+    pt->sleeping = 0;
+  }
+  if (pt->budget && ((int32_t)(SchedTime - pt->replenish) >= 0)) {
+    pt->remaining = pt->budget;  // deferrable server, full refill
+    pt->throttled = 0;
+    pt->replenish += pt->period;
+    if ((int32_t)(SchedTime - pt->replenish) >= 0) {
+      pt->replenish = SchedTime + pt->period;  // idle for several periods
+    }
+  }
+  return !pt->throttled;
+}
+
+// ******** Scheduler ************
+// pick the highest priority ready thread, round robin among equals
+// starting after the running thread
+// Inputs:  none
+// Outputs: none, sets NextPt
+// called with interrupts disabled
+static void Scheduler(void) {
+  uint32_t i, start, best = IDLEPRIORITY + 1;
+  tcbType *pt;
+  Reap();  // a process ends as soon as its last thread is switched out
+  start = RunPt - tcbs;
+  for (i = 1; i <= MAXTHREADS; i++) {
+    pt = &tcbs[(start + i) % MAXTHREADS];
+    if (Ready(pt) && (pt->priority < best)) {
+      best = pt->priority;
+      NextPt = pt;
+    }
+  }
+}
+
 /*------------------------------------------------------------------------------
   Systick Interrupt Handler
-  SysTick interrupt happens every 10 ms
-  used for preemptive thread switch
+  SysTick interrupt happens every time slice
+  used for preemptive thread switch and CPU budget accounting
  *------------------------------------------------------------------------------*/
-void SysTick_Handler(void) {}  // end SysTick_Handler
+void SysTick_Handler(void) {
+  long sr = StartCritical();
+  Charge(TimeSlice);
+  Scheduler();
+  ContextSwitch();
+  EndCritical(sr);
+}  // end SysTick_Handler
 
 unsigned long OS_LockScheduler(void) {
   // lab 4 might need this for disk formating
@@ -48,7 +175,77 @@ void OS_UnLockScheduler(unsigned long previous) {
   // lab 4 might need this for disk formating
 }
 
-void SysTick_Init(unsigned long period) {}
+void SysTick_Init(unsigned long period) {
+  NVIC_ST_CTRL_R = 0;             // disable SysTick during setup
+  NVIC_ST_RELOAD_R = period - 1;  // reload value
+  NVIC_ST_CURRENT_R = 0;          // any write to current clears it
+  NVIC_SYS_PRI3_R = (NVIC_SYS_PRI3_R & 0x00FFFFFF) | 0xC0000000;  // SysTick 6
+  NVIC_SYS_PRI3_R = (NVIC_SYS_PRI3_R & 0xFF00FFFF) | 0x00E00000;  // PendSV 7
+  NVIC_ST_CTRL_R = NVIC_ST_CTRL_ENABLE + NVIC_ST_CTRL_CLK_SRC +
+                   NVIC_ST_CTRL_INTEN;  // enable with core clock and interrupts
+  TimeSlice = period;
+}
+
+// ******** SetInitialStack ************
+// build the stack frame PendSV/StartOS expect for a thread never run before
+// Inputs:  TCB, top of the stack (8-byte aligned), address of the thread
+//          function, initial R9 (static base of the process)
+// Outputs: none
+static void SetInitialStack(tcbType *t, int32_t *top, void (*task)(void),
+                            int32_t r9) {
+  t->sp = top - 16;            // thread stack pointer
+  top[-1] = 0x01000000;        // thumb bit
+  top[-2] = (int32_t)task;     // PC
+  top[-3] = (int32_t)OS_Kill;  // R14, return kills thread
+  top[-4] = 0x12121212;        // R12
+  top[-5] = 0x03030303;        // R3
+  top[-6] = 0x02020202;        // R2
+  top[-7] = 0x01010101;        // R1
+  top[-8] = 0x00000000;        // R0
+  top[-9] = 0x11111111;        // R11
+  top[-10] = 0x10101010;       // R10
+  top[-11] = r9;               // R9
+  top[-12] = 0x08080808;       // R8
+  top[-13] = 0x07070707;       // R7
+  top[-14] = 0x06060606;       // R6
+  top[-15] = 0x05050505;       // R5
+  top[-16] = 0x04040404;       // R4
+}
+
+// ******** Reap ************
+// return the TCB of a killed thread to TcbPool once PendSV has saved its
+// context; until then PendSV still writes the stack pointer into it.
+// A process is released with its last thread: its arena goes back to the
+// heap in one piece, or its segments do if it was not loaded into one.
+// called with interrupts disabled
+static void Reap(void) {
+  tcbType *t = Dying;
+  pcbType *p;
+  if ((t == 0) || (t == RunPt)) return;
+  Dying = 0;
+  p = t->process;
+  if (p) {
+    if (t->stack) Arena_Free(p->arena, t->stack);
+    if (--p->threads == 0) {
+      if (p->arena) {
+        Arena_Destroy(p->arena);  // segments, stacks and Heap_Malloc memory
+      } else {
+        if (p->text) Heap_Free(p->text);
+        if (p->data) Heap_Free(p->data);
+      }
+      Pool_Free(PcbPool, p);
+    }
+  }
+  Pool_Free(TcbPool, t);
+}
+
+// ******** IdleThread ************
+// kernel thread that runs when no user thread is ready
+static void IdleThread(void) {
+  for (;;) {
+    if (!OS_RunIdleWork()) WaitForInterrupt();
+  }
+}
 
 /**
  * @details  Initialize operating system, disable interrupts until OS_Launch.
@@ -58,19 +255,65 @@ void SysTick_Init(unsigned long period) {}
  * @return none
  * @brief  Initialize OS
  */
-void OS_Init(void){
-    // put Lab 2 (and beyond) solution here
-
-};
+void OS_Init(void) {
+  int i;
+  DisableInterrupts();
+  PLL_Init(Bus80MHz);
+  UART_Init();                 // serial I/O for interpreter
+  ST7735_InitR(INITR_REDTAB);  // LCD initialization
+  LaunchPad_Init();            // debugging profile on PF1
+  OS_ClockInit();              // 64-bit system time, OS_Time64
+  TcbPool = Pool_Create(sizeof(tcbType), MAXTHREADS);
+  tcbs = Pool_Base(TcbPool);
+  PcbPool = Pool_Create(sizeof(pcbType), MAXPROCESSES);
+  for (i = 0; i < MAXTHREADS; i++) {
+    tcbs[i].id = 0;
+  }
+  RunPt = 0;  // no thread runs until OS_Launch
+  OS_AddThread(&IdleThread, STACKSIZE * 4, IDLEPRIORITY);
+}
 
 // ******** OS_InitSemaphore ************
 // initialize semaphore
 // input:  pointer to a semaphore
 // output: none
-void OS_InitSemaphore(Sema4Type *semaPt, int32_t value){
-    // put Lab 2 (and beyond) solution here
+void OS_InitSemaphore(Sema4Type *semaPt, int32_t value) {
+  semaPt->Value = value;
+}
 
-};
+// ******** Block ************
+// block the running thread on a semaphore until Wake picks it
+// called with interrupts disabled; the switch happens once they are enabled
+static void Block(Sema4Type *semaPt) {
+  RunPt->blocked = semaPt;
+  RunPt->waitOrder = Waits++;
+  OS_Suspend();
+}
+
+// ******** Wake ************
+// make ready the thread of highest priority blocked on a semaphore, the one
+// that waited longest among equals, and switch to it if it outranks the
+// running thread
+// Inputs:  semaphore
+// Outputs: 1 if a thread was woken, 0 if none was blocked
+// called with interrupts disabled, from a thread or an interrupt handler
+static int Wake(Sema4Type *semaPt) {
+  tcbType *pt, *best = 0;
+  int i;
+  for (i = 0; i < MAXTHREADS; i++) {
+    pt = &tcbs[i];
+    if ((pt->id == 0) || (pt->blocked != semaPt)) continue;
+    if ((best == 0) || (pt->priority < best->priority) ||
+        ((pt->priority == best->priority) &&
+         ((int32_t)(pt->waitOrder - best->waitOrder) < 0))) {
+      best = pt;
+    }
+  }
+  if (best == 0) return 0;
+  best->blocked = 0;
+  if (RunPt && (best->priority < RunPt->priority)) OS_Suspend();
+  return 1;
+}
 
 // ******** OS_Wait ************
 // decrement semaphore
@@ -78,10 +321,13 @@ void OS_InitSemaphore(Sema4Type *semaPt, int32_t value){
 // Lab3 block if less than zero
 // input:  pointer to a counting semaphore
 // output: none
-void OS_Wait(Sema4Type *semaPt){
-    // put Lab 2 (and beyond) solution here
-
-};
+// Called from threads with interrupts enabled, never from a handler
+void OS_Wait(Sema4Type *semaPt) {
+  long sr = StartCritical();
+  semaPt->Value--;
+  if (semaPt->Value < 0) Block(semaPt);
+  EndCritical(sr);
+}
 
 // ******** OS_Signal ************
 // increment semaphore
@@ -89,30 +335,137 @@ void OS_Wait(Sema4Type *semaPt){
 // Lab3 wakeup blocked thread if appropriate
 // input:  pointer to a counting semaphore
 // output: none
-void OS_Signal(Sema4Type *semaPt){
-    // put Lab 2 (and beyond) solution here
-
-};
+// May be called from interrupt handlers
+void OS_Signal(Sema4Type *semaPt) {
+  long sr = StartCritical();
+  semaPt->Value++;
+  if (semaPt->Value <= 0) Wake(semaPt);
+  EndCritical(sr);
+}
 
 // ******** OS_bWait ************
 // Lab2 spinlock, set to 0
 // Lab3 block if less than zero
 // input:  pointer to a binary semaphore
 // output: none
-void OS_bWait(Sema4Type *semaPt){
-    // put Lab 2 (and beyond) solution here
-
-};
+// Called from threads with interrupts enabled, never from a handler
+void OS_bWait(Sema4Type *semaPt) {
+  long sr = StartCritical();
+  if (semaPt->Value > 0) {
+    semaPt->Value = 0;
+  } else {
+    Block(semaPt);  // OS_bSignal hands the semaphore over
+  }
+  EndCritical(sr);
+}
 
 // ******** OS_bSignal ************
 // Lab2 spinlock, set to 1
 // Lab3 wakeup blocked thread if appropriate
 // input:  pointer to a binary semaphore
 // output: none
-void OS_bSignal(Sema4Type *semaPt){
-    // put Lab 2 (and beyond) solution here
+// May be called from interrupt handlers
+void OS_bSignal(Sema4Type *semaPt) {
+  long sr = StartCritical();
+  if (!Wake(semaPt)) semaPt->Value = 1;
+  EndCritical(sr);
+}
 
-};
+// ******** OS_bTryWait ************
+// take a binary semaphore if it is free, never block
+// input:  pointer to a binary semaphore
+// output: 1 if taken, release it with OS_bSignal; 0 if it is busy
+// For the idle thread, which must always be ready
+int OS_bTryWait(Sema4Type *semaPt) {
+  long sr = StartCritical();
+  int taken = (semaPt->Value > 0);
+  if (taken) semaPt->Value = 0;
+  EndCritical(sr);
+  return taken;
+}
+
+// ******** ThreadTime ************
+// cycles the running thread has run, including its current slice, so time
+// other threads and handlers preempted it for is not counted
+// Inputs:  none
+// Outputs: time in 12.5ns units
+static uint32_t ThreadTime(void) {
+  long sr = StartCritical();
+  uint32_t time = RunPt->cpu + (TimeSlice - NVIC_ST_CURRENT_R);
+  if (NVIC_INT_CTRL_R & 0x04000000) time += TimeSlice;  // not charged yet
+  EndCritical(sr);
+  return time;
+}
+
+// ******** Caller ************
+// process on whose behalf the OS is called: that of the running thread from
+// thread mode or SVC, none from an interrupt handler
+// Inputs:  none
+// Outputs: PCB, 0 for none
+static pcbType *Caller(void) {
+  uint32_t active = NVIC_INT_CTRL_R & NVIC_INT_CTRL_VEC_ACT_M;
+  if (RunPt && ((active == 0) || (active == 11))) return RunPt->process;
+  return 0;
+}
+
+// ******** AddThread ************
+// create a thread, see OS_AddBudgetThread
+// Inputs:  as OS_AddBudgetThread, and the process the thread belongs to
+// Outputs: 1 if successful, 0 if this thread can not be added
+// A thread of a process with an arena gets its stack from that arena,
+// any other thread uses the fixed stack that goes with its TCB.
+static int AddThread(void (*task)(void), uint32_t stackSize,
+                     uint32_t priority, uint32_t budget, uint32_t period,
+                     pcbType *process) {
+  int i;
+  tcbType *t;
+  int32_t *stack = 0;
+  int32_t *top;
+  long sr;
+  if (budget && (budget > period)) return 0;
+  if (process && process->arena) {
+    if (stackSize < 16 * 4) return 0;  // no room for the initial frame
+  } else if (stackSize > STACKSIZE * 4) {
+    return 0;
+  }
+  sr = StartCritical();
+  Reap();
+  t = Pool_Alloc(TcbPool);
+  if (t == 0) {
+    EndCritical(sr);
+    return 0;  // no free TCB
+  }
+  i = t - tcbs;  // the fixed stack goes with the TCB
+  top = &Stacks[i][STACKSIZE];
+  if (process && process->arena) {
+    stack = Arena_Malloc(process->arena, stackSize);
+    if (stack == 0) {
+      Pool_Free(TcbPool, t);
+      EndCritical(sr);
+      return 0;  // arena full
+    }
+    top = (int32_t *)(((uintptr_t)stack + stackSize) & ~(uintptr_t)7);
+  }
+  SetInitialStack(t, top, task,
+                  process ? (int32_t)(uintptr_t)process->data : 0x09090909);
+  t->priority = priority;
+  t->sleeping = 0;
+  t->blocked = 0;
+  t->cpu = 0;
+  t->budget = budget;
+  t->period = period;
+  t->remaining = budget;
+  t->replenish = SchedTime + period;
+  t->throttled = 0;
+  t->overruns = 0;
+  t->overrunMax = 0;
+  t->process = process;
+  t->stack = stack;
+  if (process) process->threads++;
+  t->id = NextId++;
+  EndCritical(sr);
+  return 1;
+}
 
 //******** OS_AddThread ***************
 // add a foregound thread to the scheduler
@@ -123,11 +476,173 @@ void OS_bSignal(Sema4Type *semaPt){
 // stack size must be divisable by 8 (aligned to double word boundary)
 // In Lab 2, you can ignore both the stackSize and priority fields
 // In Lab 3, you can ignore the stackSize fields
+// A thread added by a thread of a process, or through its SVC calls, joins
+// that process
 int OS_AddThread(void (*task)(void), uint32_t stackSize, uint32_t priority) {
-  // put Lab 2 (and beyond) solution here
+  return AddThread(task, stackSize, priority, 0, 0, Caller());
+};
 
-  return 0;  // replace this line with solution
+//******** OS_AddBudgetThread ***************
+// add a foreground thread whose CPU time is limited by a budget that is
+// replenished every period (deferrable server)
+// Inputs: pointer to a void/void foreground task
+//         number of bytes allocated for its stack
+//         priority, 0 is highest, 5 is the lowest
+//         budget, cycles (12.5ns) the thread may run in one period, 0 for none
+//         period, replenishment period in 12.5ns units
+// Outputs: 1 if successful, 0 if this thread can not be added
+// A thread that uses up its budget is not scheduled again until the next
+// replenishment, and the overrun is counted (see OS_GetBudgetStats).
+// Accounting is done at every thread switch, so the thread can overshoot
+// its budget by up to one time slice.
+int OS_AddBudgetThread(void (*task)(void), uint32_t stackSize,
+                       uint32_t priority, uint32_t budget, uint32_t period) {
+  return AddThread(task, stackSize, priority, budget, period, Caller());
+}
+
+//******** OS_GetBudgetStats ***************
+// report CPU budget accounting for a thread
+// Inputs: thread ID (see OS_Id)
+//         reference to a budget_stats_t that returns the budget state
+// Outputs: 0 if successful, 1 if there is no such thread
+int OS_GetBudgetStats(uint32_t id, budget_stats_t *stats) {
+  int i;
+  long sr = StartCritical();
+  for (i = 0; i < MAXTHREADS; i++) {
+    if (tcbs[i].id == id) {
+      stats->budget = tcbs[i].budget;
+      stats->period = tcbs[i].period;
+      stats->remaining = tcbs[i].remaining > 0 ? tcbs[i].remaining : 0;
+      stats->throttled = tcbs[i].throttled;
+      stats->overruns = tcbs[i].overruns;
+      stats->overrunMax = tcbs[i].overrunMax;
+      EndCritical(sr);
+      return 0;
+    }
+  }
+  EndCritical(sr);
+  return 1;
+}
+
+#define MAXIDLEWORK 8  // maximum number of idle work functions
+// background maintenance run from the idle thread(s), see OS_AddIdleWork
+struct idlework {
+  int (*work)(uint32_t budget);  // returns nonzero while work is pending
+  uint32_t budget;               // cycles (12.5ns) allowed per call
+  uint32_t runs;                 // number of calls
+  uint32_t maxCycles;            // longest call measured
+  uint32_t overruns;             // calls that took longer than budget
 };
+static struct idlework IdleWork[MAXIDLEWORK];
+static uint32_t NumIdleWork;
+
+//******** OS_AddIdleWork ***************
+// register low priority maintenance work that only runs when nothing else
+// is ready, e.g. flushing dirty disk sectors or gathering statistics
+// Inputs: work function, called repeatedly with its budget; it must do at
+//           most budget cycles (12.5ns) of work and return nonzero if more
+//           work is still pending, 0 when it is caught up
+//         budget in 12.5ns units for one call
+// Outputs: 1 if successful, 0 if this work can not be added
+int OS_AddIdleWork(int (*work)(uint32_t budget), uint32_t budget) {
+  long sr = StartCritical();
+  if (NumIdleWork == MAXIDLEWORK) {
+    EndCritical(sr);
+    return 0;
+  }
+  IdleWork[NumIdleWork].work = work;
+  IdleWork[NumIdleWork].budget = budget;
+  IdleWork[NumIdleWork].runs = 0;
+  IdleWork[NumIdleWork].maxCycles = 0;
+  IdleWork[NumIdleWork].overruns = 0;
+  NumIdleWork++;  // visible to OS_RunIdleWork only once filled in
+  EndCritical(sr);
+  return 1;
+}
+
+//******** OS_RunIdleWork ***************
+// call each registered idle work function once, measuring how long it ran
+// on the CPU of the calling thread; preemption is not counted
+// Inputs: none
+// Outputs: nonzero if some work is still pending, 0 if the caller may sleep
+// Called by the kernel idle thread and by the Idle threads of the labs,
+// which run at the lowest priority, so any other ready thread preempts it
+int OS_RunIdleWork(void) {
+  uint32_t i, start, elapsed;
+  int pending = 0;
+  for (i = 0; i < NumIdleWork; i++) {
+    start = ThreadTime();
+    pending |= IdleWork[i].work(IdleWork[i].budget);
+    elapsed = ThreadTime() - start;
+    IdleWork[i].runs++;
+    if (elapsed > IdleWork[i].maxCycles) IdleWork[i].maxCycles = elapsed;
+    if (elapsed > IdleWork[i].budget) IdleWork[i].overruns++;
+  }
+  return pending;
+}
+
+//******** OS_GetIdleWorkStats ***************
+// report how an idle work function kept to its budget
+// Inputs: index of the work function, in order of OS_AddIdleWork calls
+//         reference to an idle_work_stats_t to fill in
+// Outputs: 0 if successful, 1 if there is no such work function
+int OS_GetIdleWorkStats(uint32_t index, idle_work_stats_t *stats) {
+  if (index >= NumIdleWork) return 1;
+  stats->budget = IdleWork[index].budget;
+  stats->runs = IdleWork[index].runs;
+  stats->maxCycles = IdleWork[index].maxCycles;
+  stats->overruns = IdleWork[index].overruns;
+  return 0;
+}
+
+static Sema4Type RefillNeeded;  // a size of buffers ran low
+
+// ******** RefillSignal ************
+// called by Heap_IsrMalloc, in any context, when it leaves a size with
+// fewer buffers than it keeps ready
+static void RefillSignal(void) { OS_bSignal(&RefillNeeded); }
+
+// ******** IsrShort ************
+// 1 if a size has fewer buffers than it keeps ready
+static int IsrShort(void) {
+  heap_isr_stats_t stats;
+  uint32_t i;
+  for (i = 0; Heap_IsrStats(i, &stats) == 0; i++) {
+    if (stats.free < stats.depth) return 1;
+  }
+  return 0;
+}
+
+// ******** RefillThread ************
+// kernel thread that allocates buffers for interrupt handlers once
+// Heap_IsrMalloc signals; it polls only while the heap has no room
+static void RefillThread(void) {
+  for (;;) {
+    OS_bWait(&RefillNeeded);
+    Heap_IsrRefill();
+    while (IsrShort()) {  // heap full, try again after some frees
+      OS_Sleep(1);
+      Heap_IsrRefill();
+    }
+  }
+}
+
+//******** OS_AddIsrBuffers ***************
+// keep heap buffers of one size ready for interrupt handlers
+// Inputs: bytes in each buffer, number of buffers to keep ready
+// Outputs: 1 if successful, 0 if these buffers can not be added
+int OS_AddIsrBuffers(uint32_t bytes, uint32_t depth) {
+  static int refilling;  // RefillThread started
+  if (Heap_IsrPool(bytes, depth)) return 0;
+  Heap_IsrRefill();  // ready before the interrupts are enabled
+  if (!refilling) {
+    OS_InitSemaphore(&RefillNeeded, 0);
+    Heap_IsrNotify(&RefillSignal);
+    refilling = AddThread(&RefillThread, 128, REFILLPRIORITY, 0, 0, 0);
+    if (!refilling) return 0;
+  }
+  return 1;
+}
 
 //******** OS_AddProcess ***************
 // add a process with foregound thread to the scheduler
@@ -137,24 +652,156 @@ int OS_AddThread(void (*task)(void), uint32_t stackSize, uint32_t priority) {
 //         number of bytes allocated for its stack
 //         priority (0 is highest)
 // Outputs: 1 if successful, 0 if this process can not be added
-// This function will be needed for Lab 5
-// In Labs 2-4, this function can be ignored
+// If text lies in an arena (see Arena_Create) the process takes it over:
+// thread stacks and Heap_Malloc calls of the process are served from it and
+// the whole arena is destroyed when the last thread of the process dies.
+// Otherwise text and data must come from Heap_Malloc and are freed then.
 int OS_AddProcess(void (*entry)(void), void *text, void *data,
                   unsigned long stackSize, unsigned long priority) {
-  // put Lab 5 solution here
+  pcbType *p;
+  int added;
+  long sr = StartCritical();
+  Reap();
+  p = Pool_Alloc(PcbPool);
+  if (p == 0) {
+    EndCritical(sr);
+    return 0;  // no free PCB
+  }
+  p->arena = Arena_Of(text);
+  p->text = text;
+  p->data = data;
+  p->threads = 0;
+  added = AddThread(entry, stackSize, priority, 0, 0, p);
+  if (!added) Pool_Free(PcbPool, p);  // the caller still owns the segments
+  EndCritical(sr);
+  return added;
+}
 
-  return 0;  // replace this line with Lab 5 solution
+// ******** OS_SVC ************
+// dispatch a system call made by a process with SVC #number, see
+// SVC_Handler in osasm.s
+// Inputs:  number encoded in the SVC instruction
+//          exception frame, R0-R3 of the caller in frame[0..3]
+// Outputs: value returned to the caller in R0
+uint32_t OS_SVC(uint32_t number, uint32_t *frame) {
+  arena_t *arena;
+  switch (number) {
+    case 0:
+      return OS_Id();
+    case 1:
+      Kill();  // PendSV switches away once the SVC returns
+      return 0;
+    case 2:
+      OS_Sleep(frame[0]);
+      return 0;
+    case 3:
+      return OS_Time();
+    case 4:
+      return OS_AddThread((void (*)(void))frame[0], frame[1], frame[2]);
+    case 5:  // Heap_Malloc, in the arena of the process if it has one
+      if (RunPt->process && RunPt->process->arena) {
+        return (uint32_t)Arena_Malloc(RunPt->process->arena, frame[0]);
+      }
+      return (uint32_t)Heap_Malloc(frame[0]);
+    case 6:  // Heap_Free
+      arena = Arena_Of((void *)frame[0]);
+      if (arena) return Arena_Free(arena, (void *)frame[0]);
+      return Heap_Free((void *)frame[0]);
+  }
+  return 0;
 }
 
 //******** OS_Id ***************
 // returns the thread ID for the currently running thread
 // Inputs: none
 // Outputs: Thread ID, number greater than zero
-uint32_t OS_Id(void) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+uint32_t OS_Id(void) { return RunPt->id; };
+
+#define MAXPERIODIC 4  // Timer1A, Timer2A, Timer3A and Timer5A
+// periodic threads, each released by the timeout of its own timer
+struct periodic {
+  void (*task)(void);
+  uint32_t period;       // release interval in 12.5ns units
+  uint32_t nextRelease;  // OS_Time of the next expected timeout
+  uint32_t releases;     // number of times task ran
+  uint32_t missed;       // releases lost because the ISR was held off
+  uint32_t overruns;     // runs that finished after the next release
+  uint32_t maxExec;      // longest run of task, 12.5ns units
+  uint32_t maxLateness;  // longest delay from release to start of task
 };
+static struct periodic Periodic[MAXPERIODIC];
+static uint32_t NumPeriodic;
+static void (*OverloadHandler)(uint32_t index);
+static void PeriodicDispatch(uint32_t index);
+
+// ******** PeriodicTimerInit ************
+// start the timer of a periodic thread slot in 32-bit periodic mode
+// Inputs: slot 0 to MAXPERIODIC-1, period in 12.5ns units, NVIC priority
+static void PeriodicTimerInit(uint32_t slot, uint32_t period,
+                              uint32_t priority) {
+  switch (slot) {
+    case 0:
+      SYSCTL_RCGCTIMER_R |= 0x02;  // activate TIMER1
+      while ((SYSCTL_PRTIMER_R & 0x02) == 0) {
+      };
+      TIMER1_CTL_R = 0;             // disable TIMER1A during setup
+      TIMER1_CFG_R = 0;             // 32-bit mode
+      TIMER1_TAMR_R = 0x00000002;   // periodic mode, down-count
+      TIMER1_TAILR_R = period - 1;  // reload value
+      TIMER1_TAPR_R = 0;            // bus clock resolution
+      TIMER1_ICR_R = 0x00000001;    // clear TIMER1A timeout flag
+      TIMER1_IMR_R = 0x00000001;    // arm timeout interrupt
+      NVIC_PRI5_R = (NVIC_PRI5_R & 0xFFFF00FF) | (priority << 13);
+      NVIC_EN0_R = 1 << 21;       // enable IRQ 21 in NVIC
+      TIMER1_CTL_R = 0x00000001;  // enable TIMER1A
+      break;
+    case 1:
+      SYSCTL_RCGCTIMER_R |= 0x04;  // activate TIMER2
+      while ((SYSCTL_PRTIMER_R & 0x04) == 0) {
+      };
+      TIMER2_CTL_R = 0;
+      TIMER2_CFG_R = 0;
+      TIMER2_TAMR_R = 0x00000002;
+      TIMER2_TAILR_R = period - 1;
+      TIMER2_TAPR_R = 0;
+      TIMER2_ICR_R = 0x00000001;
+      TIMER2_IMR_R = 0x00000001;
+      NVIC_PRI5_R = (NVIC_PRI5_R & 0x00FFFFFF) | (priority << 29);
+      NVIC_EN0_R = 1 << 23;  // enable IRQ 23 in NVIC
+      TIMER2_CTL_R = 0x00000001;
+      break;
+    case 2:
+      SYSCTL_RCGCTIMER_R |= 0x08;  // activate TIMER3
+      while ((SYSCTL_PRTIMER_R & 0x08) == 0) {
+      };
+      TIMER3_CTL_R = 0;
+      TIMER3_CFG_R = 0;
+      TIMER3_TAMR_R = 0x00000002;
+      TIMER3_TAILR_R = period - 1;
+      TIMER3_TAPR_R = 0;
+      TIMER3_ICR_R = 0x00000001;
+      TIMER3_IMR_R = 0x00000001;
+      NVIC_PRI8_R = (NVIC_PRI8_R & 0x00FFFFFF) | (priority << 29);
+      NVIC_EN1_R = 1 << (35 - 32);  // enable IRQ 35 in NVIC
+      TIMER3_CTL_R = 0x00000001;
+      break;
+    default:
+      SYSCTL_RCGCTIMER_R |= 0x20;  // activate TIMER5
+      while ((SYSCTL_PRTIMER_R & 0x20) == 0) {
+      };
+      TIMER5_CTL_R = 0;
+      TIMER5_CFG_R = 0;
+      TIMER5_TAMR_R = 0x00000002;
+      TIMER5_TAILR_R = period - 1;
+      TIMER5_TAPR_R = 0;
+      TIMER5_ICR_R = 0x00000001;
+      TIMER5_IMR_R = 0x00000001;
+      NVIC_PRI23_R = (NVIC_PRI23_R & 0xFFFFFF00) | (priority << 5);
+      NVIC_EN2_R = 1 << 28;  // enable IRQ 92 in NVIC
+      TIMER5_CTL_R = 0x00000001;
+      break;
+  }
+}
 
 //******** OS_AddPeriodicThread ***************
 // add a background periodic task
@@ -175,17 +822,173 @@ uint32_t OS_Id(void) {
 // In lab 3, there will be up to four background threads, and this priority
 // field
 //           determines the relative priority of these four threads
+// Each release is checked against its deadline (the next release); missed
+// releases and overruns are counted, see OS_GetPeriodicStats
 int OS_AddPeriodicThread(void (*task)(void), uint32_t period,
                          uint32_t priority) {
-  // put Lab 2 (and beyond) solution here
+  struct periodic *p;
+  long sr;
+  if (period == 0 || priority > 5) return 0;
+  sr = StartCritical();
+  if (NumPeriodic == MAXPERIODIC) {
+    EndCritical(sr);
+    return 0;
+  }
+  p = &Periodic[NumPeriodic];
+  p->task = task;
+  p->period = period;
+  p->releases = 0;
+  p->missed = 0;
+  p->overruns = 0;
+  p->maxExec = 0;
+  p->maxLateness = 0;
+  p->nextRelease = OS_Time() + period;  // timer starts after this read
+  PeriodicTimerInit(NumPeriodic, period, priority);
+  NumPeriodic++;
+  EndCritical(sr);
+  return 1;
+}
 
-  return 0;  // replace this line with solution
-};
+// ******** PeriodicDispatch ************
+// run one release of a periodic thread and check its deadline, which is the
+// next release; called from the timer ISR of the slot
+static void PeriodicDispatch(uint32_t index) {
+  struct periodic *p = &Periodic[index];
+  uint32_t start = OS_Time();
+  uint32_t lateness = OS_TimeDifference(p->nextRelease, start);
+  uint32_t exec;
+  int overload = 0;
+  if ((int32_t)lateness < 0) lateness = 0;
+  if (lateness >= p->period) {  // timeouts merged while the ISR was held off
+    p->missed += lateness / p->period;
+    p->nextRelease += (lateness / p->period) * p->period;
+    lateness = lateness % p->period;
+    overload = 1;
+  }
+  p->nextRelease += p->period;
+  p->releases++;
+  if (lateness > p->maxLateness) p->maxLateness = lateness;
+  p->task();
+  exec = OS_TimeDifference(start, OS_Time());
+  if (exec > p->maxExec) p->maxExec = exec;
+  if (lateness + exec > p->period) {  // still running at the next release
+    p->overruns++;
+    overload = 1;
+  }
+  if (overload && OverloadHandler) OverloadHandler(index);
+}
+
+void Timer1A_Handler(void) {
+  TIMER1_ICR_R = TIMER_ICR_TATOCINT;  // acknowledge TIMER1A timeout
+  PeriodicDispatch(0);
+}
+
+void Timer2A_Handler(void) {
+  TIMER2_ICR_R = TIMER_ICR_TATOCINT;  // acknowledge TIMER2A timeout
+  PeriodicDispatch(1);
+}
+
+void Timer3A_Handler(void) {
+  TIMER3_ICR_R = TIMER_ICR_TATOCINT;  // acknowledge TIMER3A timeout
+  PeriodicDispatch(2);
+}
+
+void Timer5A_Handler(void) {
+  TIMER5_ICR_R = TIMER_ICR_TATOCINT;  // acknowledge TIMER5A timeout
+  PeriodicDispatch(3);
+}
+
+//******** OS_SetOverloadHandler ***************
+// install a function to call when a periodic thread misses a release or
+// overruns its period
+// Inputs: handler, given the index of the periodic thread, 0 to remove
+// Outputs: none
+// The handler runs inside the timer ISR right after the late task returns,
+// so it must also run to completion (e.g. shed load, signal a semaphore)
+void OS_SetOverloadHandler(void (*handler)(uint32_t index)) {
+  OverloadHandler = handler;
+}
+
+//******** OS_GetPeriodicStats ***************
+// report the deadline monitoring of a periodic thread
+// Inputs: index of the periodic thread, in order of OS_AddPeriodicThread
+//         reference to a periodic_stats_t to fill in
+// Outputs: 0 if successful, 1 if there is no such periodic thread
+int OS_GetPeriodicStats(uint32_t index, periodic_stats_t *stats) {
+  long sr;
+  if (index >= NumPeriodic) return 1;
+  sr = StartCritical();
+  stats->period = Periodic[index].period;
+  stats->releases = Periodic[index].releases;
+  stats->missed = Periodic[index].missed;
+  stats->overruns = Periodic[index].overruns;
+  stats->maxExec = Periodic[index].maxExec;
+  stats->maxLateness = Periodic[index].maxLateness;
+  EndCritical(sr);
+  return 0;
+}
+
+//******** OS_ClearPeriodicStats ***************
+// restart the deadline monitoring counts of all periodic threads
+// Inputs: none
+// Outputs: none
+void OS_ClearPeriodicStats(void) {
+  uint32_t i;
+  long sr = StartCritical();
+  for (i = 0; i < NumPeriodic; i++) {
+    Periodic[i].releases = 0;
+    Periodic[i].missed = 0;
+    Periodic[i].overruns = 0;
+    Periodic[i].maxExec = 0;
+    Periodic[i].maxLateness = 0;
+  }
+  EndCritical(sr);
+}
+
+#define SW1PIN 0x10  // PF4
+#define SW2PIN 0x01  // PF0
+#define DEBOUNCE (10 * TIME_1MS)  // edges this close to a push are bounces
+static void (*SW1Task)(void);
+static void (*SW2Task)(void);
+static uint32_t SwitchPriority = 7;  // NVIC priority of GPIO Port F
+static uint32_t Pushed[2];           // OS_Time of the last push of each
+
+// ******** SwitchInit ************
+// arm a falling edge interrupt on a LaunchPad switch, set up by
+// LaunchPad_Init with its pull-up; both switches share the Port F
+// interrupt, which runs at the higher of their priorities
+// Inputs: pin mask, priority 0 to 5
+static void SwitchInit(uint32_t pin, uint32_t priority) {
+  long sr = StartCritical();
+  if (priority < SwitchPriority) SwitchPriority = priority;
+  GPIO_PORTF_IS_R &= ~pin;   // edge-sensitive
+  GPIO_PORTF_IBE_R &= ~pin;  // not both edges
+  GPIO_PORTF_IEV_R &= ~pin;  // falling edge, the switches pull low
+  GPIO_PORTF_ICR_R = pin;    // clear an old edge
+  GPIO_PORTF_IM_R |= pin;    // arm the interrupt
+  NVIC_PRI7_R = (NVIC_PRI7_R & 0xFF00FFFF) | (SwitchPriority << 21);
+  NVIC_EN0_R = 1 << 30;  // enable IRQ 30 in NVIC
+  EndCritical(sr);
+}
+
+// ******** Push ************
+// run the task of a switch unless the edge is a bounce of the last push
+static void Push(int i, void (*task)(void)) {
+  uint32_t now = OS_Time();
+  if (OS_TimeDifference(Pushed[i], now) < DEBOUNCE) return;
+  Pushed[i] = now;
+  if (task) task();
+}
 
 /*----------------------------------------------------------------------------
   PF1 Interrupt Handler
  *----------------------------------------------------------------------------*/
-void GPIOPortF_Handler(void) {}
+void GPIOPortF_Handler(void) {
+  uint32_t edges = GPIO_PORTF_RIS_R & (SW1PIN | SW2PIN);
+  GPIO_PORTF_ICR_R = edges;  // acknowledge
+  if (edges & SW1PIN) Push(0, SW1Task);
+  if (edges & SW2PIN) Push(1, SW2Task);
+}
 
 //******** OS_AddSW1Task ***************
 // add a background task to run whenever the SW1 (PF4) button is pushed
@@ -195,6 +998,7 @@ void GPIOPortF_Handler(void) {}
 // It is assumed that the user task will run to completion and return
 // This task can not spin, block, loop, sleep, or kill
 // This task can call OS_Signal  OS_bSignal   OS_AddThread
+// Threads it starts should get a budget, see OS_AddBudgetThread
 // This task does not have a Thread ID
 // In labs 2 and 3, this command will be called 0 or 1 times
 // In lab 2, the priority field can be ignored
@@ -202,9 +1006,10 @@ void GPIOPortF_Handler(void) {}
 // field
 //           determines the relative priority of these four threads
 int OS_AddSW1Task(void (*task)(void), uint32_t priority) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+  if (priority > 5) return 0;
+  SW1Task = task;
+  SwitchInit(SW1PIN, priority);
+  return 1;
 };
 
 //******** OS_AddSW2Task ***************
@@ -215,6 +1020,7 @@ int OS_AddSW1Task(void (*task)(void), uint32_t priority) {
 // It is assumed user task will run to completion and return
 // This task can not spin block loop sleep or kill
 // This task can call issue OS_Signal, it can call OS_AddThread
+// Threads it starts should get a budget, see OS_AddBudgetThread
 // This task does not have a Thread ID
 // In lab 2, this function can be ignored
 // In lab 3, this command will be called will be called 0 or 1 times
@@ -222,9 +1028,10 @@ int OS_AddSW1Task(void (*task)(void), uint32_t priority) {
 // field
 //           determines the relative priority of these four threads
 int OS_AddSW2Task(void (*task)(void), uint32_t priority) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+  if (priority > 5) return 0;
+  SW2Task = task;
+  SwitchInit(SW2PIN, priority);
+  return 1;
 };
 
 // ******** OS_Sleep ************
@@ -233,18 +1040,32 @@ int OS_AddSW2Task(void (*task)(void), uint32_t priority) {
 // output: none
 // You are free to select the time resolution for this function
 // OS_Sleep(0) implements cooperative multitasking
-void OS_Sleep(uint32_t sleepTime){
-    // put Lab 2 (and beyond) solution here
-
+void OS_Sleep(uint32_t sleepTime) {
+  long sr = StartCritical();
+  RunPt->wakeTime = SchedTime + (TimeSlice - NVIC_ST_CURRENT_R) +
+                    sleepTime * TIME_1MS;
+  RunPt->sleeping = 1;
+  OS_Suspend();
+  EndCritical(sr);
 };
 
+// ******** Kill ************
+// mark the running thread dead and pend the switch away from it
+// called with interrupts disabled or from SVC_Handler
+static void Kill(void) {
+  Reap();
+  RunPt->id = 0;
+  Dying = RunPt;  // TCB reused only after PendSV has switched away
+  OS_Suspend();
+}
+
 // ******** OS_Kill ************
 // kill the currently running thread, release its TCB and stack
 // input:  none
 // output: none
 void OS_Kill(void) {
-  // put Lab 2 (and beyond) solution here
-
+  DisableInterrupts();
+  Kill();
   EnableInterrupts();  // end of atomic section
   for (;;) {
   };  // can not return
@@ -257,11 +1078,24 @@ void OS_Kill(void) {
 // Same function as OS_Sleep(0)
 // input:  none
 // output: none
-void OS_Suspend(void){
-    // put Lab 2 (and beyond) solution here
-
+void OS_Suspend(void) {
+  long sr = StartCritical();
+  // charge the used part of the slice and give the next thread a full one
+  Charge(TimeSlice - NVIC_ST_CURRENT_R);
+  NVIC_ST_CURRENT_R = 0;
+  NVIC_INT_CTRL_R = 0x02000000;  // clear a SysTick that is already pending
+  Scheduler();
+  ContextSwitch();
+  EndCritical(sr);
 };
 
+#define MAXFIFO 256  // largest OS_Fifo_Init size, a power of 2
+static uint32_t Fifo[MAXFIFO];
+static uint32_t FifoSize;  // a power of 2
+static uint32_t PutI;      // OS_Fifo_Put count, indexes modulo FifoSize
+static uint32_t GetI;      // OS_Fifo_Get count
+static Sema4Type FifoData;  // samples not yet taken by OS_Fifo_Get
+
 // ******** OS_Fifo_Init ************
 // Initialize the Fifo to be empty
 // Inputs: size
@@ -271,9 +1105,14 @@ void OS_Suspend(void){
 // In Lab 3, you can put whatever restrictions you want on size
 //    e.g., 4 to 64 elements
 //    e.g., must be a power of 2,4,8,16,32,64,128
-void OS_Fifo_Init(uint32_t size){
-    // put Lab 2 (and beyond) solution here
-
+// Here size is rounded down to a power of 2, 1 to 256
+void OS_Fifo_Init(uint32_t size) {
+  long sr = StartCritical();
+  FifoSize = MAXFIFO;
+  while ((FifoSize > 1) && (FifoSize > size)) FifoSize /= 2;
+  PutI = GetI = 0;
+  OS_InitSemaphore(&FifoData, 0);
+  EndCritical(sr);
 };
 
 // ******** OS_Fifo_Put ************
@@ -284,10 +1123,13 @@ void OS_Fifo_Init(uint32_t size){
 //          false if data not saved, because it was full
 // Since this is called by interrupt handlers
 //  this function can not disable or enable interrupts
+// (OS_Signal only saves and restores the interrupt state)
 int OS_Fifo_Put(uint32_t data) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+  if ((PutI - GetI) == FifoSize) return 0;  // full
+  Fifo[PutI & (FifoSize - 1)] = data;
+  PutI++;
+  OS_Signal(&FifoData);
+  return 1;
 };
 
 // ******** OS_Fifo_Get ************
@@ -296,9 +1138,11 @@ int OS_Fifo_Put(uint32_t data) {
 // Inputs:  none
 // Outputs: data
 uint32_t OS_Fifo_Get(void) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+  uint32_t data;
+  OS_Wait(&FifoData);  // blocks while empty
+  data = Fifo[GetI & (FifoSize - 1)];
+  GetI++;  // a single consumer, OS_Fifo_Put only reads it
+  return data;
 };
 
 // ******** OS_Fifo_Size ************
@@ -308,20 +1152,19 @@ uint32_t OS_Fifo_Get(void) {
 //          greater than zero if a call to OS_Fifo_Get will return right away
 //          zero or less than zero if the Fifo is empty
 //          zero or less than zero if a call to OS_Fifo_Get will spin or block
-int32_t OS_Fifo_Size(void) {
-  // put Lab 2 (and beyond) solution here
+int32_t OS_Fifo_Size(void) { return PutI - GetI; };
 
-  return 0;  // replace this line with solution
-};
+static uint32_t Mail;       // the MailBox
+static Sema4Type BoxFree;   // 1 when Mail may be overwritten
+static Sema4Type BoxValid;  // 1 when Mail holds data not yet received
 
 // ******** OS_MailBox_Init ************
 // Initialize communication channel
 // Inputs:  none
 // Outputs: none
-void OS_MailBox_Init(void){
-    // put Lab 2 (and beyond) solution here
-
-    // put solution here
+void OS_MailBox_Init(void) {
+  OS_InitSemaphore(&BoxFree, 1);
+  OS_InitSemaphore(&BoxValid, 0);
 };
 
 // ******** OS_MailBox_Send ************
@@ -330,10 +1173,10 @@ void OS_MailBox_Init(void){
 // Outputs: none
 // This function will be called from a foreground thread
 // It will spin/block if the MailBox contains data not yet received
-void OS_MailBox_Send(uint32_t data){
-    // put Lab 2 (and beyond) solution here
-    // put solution here
-
+void OS_MailBox_Send(uint32_t data) {
+  OS_bWait(&BoxFree);
+  Mail = data;
+  OS_bSignal(&BoxValid);
 };
 
 // ******** OS_MailBox_Recv ************
@@ -343,71 +1186,87 @@ void OS_MailBox_Send(uint32_t data){
 // This function will be called from a foreground thread
 // It will spin/block if the MailBox is empty
 uint32_t OS_MailBox_Recv(void) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+  uint32_t data;
+  OS_bWait(&BoxValid);
+  data = Mail;
+  OS_bSignal(&BoxFree);
+  return data;
 };
 
+// ******** OS_ClockInit ************
+// start WTimer0 as a free-running 64-bit up counter at the bus clock
+// no interrupts are used, the count never wraps (7000+ years at 80 MHz)
+// Inputs:  none
+// Outputs: none
+static void OS_ClockInit(void) {
+  if (SYSCTL_RCGCWTIMER_R & 0x01) return;  // already running
+  SYSCTL_RCGCWTIMER_R |= 0x01;             // activate WTIMER0
+  while ((SYSCTL_PRWTIMER_R & 0x01) == 0) {
+  };                           // allow time for clock to stabilize
+  WTIMER0_CTL_R = 0x00000000;  // disable WTIMER0A during setup
+  WTIMER0_CFG_R = 0x00000000;  // configure for 64-bit mode
+  WTIMER0_TAMR_R = TIMER_TAMR_TAMR_PERIOD + TIMER_TAMR_TACDIR;  // count up
+  WTIMER0_TAILR_R = 0xFFFFFFFF;    // bits 31:0 of the reload value
+  WTIMER0_TBILR_R = 0xFFFFFFFF;    // bits 63:32
+  WTIMER0_TAPR_R = 0;              // bus clock resolution
+  WTIMER0_IMR_R = 0x00000000;      // no interrupts
+  WTIMER0_CTL_R = TIMER_CTL_TAEN;  // enable WTIMER0
+}
+
+// ******** OS_Time64 ************
+// return the monotonic system time since OS_Init
+// Inputs:  none
+// Outputs: time in 12.5ns units, 64 bits
+// Reads the hardware counter without disabling interrupts: the upper half is
+// read before and after the lower half, and the pair is read again if a
+// carry happened in between
+uint64_t OS_Time64(void) {
+  uint32_t hi, lo;
+  do {
+    hi = WTIMER0_TBV_R;
+    lo = WTIMER0_TAV_R;
+  } while (hi != WTIMER0_TBV_R);
+  return ((uint64_t)hi << 32) | lo;
+}
+
 // ******** OS_Time ************
 // return the system time
 // Inputs:  none
 // Outputs: time in 12.5ns units, 0 to 4294967295
-// The time resolution should be less than or equal to 1us, and the precision 32
-// bits It is ok to change the resolution and precision of this function as long
-// as
-//   this function and OS_TimeDifference have the same resolution and precision
-uint32_t OS_Time(void) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
-};
+// This is the lower 32 bits of OS_Time64, it wraps every 53.7 seconds
+uint32_t OS_Time(void) { return WTIMER0_TAV_R; };
 
 // ******** OS_TimeDifference ************
 // Calculates difference between two times
 // Inputs:  two times measured with OS_Time
 // Outputs: time difference in 12.5ns units
-// The time resolution should be less than or equal to 1us, and the precision at
-// least 12 bits It is ok to change the resolution and precision of this
-// function as long as
-//   this function and OS_Time have the same resolution and precision
+// Correct across one wrap of OS_Time, so for intervals up to 53.7 seconds;
+// use OS_Time64 to measure longer intervals
 uint32_t OS_TimeDifference(uint32_t start, uint32_t stop) {
-  // put Lab 2 (and beyond) solution here
-
-  return 0;  // replace this line with solution
+  return stop - start;
 };
 
+// Value of OS_Time64 / 1 ms at the last OS_ClearMsTime.
+// 32 bits so readers never see it half written.
+static uint32_t MsTimeBase;
+
 // ******** OS_ClearMsTime ************
-// sets the system time to zero (solve for Lab 1), and start a periodic
-// interrupt Inputs:  none Outputs: none You are free to change how this works
+// sets the system time to zero (from Lab 1)
+// Inputs:  none
+// Outputs: none
+// Does not touch the hardware counter, it only moves the origin of OS_MsTime
 void OS_ClearMsTime(void) {
-  // put Lab 1 solution here
-
-  // TODO:
-  // disable the interrupts here
-  Curr_time = 0;
-
-  // reenable the interrupts
+  OS_ClockInit();  // Lab 1 does not call OS_Init
+  MsTimeBase = (uint32_t)(OS_Time64() / TIME_1MS);
 };
 
-/* ******** timer_task *********
- * Increments the timer on timer interrupts
- * defining function here as the curr time variable is defined here
- * expected to run at 1KHz frequency
- */
-void OS_timer_task(void) { Curr_time++; }
-
 // ******** OS_MsTime ************
-// reads the current time in msec (solve for Lab 1)
+// reads the current time in msec (from Lab 1)
 // Inputs:  none
-// Outputs: time in ms units
-// You are free to select the time resolution for this function
-// For Labs 2 and beyond, it is ok to make the resolution to match the first
-// call to OS_AddPeriodicThread
+// Outputs: time in ms units since the last OS_ClearMsTime
+// Computed from OS_Time64, so no periodic interrupt is needed
 uint32_t OS_MsTime(void) {
-  // put Lab 1 solution here
-
-  return Curr_time;
-  // return 0;  // replace this line with solution
+  return (uint32_t)(OS_Time64() / TIME_1MS) - MsTimeBase;
 };
 
 //******** OS_Launch ***************
@@ -418,21 +1277,27 @@ uint32_t OS_MsTime(void) {
 // In Lab 2, you can ignore the theTimeSlice field
 // In Lab 3, you should implement the user-defined TimeSlice field
 // It is ok to limit the range of theTimeSlice to match the 24-bit SysTick
-void OS_Launch(uint32_t theTimeSlice){
-    // put Lab 2 (and beyond) solution here
-
+void OS_Launch(uint32_t theTimeSlice) {
+  SchedTime = 0;
+  RunPt = &tcbs[MAXTHREADS - 1];  // so the search starts at tcbs[0]
+  Scheduler();                    // pick the first thread to run
+  RunPt = NextPt;
+  SysTick_Init(theTimeSlice);
+  StartOS();  // start on the first task, enables interrupts
 };
 
 //************** I/O Redirection ***************
 // redirect terminal I/O to UART or file (Lab 4)
 
 int StreamToDevice = 0;  // 0=UART, 1=stream to file (Lab 4)
+static int StreamFile;   // descriptor of the file, see eFile_Open
 
 int fputc(int ch, FILE *f) {
-  if (StreamToDevice == 1) {   // Lab 4
-    if (eFile_Write(ch)) {     // close file on error
-      OS_EndRedirectToFile();  // cannot write to file
-      return 1;                // failure
+  char data = ch;
+  if (StreamToDevice == 1) {                     // Lab 4
+    if (eFile_WriteBuf(StreamFile, &data, 1)) {  // close file on error
+      OS_EndRedirectToFile();                    // cannot write to file
+      return 1;                                  // failure
     }
     return 0;  // success writing
   }
@@ -449,15 +1314,16 @@ int fgetc(FILE *f) {
 }
 
 int OS_RedirectToFile(const char *name) {  // Lab 4
-  eFile_Create(name);               // ignore error if file already exists
-  if (eFile_WOpen(name)) return 1;  // cannot open file
+  eFile_Create(name);  // ignore error if file already exists
+  StreamFile = eFile_Open(name, EFILE_WRITE);  // eFile_WOpen stays free
+  if (StreamFile < 0) return 1;                // cannot open file
   StreamToDevice = 1;
   return 0;
 }
 
 int OS_EndRedirectToFile(void) {  // Lab 4
   StreamToDevice = 0;
-  if (eFile_WClose()) return 1;  // cannot close file
+  if (eFile_Close(StreamFile)) return 1;  // cannot close file
   return 0;
 }
 
@@ -29,7 +29,7 @@
  */
 struct Sema4 {
   int32_t Value;  // >0 means free, otherwise means busy
-  // add other components here, if necessary to implement blocking
+  // the threads blocked on it are marked in their TCBs, see OS.c
 };
 typedef struct Sema4 Sema4Type;
 
@@ -79,6 +79,12 @@ void OS_bWait(Sema4Type *semaPt);
 // output: none
 void OS_bSignal(Sema4Type *semaPt);
 
+// ******** OS_bTryWait ************
+// take a binary semaphore if it is free, never block, e.g. in idle work
+// input:  pointer to a binary semaphore
+// output: 1 if taken (release it with OS_bSignal), 0 if it is busy
+int OS_bTryWait(Sema4Type *semaPt);
+
 //******** OS_AddThread ***************
 // add a foregound thread to the scheduler
 // Inputs: pointer to a void/void foreground task
@@ -90,6 +96,96 @@ void OS_bSignal(Sema4Type *semaPt);
 // In Lab 3, you can ignore the stackSize fields
 int OS_AddThread(void (*task)(void), uint32_t stackSize, uint32_t priority);
 
+/**
+ * \brief CPU budget state of a thread, see OS_GetBudgetStats
+ */
+typedef struct budget_stats {
+  uint32_t budget;      // cycles (12.5ns) allowed per period, 0 if unlimited
+  uint32_t period;      // replenishment period in 12.5ns units
+  uint32_t remaining;   // cycles left in the current period
+  uint32_t throttled;   // 1 if waiting for the next replenishment
+  uint32_t overruns;    // number of times the budget was exhausted
+  uint32_t overrunMax;  // largest overshoot past the budget in cycles
+} budget_stats_t;
+
+//******** OS_AddBudgetThread ***************
+// add a foreground thread whose CPU time is limited to budget cycles in
+// every period, intended for aperiodic work started by SW1/SW2 tasks or
+// the interpreter so it cannot starve lower priority threads
+// Inputs: pointer to a void/void foreground task
+//         number of bytes allocated for its stack
+//         priority, 0 is highest, 5 is the lowest
+//         budget in 12.5ns units, 0 means unlimited (same as OS_AddThread)
+//         replenishment period in 12.5ns units, at least budget
+// Outputs: 1 if successful, 0 if this thread can not be added
+// A thread that exhausts its budget is throttled until the next
+// replenishment; accounting happens at thread switches, so it may overshoot
+// by up to one time slice
+int OS_AddBudgetThread(void (*task)(void), uint32_t stackSize,
+                       uint32_t priority, uint32_t budget, uint32_t period);
+
+/**
+ * \brief Default budget of the threads started by the SW1/SW2 tasks and of
+ * the interpreter: 2 ms of CPU time every 10 ms, at most 20%
+ */
+#define APERIODIC_BUDGET (2 * TIME_1MS)
+#define APERIODIC_PERIOD (10 * TIME_1MS)
+
+//******** OS_GetBudgetStats ***************
+// report the CPU budget state and overrun count of a thread
+// Inputs: thread ID (see OS_Id)
+//         reference to a budget_stats_t to fill in
+// Outputs: 0 if successful, 1 if there is no such thread
+int OS_GetBudgetStats(uint32_t id, budget_stats_t *stats);
+
+//******** OS_AddIdleWork ***************
+// register low priority maintenance work (flushing dirty disk sectors, heap
+// checks, trace dumping, statistics) that runs only when nothing else is
+// ready
+// Inputs: work function, called repeatedly with its budget; it must do at
+//           most budget cycles (12.5ns) of work per call and return nonzero
+//           while more work is pending, 0 when caught up
+//         budget in 12.5ns units for one call
+// Outputs: 1 if successful, 0 if this work can not be added
+int OS_AddIdleWork(int (*work)(uint32_t budget), uint32_t budget);
+
+//******** OS_RunIdleWork ***************
+// call each registered idle work function once
+// Inputs: none
+// Outputs: nonzero if some work is still pending, 0 if the caller may sleep
+// Call this from the lowest priority (idle) thread, for example
+//   if (!OS_RunIdleWork()) WaitForInterrupt();
+int OS_RunIdleWork(void);
+
+/**
+ * \brief Budget keeping of an idle work function, see OS_GetIdleWorkStats
+ */
+typedef struct idle_work_stats {
+  uint32_t budget;     // cycles (12.5ns) allowed per call
+  uint32_t runs;       // number of calls
+  uint32_t maxCycles;  // longest call measured
+  uint32_t overruns;   // calls that took longer than budget
+} idle_work_stats_t;
+
+//******** OS_GetIdleWorkStats ***************
+// report how an idle work function kept to its budget
+// Inputs: index of the work function, in order of OS_AddIdleWork calls
+//         reference to an idle_work_stats_t to fill in
+// Outputs: 0 if successful, 1 if there is no such work function
+int OS_GetIdleWorkStats(uint32_t index, idle_work_stats_t *stats);
+
+//******** OS_AddIsrBuffers ***************
+// keep heap buffers of one size ready for interrupt handlers, which take
+// them with Heap_IsrMalloc and hand them to threads without copying
+// Inputs: bytes in each buffer
+//         number of buffers to keep ready, enough for the interrupts that
+//           can come before the refill thread gets to run
+// Outputs: 1 if successful, 0 if these buffers can not be added
+// The first call starts a low priority kernel thread that refills the
+// buffers when Heap_IsrMalloc signals it; the heap must be initialized
+// (Heap_Init)
+int OS_AddIsrBuffers(uint32_t bytes, uint32_t depth);
+
 //******** OS_Id ***************
 // returns the thread ID for the currently running thread
 // Inputs: none
@@ -114,9 +210,45 @@ uint32_t OS_Id(void);
 // In lab 3, there will be up to four background threads, and this priority
 // field
 //           determines the relative priority of these four threads
+// Each release is checked against its deadline (the next release); missed
+// releases and overruns are counted, see OS_GetPeriodicStats
 int OS_AddPeriodicThread(void (*task)(void), uint32_t period,
                          uint32_t priority);
 
+/**
+ * \brief Deadline monitoring of a periodic thread, see OS_GetPeriodicStats
+ */
+typedef struct periodic_stats {
+  uint32_t period;       // release interval in 12.5ns units
+  uint32_t releases;     // number of times the task ran
+  uint32_t missed;       // releases lost because the timer ISR was held off
+  uint32_t overruns;     // runs that finished after the next release
+  uint32_t maxExec;      // longest run of the task, 12.5ns units
+  uint32_t maxLateness;  // longest delay from release to start of the task
+} periodic_stats_t;
+
+//******** OS_GetPeriodicStats ***************
+// report the deadline monitoring of a periodic thread
+// Inputs: index of the periodic thread, in order of OS_AddPeriodicThread
+//         reference to a periodic_stats_t to fill in
+// Outputs: 0 if successful, 1 if there is no such periodic thread
+int OS_GetPeriodicStats(uint32_t index, periodic_stats_t *stats);
+
+//******** OS_ClearPeriodicStats ***************
+// restart the deadline monitoring counts of all periodic threads
+// Inputs: none
+// Outputs: none
+void OS_ClearPeriodicStats(void);
+
+//******** OS_SetOverloadHandler ***************
+// install a function to call when a periodic thread misses a release or
+// overruns its period
+// Inputs: handler, given the index of the periodic thread, 0 to remove
+// Outputs: none
+// The handler runs inside the timer ISR right after the late task returns,
+// so it must also run to completion (e.g. shed load, signal a semaphore)
+void OS_SetOverloadHandler(void (*handler)(uint32_t index));
+
 //******** OS_AddSW1Task ***************
 // add a background task to run whenever the SW1 (PF4) button is pushed
 // Inputs: pointer to a void/void background function
@@ -237,40 +369,40 @@ void OS_MailBox_Send(uint32_t data);
 // It will spin/block if the MailBox is empty
 uint32_t OS_MailBox_Recv(void);
 
+// ******** OS_Time64 ************
+// return the monotonic system time
+// Inputs:  none
+// Outputs: time in 12.5ns units since OS_Init, 64 bits, never wraps
+// Derived from the free-running WTimer0, read without interrupts or locks
+uint64_t OS_Time64(void);
+
 // ******** OS_Time ************
 // return the system time
 // Inputs:  none
 // Outputs: time in 12.5ns units, 0 to 4294967295
-// The time resolution should be less than or equal to 1us, and the precision 32
-// bits It is ok to change the resolution and precision of this function as long
-// as
-//   this function and OS_TimeDifference have the same resolution and precision
+// Lower 32 bits of OS_Time64, wraps every 53.7 seconds
 uint32_t OS_Time(void);
 
 // ******** OS_TimeDifference ************
 // Calculates difference between two times
 // Inputs:  two times measured with OS_Time
 // Outputs: time difference in 12.5ns units
-// The time resolution should be less than or equal to 1us, and the precision at
-// least 12 bits It is ok to change the resolution and precision of this
-// function as long as
-//   this function and OS_Time have the same resolution and precision
+// Correct across a wrap of OS_Time for intervals up to 53.7 seconds,
+// use OS_Time64 for longer intervals
 uint32_t OS_TimeDifference(uint32_t start, uint32_t stop);
 
 // ******** OS_ClearMsTime ************
 // sets the system time to zero (from Lab 1)
 // Inputs:  none
 // Outputs: none
-// You are free to change how this works
+// Only moves the origin of OS_MsTime, OS_Time64 keeps counting
 void OS_ClearMsTime(void);
 
 // ******** OS_MsTime ************
 // reads the current time in msec (from Lab 1)
 // Inputs:  none
-// Outputs: time in ms units
-// You are free to select the time resolution for this function
-// It is ok to make the resolution to match the first call to
-// OS_AddPeriodicThread
+// Outputs: time in ms units since the last OS_ClearMsTime
+// Computed from OS_Time64, no periodic interrupt is needed
 uint32_t OS_MsTime(void);
 
 //******** OS_Launch ***************
@@ -316,11 +448,4 @@ int OS_RedirectToUART(void);
  */
 int OS_RedirectToST7735(void);
 
-/* ******** OS_timer_task *********
- * @Increments the timer on timer interrupts
- * @defining function here as the curr time variable is defined here
- * @expected to run at 1KHz frequency
- */
-void OS_timer_task(void) { return; }
-
 #endif
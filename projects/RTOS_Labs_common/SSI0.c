@@ -0,0 +1,75 @@
+// filename ************** SSI0.c *****************************
+// Pipelined SSI0 transfers shared by eDisk.c and ST7735.c
+// Sending a byte and then waiting for the byte it clocks in leaves the bus
+// idle while the CPU turns around; here up to FIFOSIZE bytes are in flight,
+// so the transmit FIFO never runs dry and the receive FIFO never overflows.
+
+#include "../RTOS_Labs_common/SSI0.h"
+
+#include <stdint.h>
+
+#include "../inc/tm4c123gh6pm.h"
+
+#define FIFOSIZE 8  // depth of the transmit and receive FIFOs
+
+// where the bytes to send come from
+#define BYTES 0      // tx is bytes, 0xFF if tx is NULL
+#define HALFWORDS 1  // tx is halfwords, most significant byte first
+#define FILL 2       // value, most significant byte first
+
+// exchange n bytes, keeping the FIFOs busy
+static void Pipe(uint8_t *rx, const void *tx, uint16_t value, uint32_t n,
+                 int mode) {
+  uint32_t sent = 0, received = 0;
+  uint8_t data;
+  while (SSI0_SR_R & SSI_SR_BSY) {
+  };  // wait until the last transfer is done
+  while (SSI0_SR_R & SSI_SR_RNE) {
+    data = SSI0_DR_R;  // bytes nobody read, they are not ours
+  }
+  while (received < n) {
+    if ((sent < n) && (sent - received < FIFOSIZE) &&
+        (SSI0_SR_R & SSI_SR_TNF)) {
+      if (mode == BYTES) {
+        data = tx ? ((const uint8_t *)tx)[sent] : 0xFF;
+      } else {
+        if (mode == HALFWORDS) value = ((const uint16_t *)tx)[sent / 2];
+        data = (sent & 1) ? value : value >> 8;
+      }
+      SSI0_DR_R = data;  // data out
+      sent++;
+    }
+    if (SSI0_SR_R & SSI_SR_RNE) {
+      data = SSI0_DR_R;  // data in
+      if (rx) rx[received] = data;
+      received++;
+    }
+  }
+}
+
+//******** SSI0_Transfer ***************
+// send n bytes and receive the n bytes clocked in
+// input: rx, where to put them, NULL to discard them
+//   tx, bytes to send, NULL to send 0xFF
+//   n, number of bytes
+// output: none
+// notes: returns when the bus is idle
+void SSI0_Transfer(uint8_t *rx, const uint8_t *tx, uint32_t n) {
+  Pipe(rx, tx, 0, n, BYTES);
+}
+
+//******** SSI0_Send16 ***************
+// send n halfwords, most significant byte first
+// input: tx, halfwords to send
+//   n, number of halfwords
+// output: none
+void SSI0_Send16(const uint16_t *tx, uint32_t n) {
+  Pipe(0, tx, 0, 2 * n, HALFWORDS);
+}
+
+//******** SSI0_Fill16 ***************
+// send one halfword n times, most significant byte first
+// input: value, to send
+//   n, number of times
+// output: none
+void SSI0_Fill16(uint16_t value, uint32_t n) { Pipe(0, 0, value, 2 * n, FILL); }
@@ -0,0 +1,54 @@
+/**
+ * @file      SSI0.h
+ * @brief     pipelined SSI0 transfers
+ * @details   Byte transfers for the two devices on SSI0, the SD card
+ * (eDisk.c) and the LCD (ST7735.c). Instead of sending a byte and waiting
+ * for it to come back, these keep the 8-deep transmit FIFO full and read
+ * the receive FIFO as it fills, so the bus runs at its line rate with no
+ * gaps between bytes. No DMA is needed. The caller selects the device
+ * (chip select, LCD data/command) and owns the port (LCDFree); SSI0 must
+ * be initialized, see SSI0_Init in eDisk.c and ST7735_InitR.
+ * @version   V1.0
+ * @author    Valvano
+ * @copyright Copyright 2020 by Jonathan W. Valvano, valvano@mail.utexas.edu,
+ * @warning   AS-IS
+ * @note      For more information see  http://users.ece.utexas.edu/~valvano/
+ * @date      Jan 12, 2020
+ ******************************************************************************/
+#ifndef __SSI0_H
+#define __SSI0_H 1
+
+#include <stdint.h>
+
+/**
+ * @details Send n bytes and receive the n bytes clocked in. Returns when
+ * the last byte has been received, so the bus is idle.
+ * @param  rx pointer to n bytes to receive, NULL to discard them
+ * @param  tx pointer to n bytes to send, NULL to send 0xFF
+ * @param  n number of bytes
+ * @return none
+ * @brief  Exchange bytes on SSI0
+ */
+void SSI0_Transfer(uint8_t *rx, const uint8_t *tx, uint32_t n);
+
+/**
+ * @details Send n 16-bit values, most significant byte first, e.g., a row
+ * of LCD pixels. Received bytes are discarded.
+ * @param  tx pointer to n values
+ * @param  n number of values
+ * @return none
+ * @brief  Send halfwords on SSI0
+ */
+void SSI0_Send16(const uint16_t *tx, uint32_t n);
+
+/**
+ * @details Send one 16-bit value n times, most significant byte first,
+ * e.g., to fill an LCD window with a color. Received bytes are discarded.
+ * @param  value to send
+ * @param  n number of times
+ * @return none
+ * @brief  Repeat a halfword on SSI0
+ */
+void SSI0_Fill16(uint16_t value, uint32_t n);
+
+#endif
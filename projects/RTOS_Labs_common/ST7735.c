@@ -117,6 +117,7 @@
 #include <stdio.h>
 
 #include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/SSI0.h"
 #include "../RTOS_Labs_common/eDisk.h"
 #include "../inc/tm4c123gh6pm.h"
 // these defines are in two places, here and in eDisk.c
@@ -837,6 +838,24 @@ void static pushColor(uint16_t color) {
   writedata((uint8_t)color);
 }
 
+// Send count pixels as data with the FIFO kept full (see SSI0.c): the
+// pixels of image, or count times color if image is NULL
+void static pushColors(const uint16_t *image, uint16_t color, int32_t count) {
+  if (count <= 0) return;
+  // wait until SSI0 not busy/transmit FIFO empty
+  while ((SSI0_SR_R & SSI_SR_BSY) == SSI_SR_BSY) {
+  };
+  SDC_CS = SDC_CS_HIGH;
+  TFT_CS = TFT_CS_LOW;
+  DC = DC_DATA;
+  if (image) {
+    SSI0_Send16(image, count);
+  } else {
+    SSI0_Fill16(color, count);
+  }
+  TFT_CS = TFT_CS_HIGH;
+}
+
 //------------ST7735_DrawPixel------------
 // Color the pixel at the given coordinates with the given color.
 // Requires 13 bytes of transmission
@@ -870,17 +889,12 @@ void ST7735_DrawPixel(int16_t x, int16_t y, uint16_t color) {
 //        be produced by ST7735_Color565()
 // Output: none
 void ST7735_DrawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
-  uint8_t hi = color >> 8, lo = color;
-
   // Rudimentary clipping
   if ((x >= _width) || (y >= _height)) return;
   if ((y + h - 1) >= _height) h = _height - y;
   setAddrWindow(x, y, x, y + h - 1);
 
-  while (h--) {
-    writedata(hi);
-    writedata(lo);
-  }
+  pushColors(0, color, h);
 
   // deselect();
 }
@@ -896,17 +910,12 @@ void ST7735_DrawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
 //        be produced by ST7735_Color565()
 // Output: none
 void ST7735_DrawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
-  uint8_t hi = color >> 8, lo = color;
-
   // Rudimentary clipping
   if ((x >= _width) || (y >= _height)) return;
   if ((x + w - 1) >= _width) w = _width - x;
   setAddrWindow(x, y, x + w - 1, y);
 
-  while (w--) {
-    writedata(hi);
-    writedata(lo);
-  }
+  pushColors(0, color, w);
 
   // deselect();
 }
@@ -933,8 +942,6 @@ void ST7735_FillScreen(uint16_t color) {
 // Output: none
 void ST7735_FillRect(int16_t x, int16_t y, int16_t w, int16_t h,
                      uint16_t color) {
-  uint8_t hi = color >> 8, lo = color;
-
   // rudimentary clipping (drawChar w/big text requires this)
   if ((x >= _width) || (y >= _height)) return;
   if ((x + w - 1) >= _width) w = _width - x;
@@ -942,12 +949,7 @@ void ST7735_FillRect(int16_t x, int16_t y, int16_t w, int16_t h,
 
   setAddrWindow(x, y, x + w - 1, y + h - 1);
 
-  for (y = h; y > 0; y--) {
-    for (x = w; x > 0; x--) {
-      writedata(hi);
-      writedata(lo);
-    }
-  }
+  if ((w > 0) && (h > 0)) pushColors(0, color, w * h);
 
   // deselect();
 }
@@ -965,17 +967,12 @@ void ST7735_FillRect(int16_t x, int16_t y, int16_t w, int16_t h,
 int16_t const smallCircle[6][3] = {{2, 3, 2}, {1, 4, 4}, {0, 5, 6},
                                    {0, 5, 6}, {1, 4, 4}, {2, 3, 2}};
 void ST7735_DrawSmallCircle(int16_t x, int16_t y, uint16_t color) {
-  uint32_t i, w;
-  uint8_t hi = color >> 8, lo = color;
+  uint32_t i;
   // rudimentary clipping
   if ((x > _width - 5) || (y > _height - 5)) return;  // doesn't fit
   for (i = 0; i < 6; i++) {
     setAddrWindow(x + smallCircle[i][0], y + i, x + smallCircle[i][1], y + i);
-    w = smallCircle[i][2];
-    while (w--) {
-      writedata(hi);
-      writedata(lo);
-    }
+    pushColors(0, color, smallCircle[i][2]);
   }
   // deselect();
 }
@@ -993,17 +990,12 @@ int16_t const circle[10][3] = {{4, 5, 2},  {2, 7, 6},  {1, 8, 8}, {1, 8, 8},
                                {0, 9, 10}, {0, 9, 10}, {1, 8, 8}, {1, 8, 8},
                                {2, 7, 6},  {4, 5, 2}};
 void ST7735_DrawCircle(int16_t x, int16_t y, uint16_t color) {
-  uint32_t i, w;
-  uint8_t hi = color >> 8, lo = color;
+  uint32_t i;
   // rudimentary clipping
   if ((x > _width - 9) || (y > _height - 9)) return;  // doesn't fit
   for (i = 0; i < 10; i++) {
     setAddrWindow(x + circle[i][0], y + i, x + circle[i][1], y + i);
-    w = circle[i][2];
-    while (w--) {
-      writedata(hi);
-      writedata(lo);
-    }
+    pushColors(0, color, circle[i][2]);
   }
   // deselect();
 }
@@ -1087,13 +1079,8 @@ void ST7735_DrawBitmap(int16_t x, int16_t y, const uint16_t *image, int16_t w,
   setAddrWindow(x, y - h + 1, x + w - 1, y);
 
   for (y = 0; y < h; y = y + 1) {
-    for (x = 0; x < w; x = x + 1) {
-      // send the top 8 bits
-      writedata((uint8_t)(image[i] >> 8));
-      // send the bottom 8 bits
-      writedata((uint8_t)image[i]);
-      i = i + 1;  // go to the next pixel
-    }
+    pushColors(&image[i], 0, w);  // a row, top 8 bits first
+    i = i + w;                    // go to the next row
     i = i + skipC;
     i = i - 2 * originalWidth;
   }
@@ -38,6 +38,9 @@
 
 #include <stdint.h>
 
+#include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/heap.h"
+
 #include "../inc/can.h"
 #include "../inc/cpu.h"
 #include "../inc/debug.h"
@@ -56,9 +59,13 @@ uint32_t XMT_ID = 4;
 #define NULL 0
 // reverse these IDs on the other microcontroller
 
-// Mailbox linkage from background to foreground
-uint8_t static RCVData[4];
-int static MailFlag;
+// Mailbox linkage from background to foreground: the interrupt receives
+// each message straight into a heap buffer and queues the buffer
+#define MAILSIZE 8  // messages queued, a power of two
+uint8_t static* Mail[MAILSIZE];
+uint32_t static volatile MailPut, MailGet;  // only CAN0_Handler writes MailPut
+uint32_t CAN0_Lost;                         // dropped, no buffer or queue full
+static Sema4Type MailCount;  // signalled for each message queued
 
 //*****************************************************************************
 //
@@ -67,23 +74,33 @@ int static MailFlag;
 //*****************************************************************************
 void CAN0_Handler(void) {
   uint8_t data[4];
+  uint8_t* buffer;
   uint32_t ulIntStatus, ulIDStatus;
   int i;
   tCANMsgObject xTempMsgObject;
-  xTempMsgObject.pucMsgData = data;
   ulIntStatus = CANIntStatus(CAN0_BASE, CAN_INT_STS_CAUSE);  // cause?
   if (ulIntStatus & CAN_INT_INTID_STATUS) {                  // receive?
     ulIDStatus = CANStatusGet(CAN0_BASE, CAN_STS_NEWDAT);
     for (i = 0; i < 32; i++) {        // test every bit of the mask
       if ((0x1 << i) & ulIDStatus) {  // if active, get data
+        buffer = Heap_IsrMalloc(4);
+        if (buffer && (MailPut - MailGet == MAILSIZE)) {
+          Heap_IsrFree(buffer);  // queue full
+          buffer = NULL;
+        }
+        xTempMsgObject.pucMsgData = buffer ? buffer : data;
         CANMessageGet(CAN0_BASE, (i + 1), &xTempMsgObject, true);
         if (xTempMsgObject.ulMsgID == RCV_ID) {
-          RCVData[0] = data[0];
-          RCVData[1] = data[1];
-          RCVData[2] = data[2];
-          RCVData[3] = data[3];
-          MailFlag = true;  // new mail
+          if (buffer) {
+            Mail[MailPut % MAILSIZE] = buffer;  // new mail
+            MailPut++;
+            OS_Signal(&MailCount);
+            buffer = NULL;
+          } else {
+            CAN0_Lost++;
+          }
         }
+        if (buffer) Heap_IsrFree(buffer);  // not ours
       }
     }
   }
@@ -107,7 +124,9 @@ void CAN0_Open(uint32_t rcvId, uint32_t xmtID) {
   uint32_t volatile delay;
   RCV_ID = rcvId;
   XMT_ID = xmtID;
-  MailFlag = false;
+  MailGet = MailPut;
+  OS_InitSemaphore(&MailCount, 0);
+  OS_AddIsrBuffers(4, MAILSIZE);
 
   SYSCTL_RCGCCAN_R |= 0x00000001;   // CAN0 enable bit 0
   SYSCTL_RCGCGPIO_R |= 0x00000010;  // RCGC2 portE bit 4
@@ -140,28 +159,49 @@ void CAN0_SendData(uint8_t data[4]) {
 
 // Returns true if receive data is available
 //         false if no receive data ready
-int CAN0_CheckMail(void) { return MailFlag; }
+int CAN0_CheckMail(void) { return MailGet != MailPut; }
+// if receive data is ready, returns the buffer the 4 bytes were received
+// in, the caller releases it with Heap_IsrFree
+// if no receive data is ready, returns NULL
+uint8_t* CAN0_GetMailBuffer(void) {
+  uint8_t* buffer;
+  if (MailGet == MailPut) return NULL;
+  buffer = Mail[MailGet % MAILSIZE];
+  MailGet++;
+  return buffer;
+}
+// waits until receive data is ready and returns the buffer it was received
+// in, the caller releases it with Heap_IsrFree
+// the thread is blocked while it waits
+uint8_t* CAN0_WaitMailBuffer(void) {
+  uint8_t* buffer;
+  do {  // a signal may be left from a message CAN0_GetMailBuffer took
+    OS_Wait(&MailCount);
+    buffer = CAN0_GetMailBuffer();
+  } while (buffer == NULL);
+  return buffer;
+}
 // if receive data is ready, gets the data and returns true
 // if no receive data is ready, returns false
 int CAN0_GetMailNonBlock(uint8_t data[4]) {
-  if (MailFlag) {
-    data[0] = RCVData[0];
-    data[1] = RCVData[1];
-    data[2] = RCVData[2];
-    data[3] = RCVData[3];
-    MailFlag = false;
+  uint8_t* buffer = CAN0_GetMailBuffer();
+  if (buffer) {
+    data[0] = buffer[0];
+    data[1] = buffer[1];
+    data[2] = buffer[2];
+    data[3] = buffer[3];
+    Heap_IsrFree(buffer);
     return true;
   }
   return false;
 }
 // if receive data is ready, gets the data
-// if no receive data is ready, it waits until it is ready
+// if no receive data is ready, it waits until it is ready, blocked
 void CAN0_GetMail(uint8_t data[4]) {
-  while (MailFlag == false) {
-  };
-  data[0] = RCVData[0];
-  data[1] = RCVData[1];
-  data[2] = RCVData[2];
-  data[3] = RCVData[3];
-  MailFlag = false;
+  uint8_t* buffer = CAN0_WaitMailBuffer();
+  data[0] = buffer[0];
+  data[1] = buffer[1];
+  data[2] = buffer[2];
+  data[3] = buffer[3];
+  Heap_IsrFree(buffer);
 }
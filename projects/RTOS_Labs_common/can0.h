@@ -39,9 +39,18 @@ int CAN0_CheckMail(void);
 // if receive data is ready, gets the data and returns true
 // if no receive data is ready, returns false
 int CAN0_GetMailNonBlock(uint8_t data[4]);
+// if receive data is ready, returns the buffer the 4 bytes were received
+// in, without copying; release it with Heap_IsrFree
+// if no receive data is ready, returns NULL
+uint8_t* CAN0_GetMailBuffer(void);
+// waits until receive data is ready, blocked, and returns the buffer as
+// CAN0_GetMailBuffer does
+uint8_t* CAN0_WaitMailBuffer(void);
+// messages dropped because no buffer was ready or the queue was full
+extern uint32_t CAN0_Lost;
 
 // if receive data is ready, gets the data
-// if no receive data is ready, it waits until it is ready
+// if no receive data is ready, it waits until it is ready, blocked
 void CAN0_GetMail(uint8_t data[4]);
 
 // Initialize CAN port
@@ -0,0 +1,388 @@
+// filename ************** eCache.c *****************************
+// Write-back sector cache between the file systems and eDisk
+// eFile and FatFs (ff.c) call eCache_Get/eCache_Read/eCache_Write instead
+// of eDisk_Read/eDisk_Write, so repeated accesses to the same sector, the
+// byte-at-a-time eFile_Write and eFile_ReadNext in particular, cost one SPI
+// transfer per sector instead of one per byte.
+
+#include "../RTOS_Labs_common/eCache.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "../RTOS_Labs_common/eDisk.h"
+
+// The cache is CACHE_SETS sets of CACHE_WAYS lines; a sector can only be in
+// set sector % CACHE_SETS, so a lookup compares CACHE_WAYS tags, and a miss
+// replaces the line of that set used least recently. Pinned sectors live in
+// their own CACHE_PINNED lines outside the sets and are never replaced.
+// Lines are written back only when they are replaced, unpinned into a full
+// set, or flushed. A held line, modified with CACHE_HOLD, is never replaced:
+// its changes must not reach the disk before the journal that has them, so
+// until eCache_Release only a flush writes it, and an unpinned one stays
+// parked in its pinned line, valid with no pins.
+
+#define SECTORSIZE 512
+#define PREERASE 4  // shortest stream worth the two commands of ACMD23
+
+typedef struct line {
+  BYTE data[SECTORSIZE];  // first, so it is word aligned
+  DWORD sector;           // which sector, if valid or pinned
+  uint32_t used;          // Clock at the last access, for LRU
+  uint8_t valid;          // data holds the sector
+  uint8_t dirty;          // data differs from the disk
+  uint8_t pins;           // pinned lines: eCache_Pin count
+  uint8_t held;           // modified with CACHE_HOLD, see eCache_Release
+} line_t;
+
+static line_t Lines[CACHE_SETS][CACHE_WAYS];
+static line_t Pinned[CACHE_PINNED];
+static uint32_t Clock;  // access count, the LRU time stamp
+static cache_stats_t Stats;
+
+// write a line to the disk, it stays valid
+static int WriteBack(line_t *l) {
+  if (eDisk_Write(0, l->data, l->sector, 1) != RES_OK) return 1;
+  Stats.writes++;
+  l->dirty = 0;
+  return 0;
+}
+
+#ifdef CACHE_BYPASS
+// no caching, for comparison: modified sectors are written at the next
+// access and every access reads its sector again, the way a file system
+// without a cache has to. Held sectors too, so this model of the transfers
+// does not keep them from reaching the disk ahead of the journal.
+static void Settle(void) {
+  int i, j;
+  for (i = 0; i < CACHE_SETS; i++) {
+    for (j = 0; j < CACHE_WAYS; j++) {
+      if (Lines[i][j].dirty) WriteBack(&Lines[i][j]);
+      Lines[i][j].valid = Lines[i][j].held = 0;
+    }
+  }
+  for (i = 0; i < CACHE_PINNED; i++) {
+    if (Pinned[i].dirty) WriteBack(&Pinned[i]);
+    Pinned[i].valid = Pinned[i].held = 0;
+  }
+}
+#else
+#define Settle()
+#endif
+
+// a pinned line is in use while it is pinned or parked
+#define INUSE(p) ((p)->pins || (p)->valid)
+
+// the pinned line or the line of the set that holds a sector, NULL if none
+static line_t *Find(DWORD sector) {
+  line_t *set = Lines[sector % CACHE_SETS];
+  int i;
+  for (i = 0; i < CACHE_PINNED; i++) {
+    if (INUSE(&Pinned[i]) && (Pinned[i].sector == sector)) return &Pinned[i];
+  }
+  for (i = 0; i < CACHE_WAYS; i++) {
+    if (set[i].valid && (set[i].sector == sector)) return &set[i];
+  }
+  return 0;
+}
+
+// the line of its set to put a sector in: an empty one, else the least
+// recently used that is not held, written back if modified; NULL if all
+// are held or on a disk error
+static line_t *Replace(DWORD sector) {
+  line_t *set = Lines[sector % CACHE_SETS];
+  line_t *l = 0;
+  int i;
+  for (i = 0; i < CACHE_WAYS; i++) {
+    if (set[i].held) continue;  // not before its journal
+    if (!set[i].valid) {
+      l = &set[i];
+      break;
+    }
+    if (!l || ((int32_t)(set[i].used - l->used) < 0)) l = &set[i];
+  }
+  if (l == 0) return 0;
+  if (l->valid && l->dirty && WriteBack(l)) return 0;
+  l->valid = 0;
+  return l;
+}
+
+//******** eCache_Get ***************
+// return the cached copy of a sector, read from the disk if needed
+// input: sector number
+//   mode, CACHE_READ, CACHE_WRITE to modify it, CACHE_NEW to overwrite it
+// output: pointer to the 512 bytes, NULL on a disk error
+// notes: the pointer is valid until the next call to the cache, for a
+//   pinned sector until it is unpinned
+BYTE *eCache_Get(DWORD sector, int mode) {
+  line_t *l;
+  Settle();
+  l = Find(sector);
+  if (l == 0) {
+    l = Replace(sector);
+    if (l == 0) return 0;
+    l->sector = sector;
+  }
+  if (l->valid) {
+    Stats.hits++;
+  } else {
+    Stats.misses++;
+    if (mode != CACHE_NEW) {
+      if (eDisk_Read(0, l->data, sector, 1) != RES_OK) return 0;
+      Stats.reads++;
+    }
+    l->valid = 1;
+    l->dirty = 0;
+  }
+  if (mode != CACHE_READ) l->dirty = 1;
+  if (mode == CACHE_HOLD) l->held = 1;
+  l->used = ++Clock;
+  return l->data;
+}
+
+//******** eCache_Pin ***************
+// keep a sector in a pinned line until eCache_Unpin
+// input: sector number
+// output: pointer to the 512 bytes, NULL if all pinned lines are in use or
+//   on a disk error
+BYTE *eCache_Pin(DWORD sector) {
+  line_t *p = 0, *l;
+  BYTE *data;
+  int i;
+  for (i = 0; i < CACHE_PINNED; i++) {
+    if (INUSE(&Pinned[i]) && (Pinned[i].sector == sector)) {
+      Pinned[i].pins++;  // pinned again, or parked
+      return eCache_Get(sector, CACHE_READ);
+    }
+    if (!INUSE(&Pinned[i])) p = &Pinned[i];
+  }
+  if (p == 0) return 0;
+  l = Find(sector);  // move it out of its set
+  if (l) {
+    memcpy(p->data, l->data, SECTORSIZE);
+    p->dirty = l->dirty;
+    p->held = l->held;
+    l->valid = l->held = 0;
+  }
+  p->valid = (l != 0);
+  p->sector = sector;
+  p->pins = 1;
+  data = eCache_Get(sector, CACHE_READ);
+  if (data == 0) p->pins = 0;
+  return data;
+}
+
+// move a pinned line with no pins back into its set. A held line stays
+// parked, and so does one the set has no room for: 1 then.
+static int Unpark(line_t *p) {
+  line_t *l;
+  if (p->held) return 0;  // after eCache_Release
+  if (p->valid) {
+    l = Replace(p->sector);
+    if (l == 0) return 1;  // cannot write back the line it replaces
+    memcpy(l->data, p->data, SECTORSIZE);
+    l->sector = p->sector;
+    l->used = p->used;
+    l->dirty = p->dirty;
+    l->valid = 1;
+  }
+  p->valid = 0;
+  p->dirty = 0;
+  return 0;
+}
+
+//******** eCache_Unpin ***************
+// undo one eCache_Pin, the last moves the sector back into its set
+// input: sector number
+// output: 0 if successful and 1 on failure (not pinned, disk error)
+// notes: a held sector stays in its pinned line until eCache_Release
+int eCache_Unpin(DWORD sector) {
+  line_t *p = Find(sector);
+  if ((p == 0) || (p < Pinned) || (p >= &Pinned[CACHE_PINNED]) ||
+      (p->pins == 0)) {
+    return 1;
+  }
+  if (--p->pins) return 0;
+  return Unpark(p);
+}
+
+//******** eCache_Release ***************
+// let the held sectors be written back like any other
+// input: none
+// output: none
+// notes: call once the journal with their changes is on the disk
+void eCache_Release(void) {
+  int i, j;
+  for (i = 0; i < CACHE_SETS; i++) {
+    for (j = 0; j < CACHE_WAYS; j++) Lines[i][j].held = 0;
+  }
+  for (i = 0; i < CACHE_PINNED; i++) {
+    Pinned[i].held = 0;
+    if (Pinned[i].pins == 0) Unpark(&Pinned[i]);  // stays if no room
+  }
+}
+
+// write count lines of consecutive sectors in one eDisk_WriteBegin stream
+static int WriteStream(line_t **run, int count) {
+  int i;
+  if (count == 1) return WriteBack(run[0]);
+  if (eDisk_WriteBegin(run[0]->sector, (count < PREERASE) ? 0 : count)) {
+    return 1;
+  }
+  for (i = 0; i < count; i++) {
+    if (eDisk_WriteNext(run[i]->data) != RES_OK) return 1;  // stream ended
+    Stats.writes++;
+    run[i]->dirty = 0;
+  }
+  return eDisk_WriteEnd() != RES_OK;
+}
+
+//******** eCache_Flush ***************
+// write all modified sectors to the disk, they stay cached
+// input: none
+// output: RES_OK, or RES_ERROR if a sector could not be written
+// notes: sectors are written in order, consecutive ones in one stream
+DRESULT eCache_Flush(void) { return eCache_FlushRange(0, 0xFFFFFFFF); }
+
+//******** eCache_FlushRange ***************
+// write the modified sectors from first to first + count - 1 to the disk
+// input: first sector
+//   count, number of sectors
+// output: RES_OK, or RES_ERROR if a sector could not be written
+// notes: sectors are written in order, consecutive ones in one stream
+DRESULT eCache_FlushRange(DWORD first, DWORD count) {
+  line_t *dirty[CACHE_PINNED + CACHE_SETS * CACHE_WAYS], *l;
+  DRESULT result = RES_OK;
+  int i, j, n = 0;
+  for (i = 0; i < CACHE_PINNED + CACHE_SETS * CACHE_WAYS; i++) {
+    l = (i < CACHE_PINNED) ? &Pinned[i] : &Lines[0][0] + (i - CACHE_PINNED);
+    if (!l->valid || !l->dirty || (l->sector - first >= count)) continue;
+    for (j = n++; (j > 0) && (dirty[j - 1]->sector > l->sector); j--) {
+      dirty[j] = dirty[j - 1];  // insertion sort by sector
+    }
+    dirty[j] = l;
+  }
+  for (i = 0; i < n; i += j) {
+    j = 1;
+    while ((i + j < n) && (dirty[i + j]->sector == dirty[i]->sector + j)) j++;
+    if (WriteStream(&dirty[i], j)) result = RES_ERROR;
+  }
+  return result;
+}
+
+//******** eCache_WriteBack ***************
+// write one sector to the disk now if it is cached and modified
+// input: sector number
+// output: RES_OK, or RES_ERROR if it could not be written
+DRESULT eCache_WriteBack(DWORD sector) {
+  line_t *l = Find(sector);
+  if (l && l->valid && l->dirty && WriteBack(l)) return RES_ERROR;
+  return RES_OK;
+}
+
+//******** eCache_Invalidate ***************
+// forget all sectors, pinned and modified ones too
+// input: none
+// output: none
+void eCache_Invalidate(void) {
+  memset(Lines, 0, sizeof(Lines));
+  memset(Pinned, 0, sizeof(Pinned));
+}
+
+// write back the cached sectors of a run that goes straight to the disk
+static int WriteBackRun(DWORD sector, UINT count) {
+  line_t *l;
+  UINT i;
+  for (i = 0; i < count; i++) {
+    l = Find(sector + i);
+    if (l && l->valid && l->dirty && WriteBack(l)) return 1;
+  }
+  return 0;
+}
+
+//******** eCache_Read ***************
+// eDisk_Read through the cache
+// Inputs:  drv    Physical drive number (0)
+//          buff   Pointer to the data buffer to store read data
+//          sector Start sector number (LBA)
+//          count  Number of sectors to read (1..128)
+// Outputs: status (see DRESULT)
+DRESULT eCache_Read(BYTE drv, BYTE *buff, DWORD sector, UINT count) {
+  BYTE *data;
+  if (drv || (count == 0)) return eDisk_Read(drv, buff, sector, count);
+  if (count == 1) {
+    data = eCache_Get(sector, CACHE_READ);
+    if (data == 0) return RES_ERROR;
+    memcpy(buff, data, SECTORSIZE);
+    return RES_OK;
+  }
+  Settle();
+  if (WriteBackRun(sector, count)) return RES_ERROR;
+  Stats.reads += count;
+  return eDisk_Read(drv, buff, sector, count);
+}
+
+//******** eCache_Write ***************
+// eDisk_Write through the cache
+// Inputs:  drv    Physical drive number (0)
+//          buff   Pointer to the data buffer to write to disk
+//          sector Start sector number (LBA)
+//          count  Number of sectors to write (1..128)
+// Outputs: status (see DRESULT)
+// notes: a single sector is written back later, a run goes to the disk now
+DRESULT eCache_Write(BYTE drv, const BYTE *buff, DWORD sector, UINT count) {
+  BYTE *data;
+  line_t *l;
+  DRESULT result;
+  UINT i;
+  if (drv || (count == 0)) return eDisk_Write(drv, buff, sector, count);
+  if (count == 1) {
+    data = eCache_Get(sector, CACHE_NEW);
+    if (data == 0) return RES_ERROR;
+    memcpy(data, buff, SECTORSIZE);
+    return RES_OK;
+  }
+  Settle();
+  result = eDisk_Write(drv, buff, sector, count);
+  if (result != RES_OK) return result;
+  Stats.writes += count;
+  for (i = 0; i < count; i++) {  // cached copies are now out of date
+    l = Find(sector + i);
+    if (l && l->valid) {
+      memcpy(l->data, buff + i * SECTORSIZE, SECTORSIZE);
+      l->dirty = 0;
+    }
+  }
+  return RES_OK;
+}
+
+//******** eCache_Ioctl ***************
+// disk_ioctl through the cache, CTRL_SYNC writes back the cache first
+// Inputs:  drv,   Physical drive number (0)
+//          cmd,   Control command code
+//          buff   Pointer to the control data
+// Outputs: status (see DRESULT)
+DRESULT eCache_Ioctl(BYTE drv, BYTE cmd, void *buff) {
+  if ((drv == 0) && (cmd == CTRL_SYNC) && eCache_Flush()) return RES_ERROR;
+  return disk_ioctl(drv, cmd, buff);
+}
+
+//******** eCache_Stats ***************
+// return hit, miss and transfer counts since reset
+// input: reference to a cache_stats_t to fill in
+// output: 0 if successful
+int eCache_Stats(cache_stats_t *stats) {
+  int i, j;
+  *stats = Stats;
+  stats->dirty = stats->pinned = 0;
+  for (i = 0; i < CACHE_PINNED; i++) {
+    stats->pinned += (Pinned[i].pins != 0);
+    stats->dirty += Pinned[i].valid && Pinned[i].dirty;
+  }
+  for (i = 0; i < CACHE_SETS; i++) {
+    for (j = 0; j < CACHE_WAYS; j++) {
+      stats->dirty += Lines[i][j].valid && Lines[i][j].dirty;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,179 @@
+/**
+ * @file      eCache.h
+ * @brief     write-back sector cache
+ * @details   Sits between the file systems (eFile, FatFs) and eDisk, so
+ * that byte-at-a-time reads and writes do not cost a 512-byte SPI transfer
+ * each. Sectors are kept in CACHE_SETS sets of CACHE_WAYS lines and the
+ * least recently used line of a set is replaced. Modified sectors go to the
+ * disk when they are replaced or on eCache_Flush. Directory and FAT sectors
+ * can be pinned into CACHE_PINNED separate lines, so streaming file data
+ * never pushes them out. A sector modified with CACHE_HOLD is only written
+ * by a flush until eCache_Release, so a journal can go to the disk first.
+ * The cache is not reentrant, callers hold the disk lock (LCDFree). Only
+ * drive 0 is cached.
+ * @version   V1.0
+ * @author    Valvano
+ * @copyright Copyright 2020 by Jonathan W. Valvano, valvano@mail.utexas.edu,
+ * @warning   AS-IS
+ * @note      For more information see  http://users.ece.utexas.edu/~valvano/
+ * @date      Jan 12, 2020
+ ******************************************************************************/
+#ifndef __ECACHE_H
+#define __ECACHE_H 1
+
+#include <stdint.h>
+
+#include "eDisk.h"
+
+#ifndef CACHE_SETS
+#define CACHE_SETS 2  // a sector goes to set sector % CACHE_SETS
+#endif
+#ifndef CACHE_WAYS
+#define CACHE_WAYS 2  // lines in each set
+#endif
+#ifndef CACHE_PINNED
+#define CACHE_PINNED 3  // lines for pinned sectors, at least 1
+#endif
+
+// access modes of eCache_Get
+#define CACHE_READ 0   // read the sector
+#define CACHE_WRITE 1  // modify the sector
+#define CACHE_NEW 2    // overwrite all of the sector, it is not read
+#define CACHE_HOLD 3   // modify the sector, not written back until released
+
+// cache statistics, see eCache_Stats
+typedef struct cache_stats {
+  uint32_t hits;    // accesses to a sector in the cache
+  uint32_t misses;  // accesses that had to replace or fill a line
+  uint32_t reads;   // sectors read from the disk
+  uint32_t writes;  // sectors written to the disk
+  uint32_t dirty;   // modified lines not yet written
+  uint32_t pinned;  // lines pinned now
+} cache_stats_t;
+
+/**
+ * @details Return the cached copy of a sector, reading it from the disk if
+ * needed. The copy stays valid until the next call to the cache unless the
+ * sector is pinned; CACHE_WRITE and CACHE_NEW mark it to be written back.
+ * CACHE_HOLD also keeps it from being written back to make room until
+ * eCache_Release.
+ * @param  sector sector number of SD card: 0,1,2,...
+ * @param  mode CACHE_READ, CACHE_WRITE, CACHE_NEW or CACHE_HOLD
+ * @return pointer to the 512 bytes of the sector, NULL on a disk error or
+ * if every line it could go in is held
+ * @brief  Access a sector through the cache
+ */
+BYTE *eCache_Get(DWORD sector, int mode);
+
+/**
+ * @details Keep a sector in one of the CACHE_PINNED lines until it is
+ * unpinned. Pins nest. Access it with eCache_Get as usual.
+ * @param  sector sector number of SD card: 0,1,2,...
+ * @return pointer to the 512 bytes of the sector, NULL if all pinned lines
+ * are in use or on a disk error
+ * @brief  Pin a directory or FAT sector
+ */
+BYTE *eCache_Pin(DWORD sector);
+
+/**
+ * @details Undo one eCache_Pin. The sector moves back to its set, where it
+ * is replaced like any other. A held sector stays in its pinned line until
+ * eCache_Release.
+ * @param  sector sector number of SD card: 0,1,2,...
+ * @return 0 if successful and 1 on failure (not pinned, disk error)
+ * @brief  Unpin a sector
+ */
+int eCache_Unpin(DWORD sector);
+
+/**
+ * @details Let the sectors modified with CACHE_HOLD be written back like
+ * any other, e.g., once a journal that has their changes is on the disk.
+ * @param  none
+ * @return none
+ * @brief  Release the held sectors
+ */
+void eCache_Release(void);
+
+/**
+ * @details Write all modified sectors to the disk, held ones too. They stay
+ * cached.
+ * Consecutive sectors are written in one eDisk_WriteBegin stream.
+ * @param  none
+ * @return result (0 means OK)
+ * @brief  Write back the cache
+ */
+DRESULT eCache_Flush(void);
+
+/**
+ * @details Write the modified sectors in a range to the disk, e.g., the
+ * data of a file but not the metadata a journal keeps. They stay cached.
+ * @param  first sector number of SD card: 0,1,2,...
+ * @param  count number of sectors
+ * @return result (0 means OK)
+ * @brief  Write back part of the cache
+ */
+DRESULT eCache_FlushRange(DWORD first, DWORD count);
+
+/**
+ * @details Write one sector to the disk now if it is cached and modified,
+ * e.g., a block of a file that is complete. It stays cached.
+ * @param  sector sector number of SD card: 0,1,2,...
+ * @return result (0 means OK)
+ * @brief  Write back one sector
+ */
+DRESULT eCache_WriteBack(DWORD sector);
+
+/**
+ * @details Forget all sectors, including pinned and modified ones, e.g.,
+ * after formatting or when the card is changed. Call eCache_Flush first to
+ * keep the changes.
+ * @param  none
+ * @return none
+ * @brief  Empty the cache
+ */
+void eCache_Invalidate(void);
+
+/**
+ * @details Same as eDisk_Read, through the cache. Runs of several sectors
+ * go straight to the disk, after writing back the cached ones among them.
+ * @param  drv (only drive 0 is cached)
+ * @param  buff pointer to an empty RAM buffer
+ * @param  sector sector number of SD card to read: 0,1,2,...
+ * @param  count number of sectors to read
+ * @return result (0 means OK)
+ * @brief  Read sectors through the cache.
+ */
+DRESULT eCache_Read(BYTE drv, BYTE *buff, DWORD sector, UINT count);
+
+/**
+ * @details Same as eDisk_Write, through the cache. A single sector is
+ * written back later, runs of several go straight to the disk and update
+ * the cached copies.
+ * @param  drv (only drive 0 is cached)
+ * @param  buff pointer to RAM buffer with data
+ * @param  sector sector number of SD card to write: 0,1,2,...
+ * @param  count number of sectors to write
+ * @return result (0 means OK)
+ * @brief  Write sectors through the cache.
+ */
+DRESULT eCache_Write(BYTE drv, const BYTE *buff, DWORD sector, UINT count);
+
+/**
+ * @details Same as disk_ioctl, CTRL_SYNC writes back the cache first
+ * @param  drv (only drive 0 is cached)
+ * @param  cmd disk command
+ * @param  buff pointer to RAM input/output data
+ * @return result (0 means OK)
+ * @brief  Disk input/output through the cache.
+ */
+DRESULT eCache_Ioctl(BYTE drv, BYTE cmd, void *buff);
+
+/**
+ * @details Return hit, miss and transfer counts since reset
+ * @param  stats reference to a cache_stats_t to fill in
+ * @return 0 if successful
+ * @brief  Get cache statistics
+ */
+int eCache_Stats(cache_stats_t *stats);
+
+#endif
@@ -54,6 +54,9 @@
 
 #include <stdint.h>
 
+#include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/SSI0.h"
+#include "../inc/CortexM.h"
 #include "../inc/tm4c123gh6pm.h"
 
 // these defines are in two places, here and in ST7735.c
@@ -62,6 +65,9 @@
 #define TFT_CS (*((volatile unsigned long *)0x40004020))
 #define TFT_CS_LOW 0  // CS normally controlled by hardware
 #define TFT_CS_HIGH 0x08
+#ifndef EDISK_DMA
+#define EDISK_DMA 0 /* 1 to move data blocks with the uDMA */
+#endif
 
 #if SDC_CS_PD7
 // CS is PD7
@@ -233,6 +239,87 @@ static volatile UINT Timer1,
 
 static BYTE CardType; /* Card type flags */
 
+static BYTE Streaming; /* CMD25 left open by eDisk_WriteBegin */
+
+#if EDISK_DMA
+#define DMA_MIN 64 /* Shorter transfers are not worth the set up */
+
+/*-----------------------------------------------------------------------*/
+/* Block transfers by uDMA (Platform dependent)                          */
+/*-----------------------------------------------------------------------*/
+// The calling thread blocks on DmaDone while the uDMA exchanges the bytes
+// with SSI0, so other threads run during the transfer of a data block.
+// The control table used by the uDMA controller, see inc/DMASPI.c
+uint32_t ucControlTable[256] __attribute__((aligned(1024)));
+// SSI0 RX uses uDMA channel 10 and SSI0 TX uses channel 11, encoding 0
+#define CH10 (10 * 4)
+#define CH11 (11 * 4)
+#define BIT10 0x00000400
+#define BIT11 0x00000800
+static Sema4Type DmaDone; /* Signalled when the last byte is received */
+static const BYTE DmaFill = 0xFF; /* Sent while receiving */
+static BYTE DmaSink;              /* Received while sending */
+
+static void dma_init(void) {
+  SYSCTL_RCGCDMA_R = 0x01;  // uDMA Module Run Mode Clock Gating Control
+  while ((SYSCTL_PRDMA_R & 0x01) == 0) {
+  };  // allow time to finish
+  UDMA_CFG_R = 0x01;         // MASTEN Controller Master Enable
+  UDMA_CTLBASE_R = (uint32_t)ucControlTable;
+  UDMA_CHMAP1_R &= ~0x0000FF00;        // SSI0 RX and TX on channels 10, 11
+  UDMA_PRIOCLR_R = BIT10 | BIT11;      // default, not high priority
+  UDMA_ALTCLR_R = BIT10 | BIT11;       // use primary control
+  UDMA_USEBURSTCLR_R = BIT10 | BIT11;  // both burst and single requests
+  UDMA_REQMASKCLR_R = BIT10 | BIT11;   // recognize requests from SSI0
+  OS_InitSemaphore(&DmaDone, 0);
+  NVIC_PRI1_R = (NVIC_PRI1_R & 0x00FFFFFF) | 0x40000000;  // SSI0 priority 2
+  NVIC_EN0_R = 0x00000080;  // enable interrupt 7 (SSI0) in NVIC
+}
+
+// 1 if called from a thread with interrupts enabled, which can block
+static int dma_ok(void) {
+  long sr = StartCritical();
+  EndCritical(sr);
+  return !(sr & 1) && ((NVIC_INT_CTRL_R & NVIC_INT_CTRL_VEC_ACT_M) == 0);
+}
+
+// Exchange btx bytes: send tx, or 0xFF if tx is null, and receive into rx,
+// or discard if rx is null. Returns when the last byte has been received.
+static void dma_spi(BYTE *rx, const BYTE *tx, UINT btx) {
+  ucControlTable[CH10] = (uint32_t)&SSI0_DR_R;  // fixed source
+  ucControlTable[CH10 + 1] = rx ? (uint32_t)(rx + btx - 1) : (uint32_t)&DmaSink;
+  ucControlTable[CH10 + 2] = (rx ? 0x0C000001 : 0xCC000001) + ((btx - 1) << 4);
+  ucControlTable[CH11] = tx ? (uint32_t)(tx + btx - 1) : (uint32_t)&DmaFill;
+  ucControlTable[CH11 + 1] = (uint32_t)&SSI0_DR_R;  // fixed destination
+  ucControlTable[CH11 + 2] = (tx ? 0xC0000001 : 0xCC000001) + ((btx - 1) << 4);
+  /* DMACHCTL          Bits    Value Description
+     DSTINC            31:30   0/11  8-bit destination increment, or none
+     DSTSIZE           29:28   00    8-bit destination data size
+     SRCINC            27:26   0/11  8-bit source increment, or none
+     SRCSIZE           25:24   00    8-bit source data size
+     ARBSIZE           17:14   0     Arbitrates after 1 transfer
+     XFERSIZE          13:4  btx-1   Transfer count items
+     XFERMODE          2:0     001   Basic transfer mode
+    */
+  UDMA_ENASET_R = BIT10 | BIT11;  // receive channel first, then transmit
+  SSI0_DMACTL_R = SSI_DMACTL_RXDMAE | SSI_DMACTL_TXDMAE;
+  OS_bWait(&DmaDone);  // other threads run until SSI0_Handler signals
+}
+
+// Runs when a uDMA channel of SSI0 completes
+void SSI0_Handler(void) {
+  uint32_t done = UDMA_CHIS_R & (BIT10 | BIT11);
+  UDMA_CHIS_R = done;  // acknowledge
+  if (done & BIT11) {  // all sent, stop the transmit requests
+    SSI0_DMACTL_R &= ~SSI_DMACTL_TXDMAE;
+  }
+  if (done & BIT10) {  // all received, the transfer is over
+    SSI0_DMACTL_R = 0;
+    OS_bSignal(&DmaDone);
+  }
+}
+#endif
+
 /*-----------------------------------------------------------------------*/
 /* SPI controls (Platform dependent)                                     */
 /*-----------------------------------------------------------------------*/
@@ -241,6 +328,9 @@ static BYTE CardType; /* Card type flags */
 static void init_spi(void) {
   SPIxENABLE(); /* Enable SPI function */
   CS_HIGH();    /* Set CS# high */
+#if EDISK_DMA
+  dma_init(); /* Data blocks by uDMA */
+#endif
 
   for (Timer1 = 10; Timer1;)
     ; /* 10ms */
@@ -262,32 +352,18 @@ static BYTE xchg_spi(BYTE dat) {
   return rcvdat;
 }
 
-/*-----------------------------------------------------------------------*/
-/* Receive a byte from MMC via SPI  (Platform dependent)                 */
-/*-----------------------------------------------------------------------*/
-// Inputs:  none
-// Outputs: byte received from SPI
-// assumes it has been selected with CS low
-static BYTE rcvr_spi(void) {
-  // wait until SSI0 not busy/transmit FIFO empty
-  while ((SSI0_SR_R & SSI_SR_BSY) == SSI_SR_BSY) {
-  };
-  SSI0_DR_R = 0xFF;  // data out, garbage
-  while ((SSI0_SR_R & SSI_SR_RNE) == 0) {
-  };                       // wait until response
-  return (BYTE)SSI0_DR_R;  // read received data
-}
-
 /* Receive multiple byte */
 // Input:  buff Pointer to empty buffer into which data will be received
 //         btr  Number of bytes to receive (even number)
 // Output: none
 static void rcvr_spi_multi(BYTE *buff, UINT btr) {
-  while (btr) {
-    *buff = rcvr_spi();  // return by reference
-    btr--;
-    buff++;
+#if EDISK_DMA
+  if ((btr >= DMA_MIN) && dma_ok()) {
+    dma_spi(buff, 0, btr);
+    return;
   }
+#endif
+  SSI0_Transfer(buff, 0, btr); /* Send 0xFF, keep the FIFO full */
 }
 
 #if _USE_WRITE
@@ -296,15 +372,13 @@ static void rcvr_spi_multi(BYTE *buff, UINT btr) {
 //         btx  Number of bytes to send (even number)
 // Output: none
 static void xmit_spi_multi(const BYTE *buff, UINT btx) {
-  BYTE volatile rcvdat;
-  while (btx) {
-    SSI0_DR_R = *buff;  // data out
-    while ((SSI0_SR_R & SSI_SR_RNE) == 0) {
-    };                   // wait until response
-    rcvdat = SSI0_DR_R;  // acknowledge response
-    btx--;
-    buff++;
+#if EDISK_DMA
+  if ((btx >= DMA_MIN) && dma_ok()) {
+    dma_spi(0, buff, btx);
+    return;
   }
+#endif
+  SSI0_Transfer(0, buff, btx); /* Keep the FIFO full, discard responses */
 }
 #endif
 
@@ -521,6 +595,9 @@ DSTATUS eDisk_Status(BYTE drv) {
 DRESULT eDisk_Read(BYTE drv, BYTE *buff, DWORD sector, UINT count) {
   if (drv || !count) return RES_PARERR;     /* Check parameter */
   if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check if drive is ready */
+#if _USE_WRITE
+  if (Streaming && eDisk_WriteEnd()) return RES_ERROR; /* Close the stream */
+#endif
 
   if (!(CardType & CT_BLOCK))
     sector *= 512; /* LBA ot BA conversion (byte addressing cards) */
@@ -570,29 +647,27 @@ DRESULT eDisk_ReadBlock(
 //          count  Number of sectors to write (1..128)
 //  Outputs: status (see DRESULT)
 DRESULT eDisk_Write(BYTE drv, const BYTE *buff, DWORD sector, UINT count) {
+  DRESULT res;
   if (drv || !count) return RES_PARERR;     /* Check parameter */
   if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check drive status */
   if (Stat & STA_PROTECT) return RES_WRPRT; /* Check write protect */
 
+  if (count > 1) { /* Multiple sector write, one stream */
+    res = eDisk_WriteBegin(sector, count);
+    while ((res == RES_OK) && count--) {
+      res = eDisk_WriteNext(buff);
+      buff += 512;
+    }
+    return (res == RES_OK) ? eDisk_WriteEnd() : res;
+  }
+  if (Streaming && eDisk_WriteEnd()) return RES_ERROR; /* Close the stream */
+
   if (!(CardType & CT_BLOCK))
     sector *= 512; /* LBA ==> BA conversion (byte addressing cards) */
 
-  if (count == 1) {                    /* Single sector write */
-    if ((send_cmd(CMD24, sector) == 0) /* WRITE_BLOCK */
-        && xmit_datablock(buff, 0xFE))
-      count = 0;
-  } else { /* Multiple sector write */
-    if (CardType & CT_SDC)
-      send_cmd(ACMD23, count);          /* Predefine number of sectors */
-    if (send_cmd(CMD25, sector) == 0) { /* WRITE_MULTIPLE_BLOCK */
-      do {
-        if (!xmit_datablock(buff, 0xFC)) break;
-        buff += 512;
-      } while (--count);
-      if (!xmit_datablock(0, 0xFD)) /* STOP_TRAN token */
-        count = 1;
-    }
-  }
+  if ((send_cmd(CMD24, sector) == 0) /* Single sector write, WRITE_BLOCK */
+      && xmit_datablock(buff, 0xFE))
+    count = 0;
   deselect();
 
   return count ? RES_ERROR : RES_OK; /* Return result */
@@ -613,6 +688,57 @@ DRESULT eDisk_WriteBlock(
   return eDisk_Write(0, buff, sector, 1);  // 1 block
 }
 
+//*************** eDisk_WriteBegin ***********
+// Start a stream of consecutive sectors, written with eDisk_WriteNext
+// The card stays selected with CMD25 open until eDisk_WriteEnd, so the
+// caller holds the SSI (LCDFree) for the whole stream. The card pays its
+// programming busy time once per stream instead of once per sector.
+// Inputs: sector number of SD card of the first sector: 0,1,2,...
+//         count of sectors the stream is expected to write, for ACMD23 to
+//         pre-erase them, 0 if not known
+// Outputs: result (see eDisk_WriteBlock)
+DRESULT eDisk_WriteBegin(DWORD sector, UINT count) {
+  if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check drive status */
+  if (Stat & STA_PROTECT) return RES_WRPRT; /* Check write protect */
+  if (Streaming && eDisk_WriteEnd()) return RES_ERROR; /* Close the last */
+
+  if (!(CardType & CT_BLOCK))
+    sector *= 512; /* LBA ==> BA conversion (byte addressing cards) */
+
+  if (count && (CardType & CT_SDC))
+    send_cmd(ACMD23, count);          /* Predefine number of sectors */
+  if (send_cmd(CMD25, sector) != 0) { /* WRITE_MULTIPLE_BLOCK */
+    deselect();
+    return RES_ERROR;
+  }
+  Streaming = 1;
+  return RES_OK;
+}
+
+//*************** eDisk_WriteNext ***********
+// Write the next 512-byte sector of the stream
+// Inputs: pointer to RAM buffer with 512 bytes of data
+// Outputs: result (see eDisk_WriteBlock), on an error the stream is ended
+DRESULT eDisk_WriteNext(const BYTE *buff) {
+  if (!Streaming) return RES_PARERR;
+  if (xmit_datablock(buff, 0xFC)) return RES_OK;
+  eDisk_WriteEnd(); /* The card did not accept it, stop */
+  return RES_ERROR;
+}
+
+//*************** eDisk_WriteEnd ***********
+// Finish the stream and release the card
+// Inputs: none
+// Outputs: result (see eDisk_WriteBlock)
+DRESULT eDisk_WriteEnd(void) {
+  int ok;
+  if (!Streaming) return RES_PARERR;
+  Streaming = 0;
+  ok = xmit_datablock(0, 0xFD); /* STOP_TRAN token */
+  deselect();
+  return ok ? RES_OK : RES_ERROR;
+}
+
 #endif
 
 /*-----------------------------------------------------------------------*/
@@ -630,6 +756,9 @@ DRESULT disk_ioctl(BYTE drv, BYTE cmd, void *buff) {
 
   if (drv) return RES_PARERR;               /* Check parameter */
   if (Stat & STA_NOINIT) return RES_NOTRDY; /* Check if drive is ready */
+#if _USE_WRITE
+  if (Streaming && eDisk_WriteEnd()) return RES_ERROR; /* Close the stream */
+#endif
 
   res = RES_ERROR;
 
@@ -193,6 +193,36 @@ DRESULT eDisk_WriteBlock(
     const BYTE *buff, /* Pointer to the data to be written */
     DWORD sector);    /* Start sector number (LBA) */
 
+/**
+ * @details  Start writing consecutive sectors as one CMD25 stream, so
+ * the card's busy time is paid once instead of once per sector. The card
+ * stays selected until eDisk_WriteEnd and the SSI port cannot be used for
+ * the LCD in between; other eDisk calls end the stream first.
+ * @param  sector sector number of SD card of the first sector: 0,1,2,...
+ * @param  count number of sectors expected, sent with ACMD23 so the card
+ * can pre-erase them, 0 if not known
+ * @return result (0 means OK)
+ * @brief  Begin a streaming write.
+ */
+DRESULT eDisk_WriteBegin(DWORD sector, UINT count);
+
+/**
+ * @details  Write the next sector of the stream started by
+ * eDisk_WriteBegin. The stream is ended if the card rejects it.
+ * @param  buff pointer to RAM buffer with 512 bytes of data
+ * @return result (0 means OK)
+ * @brief  Write the next sector of a stream.
+ */
+DRESULT eDisk_WriteNext(const BYTE *buff);
+
+/**
+ * @details  Send the stop token of the stream and deselect the card.
+ * @param  none
+ * @return result (0 means OK)
+ * @brief  End a streaming write.
+ */
+DRESULT eDisk_WriteEnd(void);
+
 #endif
 /**
  * @details  Enable SDC chip select, so it is an output
@@ -9,15 +9,796 @@
 #include <string.h>
 
 #include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/eCache.h"
 #include "../RTOS_Labs_common/eDisk.h"
 
+// Disk layout, in 512-byte blocks starting at sector 0 of the card:
+//   block 0              header
+//   EFILE_JOURNAL        journal of directory and FAT changes
+//   EFILE_DIRBLOCKS      directory, a hash table of SLOTS entries
+//   FATBLOCKS            file allocation table, a 16-bit link per block
+//   the rest             file data
+// A file is a chain of blocks linked through the FAT, ending in LAST; new
+// data goes at the end of its last block. A name is looked up at the slot
+// its hash and the directory it is in give, and the slots after it up to
+// an empty one, so an open reads one directory sector however many files
+// there are. A path names a file in subdirectories, e.g. "logs/run1". All
+// blocks are accessed through the write-back cache in eCache.c, and the
+// directory and FAT sectors used last stay pinned, so a byte written or
+// read costs no disk transfer unless it starts a new block.
+//
+// Free space is a bitmap in RAM, built from the FAT at mount. A file being
+// written takes its blocks from an extent, a run of free blocks reserved
+// for it (EFILE_EXTENT, or the size given to eFile_CreateSize) and found
+// first fit, so files written at the same time are each contiguous. The
+// blocks left in an extent are freed when the file is closed.
+//
+// Directory and FAT changes are not written in place as they are made.
+// A commit (Create, Delete, closing a file written) appends what changed
+// since the last one to the journal as redo records, all in one block
+// write, and the sectors stay in the cache. They are held there until
+// that write is done, so no change reaches its sector ahead of its record.
+// Only when the journal is full, or at eFile_Unmount, is a checkpoint
+// taken: the cache is flushed and the header starts a new generation of
+// the journal. eFile_Mount redoes the journal blocks of the current
+// generation.
+//
+// With EFILE_LOG the layout is tuned for appending logs. Every data block
+// starts with a tag: its file, a sequence number, and the block allocated
+// to follow it. A full block is written once. Closing a file writes just
+// its last block, and the directory and FAT are committed every
+// EFILE_CHECKPOINT blocks. eFile_Mount recovers what was appended after
+// the last commit by following the tags from the last block of each file.
+
+#define BLOCKSIZE 512
+#ifndef EFILE_BLOCKS
+#define EFILE_BLOCKS 4096  // blocks of the card used, 2 MB
+#endif
+#ifndef EFILE_LOG
+#define EFILE_LOG 1  // log-structured layout
+#endif
+#ifndef EFILE_CHECKPOINT
+#define EFILE_CHECKPOINT 64  // log blocks started between checkpoints
+#endif
+#ifndef EFILE_DIRBLOCKS
+#define EFILE_DIRBLOCKS 32  // directory blocks, 512 files and directories
+#endif
+#ifndef EFILE_JOURNAL
+#define EFILE_JOURNAL 4  // journal blocks filled between checkpoints
+#endif
+#ifndef EFILE_EXTENT
+#define EFILE_EXTENT 16  // blocks reserved at a time for a file written
+#endif
+#define ENTRIES (BLOCKSIZE / sizeof(dirEntry))  // directory entries per block
+#define SLOTS (EFILE_DIRBLOCKS * ENTRIES)
+#define LINKS (BLOCKSIZE / sizeof(uint16_t))  // FAT entries per block
+#define FATBLOCKS ((EFILE_BLOCKS + LINKS - 1) / LINKS)
+#define JOURNALSTART 1                           // first journal block
+#define DIRSTART (JOURNALSTART + EFILE_JOURNAL)  // first directory block
+#define FATSTART (DIRSTART + EFILE_DIRBLOCKS)    // first FAT block
+#define DATASTART (FATSTART + FATBLOCKS)         // first data block
+#define FREE 0       // FAT entry of a free block
+#define LAST 0xFFFF  // FAT entry of the last block of a file
+#define NAMESIZE 8   // 7 characters and the terminating null
+#define ROOT 0xFFFF  // parent of the files in the root directory
+#define PINS 3       // directory and FAT sectors pinned, see Hot
+#define EXTENTS (EFILE_FILES + 2)  // files with blocks reserved
+#define JWORDS 249  // record words in a journal block
+#define JSLOTS 8    // directory slots changed between commits
+#define JRUNS 8     // runs of FAT entries changed between commits
+#define ENTRYWORDS (sizeof(dirEntry) / sizeof(uint16_t))
+#if EFILE_LOG
+#define MAGIC "eFile6"  // header name on a formatted disk
+#define TAGSIZE sizeof(blockTag)
+#else
+#define MAGIC "eFile5"
+#define TAGSIZE 0
+#endif
+#define PAYLOAD (BLOCKSIZE - TAGSIZE)  // data bytes in a block
+
+// kinds of directory entries
+#define EMPTY 0      // never used, ends a lookup
+#define DELETED 1    // was used, a lookup goes on past it
+#define FILE 2       // a file
+#define DIRECTORY 3  // a subdirectory
+
+// journal records, a kind and then
+#define JENTRY 1  // slot, and the ENTRYWORDS of its dirEntry
+#define JLINK 2   // first, count, end: count FAT entries from first, each
+                  // linked to the next block and the last one to end
+#define JFREE 3   // first, count: count FAT entries from first, all FREE
+
+// block 0
+typedef struct diskHeader {
+  char name[NAMESIZE];     // MAGIC
+  uint16_t dirBlocks;      // EFILE_DIRBLOCKS
+  uint16_t journalBlocks;  // EFILE_JOURNAL
+  uint16_t last;           // EFILE_BLOCKS - 1
+  uint16_t unused;         // word alignment
+  uint32_t sequence;       // Sequence at the checkpoint
+  uint32_t generation;     // of the journal blocks written after it
+} diskHeader;
+
+// a journal block, records of the changes of one or more commits
+typedef struct journalBlock {
+  uint32_t generation;      // of the header, else the block is stale
+  uint32_t sequence;        // Sequence at the last commit in it
+  uint16_t index;           // in the journal, 0 to EFILE_JOURNAL - 1
+  uint16_t words;           // record words used
+  uint16_t check;           // see Sum, a torn block fails it
+  uint16_t record[JWORDS];  // 512 bytes
+} journalBlock;
+
+// a directory slot
+typedef struct dirEntry {
+  char name[NAMESIZE];
+  uint16_t first;      // first block
+  uint16_t last;       // last block, where eFile_Write appends
+  uint32_t size;       // bytes, entries in a directory
+  uint16_t parent;     // slot of the directory it is in, ROOT if none
+  uint16_t kind;       // EMPTY, DELETED, FILE or DIRECTORY
+  uint8_t unused[12];  // 32 bytes
+} dirEntry;
+
+// start of every data block with EFILE_LOG
+typedef struct blockTag {
+  uint32_t seq;     // Sequence when the block was started
+  uint16_t file;    // directory index
+  uint16_t next;    // block allocated to follow it, LAST if none
+  uint16_t used;    // data bytes in the block
+  uint16_t unused;  // word alignment
+} blockTag;
+
+// a descriptor, see eFile_Open
+typedef struct openFile {
+  int slot;        // directory slot of the file
+  int mode;        // EFILE_READ or EFILE_WRITE, 0 if the descriptor is free
+  uint16_t block;  // reading: block of the next byte
+  uint32_t pos;    // reading: offset of that byte in the file
+} openFile;
+
+// blocks reserved for a file, see Reserve
+typedef struct extent {
+  int slot;       // directory slot of the file
+  uint16_t next;  // next block it gets
+  uint16_t end;   // after the last block reserved, 0 if the entry is free
+} extent;
+
+// FAT entries changed since the last commit
+typedef struct linkRun {
+  uint16_t first;  // block
+  uint16_t count;  // blocks, 0 if the entry is free
+} linkRun;
+
+// Display semaphore, the card shares the SSI port with the LCD
+extern Sema4Type LCDFree;
+
+static int Initialized;
+static int Mounted;
+static openFile Files[EFILE_FILES];  // descriptors
+static int Writer = -1;   // descriptor of the file eFile_WOpen opened
+static int Reader = -1;   // descriptor of the file eFile_ROpen opened
+static int DirPos = -1;   // next slot for eFile_DirNext
+static int DirOpen = -1;  // slot of the directory open, or ROOT
+static char DirName[NAMESIZE];
+static uint32_t Bitmap[(EFILE_BLOCKS + 31) / 32];  // 1 if used or reserved
+static extent Extents[EXTENTS];
+static DWORD Pinned[PINS];  // most recently used first, 0 if none
+static uint32_t Sequence;   // tag of the next log block started
+static uint32_t Started;    // log blocks started since the commit
+static uint32_t Generation;  // of the journal, in the header
+static journalBlock Journal;  // the block commits are appended to
+static uint16_t Changed[JSLOTS];  // directory slots for the next commit
+static int ChangedSlots;
+static linkRun Runs[JRUNS];  // FAT entries for the next commit
+static int Overflow;         // more changes than these hold, checkpoint
+static int Hold = CACHE_HOLD;  // cache mode of directory and FAT changes
+static int Committing;         // in Commit, it cannot make room itself
+
+static int Commit(void);
+
+// release the disk lock and return result
+static int Done(int result) {
+  OS_bSignal(&LCDFree);
+  return result;
+}
+
+// a sector through the cache, valid until the next cache access. When
+// every line it could go in holds uncommitted changes, they are committed
+// to make room, even in the middle of an operation. Not while mounting,
+// nothing is held then.
+static BYTE *Cached(DWORD sector, int mode) {
+  BYTE *data = eCache_Get(sector, mode);
+  if (data || Committing || (Hold != CACHE_HOLD) || Commit()) return data;
+  return eCache_Get(sector, mode);
+}
+
+// a directory or FAT sector, valid until the next cache access. The
+// sector stays pinned while it is one of the PINS used last.
+static BYTE *Hot(DWORD sector, int mode) {
+  int i;
+  for (i = 0; (i < PINS - 1) && (Pinned[i] != sector); i++) {
+  }
+  if (Pinned[i] != sector) {  // pin it in place of the oldest
+    if (Pinned[i]) eCache_Unpin(Pinned[i]);
+    Pinned[i] = eCache_Pin(sector) ? sector : 0;
+  }
+  if (Pinned[i] == sector) {  // make it the most recently used
+    for (; i > 0; i--) Pinned[i] = Pinned[i - 1];
+    Pinned[0] = sector;
+  }
+  return Cached(sector, mode);
+}
+
+// unpin all directory and FAT sectors
+static void Unpin(void) {
+  int i;
+  for (i = 0; i < PINS; i++) {
+    if (Pinned[i]) eCache_Unpin(Pinned[i]);
+    Pinned[i] = 0;
+  }
+}
+
+// note a FAT entry changed, for the next commit
+static void ChangeLink(uint16_t block) {
+  linkRun *free = 0;
+  int i;
+  for (i = 0; i < JRUNS; i++) {
+    if (Runs[i].count == 0) {
+      if (free == 0) free = &Runs[i];
+    } else if (block + 1 == Runs[i].first) {  // just before it
+      Runs[i].first--;
+      Runs[i].count++;
+      return;
+    } else if ((block >= Runs[i].first) &&
+               (block <= Runs[i].first + Runs[i].count)) {  // in or after
+      if (block == Runs[i].first + Runs[i].count) Runs[i].count++;
+      return;
+    }
+  }
+  if (free == 0) {
+    Overflow = 1;
+    return;
+  }
+  free->first = block;
+  free->count = 1;
+}
+
+// note a directory slot changed, for the next commit
+static void ChangeEntry(int slot) {
+  int i;
+  for (i = 0; i < ChangedSlots; i++) {
+    if (Changed[i] == slot) return;
+  }
+  if (ChangedSlots == JSLOTS) {
+    Overflow = 1;
+    return;
+  }
+  Changed[ChangedSlots++] = slot;
+}
+
+// FAT entry of a block, valid until the next cache access
+static uint16_t *Fat(uint16_t block, int mode) {
+  uint16_t *links = (uint16_t *)Hot(FATSTART + block / LINKS,
+                                    (mode == CACHE_WRITE) ? Hold : mode);
+  if (links && (mode == CACHE_WRITE)) ChangeLink(block);
+  return links ? &links[block % LINKS] : 0;
+}
+
+// directory slot i, valid until the next cache access
+static dirEntry *Entry(int i, int mode) {
+  dirEntry *entries = (dirEntry *)Hot(DIRSTART + i / ENTRIES,
+                                      (mode == CACHE_WRITE) ? Hold : mode);
+  if (entries && (mode == CACHE_WRITE)) ChangeEntry(i);
+  return entries ? &entries[i % ENTRIES] : 0;
+}
+
+// copy directory slot i
+static int GetEntry(int i, dirEntry *file) {
+  dirEntry *entry = Entry(i, CACHE_READ);
+  if (entry == 0) return 1;
+  *file = *entry;
+  return 0;
+}
+
+// change directory slot i, journaled by the next commit
+static int SetEntry(int i, const dirEntry *file) {
+  dirEntry *entry = Entry(i, CACHE_WRITE);
+  if (entry == 0) return 1;
+  *entry = *file;
+  return 0;
+}
+
+// FNV-1a hash of a name and the directory it is in
+static uint32_t Hash(int parent, const char name[]) {
+  uint32_t hash = (2166136261u ^ (uint16_t)parent) * 16777619u;
+  int i;
+  for (i = 0; (i < NAMESIZE) && name[i]; i++) {
+    hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// slot of a name in a directory, -1 if there is none. The slot it would
+// be added in goes to free, -1 if the directory is full.
+static int Find(int parent, const char name[], int *free) {
+  dirEntry *entry;
+  int i = Hash(parent, name) % SLOTS, n, slot = -1;
+  for (n = 0; n < SLOTS; n++) {
+    entry = Entry(i, CACHE_READ);
+    if (entry == 0) {
+      slot = -1;  // disk error
+      break;
+    }
+    if (entry->kind < FILE) {
+      if (slot < 0) slot = i;
+      if (entry->kind == EMPTY) break;  // it would be here, or before
+    } else if ((entry->parent == parent) &&
+               !strncmp(entry->name, name, NAMESIZE)) {
+      return i;
+    }
+    i = (i + 1) % SLOTS;
+  }
+  if (free) *free = slot;
+  return -1;
+}
+
+// split a path into the directory it names and the last name: returns the
+// slot of the directory, ROOT, or -1 if there is none or a name is too long
+static int Path(const char path[], char name[NAMESIZE]) {
+  dirEntry *entry;
+  const char *end;
+  int parent = ROOT, n;
+  while (1) {
+    end = strchr(path, '/');
+    n = end ? end - path : strlen(path);
+    if ((n == 0) || (n >= NAMESIZE)) return -1;
+    memset(name, 0, NAMESIZE);
+    memcpy(name, path, n);
+    if (end == 0) return parent;
+    parent = Find(parent, name, 0);
+    if (parent < 0) return -1;
+    entry = Entry(parent, CACHE_READ);
+    if ((entry == 0) || (entry->kind != DIRECTORY)) return -1;
+    path = end + 1;
+  }
+}
+
+// slot of the file or directory a path names, -1 if there is none
+static int Lookup(const char path[], int kind) {
+  dirEntry *entry;
+  char name[NAMESIZE];
+  int parent = Path(path, name), i;
+  if (parent < 0) return -1;
+  i = Find(parent, name, 0);
+  if (i < 0) return -1;
+  entry = Entry(i, CACHE_READ);
+  return (entry && (entry->kind == kind)) ? i : -1;
+}
+
+// count an entry added to (+1) or removed from (-1) a directory
+static int Count(int parent, int change) {
+  dirEntry *entry;
+  if (parent == ROOT) return 0;
+  entry = Entry(parent, CACHE_WRITE);
+  if (entry == 0) return 1;
+  entry->size += change;
+  return 0;
+}
+
+// an open file from its descriptor, in a mode or 0 for any; NULL if none
+static openFile *Handle(int fd, int mode) {
+  if ((fd < 0) || (fd >= EFILE_FILES) || (Files[fd].mode == 0)) return 0;
+  return (mode && (Files[fd].mode != mode)) ? 0 : &Files[fd];
+}
+
+// number of descriptors open on a directory slot in a mode, 0 for any
+static int Opened(int slot, int mode) {
+  int fd, n = 0;
+  for (fd = 0; fd < EFILE_FILES; fd++) {
+    if (Handle(fd, mode) && (Files[fd].slot == slot)) n++;
+  }
+  return n;
+}
+
+// mark count blocks from block used (1) or free (0) in the bitmap
+static void Mark(uint32_t block, uint32_t count, int used) {
+  for (; count; block++, count--) {
+    if (used) {
+      Bitmap[block / 32] |= 1u << (block % 32);
+    } else {
+      Bitmap[block / 32] &= ~(1u << (block % 32));
+    }
+  }
+}
+
+// build the bitmap from the FAT
+static int Scan(void) {
+  uint16_t *links;
+  uint32_t i, j;
+  memset(Bitmap, 0, sizeof(Bitmap));
+  for (i = 0; i < FATBLOCKS; i++) {
+    links = (uint16_t *)eCache_Get(FATSTART + i, CACHE_READ);
+    if (links == 0) return 1;
+    for (j = 0; (j < LINKS) && (i * LINKS + j < EFILE_BLOCKS); j++) {
+      if (links[j] != FREE) Mark(i * LINKS + j, 1, 1);
+    }
+  }
+  return 0;
+}
+
+// first run of count free blocks, else the longest there is: its first
+// block goes to start, returns its length, 0 if the disk is full
+static uint32_t FirstFit(uint32_t count, uint16_t *start) {
+  uint32_t block, run = 0, best = 0;
+  for (block = DATASTART; (block < EFILE_BLOCKS) && (best < count); block++) {
+    if ((block % 32 == 0) && (Bitmap[block / 32] == 0xFFFFFFFF)) {
+      block += 31;  // a word of used blocks
+      run = 0;
+    } else if (Bitmap[block / 32] & (1u << (block % 32))) {
+      run = 0;
+    } else if (++run > best) {
+      best = run;
+      *start = block + 1 - run;
+    }
+  }
+  return best;
+}
+
+// free the blocks left in the extent of a file
+static void Release(int slot) {
+  int i;
+  for (i = 0; i < EXTENTS; i++) {
+    if (Extents[i].end && (Extents[i].slot == slot)) {
+      Mark(Extents[i].next, Extents[i].end - Extents[i].next, 0);
+      Extents[i].end = 0;
+    }
+  }
+}
+
+// the extent of a file with blocks left in it, a new one of up to count
+// blocks if needed; NULL if the disk is full or all extents are taken by
+// files being written
+static extent *Reserve(int slot, uint32_t count) {
+  extent *e = 0;
+  uint16_t start;
+  int i;
+  for (i = 0; (i < EXTENTS) && (e == 0); i++) {
+    if (Extents[i].end && (Extents[i].slot == slot)) e = &Extents[i];
+  }
+  if (e && (e->next < e->end)) return e;
+  for (i = 0; (i < EXTENTS) && (e == 0); i++) {
+    if (Extents[i].end == 0) e = &Extents[i];
+  }
+  for (i = 0; (i < EXTENTS) && (e == 0); i++) {  // one reserved in vain
+    if (!Opened(Extents[i].slot, EFILE_WRITE)) {
+      Release(Extents[i].slot);
+      e = &Extents[i];
+    }
+  }
+  if (e == 0) return 0;
+  e->end = 0;
+  count = FirstFit(count, &start);
+  if (count == 0) return 0;
+  Mark(start, count, 1);
+  e->slot = slot;
+  e->next = start;
+  e->end = start + count;
+  return e;
+}
+
+// take a free block as the last block of a file, 0 if the disk is full
+static uint16_t Allocate(int slot) {
+  extent *e = Reserve(slot, EFILE_EXTENT);
+  uint16_t block, *link;
+  if (e) {
+    block = e->next++;
+  } else if (FirstFit(1, &block)) {  // all extents in use
+    Mark(block, 1, 1);
+  } else {
+    return 0;
+  }
+  link = Fat(block, CACHE_WRITE);
+  if (link == 0) return 0;
+  *link = LAST;
+  return block;
+}
+
+// fill in block 0, all of it is known
+static void Header(diskHeader *header) {
+  memset(header, 0, BLOCKSIZE);
+  strcpy(header->name, MAGIC);
+  header->dirBlocks = EFILE_DIRBLOCKS;
+  header->journalBlocks = EFILE_JOURNAL;
+  header->last = EFILE_BLOCKS - 1;
+  header->sequence = Sequence;
+  header->generation = Generation;
+}
+
+// start the journal over, nothing changed since
+static void Restart(void) {
+  memset(&Journal, 0, sizeof(Journal));
+  Journal.generation = Generation;
+  memset(Runs, 0, sizeof(Runs));
+  ChangedSlots = Overflow = 0;
+  Started = 0;
+}
+
+// write the directory, FAT and data in place, then a header with a new
+// generation, which makes the journal blocks written so far stale
+static int Checkpoint(void) {
+  diskHeader *header;
+  if (eCache_Flush() != RES_OK) return 1;
+  eCache_Release();  // all written
+  header = (diskHeader *)eCache_Get(0, CACHE_NEW);  // not read
+  if (header == 0) return 1;
+  Generation++;
+  Header(header);  // tags up to Sequence are in the directory
+  Restart();
+  return eCache_WriteBack(0) != RES_OK;
+}
+
+// checksum of a journal block
+static uint16_t Sum(const journalBlock *block) {
+  uint32_t sum = block->generation + block->sequence;
+  int i;
+  sum = sum * 31 + block->index;
+  sum = sum * 31 + block->words;
+  for (i = 0; (i < block->words) && (i < JWORDS); i++) {
+    sum = sum * 31 + block->record[i];
+  }
+  return sum ^ (sum >> 16);
+}
+
+// the records of what changed since the last commit, in at most room
+// words: returns the words used, -1 if they do not fit or on a disk error
+static int Records(uint16_t record[], int room) {
+  dirEntry *entry;
+  uint16_t *link, block, end, stop, next;
+  int i, n = 0;
+  for (i = 0; i < ChangedSlots; i++) {
+    if (n + 2 + ENTRYWORDS > room) return -1;
+    entry = Entry(Changed[i], CACHE_READ);
+    if (entry == 0) return -1;
+    record[n++] = JENTRY;
+    record[n++] = Changed[i];
+    memcpy(&record[n], entry, sizeof(dirEntry));
+    n += ENTRYWORDS;
+  }
+  for (i = 0; i < JRUNS; i++) {
+    stop = Runs[i].first + Runs[i].count;
+    for (block = Runs[i].first; block < stop; block = end + 1) {
+      link = Fat(block, CACHE_READ);
+      if (link == 0) return -1;
+      if (*link == FREE) {  // blocks freed, e.g., by eFile_Delete
+        for (end = block; end + 1 < stop; end++) {
+          link = Fat(end + 1, CACHE_READ);
+          if (link == 0) return -1;
+          if (*link != FREE) break;
+        }
+        if (n + 3 > room) return -1;
+        record[n++] = JFREE;
+        record[n++] = block;
+        record[n++] = end + 1 - block;
+        continue;
+      }
+      for (end = block;; end++) {  // blocks linked one to the next
+        next = *link;
+        if ((next != end + 1) || (end + 1 == stop)) break;
+        link = Fat(end + 1, CACHE_READ);
+        if (link == 0) return -1;
+        if (*link == FREE) break;  // starts a JFREE
+      }
+      if (n + 4 > room) return -1;
+      record[n++] = JLINK;
+      record[n++] = block;
+      record[n++] = end + 1 - block;
+      record[n++] = next;
+    }
+  }
+  return n;
+}
+
+// make the directory and FAT changes since the last commit durable with
+// one journal block write; a checkpoint if they do not fit in the journal
+static int Commit(void) {
+  int n;
+  if (Overflow) return Checkpoint();
+  Committing = 1;
+  n = Records(&Journal.record[Journal.words], JWORDS - Journal.words);
+  if ((n < 0) && Journal.words && (Journal.index + 1 < EFILE_JOURNAL)) {
+    Journal.index++;  // on to the next block
+    Journal.words = 0;
+    n = Records(Journal.record, JWORDS);
+  }
+  Committing = 0;
+  if (n < 0) return Checkpoint();
+  if (n == 0) {  // nothing changed
+    eCache_Release();
+    return 0;
+  }
+  Journal.words += n;
+  Journal.sequence = Sequence;  // tags from here on are not in it
+  Journal.check = Sum(&Journal);
+  memset(Runs, 0, sizeof(Runs));
+  ChangedSlots = 0;
+  Started = 0;
+  if (eDisk_Write(0, (BYTE *)&Journal, JOURNALSTART + Journal.index, 1) !=
+      RES_OK) {
+    return 1;
+  }
+  eCache_Release();  // the sectors may now be written in place
+  return 0;
+}
+
+// redo the records of a journal block
+static int Apply(const journalBlock *block) {
+  dirEntry file;
+  uint16_t *link, first, count;
+  int i, n = 0;
+  while (n < block->words) {
+    if ((block->record[n] == JENTRY) &&
+        (n + 2 + ENTRYWORDS <= block->words) &&
+        (block->record[n + 1] < SLOTS)) {
+      memcpy(&file, &block->record[n + 2], sizeof(file));
+      if (SetEntry(block->record[n + 1], &file)) return 1;
+      n += 2 + ENTRYWORDS;
+    } else if ((block->record[n] == JLINK) && (n + 4 <= block->words) &&
+               (block->record[n + 1] + block->record[n + 2] <=
+                EFILE_BLOCKS)) {
+      first = block->record[n + 1];
+      count = block->record[n + 2];
+      for (i = 0; i < count; i++) {
+        link = Fat(first + i, CACHE_WRITE);
+        if (link == 0) return 1;
+        *link = (i + 1 < count) ? first + i + 1 : block->record[n + 3];
+      }
+      n += 4;
+    } else if ((block->record[n] == JFREE) && (n + 3 <= block->words) &&
+               (block->record[n + 1] + block->record[n + 2] <=
+                EFILE_BLOCKS)) {
+      first = block->record[n + 1];
+      count = block->record[n + 2];
+      for (i = 0; i < count; i++) {
+        link = Fat(first + i, CACHE_WRITE);
+        if (link == 0) return 1;
+        *link = FREE;
+      }
+      n += 3;
+    } else {
+      return 1;  // not a record
+    }
+  }
+  return 0;
+}
+
+// redo the journal blocks of the current generation, in order: returns
+// how many, -1 on a disk error. The sequence of the last one goes to
+// checkpoint.
+static int Replay(uint32_t *checkpoint) {
+  int i;
+  for (i = 0; i < EFILE_JOURNAL; i++) {
+    if (eDisk_Read(0, (BYTE *)&Journal, JOURNALSTART + i, 1) != RES_OK) {
+      return -1;
+    }
+    if ((Journal.generation != Generation) || (Journal.index != i) ||
+        (Journal.words > JWORDS) || (Journal.check != Sum(&Journal))) {
+      break;  // stale or torn, the journal ends here
+    }
+    if (Apply(&Journal)) return -1;
+    *checkpoint = Journal.sequence;
+  }
+  return i;
+}
+
+// link block to next in the FAT, next becomes the last block. Next is
+// ended first, a commit in between leaves it lost, not linked to junk.
+static int Link(uint16_t block, uint16_t next) {
+  uint16_t *link;
+  if ((next != LAST) && ((next < DATASTART) || (next >= EFILE_BLOCKS))) {
+    return 1;
+  }
+  if (next != LAST) {
+    link = Fat(next, CACHE_WRITE);
+    if (link == 0) return 1;
+    *link = LAST;
+  }
+  link = Fat(block, CACHE_WRITE);
+  if (link == 0) return 1;
+  *link = next;
+  return 0;
+}
+
+// the block to continue a file after its full last block, 0 if the disk
+// is full: with EFILE_LOG the one allocated when the last was started
+static uint16_t Extend(uint16_t last, int slot) {
+  uint16_t block;
+#if EFILE_LOG
+  uint16_t *link = Fat(last, CACHE_READ);
+  if ((link == 0) || (*link == LAST)) return 0;
+  block = *link;
+#else
+  block = Allocate(slot);
+  if ((block == 0) || Link(last, block)) return 0;
+#endif
+  return block;
+}
+
+#if EFILE_LOG
+// begin a data block of a file: allocate the block to follow it, tag it
+static int Start(uint16_t block, int file) {
+  blockTag *tag;
+  uint16_t next = Allocate(file);
+  if (next == 0) {
+    next = LAST;  // disk full, this is the last block it gets
+  } else if (Link(block, next)) {
+    return 1;
+  }
+  // committed before the block is tagged, recovery follows the link to it
+  if ((++Started >= EFILE_CHECKPOINT) && Commit()) return 1;
+  tag = (blockTag *)Cached(block, CACHE_NEW);
+  if (tag == 0) return 1;
+  tag->seq = Sequence++;
+  tag->file = file;
+  tag->next = next;
+  tag->used = 0;
+  tag->unused = 0;
+  return 0;
+}
+
+// copy the tag of a data block
+static int GetTag(uint16_t block, blockTag *tag) {
+  BYTE *buffer;
+  if ((block < DATASTART) || (block >= EFILE_BLOCKS)) return 1;
+  buffer = Cached(block, CACHE_READ);
+  if (buffer == 0) return 1;
+  memcpy(tag, buffer, TAGSIZE);
+  return (tag->used > PAYLOAD);
+}
+
+// add to the files the blocks appended after the commit with this
+// Sequence: from the last block of a file follow the tags that name the
+// file and were started since the checkpoint, in order
+static int Recover(uint32_t checkpoint) {
+  dirEntry file;
+  blockTag tag, next;
+  uint32_t used;
+  int i;
+  for (i = 0; i < SLOTS; i++) {
+    if (GetEntry(i, &file)) return 1;
+    if (file.kind != FILE) continue;
+    used = file.size ? (file.size - 1) % PAYLOAD + 1 : 0;  // in last block
+    if (GetTag(file.last, &tag) || (tag.file != i) || (tag.used < used) ||
+        ((file.size == 0) && (tag.seq < checkpoint))) {
+      continue;  // nothing written to it after the checkpoint
+    }
+    while (1) {
+      file.size += tag.used - used;
+      if ((tag.used < PAYLOAD) || GetTag(tag.next, &next) ||
+          (next.file != i) || (next.seq < checkpoint) ||
+          (next.seq <= tag.seq)) {
+        break;
+      }
+      if (Link(file.last, tag.next)) return 1;
+      file.last = tag.next;
+      tag = next;
+      used = 0;
+    }
+    if (Link(file.last, tag.next) || SetEntry(i, &file)) return 1;
+  }
+  return 0;
+}
+#endif
+
 //---------- eFile_Init-----------------
 // Activate the file system, without formating
 // Input: none
 // Output: 0 if successful and 1 on failure (already initialized)
 int eFile_Init(void) {  // initialize file system
-
-  return 1;  // replace
+  if (Initialized || eDisk_Init(0)) return 1;
+  eCache_Invalidate();
+  Initialized = 1;
+  return 0;
 }
 
 //---------- eFile_Format-----------------
@@ -25,8 +806,43 @@ int eFile_Init(void) {  // initialize file system
 // Input: none
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_Format(void) {  // erase disk, add format
-
-  return 1;  // replace
+  diskHeader *header;
+  uint16_t *links;
+  int i, j, result;
+  if (!Initialized) return 1;
+  OS_bWait(&LCDFree);
+  eCache_Invalidate();  // the old contents are of no use
+  Writer = Reader = DirPos = DirOpen = -1;
+  memset(Files, 0, sizeof(Files));
+  memset(Pinned, 0, sizeof(Pinned));
+  header = (diskHeader *)eCache_Get(0, CACHE_NEW);  // a buffer, dropped below
+  if (header == 0) return Done(1);
+  Sequence = 0;
+  Generation = 1;  // zeroed journal blocks are stale
+  Header(header);
+  Restart();
+  // the header, journal, directory and FAT are consecutive, write them in
+  // one stream
+  result = (eDisk_WriteBegin(0, DATASTART) != RES_OK) ||
+           (eDisk_WriteNext((BYTE *)header) != RES_OK);
+  memset(header, 0, BLOCKSIZE);  // all slots EMPTY
+  for (i = 0; !result && (i < EFILE_JOURNAL + EFILE_DIRBLOCKS); i++) {
+    result = (eDisk_WriteNext((BYTE *)header) != RES_OK);
+  }
+  links = (uint16_t *)header;
+  for (i = 0; !result && (i < FATBLOCKS); i++) {
+    for (j = 0; j < LINKS; j++) {  // directory and FAT are in use
+      links[j] = ((i * LINKS + j) < DATASTART) ? LAST : FREE;
+    }
+    result = (eDisk_WriteNext((BYTE *)links) != RES_OK);
+  }
+  if (!result) result = (eDisk_WriteEnd() != RES_OK);
+  eCache_Invalidate();  // the buffer no longer holds block 0
+  if (result) return Done(1);
+  memset(Bitmap, 0, sizeof(Bitmap));
+  memset(Extents, 0, sizeof(Extents));
+  Mark(0, DATASTART, 1);
+  return Done(0);
 }
 
 //---------- eFile_Mount-----------------
@@ -34,17 +850,248 @@ int eFile_Format(void) {  // erase disk, add format
 // Input: none
 // Output: 0 if successful and 1 on failure
 int eFile_Mount(void) {  // initialize file system
+  diskHeader *header;
+  uint32_t checkpoint;
+  int redone;
+  if (!Initialized || Mounted) return 1;
+  OS_bWait(&LCDFree);
+  header = (diskHeader *)eCache_Get(0, CACHE_READ);
+  if (header == 0) return Done(1);
+  if (strncmp(header->name, MAGIC, NAMESIZE) ||
+      (header->dirBlocks != EFILE_DIRBLOCKS) ||
+      (header->journalBlocks != EFILE_JOURNAL) ||
+      (header->last != EFILE_BLOCKS - 1)) {
+    return Done(1);  // not formatted, or for a different size
+  }
+  Mounted = 1;
+  Generation = header->generation;
+  checkpoint = header->sequence;
+  Hold = CACHE_WRITE;  // redone after a crash, so they can go in place
+  redone = Replay(&checkpoint);
+  Restart();  // what it redid is checkpointed below
+#if EFILE_LOG
+  // blocks started after the last commit, lost or not, have lower numbers
+  Sequence = checkpoint + EFILE_CHECKPOINT;
+  if ((redone >= 0) && Recover(checkpoint)) redone = -1;
+  if (redone == 0) redone = 1;  // checkpoint what Recover linked
+#endif
+  Hold = CACHE_HOLD;
+  if ((redone < 0) || (redone && Checkpoint())) {
+    Unpin();  // leave the disk as it was
+    eCache_Invalidate();
+    Mounted = 0;
+    return Done(1);
+  }
+  memset(Extents, 0, sizeof(Extents));
+  if (Scan()) {  // after Recover, which links blocks
+    Unpin();
+    eCache_Invalidate();
+    Mounted = 0;
+    return Done(1);
+  }
+  return Done(0);
+}
 
-  return 1;  // replace
+// add a file with one allocated block and an extent of count blocks, or
+// an empty directory
+static int Add(const char path[], int kind, uint32_t count) {
+  dirEntry file;
+  int parent, i;
+  if (!Mounted) return 1;
+  OS_bWait(&LCDFree);
+  memset(&file, 0, sizeof(file));
+  parent = Path(path, file.name);
+  if ((parent < 0) || (Find(parent, file.name, &i) >= 0) || (i < 0)) {
+    return Done(1);  // no such directory, already exists, or full
+  }
+  file.parent = parent;
+  file.kind = kind;
+  if (kind == FILE) {
+    Reserve(i, count);  // a hint, the file can do without
+    file.first = file.last = Allocate(i);
+    if (file.first == 0) return Done(1);  // disk full
+  }
+  if (SetEntry(i, &file) || Count(parent, 1)) return Done(1);
+  return Done(Commit());  // directory and FAT agree
 }
 
 //---------- eFile_Create-----------------
 // Create a new, empty file with one allocated block
-// Input: file name is an ASCII string up to seven characters
+// Input: file name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/run1"
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_Create(const char name[]) {  // create new file, make it empty
+  return Add(name, FILE, EFILE_EXTENT);
+}
+
+//---------- eFile_CreateSize-----------------
+// Create a new, empty file, with contiguous blocks reserved for it to grow
+// into; the blocks it does not use are freed when it is closed
+// Input: file name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/run1"
+//        size, the bytes expected, a hint
+// Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
+int eFile_CreateSize(const char name[], uint32_t size) {
+  return Add(name, FILE, (size + PAYLOAD - 1) / PAYLOAD);
+}
 
-  return 1;  // replace
+//---------- eFile_DCreate-----------------
+// Create a new, empty subdirectory
+// Input: directory name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/day1"
+// Output: 0 if successful and 1 on failure (e.g., already exists)
+int eFile_DCreate(const char name[]) {  // create new directory
+  return Add(name, DIRECTORY, 0);
+}
+
+// save a byte at the end of a file, file is its directory entry. The entry
+// is set before a block is started, a checkpoint must find it as it is
+// then, and by the caller at the end.
+static int Put(int slot, dirEntry *file, char data) {
+  BYTE *buffer;
+  uint32_t offset = file->size % PAYLOAD;
+  if (offset == 0) {  // last block full, or the first one empty
+#if EFILE_LOG
+    if (SetEntry(slot, file)) return 1;
+#endif
+    if (file->size) {
+      file->last = Extend(file->last, slot);
+      if (file->last == 0) return 1;  // disk full
+    }
+#if EFILE_LOG
+    if (Start(file->last, slot)) return 1;
+#endif
+  }
+  buffer = Cached(file->last, (offset || EFILE_LOG) ? CACHE_WRITE : CACHE_NEW);
+  if (buffer == 0) return 1;
+  buffer[TAGSIZE + offset] = data;
+#if EFILE_LOG
+  ((blockTag *)buffer)->used = offset + 1;
+#endif
+  file->size++;
+#if EFILE_LOG
+  if ((offset + 1 == PAYLOAD) && eCache_WriteBack(file->last)) {
+    return 1;  // full, it is not written again
+  }
+#endif
+  return 0;
+}
+
+// next byte of a file open for reading, size is the file size
+static int Get(openFile *reader, uint32_t size, char *pt) {
+  uint16_t *link;
+  BYTE *buffer;
+  if (reader->pos >= size) return 1;
+  if (reader->pos && (reader->pos % PAYLOAD == 0)) {  // on to the next block
+    link = Fat(reader->block, CACHE_READ);
+    if ((link == 0) || (*link == LAST) || (*link >= EFILE_BLOCKS)) return 1;
+    reader->block = *link;
+  }
+  buffer = Cached(reader->block, CACHE_READ);
+  if (buffer == 0) return 1;
+  *pt = buffer[TAGSIZE + reader->pos % PAYLOAD];
+  reader->pos++;
+  return 0;
+}
+
+//---------- eFile_Open-----------------
+// Open a file for reading from its start or for writing at its end
+// Input: file name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/run1"
+//        mode, EFILE_READ or EFILE_WRITE
+// Output: descriptor, 0 to EFILE_FILES - 1, and -1 on failure (e.g., all
+//         descriptors in use, or the file is open for writing already)
+int eFile_Open(const char name[], int mode) {  // open a file
+  dirEntry file;
+  int fd, slot;
+  if (!Mounted || ((mode != EFILE_READ) && (mode != EFILE_WRITE))) return -1;
+  OS_bWait(&LCDFree);
+  slot = Lookup(name, FILE);
+  for (fd = 0; (fd < EFILE_FILES) && Files[fd].mode; fd++) {
+  }
+  if ((slot < 0) || (fd == EFILE_FILES) || GetEntry(slot, &file) ||
+      ((mode == EFILE_WRITE) && Opened(slot, EFILE_WRITE))) {
+    OS_bSignal(&LCDFree);
+    return -1;
+  }
+  Files[fd].slot = slot;
+  Files[fd].mode = mode;
+  Files[fd].block = file.first;
+  Files[fd].pos = 0;
+  OS_bSignal(&LCDFree);
+  return fd;
+}
+
+//---------- eFile_WriteBuf-----------------
+// save bytes at the end of an open file
+// Input: descriptor of a file open for writing
+//        buffer, bytes to save
+//        size, number of bytes
+// Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
+int eFile_WriteBuf(int fd, const char buffer[], uint32_t size) {
+  openFile *writer = Handle(fd, EFILE_WRITE);
+  dirEntry file;
+  uint32_t i;
+  int result;
+  if (writer == 0) return 1;
+  OS_bWait(&LCDFree);
+  if (GetEntry(writer->slot, &file)) return Done(1);
+  for (i = 0; (i < size) && !Put(writer->slot, &file, buffer[i]); i++) {
+  }
+  result = (i < size);
+  if (SetEntry(writer->slot, &file)) result = 1;  // what was saved
+  return Done(result);
+}
+
+//---------- eFile_ReadBuf-----------------
+// retreive bytes from an open file
+// Input: descriptor of a file open for reading
+//        buffer, room for size bytes
+//        size, number of bytes
+// Output: number of bytes read, less than size at the end of the file,
+//         and -1 on failure (e.g., not open)
+int32_t eFile_ReadBuf(int fd, char buffer[], uint32_t size) {
+  openFile *reader = Handle(fd, EFILE_READ);
+  dirEntry file;
+  uint32_t i = 0;
+  if (reader == 0) return -1;
+  OS_bWait(&LCDFree);
+  if (GetEntry(reader->slot, &file)) return Done(-1);
+  for (; (i < size) && !Get(reader, file.size, &buffer[i]); i++) {
+  }
+  return Done(i);
+}
+
+//---------- eFile_Close-----------------
+// close a file, a file written leaves the disk in a state power can be
+// removed
+// Input: descriptor of an open file
+// Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
+int eFile_Close(int fd) {  // close a file
+  openFile *handle = Handle(fd, 0);
+#if EFILE_LOG
+  dirEntry file;
+#endif
+  if (handle == 0) return 1;
+  if (handle->mode == EFILE_READ) {
+    handle->mode = 0;
+    return 0;
+  }
+  OS_bWait(&LCDFree);
+  handle->mode = 0;
+  Release(handle->slot);
+#if EFILE_LOG
+  // the directory and FAT can wait, eFile_Mount follows the tags
+  if (GetEntry(handle->slot, &file)) return Done(1);
+  return Done(eCache_WriteBack(file.last) != RES_OK);
+#else
+  // the data in place, then its directory entry and FAT entries in the
+  // journal
+  if (eCache_FlushRange(DATASTART, EFILE_BLOCKS - DATASTART) != RES_OK) {
+    return Done(1);
+  }
+  return Done(Commit());
+#endif
 }
 
 //---------- eFile_WOpen-----------------
@@ -52,8 +1099,9 @@ int eFile_Create(const char name[]) {  // create new file, make it empty
 // Input: file name is an ASCII string up to seven characters
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_WOpen(const char name[]) {  // open a file for writing
-
-  return 1;  // replace
+  if (Writer >= 0) return 1;
+  Writer = eFile_Open(name, EFILE_WRITE);
+  return Writer < 0;
 }
 
 //---------- eFile_Write-----------------
@@ -61,7 +1109,7 @@ int eFile_WOpen(const char name[]) {  // open a file for writing
 // Input: data to be saved
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_Write(const char data) {
-  return 1;  // replace
+  return eFile_WriteBuf(Writer, &data, 1);
 }
 
 //---------- eFile_WClose-----------------
@@ -69,8 +1117,9 @@ int eFile_Write(const char data) {
 // Input: none
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_WClose(void) {  // close the file for writing
-
-  return 1;  // replace
+  int result = eFile_Close(Writer);
+  Writer = -1;
+  return result;
 }
 
 //---------- eFile_ROpen-----------------
@@ -78,8 +1127,9 @@ int eFile_WClose(void) {  // close the file for writing
 // Input: file name is an ASCII string up to seven characters
 // Output: 0 if successful and 1 on failure (e.g., trouble read to flash)
 int eFile_ROpen(const char name[]) {  // open a file for reading
-
-  return 1;  // replace
+  if (Reader >= 0) return 1;
+  Reader = eFile_Open(name, EFILE_READ);
+  return Reader < 0;
 }
 
 //---------- eFile_ReadNext-----------------
@@ -88,8 +1138,7 @@ int eFile_ROpen(const char name[]) {  // open a file for reading
 // Output: return by reference data
 //         0 if successful and 1 on failure (e.g., end of file)
 int eFile_ReadNext(char *pt) {  // get next byte
-
-  return 1;  // replace
+  return eFile_ReadBuf(Reader, pt, 1) != 1;
 }
 
 //---------- eFile_RClose-----------------
@@ -97,27 +1146,66 @@ int eFile_ReadNext(char *pt) {  // get next byte
 // Input: none
 // Output: 0 if successful and 1 on failure (e.g., wasn't open)
 int eFile_RClose(void) {  // close the file for writing
-
-  return 1;  // replace
+  int result = eFile_Close(Reader);
+  Reader = -1;
+  return result;
 }
 
 //---------- eFile_Delete-----------------
-// delete this file
-// Input: file name is a single ASCII letter
+// delete this file, or this empty directory
+// Input: file name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/run1"
 // Output: 0 if successful and 1 on failure (e.g., trouble writing to flash)
 int eFile_Delete(const char name[]) {  // remove this file
-
-  return 1;  // replace
+  dirEntry file, *next;
+  uint16_t block, *link;
+  char leaf[NAMESIZE];
+  int parent, i, n;
+  if (!Mounted) return 1;
+  OS_bWait(&LCDFree);
+  parent = Path(name, leaf);
+  i = (parent < 0) ? -1 : Find(parent, leaf, 0);
+  if ((i < 0) || Opened(i, 0) || (i == DirOpen) ||
+      GetEntry(i, &file) || ((file.kind == DIRECTORY) && file.size)) {
+    return Done(1);
+  }
+  Release(i);
+  block = (file.kind == FILE) ? file.first : LAST;
+  next = Entry((i + 1) % SLOTS, CACHE_READ);
+  if (next == 0) return Done(1);
+  memset(&file, 0, sizeof(file));
+  // a lookup that got here stops at the next slot anyway if it is empty
+  file.kind = (next->kind == EMPTY) ? EMPTY : DELETED;
+  if (SetEntry(i, &file) || Count(parent, -1)) return Done(1);
+  // the entry goes first: a long chain does not fit in the cache, and a
+  // commit while it is freed leaves the rest of it lost, not half a file
+  for (n = 0; (block != LAST) && (n < EFILE_BLOCKS); n++) {  // free chain
+    link = Fat(block, CACHE_WRITE);
+    if (link == 0) return Done(1);
+    Mark(block, 1, 0);
+    block = *link;
+    *link = FREE;
+  }
+  return Done(Commit());
 }
 
 //---------- eFile_DOpen-----------------
 // Open a (sub)directory, read into RAM
-// Input: directory name is an ASCII string up to seven characters
-//        (empty/NULL for root directory)
+// Input: directory name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/day1" (empty/NULL for root directory)
 // Output: 0 if successful and 1 on failure (e.g., trouble reading from flash)
 int eFile_DOpen(const char name[]) {  // open directory
-
-  return 1;  // replace
+  if (!Mounted || (DirPos >= 0)) return 1;
+  if ((name == 0) || (name[0] == 0)) {
+    DirOpen = ROOT;
+  } else {
+    OS_bWait(&LCDFree);
+    DirOpen = Lookup(name, DIRECTORY);
+    OS_bSignal(&LCDFree);
+    if (DirOpen < 0) return 1;
+  }
+  DirPos = 0;
+  return 0;
 }
 
 //---------- eFile_DirNext-----------------
@@ -126,8 +1214,20 @@ int eFile_DOpen(const char name[]) {  // open directory
 // Output: return file name and size by reference
 //         0 if successful and 1 on failure (e.g., end of directory)
 int eFile_DirNext(char *name[], unsigned long *size) {  // get next entry
-
-  return 1;  // replace
+  dirEntry file;
+  if (DirPos < 0) return 1;
+  OS_bWait(&LCDFree);
+  while (DirPos < SLOTS) {
+    if (GetEntry(DirPos++, &file)) return Done(1);
+    if ((file.kind >= FILE) && (file.parent == DirOpen)) {
+      memcpy(DirName, file.name, NAMESIZE);
+      DirName[NAMESIZE - 1] = 0;
+      *name = DirName;
+      *size = (file.kind == FILE) ? file.size : 0;
+      return Done(0);
+    }
+  }
+  return Done(1);
 }
 
 //---------- eFile_DClose-----------------
@@ -135,8 +1235,150 @@ int eFile_DirNext(char *name[], unsigned long *size) {  // get next entry
 // Input: none
 // Output: 0 if successful and 1 on failure (e.g., wasn't open)
 int eFile_DClose(void) {  // close the directory
+  if (DirPos < 0) return 1;
+  DirPos = DirOpen = -1;
+  return 0;
+}
+
+// follow the chain of a file: returns the runs of consecutive blocks it is
+// in, -1 if it leaves the data blocks, loops, or does not end where the
+// entry says. With mark its blocks are marked in the bitmap, and a block
+// marked already, which another file has, breaks it too.
+static int Chain(const dirEntry *file, int mark) {
+  uint16_t block = file->first, previous = 0, *link;
+  uint32_t n = 0, blocks = file->size ? (file->size - 1) / PAYLOAD + 1 : 1;
+  int runs = 0, after = -1;  // blocks after the last one, allocated ahead
+  while (block != LAST) {
+    if ((block < DATASTART) || (block >= EFILE_BLOCKS) ||
+        (++n > EFILE_BLOCKS) ||
+        (mark && (Bitmap[block / 32] & (1u << (block % 32))))) {
+      return -1;
+    }
+    if (mark) Mark(block, 1, 1);
+    if (block != previous + 1) runs++;
+    if (after >= 0) after++;
+    if (block == file->last) {
+      if (n != blocks) return -1;  // the size does not fit the chain
+      after = 0;
+    }
+    previous = block;
+    link = Fat(block, CACHE_READ);
+    if (link == 0) return -1;
+    block = *link;
+  }
+  return ((after >= 0) && (after <= EFILE_LOG)) ? runs : -1;
+}
+
+// count an error in a directory entry: a bad name, kind or directory it
+// is in, or for a directory the wrong number of entries
+static int BadEntry(int slot, const dirEntry *entry) {
+  dirEntry other;
+  uint32_t n = 0;
+  int i;
+  if ((entry->kind > DIRECTORY) || (entry->name[0] == 0) ||
+      (entry->name[NAMESIZE - 1] != 0)) {
+    return 1;
+  }
+  if (entry->parent != ROOT) {
+    if ((entry->parent >= SLOTS) || GetEntry(entry->parent, &other) ||
+        (other.kind != DIRECTORY)) {
+      return 1;
+    }
+  }
+  if (entry->kind == FILE) return 0;
+  for (i = 0; i < SLOTS; i++) {
+    if (GetEntry(i, &other)) return 1;
+    if ((other.kind >= FILE) && (other.parent == slot)) n++;
+  }
+  return n != entry->size;
+}
+
+//---------- eFile_Check-----------------
+// Check the directory and FAT, and measure fragmentation
+// Input: check, to fill in
+// Output: 0 if successful and 1 on failure (e.g., a file is open for
+//         writing); the problems found are counted in check->errors
+int eFile_Check(efile_check_t *check) {
+  dirEntry file;
+  uint16_t *link;
+  uint32_t block, run = 0;
+  int i, runs, result = 0;
+  if (!Mounted) return 1;
+  OS_bWait(&LCDFree);
+  for (i = 0; i < EFILE_FILES; i++) {
+    if (Files[i].mode == EFILE_WRITE) return Done(1);  // entry not current
+  }
+  memset(check, 0, sizeof(*check));
+  memset(Bitmap, 0, sizeof(Bitmap));  // blocks of the files seen so far
+  for (i = 0; (i < SLOTS) && !result; i++) {
+    result = GetEntry(i, &file);
+    if (result || (file.kind < FILE)) continue;
+    if (file.kind == DIRECTORY) {
+      check->directories++;
+    } else {
+      check->files++;
+      runs = Chain(&file, 1);
+      if (runs < 0) {
+        check->errors++;
+      } else {
+        check->fragments += runs;
+      }
+    }
+    check->errors += BadEntry(i, &file);
+  }
+  for (block = 0; (block < EFILE_BLOCKS) && !result; block++) {
+    link = Fat(block, CACHE_READ);
+    if (link == 0) {
+      result = 1;
+    } else if (block < DATASTART) {
+      check->errors += (*link != LAST);  // header, journal, directory, FAT
+    } else if (Bitmap[block / 32] & (1u << (block % 32))) {
+      check->used++;
+      run = 0;
+    } else if (*link != FREE) {
+      check->lost++;
+      run = 0;
+    } else {
+      check->free++;
+      if (run++ == 0) check->holes++;
+      if (run > check->largest) check->largest = run;
+    }
+  }
+  if (Scan()) result = 1;  // the free space as it was
+  for (i = 0; i < EXTENTS; i++) {
+    if (Extents[i].end) {
+      Mark(Extents[i].next, Extents[i].end - Extents[i].next, 1);
+    }
+  }
+  return Done(result);
+}
+
+//---------- eFile_Fragments-----------------
+// Count the runs of consecutive blocks a file is in
+// Input: file name is an ASCII string up to seven characters, in
+//        subdirectories as e.g. "logs/run1"
+// Output: the number of runs, 1 if the file is contiguous, and -1 on
+//         failure (e.g., no such file, or its chain is broken)
+int eFile_Fragments(const char name[]) {
+  dirEntry file;
+  int slot, runs = -1;
+  if (!Mounted) return -1;
+  OS_bWait(&LCDFree);
+  slot = Lookup(name, FILE);
+  if ((slot >= 0) && !GetEntry(slot, &file)) runs = Chain(&file, 0);
+  return Done(runs);
+}
 
-  return 1;  // replace
+//---------- eFile_Idle-----------------
+// Idle work, see OS_AddIdleWork: write back the file data the cache holds
+// modified, so less of it is lost if the power fails. Skipped while a
+// thread has the disk, the idle thread can not wait for it.
+// Input: budget, more than the few sectors the cache holds take to write
+// Output: 0, nothing is left pending
+int eFile_Idle(uint32_t budget) {
+  if (!Mounted || !OS_bTryWait(&LCDFree)) return 0;
+  eCache_FlushRange(DATASTART, EFILE_BLOCKS - DATASTART);
+  return Done(0);
 }
 
 //---------- eFile_Unmount-----------------
@@ -144,5 +1386,15 @@ int eFile_DClose(void) {  // close the directory
 // Input: none
 // Output: 0 if successful and 1 on failure (not currently mounted)
 int eFile_Unmount(void) {
-  return 1;  // replace
+  int result;
+  if (!Mounted) return 1;
+  OS_bWait(&LCDFree);
+  result = Checkpoint();
+  Unpin();
+  eCache_Invalidate();
+  Mounted = 0;
+  Writer = Reader = DirPos = DirOpen = -1;
+  memset(Files, 0, sizeof(Files));
+  memset(Extents, 0, sizeof(Extents));
+  return Done(result);
 }
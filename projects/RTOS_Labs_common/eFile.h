@@ -10,6 +10,29 @@
  * @date      Jan 12, 2020
  ******************************************************************************/
 
+#include <stdint.h>
+
+#ifndef EFILE_FILES
+#define EFILE_FILES 4  // descriptors, files open at once
+#endif
+
+// modes of eFile_Open
+#define EFILE_READ 1   // read from the start of the file
+#define EFILE_WRITE 2  // write at the end of the file
+
+// what eFile_Check found
+typedef struct efile_check {
+  uint32_t files;        // files in all directories
+  uint32_t directories;  // subdirectories
+  uint32_t used;         // data blocks in files
+  uint32_t free;         // data blocks free
+  uint32_t lost;         // data blocks in use but in no file
+  uint32_t fragments;    // runs of consecutive blocks the files are in
+  uint32_t holes;        // runs of free blocks
+  uint32_t largest;      // blocks in the longest run of free blocks
+  uint32_t errors;       // bad entries, chains and directory counts
+} efile_check_t;
+
 /**
  * @details This function must be called first, before calling any of the other
  * eFile functions
@@ -37,13 +60,34 @@ int eFile_Format(void);  // erase disk, add format
 int eFile_Mount(void);  // mount disk and file system
 
 /**
- * @details Create a new, empty file with one allocated block
+ * @details Create a new, empty file with one allocated block. Names in a
+ * path are separated by '/', e.g., "logs/run1" is file run1 in
+ * subdirectory logs; this holds for all the functions that take a name.
  * @param  name file name is an ASCII string up to seven characters
  * @return 0 if successful and 1 on failure (e.g., already exists)
  * @brief  Create a new file
  */
 int eFile_Create(const char name[]);  // create new file, make it empty
 
+/**
+ * @details Create a new, empty subdirectory
+ * @param  name directory name is an ASCII string up to seven characters
+ * @return 0 if successful and 1 on failure (e.g., already exists)
+ * @brief  Create a new directory
+ */
+int eFile_DCreate(const char name[]);  // create new directory
+
+/**
+ * @details Create a new, empty file and reserve contiguous blocks for it to
+ * grow into. The size is a hint: the file can grow past it, and the blocks
+ * it does not use are freed when it is closed.
+ * @param  name file name is an ASCII string up to seven characters
+ * @param  size number of bytes expected
+ * @return 0 if successful and 1 on failure (e.g., already exists)
+ * @brief  Create a new file of a known size
+ */
+int eFile_CreateSize(const char name[], uint32_t size);
+
 /**
  * @details Open the file for writing, read into RAM last block
  * @param  name file name is an ASCII string up to seven characters
@@ -93,9 +137,53 @@ int eFile_ReadNext(char *pt);  // get next byte
  */
 int eFile_RClose(void);  // close the file for writing
 
+/**
+ * @details Open a file through a descriptor. Up to EFILE_FILES files can be
+ * open at once, e.g., by several threads, and a file can be open for
+ * reading more than once but for writing only once. eFile_WOpen and
+ * eFile_ROpen take a descriptor each.
+ * @param  name file name is an ASCII string up to seven characters
+ * @param  mode EFILE_READ to read from the start or EFILE_WRITE to write at
+ * the end
+ * @return descriptor, 0 to EFILE_FILES-1, and -1 on failure (e.g., all
+ * descriptors are in use)
+ * @brief  Open an existing file
+ */
+int eFile_Open(const char name[], int mode);  // open a file
+
+/**
+ * @details Save bytes at the end of a file open for writing
+ * @param  fd descriptor from eFile_Open
+ * @param  buffer bytes to save
+ * @param  size number of bytes
+ * @return 0 if successful and 1 on failure (e.g., disk full)
+ * @brief  Write to an open file
+ */
+int eFile_WriteBuf(int fd, const char buffer[], uint32_t size);
+
+/**
+ * @details Read the next bytes of a file open for reading
+ * @param  fd descriptor from eFile_Open
+ * @param  buffer room for size bytes
+ * @param  size number of bytes
+ * @return number of bytes read, less than size at the end of the file, and
+ * -1 on failure (e.g., not open)
+ * @brief  Read from an open file
+ */
+int32_t eFile_ReadBuf(int fd, char buffer[], uint32_t size);
+
+/**
+ * @details Close a file opened with eFile_Open. A file that was written is
+ * left in a state power can be removed.
+ * @param  fd descriptor from eFile_Open
+ * @return 0 if successful and 1 on failure (e.g., wasn't open)
+ * @brief  Close an open file
+ */
+int eFile_Close(int fd);  // close a file
+
 /**
  * @details Delete the file with this name, recover blocks so they can be used
- * by another file
+ * by another file. A directory can be deleted once it is empty.
  * @param  name file name is an ASCII string up to seven characters
  * @return 0 if successful and 1 on failure (e.g., file doesn't exist)
  * @brief  delete this file
@@ -111,7 +199,8 @@ int eFile_Delete(const char name[]);  // remove this file
 int eFile_DOpen(const char name[]);
 
 /**
- * @details Retreive directory entry from open directory
+ * @details Retreive directory entry from open directory, a subdirectory has
+ * size 0
  * @param pointers to return file name and size by reference
  * @return 0 if successful and 1 on failure (e.g., end of directory)
  */
@@ -124,6 +213,37 @@ int eFile_DirNext(char *name[], unsigned long *size);
  */
 int eFile_DClose(void);
 
+/**
+ * @details Check that every file's block chain is whole, fits its size
+ * and shares no block with another file, that every entry is in a
+ * directory that exists and every directory counts its entries right;
+ * count blocks in use that no file has, and measure fragmentation. Fails
+ * while a file is open for writing.
+ * @param  check to fill in
+ * @return 0 if successful and 1 on failure (e.g., trouble reading flash)
+ * @brief  Check the file system
+ */
+int eFile_Check(efile_check_t *check);
+
+/**
+ * @details Count the runs of consecutive blocks a file is in, 1 if it is
+ * contiguous.
+ * @param  name file name, in subdirectories as e.g. "logs/run1"
+ * @return the number of runs, and -1 on failure (e.g., no such file)
+ * @brief  Fragmentation of a file
+ */
+int eFile_Fragments(const char name[]);
+
+/**
+ * @details Idle work for OS_AddIdleWork: write back the modified file data
+ * in the cache, unless a thread is using the disk. The directory and FAT
+ * wait for their journal.
+ * @param  budget cycles (12.5ns) for one call, enough for a few sectors
+ * @return 0, nothing is left pending
+ * @brief  Write back file data when the CPU is idle
+ */
+int eFile_Idle(uint32_t budget);
+
 /**
  * @details Unmount and deactivate the file system.
  * @param  none
@@ -0,0 +1,171 @@
+// filename ************** eFileAsync.c *****************************
+// Asynchronous file input/output, see eFileAsync.h
+// Callers queue requests and go on; eFile_DiskServer makes the eFile calls
+// and takes the SD card busy times. The queue is a linked list of the
+// callers' requests, so there is nothing to allocate and no limit on it.
+// The threads wait in OS_Wait, which blocks them in OS.c; with semaphores
+// that spin, the server would burn its time slices on an empty queue.
+
+#include "../RTOS_Labs_common/eFileAsync.h"
+
+#include <stdint.h>
+
+#include "../RTOS_Labs_common/OS.h"
+#include "../RTOS_Labs_common/eFile.h"
+#include "../inc/CortexM.h"
+
+static efile_request_t *Head;  // oldest request, served next
+static efile_request_t *Tail;  // newest request
+static Sema4Type Queued;       // number of requests in the queue
+
+// add a request to the queue and wake up the server
+static int Queue(efile_request_t *request, int fd, char *buffer,
+                 uint32_t size, int write) {
+  long sr;
+  if (size == 0) return 1;
+  request->fd = fd;
+  request->buffer = buffer;
+  request->size = size;
+  request->count = 0;
+  request->result = 0;
+  request->write = write;
+  request->next = 0;
+  OS_InitSemaphore(&request->done, 0);
+  sr = StartCritical();
+  if (Tail) {
+    Tail->next = request;
+  } else {
+    Head = request;
+  }
+  Tail = request;
+  EndCritical(sr);
+  OS_Signal(&Queued);
+  return 0;
+}
+
+//******** eFile_WriteAsync ***************
+// queue a write to a file open for writing
+// input: request, unused or completed
+//   fd, descriptor from eFile_Open
+//   buffer, bytes to write, not changed until the request completes
+//   size, number of bytes
+// output: 0 if queued and 1 on failure
+int eFile_WriteAsync(efile_request_t *request, int fd, const char *buffer,
+                     uint32_t size) {
+  return Queue(request, fd, (char *)buffer, size, 1);
+}
+
+//******** eFile_ReadAsync ***************
+// queue a read from a file open for reading
+// input: request, unused or completed
+//   fd, descriptor from eFile_Open
+//   buffer, room for size bytes
+//   size, number of bytes
+// output: 0 if queued and 1 on failure
+int eFile_ReadAsync(efile_request_t *request, int fd, char *buffer,
+                    uint32_t size) {
+  return Queue(request, fd, buffer, size, 0);
+}
+
+//******** eFile_WaitAsync ***************
+// block until a request completes
+// input: request that was queued
+// output: its result, 0 if all bytes were moved
+int eFile_WaitAsync(efile_request_t *request) {
+  OS_Wait(&request->done);
+  OS_Signal(&request->done);  // waiting again returns at once
+  return request->result;
+}
+
+//******** eFile_Serve ***************
+// serve the oldest request
+// input: none
+// output: 0 if one was served and 1 if there was none
+int eFile_Serve(void) {
+  efile_request_t *request;
+  int32_t count;
+  long sr = StartCritical();
+  request = Head;
+  if (request) {
+    Head = request->next;
+    if (Head == 0) Tail = 0;
+  }
+  EndCritical(sr);
+  if (request == 0) return 1;
+  if (request->write) {
+    request->result = eFile_WriteBuf(request->fd, request->buffer,
+                                     request->size);
+    request->count = request->result ? 0 : request->size;
+  } else {
+    count = eFile_ReadBuf(request->fd, request->buffer, request->size);
+    request->count = (count > 0) ? count : 0;
+    request->result = (count != (int32_t)request->size);  // or end of file
+  }
+  OS_Signal(&request->done);
+  return 0;
+}
+
+//******** eFile_DiskServer ***************
+// disk service thread, serves requests as they come
+// input: none
+// output: none, never returns
+void eFile_DiskServer(void) {
+  while (1) {
+    OS_Wait(&Queued);
+    eFile_Serve();
+  }
+}
+
+//******** eFile_LogOpen ***************
+// start a double-buffered log on a file open for writing
+// input: log to initialize
+//   fd, descriptor from eFile_Open
+// output: 0 if successful
+int eFile_LogOpen(efile_log_t *log, int fd) {
+  log->fd = fd;
+  log->fill = 0;
+  log->active = 0;
+  log->busy[0] = log->busy[1] = 0;
+  log->result = 0;
+  return 0;
+}
+
+// queue the buffer being filled and switch to the other, once it is free
+static void Swap(efile_log_t *log) {
+  int i = log->active;
+  if (log->fill) {
+    if (eFile_WriteAsync(&log->request[i], log->fd, log->buffer[i],
+                         log->fill)) {
+      log->result = 1;
+    } else {
+      log->busy[i] = 1;
+    }
+  }
+  log->active = i = 1 - i;
+  log->fill = 0;
+  if (log->busy[i]) {  // only waits if the card is slower than the data
+    log->result |= eFile_WaitAsync(&log->request[i]);
+    log->busy[i] = 0;
+  }
+}
+
+//******** eFile_LogPut ***************
+// add a byte to a log, write the buffer when it is full
+// input: log, opened with eFile_LogOpen
+//   data, byte to add
+// output: 0 if successful and 1 if a write has failed
+int eFile_LogPut(efile_log_t *log, char data) {
+  log->buffer[log->active][log->fill++] = data;
+  if (log->fill == EFILE_LOGSIZE) Swap(log);
+  return log->result;
+}
+
+//******** eFile_LogClose ***************
+// write the rest of a log and wait for both buffers
+// input: log, opened with eFile_LogOpen
+// output: 0 if successful and 1 if a write has failed
+int eFile_LogClose(efile_log_t *log) {
+  Swap(log);  // queue the partial buffer, wait for the older one
+  Swap(log);  // and for that one
+  return log->result;
+}
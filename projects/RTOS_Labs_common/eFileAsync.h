@@ -0,0 +1,136 @@
+/**
+ * @file      eFileAsync.h
+ * @brief     asynchronous file input/output
+ * @details   Requests to write to or read from a file opened with
+ * eFile_Open are queued to a disk service thread, eFile_DiskServer, and
+ * the caller goes on; it waits on the
+ * request's semaphore only when it needs the result. A request and its
+ * buffer belong to the file system until the request completes. On top of
+ * this, an efile_log_t double buffers a log: one buffer fills while the
+ * other is written, so a data acquisition thread does not stall while the
+ * card is busy. Works with either eFile.c, it calls the eFile functions.
+ * Needs the blocking semaphores of OS.c: the server and the waiting
+ * callers sleep in OS_Wait, so they use no CPU until there is work.
+ * @version   V1.0
+ * @author    Valvano
+ * @copyright Copyright 2020 by Jonathan W. Valvano, valvano@mail.utexas.edu,
+ * @warning   AS-IS
+ * @note      For more information see  http://users.ece.utexas.edu/~valvano/
+ * @date      Jan 12, 2020
+ ******************************************************************************/
+#ifndef __EFILEASYNC_H
+#define __EFILEASYNC_H 1
+
+#include <stdint.h>
+
+#include "OS.h"
+
+#ifndef EFILE_LOGSIZE
+#define EFILE_LOGSIZE 512  // bytes in each buffer of an efile_log_t
+#endif
+
+// a read or write request, see eFile_ReadAsync and eFile_WriteAsync
+typedef struct efile_request {
+  int fd;                      // descriptor from eFile_Open
+  char *buffer;                // bytes to write, or room for those read
+  uint32_t size;               // bytes to write or to read
+  uint32_t count;              // bytes written or read
+  int result;                  // 0 if all size bytes were moved, else 1
+  int write;                   // 1 to write, 0 to read
+  Sema4Type done;              // signalled when the request completes
+  struct efile_request *next;  // in the queue of the server
+} efile_request_t;
+
+// a double-buffered log, see eFile_LogPut
+typedef struct efile_log {
+  char buffer[2][EFILE_LOGSIZE];
+  efile_request_t request[2];
+  int fd;         // descriptor from eFile_Open
+  uint32_t fill;  // bytes in the buffer being filled
+  int active;     // the buffer being filled, 0 or 1
+  int busy[2];    // buffer is being written
+  int result;     // 1 if a write failed
+} efile_log_t;
+
+/**
+ * @details Queue a write to the end of a file open for writing and
+ * return at once. Requests are served in order.
+ * @param  request to fill in, unused or completed
+ * @param  fd descriptor from eFile_Open with EFILE_WRITE
+ * @param  buffer bytes to write, left alone until the request completes
+ * @param  size number of bytes
+ * @return 0 if queued and 1 on failure (e.g., size 0)
+ * @brief  Write a buffer in the background
+ */
+int eFile_WriteAsync(efile_request_t *request, int fd, const char *buffer,
+                     uint32_t size);
+
+/**
+ * @details Queue a read of the next bytes of a file open for reading and
+ * return at once. A read that reaches the end of the file completes with
+ * result 1 and count the bytes that were there.
+ * @param  request to fill in, unused or completed
+ * @param  fd descriptor from eFile_Open with EFILE_READ
+ * @param  buffer room for size bytes
+ * @param  size number of bytes
+ * @return 0 if queued and 1 on failure (e.g., size 0)
+ * @brief  Read into a buffer in the background
+ */
+int eFile_ReadAsync(efile_request_t *request, int fd, char *buffer,
+                    uint32_t size);
+
+/**
+ * @details Block until a request completes.
+ * @param  request queued with eFile_ReadAsync or eFile_WriteAsync
+ * @return its result, 0 if all bytes were moved and 1 otherwise
+ * @brief  Wait for a request
+ */
+int eFile_WaitAsync(efile_request_t *request);
+
+/**
+ * @details Serve the oldest queued request, if any.
+ * @param  none
+ * @return 0 if one was served and 1 if the queue was empty
+ * @brief  Serve one request
+ */
+int eFile_Serve(void);
+
+/**
+ * @details Disk service thread: serves requests as they are queued. Add
+ * it with OS_AddThread at a priority above the threads it serves.
+ * @param  none
+ * @return never
+ * @brief  Disk service thread
+ */
+void eFile_DiskServer(void);
+
+/**
+ * @details Start a double-buffered log on a file open for writing.
+ * @param  log to initialize
+ * @param  fd descriptor from eFile_Open with EFILE_WRITE
+ * @return 0 if successful
+ * @brief  Open a log
+ */
+int eFile_LogOpen(efile_log_t *log, int fd);
+
+/**
+ * @details Add a byte to a log. A full buffer is queued for writing and
+ * the other one is filled next; the caller only waits if that one is
+ * still being written.
+ * @param  log opened with eFile_LogOpen
+ * @param  data byte to add
+ * @return 0 if successful and 1 if an earlier write failed
+ * @brief  Log a byte
+ */
+int eFile_LogPut(efile_log_t *log, char data);
+
+/**
+ * @details Write what is left in the buffers and wait for both. The file
+ * stays open, close it with eFile_Close.
+ * @param  log opened with eFile_LogOpen
+ * @return 0 if successful and 1 if a write failed
+ * @brief  Close a log
+ */
+int eFile_LogClose(efile_log_t *log);
+
+#endif
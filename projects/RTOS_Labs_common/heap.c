@@ -27,7 +27,499 @@
 
 #include "../RTOS_Labs_common/heap.h"
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#include "../inc/CortexM.h"
+#ifdef HEAP_PROFILE
+#include "../RTOS_Labs_common/OS.h"
+#endif
+
+// The heap is a two-level segregated fit (TLSF) allocator. Free blocks are
+// kept in size classes: the first level is the power of two of the size,
+// the second level splits each power of two into SL_COUNT linear ranges.
+// Two bitmaps record which classes are non-empty, so finding a free block
+// and inserting/removing one are a few bit operations, O(1) independent of
+// the number of blocks. Freed blocks are merged with free physical
+// neighbours immediately.
+// The price is memory, not speed. A free block holds two list links and
+// the next block's prevPhys, so no block is smaller than 4 words, where a
+// first fit list needs 2. Requests of a few bytes pay for that: in
+// tests/RTOS_Labs_common/bench_heap, with the heap kept nearly full, TLSF
+// fails about twice as many allocations as first fit, and first fit given
+// the same smallest block fails nearly as many as TLSF. More second level
+// lists, or searching the exact class before rounding up, do not lower the
+// count. What is bought is the bound: first fit searches up to 35 blocks
+// there, TLSF none.
+
+#ifndef HEAP_SIZE
+#define HEAP_SIZE 8192  // bytes of RAM given to the heap
+#endif
+
+#ifndef POOL_SIZE
+#define POOL_SIZE 2048  // bytes of RAM for fixed-size block pools
+#endif
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+#define ALIGN_LOG2 3  // 64-bit host build, see tests/RTOS_Labs_common
+#else
+#define ALIGN_LOG2 2  // Cortex M4, blocks are word aligned
+#endif
+#define ALIGN_SIZE (1 << ALIGN_LOG2)
+
+#define SL_LOG2 3  // second level lists per power of two is 8
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + ALIGN_LOG2)
+#define SMALL_BLOCK (1 << FL_SHIFT)  // sizes below this are one first level
+#define FL_MAX 16                    // largest block is below 64 KiB
+#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+
+#define BLOCK_FREE 1       // size bit 0: this block is free
+#define BLOCK_PREV_FREE 2  // size bit 1: physically previous block is free
+#define BLOCK_BITS (BLOCK_FREE | BLOCK_PREV_FREE)
+
+// A block header. prevPhys is the last word of the previous block and only
+// valid while that block is free; a used block costs just the size word.
+// nextFree/prevFree live in the payload of a free block.
+typedef struct block {
+  struct block* prevPhys;  // previous block in memory, if it is free
+  size_t size;             // payload bytes | BLOCK_FREE | BLOCK_PREV_FREE
+  struct block* nextFree;  // free list links, free blocks only
+  struct block* prevFree;
+} block_t;
+
+#define BLOCK_OVERHEAD sizeof(size_t)
+#define PAYLOAD_OFFSET offsetof(block_t, nextFree)
+// a free block must hold its list links and the next block's prevPhys
+#define MIN_PAYLOAD (sizeof(block_t) - sizeof(size_t))
+
+// control structure of one heap
+typedef struct tlsf {
+  uint32_t flBitmap;                    // bit f set if blocks[f][] not empty
+  uint32_t slBitmap[FL_COUNT];          // bit s set if blocks[f][s] not empty
+  block_t* blocks[FL_COUNT][SL_COUNT];  // heads of the free lists
+  uint8_t* start;                       // first byte of the managed region
+  uint8_t* end;                         // one past the last byte
+  uint32_t copied;                      // bytes moved by Reallocate
+} tlsf_t;
+
+static size_t HeapMemory[HEAP_SIZE / sizeof(size_t)];
+static tlsf_t Heap;
+
+// An arena is a heap inside one block of the main heap. Everything
+// allocated in it goes away at once when the arena is destroyed.
+struct arena {
+  tlsf_t heap;         // allocator of the region following this struct
+  struct arena* next;  // list of live arenas, for Arena_Of
+  struct arena* prev;
+};
+static arena_t* Arenas;
+
+// Free buffers of one size kept for interrupt handlers, see Heap_IsrMalloc.
+// A lock-free LIFO linked through the first word of each buffer; the
+// buffers are used blocks of the heap.
+typedef struct isr_class {
+  void* volatile head;     // first free buffer
+  volatile int32_t count;  // buffers in the list
+  uint32_t size;           // bytes in each buffer
+  uint32_t depth;          // buffers kept ready
+  int32_t minFree;         // fewest buffers that were ever ready
+  uint32_t failures;       // Heap_IsrMalloc calls that found no buffer
+} isr_class_t;
+#define ISR_CLASSES 4  // buffer sizes, see Heap_IsrPool
+static isr_class_t IsrClasses[ISR_CLASSES];  // by increasing size
+static int NumIsrClasses;
+static void (*IsrNotify)(void);  // called when a size runs low
+
+#ifdef HEAP_PROFILE
+#ifndef HEAP_TRACE
+#define HEAP_TRACE 64  // events in the trace ring, 16 bytes each
+#endif
+#ifdef __CC_ARM
+#define CALLER() ((uint32_t)__return_address())
+#else
+#define CALLER() ((uint32_t)(uintptr_t)__builtin_return_address(0))
+#endif
+// called in every public operation, where CALLER() is the user's code
+#define PROFILE(op, bytes, block, old, oldSize) \
+  Record(op, bytes, block, old, oldSize, CALLER())
+static void Unaccount(arena_t* arena);
+static heap_event_t Trace[HEAP_TRACE];
+static uint32_t TracePut, TraceGet;  // events written and read so far
+static heap_profile_t Profile;
+static void Record(uint8_t op, int32_t bytes, void* block, void* old,
+                   size_t oldSize, uint32_t caller);
+#else
+#define PROFILE(op, bytes, block, old, oldSize) ((void)(oldSize))
+#define Unaccount(arena)
+#endif
+
+// ******** MsBit ************
+// index of the most significant set bit, x must not be 0
+static int MsBit(uint32_t x) {
+#if defined(__CC_ARM)
+  return 31 - __clz(x);
+#else
+  return 31 - __builtin_clz(x);
+#endif
+}
+
+// ******** LsBit ************
+// index of the least significant set bit, x must not be 0
+static int LsBit(uint32_t x) { return MsBit(x & (~x + 1)); }
+
+static size_t BlockSize(const block_t* b) { return b->size & ~BLOCK_BITS; }
+
+static void* BlockToPayload(const block_t* b) {
+  return (uint8_t*)b + PAYLOAD_OFFSET;
+}
+
+static block_t* PayloadToBlock(const void* p) {
+  return (block_t*)((uint8_t*)p - PAYLOAD_OFFSET);
+}
+
+// next block in memory; its prevPhys overlaps the last word of b
+static block_t* BlockNext(const block_t* b) {
+  return (block_t*)((uint8_t*)BlockToPayload(b) + BlockSize(b) -
+                    BLOCK_OVERHEAD);
+}
+
+// ******** Mapping ************
+// size class of a block of the given payload size
+static void Mapping(size_t size, int* fl, int* sl) {
+  if (size < SMALL_BLOCK) {
+    *fl = 0;
+    *sl = (int)size / (SMALL_BLOCK / SL_COUNT);
+  } else {
+    int f = MsBit((uint32_t)size);
+    *sl = (int)(size >> (f - SL_LOG2)) ^ SL_COUNT;
+    *fl = f - (FL_SHIFT - 1);
+  }
+}
+
+// ******** MappingSearch ************
+// size class whose every block is at least size bytes
+static void MappingSearch(size_t size, int* fl, int* sl) {
+  if (size >= SMALL_BLOCK) {
+    size += ((size_t)1 << (MsBit((uint32_t)size) - SL_LOG2)) - 1;
+  }
+  Mapping(size, fl, sl);
+}
+
+static void RemoveFree(tlsf_t* h, block_t* b) {
+  int fl, sl;
+  Mapping(BlockSize(b), &fl, &sl);
+  if (b->prevFree) {
+    b->prevFree->nextFree = b->nextFree;
+  } else {
+    h->blocks[fl][sl] = b->nextFree;
+    if (b->nextFree == 0) {
+      h->slBitmap[fl] &= ~(1U << sl);
+      if (h->slBitmap[fl] == 0) h->flBitmap &= ~(1U << fl);
+    }
+  }
+  if (b->nextFree) b->nextFree->prevFree = b->prevFree;
+}
+
+static void InsertFree(tlsf_t* h, block_t* b) {
+  int fl, sl;
+  Mapping(BlockSize(b), &fl, &sl);
+  b->prevFree = 0;
+  b->nextFree = h->blocks[fl][sl];
+  if (b->nextFree) b->nextFree->prevFree = b;
+  h->blocks[fl][sl] = b;
+  h->flBitmap |= 1U << fl;
+  h->slBitmap[fl] |= 1U << sl;
+}
+
+// ******** MarkFree ************
+// flag b as free and tell its physical successor
+static void MarkFree(block_t* b) {
+  block_t* next;
+  b->size |= BLOCK_FREE;
+  next = BlockNext(b);
+  next->prevPhys = b;
+  next->size |= BLOCK_PREV_FREE;
+}
+
+static void MarkUsed(block_t* b) {
+  b->size &= ~BLOCK_FREE;
+  BlockNext(b)->size &= ~BLOCK_PREV_FREE;
+}
+
+// ******** Split ************
+// trim used or removed block b to size bytes of payload, returning the tail
+// as a new block, or 0 if the tail is too small to be a block
+static block_t* Split(block_t* b, size_t size) {
+  block_t* rest;
+  size_t left = BlockSize(b);
+  if (left < size + BLOCK_OVERHEAD + MIN_PAYLOAD) return 0;
+  rest = (block_t*)((uint8_t*)BlockToPayload(b) + size - BLOCK_OVERHEAD);
+  rest->size = left - size - BLOCK_OVERHEAD;  // flags set by caller
+  b->size = size | (b->size & BLOCK_BITS);
+  return rest;
+}
+
+// ******** Absorb ************
+// merge free block next, already removed from its list, into prev
+static void Absorb(block_t* prev, block_t* next) {
+  prev->size += BlockSize(next) + BLOCK_OVERHEAD;
+}
+
+// ******** Release ************
+// give block b, not in any list, back to its free lists, merging it with
+// free physical neighbours
+static void Release(tlsf_t* h, block_t* b) {
+  block_t* next = BlockNext(b);
+  if (b->size & BLOCK_PREV_FREE) {
+    block_t* prev = b->prevPhys;
+    RemoveFree(h, prev);
+    Absorb(prev, b);
+    b = prev;
+  }
+  if (next->size & BLOCK_FREE) {
+    RemoveFree(h, next);
+    Absorb(b, next);
+  }
+  MarkFree(b);
+  InsertFree(h, b);
+}
+
+// ******** AdjustSize ************
+// payload size for a request, 0 if it can not be satisfied
+static size_t AdjustSize(int32_t desiredBytes) {
+  size_t size;
+  if (desiredBytes <= 0 || desiredBytes >= (1L << FL_MAX)) return 0;
+  size = ((size_t)desiredBytes + ALIGN_SIZE - 1) & ~(size_t)(ALIGN_SIZE - 1);
+  return size < MIN_PAYLOAD ? MIN_PAYLOAD : size;
+}
+
+// ******** AdjustAligned ************
+// payload size for an aligned request, 0 if it can not be satisfied
+static size_t AdjustAligned(int32_t desiredBytes, int32_t alignment) {
+  size_t size = AdjustSize(desiredBytes);
+  if ((alignment <= 0) || (alignment & (alignment - 1))) return 0;
+  if ((alignment > ALIGN_SIZE) &&
+      (size + alignment + MIN_PAYLOAD + BLOCK_OVERHEAD >= (1L << FL_MAX))) {
+    return 0;  // the block searched for would exceed the largest class
+  }
+  return size;
+}
+
+// ******** FindFree ************
+// remove and return a free block of at least size bytes, 0 if none
+static block_t* FindFree(tlsf_t* h, size_t size) {
+  int fl, sl;
+  uint32_t map;
+  block_t* b;
+  MappingSearch(size, &fl, &sl);
+  if (fl < FL_COUNT) {
+    map = h->slBitmap[fl] & (~0U << sl);
+    if (map == 0) {
+      map = h->flBitmap & (fl + 1 < 32 ? ~0U << (fl + 1) : 0);
+      if (map) {
+        fl = LsBit(map);
+        map = h->slBitmap[fl];
+      }
+    }
+    if (map) {
+      b = h->blocks[fl][LsBit(map)];
+      RemoveFree(h, b);
+      return b;
+    }
+  }
+  // rounding up skipped the class of size itself; its head may still fit
+  Mapping(size, &fl, &sl);
+  b = h->blocks[fl][sl];
+  if (b && BlockSize(b) >= size) {
+    RemoveFree(h, b);
+    return b;
+  }
+  return 0;
+}
+
+// ******** Use ************
+// mark block b, taken from the free lists, used and give the part beyond
+// size bytes of payload back
+static void* Use(tlsf_t* h, block_t* b, size_t size) {
+  block_t* rest;
+  MarkUsed(b);
+  rest = Split(b, size);
+  if (rest) {
+    rest->size |= BLOCK_FREE;  // b stays used, so prev-free is clear
+    BlockNext(rest)->prevPhys = rest;
+    InsertFree(h, rest);
+    BlockNext(rest)->size |= BLOCK_PREV_FREE;
+  }
+  return BlockToPayload(b);
+}
+
+// ******** Allocate ************
+// O(1) allocation of a payload of size bytes from heap h
+static void* Allocate(tlsf_t* h, size_t size) {
+  block_t* b = FindFree(h, size);
+  if (b == 0) return 0;
+  return Use(h, b, size);
+}
+
+// ******** AllocateAligned ************
+// O(1) allocation of a payload of size bytes whose address is a multiple
+// of align, a power of two larger than ALIGN_SIZE
+// The block found is big enough for any offset of its payload. The bytes
+// in front of the aligned payload are split off as a free block of their
+// own and the tail as another, so no padding stays allocated.
+static void* AllocateAligned(tlsf_t* h, size_t size, size_t align) {
+  const size_t gapMin = MIN_PAYLOAD + BLOCK_OVERHEAD;  // smallest block
+  block_t* b = FindFree(h, size + align + gapMin);
+  block_t* aligned;
+  uintptr_t p, a;
+  if (b == 0) return 0;
+  p = (uintptr_t)BlockToPayload(b);
+  a = (p + align - 1) & ~(uintptr_t)(align - 1);
+  if ((a != p) && (a - p < gapMin)) {
+    a = (p + gapMin + align - 1) & ~(uintptr_t)(align - 1);
+  }
+  if (a != p) {
+    aligned = Split(b, a - p - BLOCK_OVERHEAD);
+    MarkFree(b);  // b is the gap now
+    InsertFree(h, b);
+    b = aligned;
+  }
+  return Use(h, b, size);
+}
+
+// ******** Trim ************
+// shrink used block b to size bytes of payload, the tail is released and
+// merges with a free successor
+static void Trim(tlsf_t* h, block_t* b, size_t size) {
+  block_t* rest = Split(b, size);
+  if (rest) Release(h, rest);
+}
+
+// ******** Reallocate ************
+// resize used block b to size bytes of payload, preferring to stay in place
+// output: payload of the resized block, 0 if there is no room
+// Grows into a free successor, then also into a free predecessor (moving
+// the data down with memmove), and copies to a new block only if neither
+// neighbour has room. Bytes moved are counted in h->copied.
+static void* Reallocate(tlsf_t* h, block_t* b, size_t size) {
+  block_t* next = BlockNext(b);
+  block_t* prev;
+  size_t old = BlockSize(b);
+  size_t room = old;
+  void* p;
+  if (next->size & BLOCK_FREE) room += BLOCK_OVERHEAD + BlockSize(next);
+  if (room >= size) {  // shrink, or grow forward in place
+    if (room > old) {
+      RemoveFree(h, next);
+      Absorb(b, next);
+      MarkUsed(b);
+    }
+    Trim(h, b, size);
+    return BlockToPayload(b);
+  }
+  if (b->size & BLOCK_PREV_FREE) {
+    prev = b->prevPhys;
+    if (BlockSize(prev) + BLOCK_OVERHEAD + room >= size) {
+      RemoveFree(h, prev);
+      if (room > old) {
+        RemoveFree(h, next);
+        Absorb(b, next);
+      }
+      Absorb(prev, b);
+      MarkUsed(prev);
+      memmove(BlockToPayload(prev), BlockToPayload(b), old);
+      h->copied += old;
+      Trim(h, prev, size);
+      return BlockToPayload(prev);
+    }
+  }
+  p = Allocate(h, size);
+  if (p) {
+    memcpy(p, BlockToPayload(b), old);
+    h->copied += old;
+    Release(h, b);
+  }
+  return p;
+}
+
+// ******** Validate ************
+// block of a pointer returned by Allocate and not yet freed, 0 if invalid
+static block_t* Validate(tlsf_t* h, void* pointer) {
+  block_t* b;
+  if ((uint8_t*)pointer < h->start + PAYLOAD_OFFSET ||
+      (uint8_t*)pointer >= h->end || ((uintptr_t)pointer & (ALIGN_SIZE - 1))) {
+    return 0;
+  }
+  b = PayloadToBlock(pointer);
+  if ((b->size & BLOCK_FREE) || BlockSize(b) < MIN_PAYLOAD ||
+      BlockSize(b) > (size_t)(h->end - (uint8_t*)pointer)) {
+    return 0;
+  }
+  return b;
+}
+
+// ******** HeapBlock ************
+// block of a pointer Heap_Malloc returned and not yet freed, 0 if invalid;
+// a pointer into an arena, which lies inside a heap block, is invalid too
+static block_t* HeapBlock(void* pointer) {
+  arena_t* a;
+  for (a = Arenas; a; a = a->next) {
+    if (((uint8_t*)pointer >= (uint8_t*)a) &&
+        ((uint8_t*)pointer < a->heap.end)) {
+      return 0;
+    }
+  }
+  return Validate(&Heap, pointer);
+}
+
+// ******** Create ************
+// lay out one free block spanning [start, start+bytes) and a zero sized
+// used block at the end that stops merging
+static void Create(tlsf_t* h, void* start, size_t bytes) {
+  block_t* b = start;
+  block_t* last;
+  memset(h, 0, sizeof(*h));
+  h->start = start;
+  h->end = (uint8_t*)start + bytes;
+  b->size = bytes - sizeof(block_t) - PAYLOAD_OFFSET + BLOCK_OVERHEAD;
+  last = BlockNext(b);
+  last->size = 0;
+  MarkFree(b);
+  InsertFree(h, b);
+}
+
+// ******** Walk ************
+// collect statistics of heap h by walking all blocks in address order
+// output: 0 if the heap is consistent, 1 if it is corrupted
+static int32_t Walk(tlsf_t* h, heap_stats_t* stats) {
+  block_t* b = (block_t*)h->start;
+  int prevFree = 0;
+  memset(stats, 0, sizeof(*stats));
+  stats->size = h->end - h->start;
+  while (BlockSize(b)) {
+    if ((uint8_t*)BlockNext(b) > h->end - sizeof(block_t)) return 1;
+    if (((b->size & BLOCK_PREV_FREE) != 0) != prevFree) return 1;
+    if (b->size & BLOCK_FREE) {
+      if (prevFree) return 1;  // neighbours should have been merged
+      stats->free += BlockSize(b);
+      stats->freeBlocks++;
+      if (BlockSize(b) > stats->largestFree) {
+        stats->largestFree = BlockSize(b);
+      }
+    } else {
+      stats->used += BlockSize(b);
+    }
+    prevFree = b->size & BLOCK_FREE;
+    b = BlockNext(b);
+  }
+  stats->reallocCopied = h->copied;
+  if (stats->free) {
+    stats->fragmentation = 100 - (100 * stats->largestFree) / stats->free;
+  }
+  return 0;
+}
 
 //******** Heap_Init ***************
 // Initialize the Heap
@@ -36,7 +528,16 @@
 // notes: Initializes/resets the heap to a clean state where no memory
 //  is allocated.
 int32_t Heap_Init(void) {
-  return 1;  // replace
+  long sr = StartCritical();
+  Create(&Heap, HeapMemory, sizeof(HeapMemory));
+  Arenas = 0;  // any arenas were in the old heap
+  NumIsrClasses = 0;  // and any buffers kept for interrupt handlers
+#ifdef HEAP_PROFILE
+  memset(&Profile, 0, sizeof(Profile));
+  TracePut = TraceGet = 0;
+#endif
+  EndCritical(sr);
+  return 0;
 }
 
 //******** Heap_Malloc ***************
@@ -45,8 +546,17 @@ int32_t Heap_Init(void) {
 //   desiredBytes: desired number of bytes to allocate
 // output: void* pointing to the allocated memory or will return NULL
 //   if there isn't sufficient space to satisfy allocation request
+// notes: constant time, can be called from an ISR
 void* Heap_Malloc(int32_t desiredBytes) {
-  return 0;  // NULL
+  void* p;
+  long sr;
+  size_t size = AdjustSize(desiredBytes);
+  if (size == 0) return 0;
+  sr = StartCritical();
+  p = Allocate(&Heap, size);
+  PROFILE(HEAP_MALLOC, desiredBytes, p, 0, 0);
+  EndCritical(sr);
+  return p;
 }
 
 //******** Heap_Calloc ***************
@@ -57,7 +567,40 @@ void* Heap_Malloc(int32_t desiredBytes) {
 //   if there isn't sufficient space to satisfy allocation request
 // notes: the allocated memory block will be zeroed out
 void* Heap_Calloc(int32_t desiredBytes) {
-  return 0;  // NULL
+  void* p;
+  long sr;
+  size_t size = AdjustSize(desiredBytes);
+  if (size == 0) return 0;
+  sr = StartCritical();
+  p = Allocate(&Heap, size);
+  PROFILE(HEAP_CALLOC, desiredBytes, p, 0, 0);
+  EndCritical(sr);
+  if (p) memset(p, 0, desiredBytes);
+  return p;
+}
+
+//******** Heap_AlignedMalloc ***************
+// Allocate memory at an address that is a multiple of alignment
+// input:
+//   desiredBytes: desired number of bytes to allocate
+//   alignment: power of two, e.g. 8 for doubles or the size of an MPU region
+// output: void* pointing to the allocated memory or will return NULL
+//   if there isn't sufficient space or alignment is not a power of two
+// notes: constant time; free the memory with Heap_Free
+void* Heap_AlignedMalloc(int32_t desiredBytes, int32_t alignment) {
+  void* p;
+  long sr;
+  size_t size = AdjustAligned(desiredBytes, alignment);
+  if (size == 0) return 0;
+  sr = StartCritical();
+  if (alignment > ALIGN_SIZE) {
+    p = AllocateAligned(&Heap, size, alignment);
+  } else {
+    p = Allocate(&Heap, size);
+  }
+  PROFILE(HEAP_MALLOC, desiredBytes, p, 0, 0);
+  EndCritical(sr);
+  return p;
 }
 
 //******** Heap_Realloc ***************
@@ -69,8 +612,30 @@ void* Heap_Calloc(int32_t desiredBytes) {
 //   if there is any reason the reallocation can't be completed
 // notes: the given block may be unallocated and its contents
 //   are copied to a new block if growing/shrinking not possible
+//   shrinking frees the tail; growing first absorbs a free neighbour after
+//   and/or before the block, so data are copied only as a last resort
 void* Heap_Realloc(void* oldBlock, int32_t desiredBytes) {
-  return 0;  // NULL
+  block_t* b;
+  void* p;
+  size_t size = AdjustSize(desiredBytes);
+  size_t oldSize = 0;
+  long sr;
+  if (size == 0) return 0;
+  sr = StartCritical();
+  if (oldBlock == 0) {
+    p = Allocate(&Heap, size);
+  } else {
+    b = HeapBlock(oldBlock);
+    if (b == 0) {
+      EndCritical(sr);
+      return 0;
+    }
+    oldSize = BlockSize(b);
+    p = Reallocate(&Heap, b, size);
+  }
+  PROFILE(HEAP_REALLOC, desiredBytes, p, oldBlock, oldSize);
+  EndCritical(sr);
+  return p;
 }
 
 //******** Heap_Free ***************
@@ -78,9 +643,20 @@ void* Heap_Realloc(void* oldBlock, int32_t desiredBytes) {
 // input: pointer to memory to unallocate
 // output: 0 if everything is ok, non-zero in case of error (e.g. invalid
 // pointer
-//     or trying to unallocate memory that has already been unallocated
+//     or trying to unallocate memory that has already been unallocated,
+//     or memory of an arena, see Arena_Free)
+// notes: constant time apart from the list of arenas, can be called from
+//   an ISR
 int32_t Heap_Free(void* pointer) {
-  return 1;  // replace
+  block_t* b;
+  long sr = StartCritical();
+  b = HeapBlock(pointer);
+  if (b) {
+    PROFILE(HEAP_FREE, 0, pointer, 0, BlockSize(b));
+    Release(&Heap, b);
+  }
+  EndCritical(sr);
+  return b == 0;
 }
 
 //******** Heap_Stats ***************
@@ -88,6 +664,552 @@ int32_t Heap_Free(void* pointer) {
 // input: reference to a heap_stats_t that returns the current usage of the heap
 // output: 0 in case of success, non-zeror in case of error (e.g. corrupted
 // heap)
+// notes: walks every block, so takes time proportional to their number
 int32_t Heap_Stats(heap_stats_t* stats) {
-  return 1;  // replace
+  int32_t result;
+  long sr = StartCritical();
+  result = Walk(&Heap, stats);
+  EndCritical(sr);
+  return result;
+}
+
+#ifdef HEAP_PROFILE
+// ******** Account ************
+// add an allocated block to the histogram and, if it is a block of the
+// heap rather than of an arena, to the usage; or take it out
+static void Account(size_t size, int allocated, int heap) {
+  int c;
+  size += BLOCK_OVERHEAD;
+  c = MsBit(size);
+  if (!heap) size = 0;  // the arena is counted as one block
+  if (allocated) {
+    Profile.live[c]++;
+    Profile.allocs[c]++;
+    Profile.used += size;
+    if (Profile.used > Profile.peak) Profile.peak = Profile.used;
+  } else {
+    Profile.live[c]--;
+    Profile.used -= size;
+  }
+}
+
+// ******** Unaccount ************
+// take the blocks still allocated in an arena out of the histogram, before
+// Arena_Destroy releases them all at once
+// called with interrupts disabled
+static void Unaccount(arena_t* arena) {
+  block_t* b;
+  for (b = (block_t*)arena->heap.start; BlockSize(b); b = BlockNext(b)) {
+    if (!(b->size & BLOCK_FREE)) Account(BlockSize(b), 0, 0);
+  }
+}
+
+// ******** Record ************
+// account for a heap operation and put it into the trace ring
+// Inputs:  op, see heap_event_t
+//          bytes asked for, block returned (or freed), block passed to
+//          Heap_Realloc or arena of the block, size of the block freed or
+//          passed to Heap_Realloc, return address of the public function
+// called with interrupts disabled
+static void Record(uint8_t op, int32_t bytes, void* block, void* old,
+                   size_t oldSize, uint32_t caller) {
+  heap_event_t* e;
+  int heap = (op != HEAP_ARENA_MALLOC) && (op != HEAP_ARENA_FREE);
+  if ((op == HEAP_FREE) || (op == HEAP_DESTROY) || (op == HEAP_ARENA_FREE)) {
+    Account(oldSize, 0, heap);
+  } else if (block) {
+    if (oldSize) Account(oldSize, 0, 1);  // Heap_Realloc replaced it
+    Account(BlockSize(PayloadToBlock(block)), 1, heap);
+  } else {
+    Profile.failures++;
+  }
+  if (TracePut - TraceGet >= HEAP_TRACE) {
+    Profile.lost++;
+    return;
+  }
+  e = &Trace[TracePut++ % HEAP_TRACE];
+  e->time = OS_Time();
+  e->caller = caller;
+  e->size = bytes;
+  e->block = block ? (uint8_t*)block - (uint8_t*)HeapMemory : 0;
+  e->old = old ? (uint8_t*)old - (uint8_t*)HeapMemory : 0;
+  e->op = op;
+  e->id = OS_Id();
+}
+#endif
+
+//******** Heap_Profile ***************
+// return the size-class histogram and the peak usage of the heap
+// input: reference to a heap_profile_t to fill in
+// output: 0 in case of success, non-zero if the profiler is not compiled in
+int32_t Heap_Profile(heap_profile_t* profile) {
+#ifdef HEAP_PROFILE
+  long sr = StartCritical();
+  *profile = Profile;
+  EndCritical(sr);
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+//******** Heap_TraceGet ***************
+// take the oldest event out of the trace ring
+// input: reference to a heap_event_t to fill in
+// output: 0 in case of success, non-zero if the ring is empty or the
+//   profiler is not compiled in
+int32_t Heap_TraceGet(heap_event_t* event) {
+#ifdef HEAP_PROFILE
+  long sr = StartCritical();
+  if (TraceGet == TracePut) {
+    EndCritical(sr);
+    return 1;
+  }
+  *event = Trace[TraceGet++ % HEAP_TRACE];
+  EndCritical(sr);
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+//******** Arena_Create ***************
+// Carve an arena, a private heap, out of the heap
+// input: bytes that can be allocated in the arena, at least in one block
+// output: handle of the arena or NULL if the heap has no room for it
+// notes: constant time apart from the list of arenas kept for Arena_Of
+arena_t* Arena_Create(int32_t bytes) {
+  arena_t* a;
+  size_t size = AdjustSize(bytes);
+  size_t region;
+  long sr;
+  if (size == 0) return 0;
+  // the region also holds the first block's prevPhys and the end block
+  region = size + sizeof(block_t) + PAYLOAD_OFFSET - BLOCK_OVERHEAD;
+  if (sizeof(arena_t) + region >= (1L << FL_MAX)) return 0;
+  sr = StartCritical();
+  a = Allocate(&Heap, sizeof(arena_t) + region);
+  PROFILE(HEAP_ARENA, bytes, a, 0, 0);
+  if (a) {
+    Create(&a->heap, a + 1, region);
+    a->prev = 0;
+    a->next = Arenas;
+    if (Arenas) Arenas->prev = a;
+    Arenas = a;
+  }
+  EndCritical(sr);
+  return a;
+}
+
+//******** Arena_Malloc ***************
+// Allocate memory in an arena, data not initialized
+// input: arena from Arena_Create, desired number of bytes to allocate
+// output: void* pointing to the allocated memory or NULL if the arena is
+//   full
+// notes: constant time, can be called from an ISR
+void* Arena_Malloc(arena_t* arena, int32_t desiredBytes) {
+  void* p;
+  long sr;
+  size_t size = AdjustSize(desiredBytes);
+  if (size == 0) return 0;
+  sr = StartCritical();
+  p = Allocate(&arena->heap, size);
+  PROFILE(HEAP_ARENA_MALLOC, desiredBytes, p, arena, 0);
+  EndCritical(sr);
+  return p;
+}
+
+//******** Arena_AlignedMalloc ***************
+// Allocate memory in an arena at an address that is a multiple of alignment
+// input: arena from Arena_Create, desired number of bytes to allocate,
+//   alignment, a power of two
+// output: void* pointing to the allocated memory or NULL if the arena is
+//   full or alignment is not a power of two
+// notes: constant time, free the memory with Arena_Free
+void* Arena_AlignedMalloc(arena_t* arena, int32_t desiredBytes,
+                          int32_t alignment) {
+  void* p;
+  long sr;
+  size_t size = AdjustAligned(desiredBytes, alignment);
+  if (size == 0) return 0;
+  sr = StartCritical();
+  if (alignment > ALIGN_SIZE) {
+    p = AllocateAligned(&arena->heap, size, alignment);
+  } else {
+    p = Allocate(&arena->heap, size);
+  }
+  PROFILE(HEAP_ARENA_MALLOC, desiredBytes, p, arena, 0);
+  EndCritical(sr);
+  return p;
+}
+
+//******** Arena_Free ***************
+// return a block to the arena it was allocated in
+// input: arena from Arena_Create, pointer from Arena_Malloc on it
+// output: 0 if everything is ok, non-zero in case of error
+int32_t Arena_Free(arena_t* arena, void* pointer) {
+  block_t* b;
+  long sr = StartCritical();
+  b = Validate(&arena->heap, pointer);
+  if (b) {
+    PROFILE(HEAP_ARENA_FREE, 0, pointer, arena, BlockSize(b));
+    Release(&arena->heap, b);
+  }
+  EndCritical(sr);
+  return b == 0;
+}
+
+//******** Arena_Destroy ***************
+// release an arena and everything allocated in it back to the heap
+// input: arena from Arena_Create
+// output: 0 if everything is ok, non-zero if arena is not a live arena
+// notes: constant time, whatever was allocated in the arena
+int32_t Arena_Destroy(arena_t* arena) {
+  block_t* b;
+  long sr = StartCritical();
+  b = Validate(&Heap, arena);
+  if (b) {
+    if (arena->prev) {
+      arena->prev->next = arena->next;
+    } else {
+      Arenas = arena->next;
+    }
+    if (arena->next) arena->next->prev = arena->prev;
+    Unaccount(arena);
+    PROFILE(HEAP_DESTROY, 0, arena, 0, BlockSize(b));
+    Release(&Heap, b);
+  }
+  EndCritical(sr);
+  return b == 0;
+}
+
+//******** Arena_Of ***************
+// find the arena a pointer was allocated in
+// input: pointer to memory
+// output: the arena containing it, NULL if it is not inside any arena
+arena_t* Arena_Of(void* pointer) {
+  arena_t* a;
+  long sr = StartCritical();
+  for (a = Arenas; a; a = a->next) {
+    if (((uint8_t*)pointer >= a->heap.start) &&
+        ((uint8_t*)pointer < a->heap.end)) {
+      break;
+    }
+  }
+  EndCritical(sr);
+  return a;
+}
+
+//******** Arena_Stats ***************
+// return the current status of an arena
+// input: arena from Arena_Create, reference to a heap_stats_t to fill in
+// output: 0 in case of success, non-zero if the arena is corrupted
+int32_t Arena_Stats(arena_t* arena, heap_stats_t* stats) {
+  int32_t result;
+  long sr = StartCritical();
+  result = Walk(&arena->heap, stats);
+  EndCritical(sr);
+  return result;
+}
+
+// Buffers for interrupt handlers. An interrupt can preempt a thread that is
+// in the middle of a push or pop, so the lists are lock free rather than
+// protected by critical sections: on the Cortex M4 every exception entry
+// and return clears the exclusive monitor, so a LDREX/STREX sequence that
+// was interrupted fails and is retried, which also rules out ABA. Host
+// builds, used by the single-threaded tests, use compare and swap.
+
+// ******** AtomicAdd ************
+static void AtomicAdd(volatile int32_t* x, int32_t n) {
+#ifdef __CC_ARM
+  int32_t v;
+  do {
+    v = __ldrex(x) + n;
+  } while (__strex(v, x));
+#else
+  __atomic_add_fetch(x, n, __ATOMIC_RELAXED);
+#endif
+}
+
+// ******** Push ************
+// put buffer p on the free list of class c
+static void Push(isr_class_t* c, void* p) {
+#ifdef __CC_ARM
+  do {
+    *(void**)p = (void*)__ldrex((volatile uint32_t*)&c->head);
+  } while (__strex((uint32_t)p, (volatile uint32_t*)&c->head));
+#else
+  void* head = c->head;
+  do {
+    *(void**)p = head;
+  } while (!__atomic_compare_exchange_n(&c->head, &head, p, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#endif
+  AtomicAdd(&c->count, 1);
+}
+
+// ******** Pop ************
+// take a buffer off the free list of class c, 0 if it is empty
+static void* Pop(isr_class_t* c) {
+  void* head;
+#ifdef __CC_ARM
+  do {
+    head = (void*)__ldrex((volatile uint32_t*)&c->head);
+    if (head == 0) {
+      __clrex();
+      return 0;
+    }
+  } while (__strex((uint32_t)(*(void**)head), (volatile uint32_t*)&c->head));
+#else
+  head = c->head;
+  while (head &&
+         !__atomic_compare_exchange_n(&c->head, &head, *(void**)head, 1,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+  }
+  if (head == 0) return 0;
+#endif
+  AtomicAdd(&c->count, -1);
+  if (c->count < c->minFree) c->minFree = c->count;  // statistics only
+  return head;
+}
+
+//******** Heap_IsrPool ***************
+// keep a number of free buffers of one size ready for interrupt handlers
+// input: bytes in each buffer, number of buffers to keep ready
+// output: 0 if successful, non-zero if there are already ISR_CLASSES sizes
+//   or the size exists
+// notes: call Heap_IsrRefill to allocate the buffers
+int32_t Heap_IsrPool(int32_t bytes, int32_t depth) {
+  int i;
+  long sr;
+  size_t size = AdjustSize(bytes);
+  if ((size == 0) || (depth <= 0)) return 1;
+  sr = StartCritical();
+  if (NumIsrClasses == ISR_CLASSES) {
+    EndCritical(sr);
+    return 1;
+  }
+  for (i = NumIsrClasses; (i > 0) && (IsrClasses[i - 1].size >= size); i--) {
+    if (IsrClasses[i - 1].size == size) {
+      EndCritical(sr);
+      return 1;
+    }
+    IsrClasses[i] = IsrClasses[i - 1];  // keep the sizes in order
+  }
+  memset(&IsrClasses[i], 0, sizeof(isr_class_t));
+  IsrClasses[i].size = size;
+  IsrClasses[i].depth = depth;
+  IsrClasses[i].minFree = depth;
+  NumIsrClasses++;
+  EndCritical(sr);
+  return 0;
+}
+
+//******** Heap_IsrRefill ***************
+// allocate buffers from the heap for every size kept for interrupt
+// handlers that has fewer than its number ready
+// input: none
+// output: number of buffers added
+// notes: call from a thread, see OS_AddIsrBuffers; each allocation is a
+//   separate critical section
+int32_t Heap_IsrRefill(void) {
+  int32_t added = 0;
+  int i;
+  void* p;
+  for (i = 0; i < NumIsrClasses; i++) {
+    while (IsrClasses[i].count < (int32_t)IsrClasses[i].depth) {
+      p = Heap_Malloc(IsrClasses[i].size);
+      if (p == 0) return added;  // heap full, try again next time
+      Push(&IsrClasses[i], p);
+      added++;
+    }
+  }
+  return added;
+}
+
+//******** Heap_IsrNotify ***************
+// have Heap_IsrMalloc call a function when it leaves a size low
+// input: void/void function that does not block, NULL for none
+// output: none
+void Heap_IsrNotify(void (*notify)(void)) { IsrNotify = notify; }
+
+//******** Heap_IsrMalloc ***************
+// allocate a buffer, from any context
+// input: desired number of bytes
+// output: void* pointing to a buffer of the smallest size set up with
+//   Heap_IsrPool that is ready and holds desiredBytes, NULL if none is
+// notes: lock free and bounded in time, for interrupt handlers
+void* Heap_IsrMalloc(int32_t desiredBytes) {
+  int i;
+  void* p;
+  for (i = 0; i < NumIsrClasses; i++) {
+    if (IsrClasses[i].size >= (uint32_t)desiredBytes) {
+      p = Pop(&IsrClasses[i]);
+      if (IsrNotify && (IsrClasses[i].count < (int32_t)IsrClasses[i].depth)) {
+        IsrNotify();  // time to refill it
+      }
+      if (p) return p;
+      IsrClasses[i].failures++;  // try the next larger size
+    }
+  }
+  return 0;
+}
+
+//******** Heap_IsrFree ***************
+// return a buffer from Heap_IsrMalloc, from any context
+// input: pointer to the buffer
+// output: 0 if everything is ok, non-zero in case of error
+// notes: the buffer goes back to its list, or to the heap when the list
+//   already has its number of buffers ready
+int32_t Heap_IsrFree(void* pointer) {
+  int i;
+  size_t size;
+  block_t* b = HeapBlock(pointer);
+  if (b == 0) return 1;
+  size = BlockSize(b);
+  for (i = NumIsrClasses - 1; i >= 0; i--) {
+    if (IsrClasses[i].size <= size) {
+      if (IsrClasses[i].count < (int32_t)IsrClasses[i].depth) {
+        Push(&IsrClasses[i], pointer);
+        return 0;
+      }
+      break;
+    }
+  }
+  return Heap_Free(pointer);
+}
+
+//******** Heap_IsrStats ***************
+// return the state of one size of buffers kept for interrupt handlers
+// input: index, 0 for the smallest size
+//   reference to a heap_isr_stats_t to fill in
+// output: 0 if successful, 1 if there is no such size
+int32_t Heap_IsrStats(uint32_t index, heap_isr_stats_t* stats) {
+  if (index >= (uint32_t)NumIsrClasses) return 1;
+  stats->size = IsrClasses[index].size;
+  stats->depth = IsrClasses[index].depth;
+  stats->free = IsrClasses[index].count;
+  stats->minFree = IsrClasses[index].minFree;
+  stats->failures = IsrClasses[index].failures;
+  return 0;
+}
+
+// Fixed-size block pools. Each pool is a contiguous array of equal blocks;
+// free blocks are linked through their first word, so allocation and
+// release pop and push the head of that list. Pools are carved out of their
+// own region, not the heap, so they survive Heap_Init and are never freed.
+struct pool {
+  void* freeList;      // first free block, its first word links the next
+  uint8_t* base;       // first block
+  uint8_t* end;        // one past the last block
+  uint32_t blockSize;  // bytes in each block, word multiple
+  uint32_t count;      // number of blocks
+  uint32_t free;       // blocks on freeList
+  uint32_t minFree;    // low watermark of free
+  uint32_t failures;   // Pool_Alloc calls that found the pool empty
+};
+
+static size_t PoolMemory[POOL_SIZE / sizeof(size_t)];
+static uint32_t PoolUsed;  // bytes of PoolMemory handed out
+
+//******** Pool_Create ***************
+// Create a pool of equal sized blocks
+// input:
+//   blockSize: bytes in each block, rounded up to a multiple of the word size
+//   count: number of blocks
+// output: handle of the new pool, NULL if the pool region is too small
+// notes: the blocks are contiguous, block i is at Pool_Base(pool)+i*size;
+//   call during initialization, a pool can not be destroyed
+pool_t* Pool_Create(uint32_t blockSize, uint32_t count) {
+  pool_t* pool;
+  uint8_t* block;
+  uint32_t bytes, i;
+  long sr;
+  blockSize = (blockSize + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+  if (blockSize < sizeof(void*)) blockSize = sizeof(void*);
+  if (count == 0 || count > POOL_SIZE / blockSize) return 0;
+  bytes = (sizeof(pool_t) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+  bytes += blockSize * count;
+  sr = StartCritical();
+  if (bytes > sizeof(PoolMemory) - PoolUsed) {
+    EndCritical(sr);
+    return 0;
+  }
+  pool = (pool_t*)((uint8_t*)PoolMemory + PoolUsed);
+  PoolUsed += bytes;
+  EndCritical(sr);
+  pool->base = (uint8_t*)PoolMemory + PoolUsed - blockSize * count;
+  pool->end = pool->base + blockSize * count;
+  pool->blockSize = blockSize;
+  pool->count = count;
+  pool->free = count;
+  pool->minFree = count;
+  pool->failures = 0;
+  pool->freeList = pool->base;  // link the blocks in address order
+  for (i = 0, block = pool->base; i < count - 1; i++, block += blockSize) {
+    *(void**)block = block + blockSize;
+  }
+  *(void**)block = 0;
+  return pool;
+}
+
+//******** Pool_Alloc ***************
+// Take a block from a pool, data not initialized
+// input: pool from Pool_Create
+// output: pointer to the block, NULL if the pool is exhausted
+// notes: constant time, can be called from an ISR
+void* Pool_Alloc(pool_t* pool) {
+  void* block;
+  long sr = StartCritical();
+  block = pool->freeList;
+  if (block) {
+    pool->freeList = *(void**)block;
+    pool->free--;
+    if (pool->free < pool->minFree) pool->minFree = pool->free;
+  } else {
+    pool->failures++;
+  }
+  EndCritical(sr);
+  return block;
+}
+
+//******** Pool_Free ***************
+// Return a block to the pool it came from
+// input: pool from Pool_Create, block from Pool_Alloc on that pool
+// output: 0 if everything is ok, non-zero if block is not in this pool
+// notes: constant time, can be called from an ISR
+int32_t Pool_Free(pool_t* pool, void* block) {
+  long sr;
+  uint8_t* b = block;
+  if (b < pool->base || b >= pool->end ||
+      (uint32_t)(b - pool->base) % pool->blockSize) {
+    return 1;
+  }
+  sr = StartCritical();
+  *(void**)block = pool->freeList;
+  pool->freeList = block;
+  pool->free++;
+  EndCritical(sr);
+  return 0;
+}
+
+//******** Pool_Base ***************
+// Address of the first block of a pool
+// input: pool from Pool_Create
+// output: pointer to block 0, the others follow every blockSize bytes
+void* Pool_Base(pool_t* pool) { return pool->base; }
+
+//******** Pool_Stats ***************
+// return the current status of a pool
+// input: pool from Pool_Create, reference to a pool_stats_t to fill in
+// output: always 0
+int32_t Pool_Stats(pool_t* pool, pool_stats_t* stats) {
+  long sr = StartCritical();
+  stats->blockSize = pool->blockSize;
+  stats->count = pool->count;
+  stats->free = pool->free;
+  stats->minFree = pool->minFree;
+  stats->failures = pool->failures;
+  EndCritical(sr);
+  return 0;
 }
@@ -17,9 +17,13 @@
 
 // struct for holding statistics on the state of the heap
 typedef struct heap_stats {
-  uint32_t size;  // heap size (in bytes)
-  uint32_t used;  // number of bytes used/allocated
-  uint32_t free;  // number of bytes available to allocate
+  uint32_t size;           // heap size (in bytes)
+  uint32_t used;           // number of bytes used/allocated
+  uint32_t free;           // number of bytes available to allocate
+  uint32_t largestFree;    // largest single allocation possible (in bytes)
+  uint32_t freeBlocks;     // number of free blocks
+  uint32_t fragmentation;  // percent of free bytes outside the largest block
+  uint32_t reallocCopied;  // bytes Heap_Realloc moved since Heap_Init
 } heap_stats_t;
 
 /**
@@ -36,7 +40,7 @@ int32_t Heap_Init(void);
  * @param  desiredBytes: desired number of bytes to allocate
  * @return void* pointing to the allocated memory or will return NULL
  *         if there isn't sufficient space to satisfy allocation request
- * @brief  Allocate memory
+ * @brief  Allocate memory, in constant time, also from an ISR
  */
 void* Heap_Malloc(int32_t desiredBytes);
 
@@ -50,7 +54,21 @@ void* Heap_Malloc(int32_t desiredBytes);
 void* Heap_Calloc(int32_t desiredBytes);
 
 /**
- * @details Reallocate buffer to a new size. The given block may be
+ * @details Allocate memory at an address that is a multiple of alignment,
+ *          in constant time. The padding in front of the block is left
+ *          free for other allocations. Free it with Heap_Free.
+ * @param  desiredBytes: desired number of bytes to allocate
+ * @param  alignment: power of two, e.g. 8 for doubles or the size of an
+ *         MPU region
+ * @return void* pointing to the allocated memory or NULL if there isn't
+ *         sufficient space or alignment is not a power of two
+ * @brief  Allocate aligned memory
+ */
+void* Heap_AlignedMalloc(int32_t desiredBytes, int32_t alignment);
+
+/**
+ * @details Reallocate buffer to a new size. The block is resized in place
+ *          when it or its free neighbours have room; only otherwise is it
  *          unallocated and its contents copied to a new block
  * @param  oldBlock: pointer to a block
  * @param  desiredBytes: a desired number of bytes for a new block
@@ -64,7 +82,8 @@ void* Heap_Realloc(void* oldBlock, int32_t desiredBytes);
  * @details Return a block to the heap
  * @param  pointer to memory to unallocate
  * @return 0 if everything is ok, non-zero in case of error (e.g. invalid
- * pointer or trying to unallocate memory that has already been unallocated)
+ * pointer or trying to unallocate memory that has already been unallocated,
+ * or memory of an arena, which goes back with Arena_Free)
  * @brief  Free memory
  */
 int32_t Heap_Free(void* pointer);
@@ -79,4 +98,268 @@ int32_t Heap_Free(void* pointer);
  */
 int32_t Heap_Stats(heap_stats_t* stats);
 
+// Heap profiler, compiled in when HEAP_PROFILE is defined for heap.c.
+// Every Heap_Malloc, Heap_Calloc, Heap_Realloc and Heap_Free, every arena
+// created or destroyed and every allocation in an arena is recorded in a
+// trace ring for replay on the host (tests/RTOS_Labs_common/replay_heap).
+#define HEAP_MALLOC 'm'  // heap_event_t op values
+#define HEAP_CALLOC 'c'
+#define HEAP_REALLOC 'r'
+#define HEAP_FREE 'f'
+#define HEAP_ARENA 'A'          // Arena_Create
+#define HEAP_DESTROY 'D'        // Arena_Destroy
+#define HEAP_ARENA_MALLOC 'M'   // Arena_Malloc, Arena_AlignedMalloc
+#define HEAP_ARENA_FREE 'F'     // Arena_Free
+#define HEAP_CLASSES 16  // class c holds blocks of 2^c to 2^(c+1)-1 bytes
+
+// one heap operation, see Heap_TraceGet
+typedef struct heap_event {
+  uint32_t time;    // OS_Time() of the call
+  uint32_t caller;  // return address into the code that called the heap
+  uint16_t size;    // bytes asked for, 0 for HEAP_FREE
+  uint16_t block;   // heap offset of the block returned or freed, 0 for NULL
+  uint16_t old;     // HEAP_REALLOC: heap offset of the block passed in,
+                    // HEAP_ARENA_MALLOC/FREE: heap offset of the arena
+  uint8_t op;       // HEAP_MALLOC, HEAP_ARENA, ..., see above
+  uint8_t id;       // OS_Id() of the calling thread
+} heap_event_t;
+
+// live profile of the heap, see Heap_Profile
+typedef struct heap_profile {
+  uint32_t used;                  // bytes in allocated blocks, with headers
+  uint32_t peak;                  // largest used since Heap_Init
+  uint32_t failures;              // allocations that returned NULL
+  uint32_t lost;                  // events dropped, the trace ring was full
+  uint32_t live[HEAP_CLASSES];    // allocated blocks per size class
+  uint32_t allocs[HEAP_CLASSES];  // allocations since Heap_Init per class
+  // live and allocs count the blocks in arenas too; used and peak count an
+  // arena as the one heap block it is
+} heap_profile_t;
+
+/**
+ * @details Return the size-class histogram and the peak usage watermark of
+ *          the heap, kept up to date by every operation
+ * @param  profile: reference to a heap_profile_t to fill in
+ * @return 0 in case of success, non-zero if heap.c was compiled without
+ *         HEAP_PROFILE
+ * @brief  Get heap profile
+ */
+int32_t Heap_Profile(heap_profile_t* profile);
+
+/**
+ * @details Take the oldest event out of the trace ring. When the ring is
+ *          full new events are dropped and counted in heap_profile_t lost,
+ *          so drain it often enough to get a complete trace.
+ * @param  event: reference to a heap_event_t to fill in
+ * @return 0 in case of success, non-zero if the ring is empty or heap.c was
+ *         compiled without HEAP_PROFILE
+ * @brief  Read heap trace
+ */
+int32_t Heap_TraceGet(heap_event_t* event);
+
+// a private heap inside the heap, see Arena_Create
+typedef struct arena arena_t;
+
+/**
+ * @details Carve an arena out of the heap. An arena is a heap of its own,
+ *          used for example for all memory of one process, and is released
+ *          as a whole by Arena_Destroy. The heap must be initialized.
+ * @param  bytes: number of bytes that can be allocated in the arena
+ * @return arena_t* handle of the arena or NULL if the heap has no room
+ * @brief  Create an arena
+ */
+arena_t* Arena_Create(int32_t bytes);
+
+/**
+ * @details Allocate memory in an arena in constant time, data not
+ *          initialized
+ * @param  arena: arena from Arena_Create
+ * @param  desiredBytes: desired number of bytes to allocate
+ * @return void* pointing to the allocated memory or NULL if the arena is
+ *         full
+ * @brief  Allocate memory in an arena
+ */
+void* Arena_Malloc(arena_t* arena, int32_t desiredBytes);
+
+/**
+ * @details Allocate memory in an arena at an address that is a multiple of
+ *          alignment, see Heap_AlignedMalloc
+ * @param  arena: arena from Arena_Create
+ * @param  desiredBytes: desired number of bytes to allocate
+ * @param  alignment: power of two
+ * @return void* pointing to the allocated memory or NULL if the arena is
+ *         full or alignment is not a power of two
+ * @brief  Allocate aligned memory in an arena
+ */
+void* Arena_AlignedMalloc(arena_t* arena, int32_t desiredBytes,
+                          int32_t alignment);
+
+/**
+ * @details Return a block to the arena it was allocated in
+ * @param  arena: arena from Arena_Create
+ * @param  pointer: memory from Arena_Malloc on the same arena
+ * @return 0 if everything is ok, non-zero in case of error
+ * @brief  Free memory in an arena
+ */
+int32_t Arena_Free(arena_t* arena, void* pointer);
+
+/**
+ * @details Return an arena and all memory allocated in it to the heap, in
+ *          constant time
+ * @param  arena: arena from Arena_Create
+ * @return 0 if everything is ok, non-zero if arena is not a live arena
+ * @brief  Destroy an arena
+ */
+int32_t Arena_Destroy(arena_t* arena);
+
+/**
+ * @details Find the arena a block of memory was allocated in
+ * @param  pointer: pointer to memory
+ * @return arena_t* containing pointer or NULL if it is in no arena
+ * @brief  Arena of a pointer
+ */
+arena_t* Arena_Of(void* pointer);
+
+/**
+ * @details Return the current usage status of an arena
+ * @param  arena: arena from Arena_Create
+ * @param  stats: reference to a heap_stats_t to fill in
+ * @return 0 in case of success, non-zero in case of error (e.g. corrupted
+ * arena)
+ * @brief  Get arena usage
+ */
+int32_t Arena_Stats(arena_t* arena, heap_stats_t* stats);
+
+// struct for holding statistics on one size of buffers for interrupt
+// handlers, see Heap_IsrPool
+typedef struct heap_isr_stats {
+  uint32_t size;      // bytes in each buffer
+  uint32_t depth;     // buffers kept ready
+  uint32_t free;      // buffers ready now
+  uint32_t minFree;   // fewest buffers that were ever ready
+  uint32_t failures;  // Heap_IsrMalloc calls that found none of this size
+} heap_isr_stats_t;
+
+/**
+ * @details Keep free buffers of one size ready for interrupt handlers,
+ *          which can not wait for the heap. Up to 4 sizes. The buffers are
+ *          allocated by Heap_IsrRefill, called by a kernel thread (see
+ *          OS_AddIsrBuffers). Heap_Init drops all sizes.
+ * @param  bytes: bytes in each buffer
+ * @param  depth: number of buffers to keep ready
+ * @return 0 if successful, non-zero if there are too many sizes or this
+ *         size exists already
+ * @brief  Set up buffers for interrupt handlers
+ */
+int32_t Heap_IsrPool(int32_t bytes, int32_t depth);
+
+/**
+ * @details Allocate heap buffers for every size of Heap_IsrPool until it
+ *          has its number of buffers ready, or the heap is full. Call from
+ *          a thread.
+ * @param  none
+ * @return number of buffers allocated
+ * @brief  Refill buffers for interrupt handlers
+ */
+int32_t Heap_IsrRefill(void);
+
+/**
+ * @details Have Heap_IsrMalloc call notify whenever it leaves a size with
+ *          fewer buffers ready than it keeps, or finds none, so a thread
+ *          can wait to refill them instead of polling. notify runs in the
+ *          context of Heap_IsrMalloc and must not block, e.g. OS_bSignal.
+ * @param  notify: void/void function, NULL for none
+ * @return none
+ * @brief  Signal when buffers for interrupt handlers run low
+ */
+void Heap_IsrNotify(void (*notify)(void));
+
+/**
+ * @details Take a ready buffer of the smallest size of Heap_IsrPool that
+ *          holds desiredBytes, trying larger sizes if that one has none.
+ *          Lock free and bounded in time, callable from any context; the
+ *          buffer can be handed on to a thread.
+ * @param  desiredBytes: desired number of bytes
+ * @return void* pointing to the buffer or NULL if none is ready
+ * @brief  Allocate memory in an interrupt handler
+ */
+void* Heap_IsrMalloc(int32_t desiredBytes);
+
+/**
+ * @details Return a buffer from Heap_IsrMalloc, from any context. It goes
+ *          back to the ready buffers, or to the heap if enough are ready.
+ * @param  pointer: buffer from Heap_IsrMalloc
+ * @return 0 if everything is ok, non-zero in case of error
+ * @brief  Free memory from an interrupt handler
+ */
+int32_t Heap_IsrFree(void* pointer);
+
+/**
+ * @details Return the state of one size of buffers for interrupt handlers
+ * @param  index: 0 for the smallest size set up with Heap_IsrPool
+ * @param  stats: reference to a heap_isr_stats_t to fill in
+ * @return 0 if successful, 1 if there is no such size
+ * @brief  Get interrupt buffer usage
+ */
+int32_t Heap_IsrStats(uint32_t index, heap_isr_stats_t* stats);
+
+// a pool of fixed-size blocks, see Pool_Create
+typedef struct pool pool_t;
+
+// struct for holding statistics on the state of a pool
+typedef struct pool_stats {
+  uint32_t blockSize;  // bytes in each block
+  uint32_t count;      // number of blocks
+  uint32_t free;       // number of blocks available to allocate
+  uint32_t minFree;    // fewest blocks that were ever available
+  uint32_t failures;   // allocations that failed because the pool was empty
+} pool_stats_t;
+
+/**
+ * @details Create a pool of count blocks of blockSize bytes each. Pools are
+ *          taken from their own region, not the heap, so Heap_Init does not
+ *          affect them; they can not be destroyed.
+ * @param  blockSize: bytes in each block, rounded up to a word multiple
+ * @param  count: number of blocks
+ * @return pool_t* handle of the pool or NULL if there is not enough space
+ * @brief  Create a fixed-size block pool
+ */
+pool_t* Pool_Create(uint32_t blockSize, uint32_t count);
+
+/**
+ * @details Take a block from the pool in constant time, also from an ISR.
+ *          Data are not initialized.
+ * @param  pool: pool from Pool_Create
+ * @return void* pointing to the block or NULL if the pool is exhausted
+ * @brief  Allocate a block
+ */
+void* Pool_Alloc(pool_t* pool);
+
+/**
+ * @details Return a block to its pool in constant time, also from an ISR
+ * @param  pool: pool from Pool_Create
+ * @param  block: pointer returned by Pool_Alloc on the same pool
+ * @return 0 if everything is ok, non-zero if block is not in this pool
+ * @brief  Free a block
+ */
+int32_t Pool_Free(pool_t* pool, void* block);
+
+/**
+ * @details The blocks of a pool are contiguous: block i starts at
+ *          Pool_Base(pool) + i*blockSize
+ * @param  pool: pool from Pool_Create
+ * @return void* pointing to the first block
+ * @brief  First block of a pool
+ */
+void* Pool_Base(pool_t* pool);
+
+/**
+ * @details Return the current usage and exhaustion counts of a pool
+ * @param  pool: pool from Pool_Create
+ * @param  stats: reference to a pool_stats_t to fill in
+ * @return always 0
+ * @brief  Get pool usage
+ */
+int32_t Pool_Stats(pool_t* pool, pool_stats_t* stats);
+
 #endif  //#ifndef HEAP_H
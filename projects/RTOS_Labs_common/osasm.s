@@ -11,6 +11,7 @@
         PRESERVE8
 
         EXTERN  RunPt            ; currently running thread
+        EXTERN  NextPt           ; thread to switch to, chosen by Scheduler
 
         EXPORT  StartOS
         EXPORT  ContextSwitch
@@ -27,9 +28,16 @@ NVIC_PENDSVSET  EQU     0x10000000                              ; Value to trigg
 
 
 StartOS
-; put your code here
-    
-    
+    LDR     R0, =RunPt         ; currently running thread
+    LDR     R1, [R0]           ; R1 = value of RunPt
+    LDR     SP, [R1]           ; new thread SP; SP = RunPt->sp;
+    POP     {R4-R11}           ; restore regs r4-11
+    POP     {R0-R3}            ; restore regs r0-3
+    POP     {R12}
+    ADD     SP, SP, #4         ; discard LR from initial stack
+    POP     {LR}               ; start location
+    ADD     SP, SP, #4         ; discard PSR
+    CPSIE   I                  ; Enable interrupts at processor level
     BX      LR                 ; start first thread
 
 OSStartHang
@@ -45,8 +53,9 @@ OSStartHang
 ;********************************************************************************************************
 
 ContextSwitch
-; edit this code
-    
+    LDR     R0, =NVIC_INT_CTRL ; trigger PendSV
+    LDR     R1, =NVIC_PENDSVSET
+    STR     R1, [R0]
     BX      LR
     
 
@@ -86,10 +95,17 @@ ContextSwitch
 ;********************************************************************************************************
 
 PendSV_Handler
-; put your code here
-
-    
-    
+    CPSID   I                  ; Prevent interrupt during switch
+    PUSH    {R4-R11}           ; Save remaining regs r4-11
+    LDR     R0, =RunPt         ; R0=pointer to RunPt, old thread
+    LDR     R1, [R0]           ; R1 = RunPt
+    STR     SP, [R1]           ; Save SP into TCB
+    LDR     R1, =NextPt        ; R1 = pointer to NextPt
+    LDR     R1, [R1]           ; R1 = NextPt, chosen by Scheduler
+    STR     R1, [R0]           ; RunPt = NextPt
+    LDR     SP, [R1]           ; new thread SP; SP = RunPt->sp;
+    POP     {R4-R11}           ; restore regs r4-11
+    CPSIE   I                  ; tasks run with interrupts enabled
     BX      LR                 ; Exception return will restore remaining context   
     
 
@@ -103,16 +119,16 @@ PendSV_Handler
 ;           Function-call paramters in R0..R3 are also auto-saved on stack on exception entry.
 ;********************************************************************************************************
 
-        IMPORT    OS_Id
-        IMPORT    OS_Kill
-        IMPORT    OS_Sleep
-        IMPORT    OS_Time
-        IMPORT    OS_AddThread
+        IMPORT    OS_SVC             ; uint32_t OS_SVC(uint32_t number, uint32_t *frame)
 
 SVC_Handler
-; put your Lab 5 code here
-
-
+    MOV     R1, SP               ; R1 = exception frame, R0-R3 of the caller
+    LDR     R0, [R1, #24]        ; return address, just past the SVC
+    LDRB    R0, [R0, #-2]        ; R0 = number in the SVC instruction
+    PUSH    {R1, LR}
+    BL      OS_SVC
+    POP     {R1, LR}
+    STR     R0, [R1]             ; result goes to the caller's R0
     BX      LR                   ; Return from exception
 
 
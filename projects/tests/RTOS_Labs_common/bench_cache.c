@@ -0,0 +1,390 @@
+/* Host benchmark for eCache.c
+ * Runs the Lab 4 Robot logging workload on a RAM disk, or on the image
+ * file given as its argument, and reports the SD card commands and sectors
+ * it costs and the time a card would take (see host_disk.h): RUNS runs of 2 s at 50 Hz, each a
+ * new file robot0, robot1, ... of one text line per sample written a byte
+ * at a time with eFile_Write, as the redirected printf does, then every
+ * file read back a byte at a time with eFile_ReadNext and compared. The
+ * Makefile builds it four ways:
+ *
+ *   bench_cache            eFile.c on the cache
+ *   bench_cache_off        eFile.c, eCache.c built with CACHE_BYPASS
+ *   bench_cache_fatfs      the Lab 5 eFile.c on FatFs (ff.c) on the cache
+ *   bench_cache_fatfs_off  the same with CACHE_BYPASS
+ *
+ * Change the geometry with e.g. make CACHE="-DCACHE_SETS=1 -DCACHE_WAYS=4",
+ * compare the eFile layouts with make bench_cache CACHE="-DEFILE_LOG=0",
+ * or model a slower card with e.g. CACHE="-DHOSTDISK_BUSY=3000000".
+ * Every build then writes and reads a file through eFileAsync.c, writes
+ * EFILE_FILES files at once through eFile_Open descriptors, creates and
+ * opens DIRFILES files in a subdirectory, and the eFile builds delete a
+ * file with more FAT sectors than the cache has lines, cut the power in
+ * the middle of a log and check what eFile_Mount recovers.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../RTOS_Labs_common/OS.h"
+#include "../../RTOS_Labs_common/eCache.h"
+#include "../../RTOS_Labs_common/eFile.h"
+#include "../../RTOS_Labs_common/eFileAsync.h"
+#include "file_disk.h"
+#include "ram_disk.h"
+
+#define RUNS 8
+#define SAMPLES 100  // 2 s at 50 Hz
+#define LINESIZE 32  // longest line
+#define LOGSIZE (RUNS * SAMPLES * LINESIZE)
+#define SENSORSIZE 3100  // bytes logged before the power loss
+#define TAILSIZE 50      // of them logged after eFile_Idle, in its block
+#define ASYNCSIZE 3000   // bytes through eFileAsync.c
+#define DIRFILES 200     // files in one subdirectory
+#define BIGSIZE 100000   // bytes of the file deleted before the power loss
+#define HUGESIZE 1000000  // bytes of a file in 8 FAT sectors
+#define HANDLESIZE 100000  // bytes of each file written at once
+#ifndef EFILE_LOG
+#define EFILE_LOG 1  // same default as eFile.c
+#endif
+
+#ifdef BENCH_FATFS
+#define FILESYSTEM "FatFs"
+#else
+#define FILESYSTEM "eFile"
+#endif
+
+// the file systems lock the disk, there is a single thread here
+Sema4Type LCDFree;
+void OS_bWait(Sema4Type *semaPt) { semaPt->Value--; }
+void OS_bSignal(Sema4Type *semaPt) { semaPt->Value++; }
+int OS_bTryWait(Sema4Type *semaPt) {
+  if (semaPt->Value <= 0) return 0;
+  semaPt->Value--;
+  return 1;
+}
+void OS_InitSemaphore(Sema4Type *semaPt, int32_t value) {
+  semaPt->Value = value;
+}
+// a thread that would block lets eFile_DiskServer run instead
+void OS_Wait(Sema4Type *semaPt) {
+  while ((semaPt->Value <= 0) && (eFile_Serve() == 0)) {
+  }
+  semaPt->Value--;
+}
+void OS_Signal(Sema4Type *semaPt) { semaPt->Value++; }
+long StartCritical(void) { return 0; }
+void EndCritical(long sr) {}
+
+static char Log[RUNS][SAMPLES * LINESIZE];  // what each run wrote
+static int LogSize[RUNS];
+
+static void check(int ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    exit(1);
+  }
+}
+
+// one run of Robot in Lab4.c, a line per ADC sample
+static void Robot(int run) {
+  char name[8], *line;
+  uint32_t time, data, voltage, distance;
+  int i, n;
+  sprintf(name, "robot%d", run);
+  eFile_Create(name);  // ignore error if file already exists
+  check(eFile_WOpen(name) == 0, "eFile_WOpen");
+  for (i = 0; i < SAMPLES; i++) {
+    time = 2 * i;                             // in 10 ms
+    data = 300 + (i * 37 + run * 101) % 600;  // ADC sample, 0 to 1023
+    voltage = (300 * data) / 1024;            // in mV
+    distance = 100 + 700 * (1023 - data) / 1023;
+    line = &Log[run][LogSize[run]];
+    n = sprintf(line, "%0u.%02u\t%0u.%03u \t%5u\n\r", time / 100, time % 100,
+                voltage / 1000, voltage % 1000, distance);
+    check(n < LINESIZE, "line size");
+    LogSize[run] += n;
+    while (*line) check(eFile_Write(*line++) == 0, "eFile_Write");
+  }
+  check(eFile_WClose() == 0, "eFile_WClose");
+}
+
+// read a file back and compare it with what Robot wrote
+static void Verify(int run) {
+  char name[8], data;
+  int i = 0;
+  sprintf(name, "robot%d", run);
+  check(eFile_ROpen(name) == 0, "eFile_ROpen");
+  while (eFile_ReadNext(&data) == 0) {
+    check((i < LogSize[run]) && (data == Log[run][i]), "file contents");
+    i++;
+  }
+  check(i == LogSize[run], "file size");
+  check(eFile_RClose() == 0, "eFile_RClose");
+}
+
+#ifndef BENCH_FATFS
+// delete a file whose FAT entries do not all fit in the cache with their
+// changes held for the journal: it must be gone, with all its blocks
+// free, and the file system whole after it is mounted again
+static void Huge(void) {
+  static char data[512];  // a sector at a time
+  efile_check_t before, after;
+  int i, fd;
+  check(eFile_Check(&before) == 0 && eFile_Create("huge") == 0,
+        "eFile_Create huge");
+  fd = eFile_Open("huge", EFILE_WRITE);
+  check(fd >= 0, "eFile_Open huge");
+  for (i = 0; i < HUGESIZE; i += sizeof(data)) {
+    memset(data, 'a' + i % 26, sizeof(data));
+    check(eFile_WriteBuf(fd, data, sizeof(data)) == 0, "eFile_WriteBuf huge");
+  }
+  check(eFile_Close(fd) == 0 && eFile_Delete("huge") == 0,
+        "eFile_Delete huge");
+  check(eFile_Unmount() == 0 && eFile_Mount() == 0, "eFile_Mount after huge");
+  check(eFile_ROpen("huge") != 0, "huge deleted");
+  check(eFile_Check(&after) == 0 && after.errors == 0 && after.lost == 0 &&
+            after.free == before.free,
+        "blocks of huge freed");
+  printf(" huge, %d bytes deleted, %u blocks free\n", HUGESIZE,
+         (unsigned)after.free);
+}
+
+// log without closing the file, lose the power, mount and read it back:
+// the blocks that were complete must come back, and all of a file closed
+// before, whose directory entry and FAT entries are only in the journal.
+// With EFILE_LOG what eFile_Idle wrote back comes back too. A big file
+// deleted before is gone, its FAT entries freed by one record.
+static void PowerLoss(void) {
+  unsigned long written;
+  char data;
+  int i;
+  check(eFile_Create("big") == 0 && eFile_WOpen("big") == 0,
+        "eFile_WOpen big");
+  for (i = 0; i < BIGSIZE; i++) {
+    check(eFile_Write(i) == 0, "eFile_Write big");
+  }
+  check(eFile_WClose() == 0, "eFile_WClose big");
+  written = HostDiskCounts.writes;
+  check(eFile_Delete("big") == 0, "eFile_Delete big");
+  written = HostDiskCounts.writes - written;
+  printf(" delete, %d bytes in %lu sectors written\n", BIGSIZE, written);
+#ifndef CACHE_BYPASS
+  check(written == 1, "eFile_Delete in one journal block");
+#endif
+  check(eFile_Create("closed") == 0 && eFile_WOpen("closed") == 0,
+        "eFile_WOpen closed");
+  for (i = 0; i < SENSORSIZE; i++) {
+    check(eFile_Write('A' + i % 26) == 0, "eFile_Write closed");
+  }
+  check(eFile_WClose() == 0, "eFile_WClose closed");
+  check(eFile_Create("sensor") == 0 && eFile_WOpen("sensor") == 0,
+        "eFile_WOpen sensor");
+  for (i = 0; i < SENSORSIZE; i++) {
+    if (i == SENSORSIZE - TAILSIZE) eFile_Idle(0);  // nothing else to do
+    check(eFile_Write('a' + i % 26) == 0, "eFile_Write sensor");
+  }
+  HostDiskOff = 1;  // the cache is lost, nothing more reaches the disk
+  eFile_Unmount();  // fails, only resets the state
+  HostDiskOff = 0;
+  check(eFile_Mount() == 0, "eFile_Mount after power loss");
+  check(eFile_ROpen("big") != 0, "big deleted");
+  check(eFile_ROpen("closed") == 0, "eFile_ROpen closed");
+  for (i = 0; eFile_ReadNext(&data) == 0; i++) {
+    check((i < SENSORSIZE) && (data == 'A' + i % 26), "closed contents");
+  }
+  check((eFile_RClose() == 0) && (i == SENSORSIZE), "closed size");
+  check(eFile_ROpen("sensor") == 0, "eFile_ROpen sensor");
+  for (i = 0; eFile_ReadNext(&data) == 0; i++) {
+    check((i < SENSORSIZE) && (data == 'a' + i % 26), "recovered contents");
+  }
+  check(eFile_RClose() == 0, "eFile_RClose sensor");
+  printf(" power loss, %d of %d bytes recovered\n", i, SENSORSIZE);
+  check(!EFILE_LOG || (i >= SENSORSIZE - TAILSIZE), "recovered size");
+}
+#endif
+
+// log through a double-buffered efile_log_t, read back with eFile_ReadAsync
+static void Async(void) {
+  static efile_log_t log;
+  static char data[ASYNCSIZE + 1];
+  efile_request_t first, rest;
+  int i, fd;
+  check(eFile_Create("async") == 0, "eFile_Create async");
+  fd = eFile_Open("async", EFILE_WRITE);
+  check(fd >= 0 && eFile_LogOpen(&log, fd) == 0, "eFile_LogOpen");
+  for (i = 0; i < ASYNCSIZE; i++) {
+    check(eFile_LogPut(&log, 'A' + i % 26) == 0, "eFile_LogPut");
+  }
+  check(eFile_LogClose(&log) == 0 && eFile_Close(fd) == 0, "eFile_LogClose");
+  fd = eFile_Open("async", EFILE_READ);
+  check(eFile_ReadAsync(&first, fd, data, 1000) == 0 &&
+            eFile_ReadAsync(&rest, fd, data + 1000, ASYNCSIZE + 1 - 1000) == 0,
+        "eFile_ReadAsync");
+  check(eFile_WaitAsync(&first) == 0 && first.count == 1000, "first read");
+  check(eFile_WaitAsync(&rest) == 1 && rest.count == ASYNCSIZE - 1000,
+        "read to the end of the file");
+  for (i = 0; i < ASYNCSIZE; i++) {
+    check(data[i] == 'A' + i % 26, "async contents");
+  }
+  check(eFile_Close(fd) == 0 && eFile_Delete("async") == 0, "eFile_Delete");
+  printf(" async, %d bytes logged and read back\n", ASYNCSIZE);
+}
+
+// EFILE_FILES - 1 logs written a line at a time in turn, as threads
+// would, and one more file with eFile_WOpen, after a Robot file is read
+static void Handles(void) {
+  static char data[SAMPLES * LINESIZE];
+  const char *line = "0.02\t0.123 \t  456\n\r";
+  uint32_t size = strlen(line), lines = HANDLESIZE / size;
+  char name[8];
+  int log[EFILE_FILES - 1], robot, i, j, n, fd;
+  for (j = 0; j < EFILE_FILES - 1; j++) {
+    sprintf(name, "log%d", j);
+    check(eFile_CreateSize(name, lines * size) == 0, "eFile_CreateSize log");
+    log[j] = eFile_Open(name, EFILE_WRITE);
+    check(log[j] >= 0, "eFile_Open log");
+  }
+  check(eFile_Create("other") == 0, "eFile_Create other");
+  robot = eFile_Open("robot1", EFILE_READ);
+  check(robot >= 0 && eFile_ReadBuf(robot, data, sizeof(data)) == LogSize[1] &&
+            !memcmp(data, Log[1], LogSize[1]),
+        "eFile_ReadBuf robot1");
+  check(eFile_Open("log0", EFILE_WRITE) < 0 &&
+            eFile_Open("robot2", EFILE_READ) < 0 && eFile_WOpen("other") != 0 &&
+            eFile_Delete("log1") != 0,
+        "second writer, descriptors used up, deleting an open file");
+  check(eFile_Close(robot) == 0 && eFile_Close(robot) != 0, "eFile_Close");
+  check(eFile_WOpen("other") == 0, "eFile_WOpen other");
+  for (i = 0; i < lines; i++) {
+    for (j = 0; j < EFILE_FILES - 1; j++) {
+      check(eFile_WriteBuf(log[(i + j) % (EFILE_FILES - 1)], line, size) == 0,
+            "eFile_WriteBuf");
+    }
+    for (j = 0; j < size; j++) {
+      check(eFile_Write(line[j]) == 0, "eFile_Write other");
+    }
+  }
+  for (j = 0; j < EFILE_FILES - 1; j++) {
+    check(eFile_Close(log[j]) == 0, "eFile_Close log");
+  }
+  check(eFile_WClose() == 0, "eFile_WClose other");
+  for (j = 0; j < EFILE_FILES; j++) {
+    sprintf(name, "log%d", j);
+    fd = eFile_Open((j < EFILE_FILES - 1) ? name : "other", EFILE_READ);
+    for (n = 0; eFile_ReadBuf(fd, data, size) == size; n++) {
+      check(!memcmp(data, line, size), "log contents");
+    }
+    check(n == lines && eFile_Close(fd) == 0, "log size");
+    check(eFile_Delete((j < EFILE_FILES - 1) ? name : "other") == 0,
+          "eFile_Delete log");
+  }
+  printf(" handles, %d files of %u bytes written in turn\n", EFILE_FILES,
+         (unsigned)(lines * size));
+}
+
+static void Report(const char *phase, host_disk_counts_t *before) {
+  printf(" %s %6lu commands %6lu read %6lu written %8.1f ms\n", phase,
+         HostDiskCounts.commands - before->commands,
+         HostDiskCounts.reads - before->reads,
+         HostDiskCounts.writes - before->writes,
+         (HostDiskCounts.time - before->time) / 1e6);
+  *before = HostDiskCounts;
+}
+
+// many files in a subdirectory: what a name lookup costs as they add up
+static void Directory(void) {
+  host_disk_counts_t counts;
+  char path[16], *name;
+  unsigned long size;
+  int i, files = 0;
+  check(eFile_DCreate("many") == 0 && eFile_DCreate("many") != 0,
+        "eFile_DCreate");
+  printf(" directory, %d files in many/\n", DIRFILES);
+  counts = HostDiskCounts;
+  for (i = 0; i < DIRFILES; i++) {
+    sprintf(path, "many/f%d", i);
+    check(eFile_Create(path) == 0, "eFile_Create in many/");
+  }
+  Report("  create", &counts);
+  for (i = 0; i < DIRFILES; i++) {
+    sprintf(path, "many/f%d", i);
+    check(eFile_ROpen(path) == 0 && eFile_RClose() == 0, "eFile_ROpen");
+  }
+  Report("  open  ", &counts);
+  check(eFile_ROpen("f0") != 0 && eFile_ROpen("many/none") != 0 &&
+            eFile_Create("none/f0") != 0,
+        "names in the wrong directory");
+  check(eFile_DOpen("many") == 0, "eFile_DOpen many");
+  while (eFile_DirNext(&name, &size) == 0) {
+    if (name[0] == '.') continue;  // FatFs lists . and ..
+    check((name[0] | 0x20) == 'f' && size == 0, "entry of many/");
+    files++;
+  }
+  check(eFile_DClose() == 0 && files == DIRFILES, "directory many/");
+  Report("  list  ", &counts);
+  check(eFile_Delete("many") != 0, "deleting a directory that is not empty");
+  for (i = 0; i < DIRFILES; i++) {
+    sprintf(path, "many/f%d", i);
+    check(eFile_Delete(path) == 0, "eFile_Delete in many/");
+  }
+  check(eFile_Delete("many") == 0, "eFile_Delete many");
+}
+
+int main(int argc, char *argv[]) {
+  host_disk_counts_t counts;
+  cache_stats_t stats;
+  char *name;
+  unsigned long size, bytes = 0;
+  int run, files = 0;
+  if (argc > 1) {
+    check(FileDisk_Open(argv[1], RAMDISK_SECTORS) == 0, "image file");
+    HostDisk_Use(&FileDisk);
+  } else {
+    RamDisk_Erase();
+    HostDisk_Use(&RamDisk);
+  }
+  OS_bSignal(&LCDFree);
+  check(eFile_Init() == 0, "eFile_Init");
+  eFile_Mount();  // FatFs formats a mounted volume, eFile a blank disk
+  check(eFile_Format() == 0, "eFile_Format");
+  eFile_Mount();
+  counts = HostDiskCounts;
+#ifdef CACHE_BYPASS
+  printf("%s, no cache\n", FILESYSTEM);
+#else
+  printf("%s, cache of %d sets of %d ways and %d pinned sectors\n",
+         FILESYSTEM, CACHE_SETS, CACHE_WAYS, CACHE_PINNED);
+#endif
+  for (run = 0; run < RUNS; run++) Robot(run);
+  for (run = 0; run < RUNS; run++) bytes += LogSize[run];
+  printf(" Robot, %d runs of %d lines, %lu bytes\n", RUNS, SAMPLES, bytes);
+  Report("  write", &counts);
+  for (run = 0; run < RUNS; run++) Verify(run);
+  Report("  read ", &counts);
+  check(eFile_DOpen("") == 0, "eFile_DOpen");
+  while (eFile_DirNext(&name, &size) == 0) {
+    check(size == LogSize[name[5] - '0'], "directory size");
+    files++;
+  }
+  check(eFile_DClose() == 0 && files == RUNS, "directory");
+  check(eFile_Delete("robot0") == 0 && eFile_ROpen("robot0") != 0,
+        "eFile_Delete");
+  check(eFile_Unmount() == 0, "eFile_Unmount");
+  Report("  other", &counts);
+  eCache_Stats(&stats);
+  check(stats.dirty == 0 && stats.pinned == 0, "cache written back");
+  printf(" cache %lu hits %lu misses\n", (unsigned long)stats.hits,
+         (unsigned long)stats.misses);
+  check(eFile_Mount() == 0, "eFile_Mount after eFile_Unmount");
+  for (run = 1; run < RUNS; run++) Verify(run);
+  Async();
+  Handles();
+  Directory();
+#ifndef BENCH_FATFS
+  Huge();
+  PowerLoss();
+#endif
+  return 0;
+}
@@ -0,0 +1,525 @@
+/* Host benchmark for heap.c
+ * Replays randomized allocation traces against the TLSF heap and against a
+ * first-fit free list of the same size, and reports the worst and average
+ * latency of Heap_Malloc/Heap_Free in ticks (TSC cycles on x86, else ns).
+ * Each trace is replayed REPEAT times and every operation is charged its
+ * fastest time, less the cost of reading the timer, which filters out host
+ * interrupts and preemption; the worst case is the largest of these. For
+ * the failed allocations it reports how many failed although a free block
+ * was large enough (a size class search that rounds up past it) and how
+ * many bytes were free on average (space lost to block overhead). A comb of
+ * small holes shows the worst case of first fit. Also runs the checks of
+ * the Lab 5 TestHeap, of the block pools, arenas, aligned allocation and
+ * the buffers for interrupt handlers first, and reports the bytes
+ * Heap_Realloc copies.
+ *
+ *   make bench_heap && ./bench_heap [traces] [operations per trace]
+ */
+
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../../RTOS_Lab5_ProcessLoader/HeapTest.h"
+#include "../../RTOS_Labs_common/heap.h"
+#include "first_fit.h"
+
+#define HEAP_BYTES 8192  // same as HEAP_SIZE in heap.c
+#define MAXLIVE 160  // live blocks keep the heap mostly full
+#define REPEAT 25    // per operation the fastest of this many replays counts
+
+// heap.c runs its operations in critical sections
+long StartCritical(void) { return 0; }
+void EndCritical(long sr) { (void)sr; }
+
+static uint32_t Random(void);
+static uint32_t Seed;
+
+static void check(int ok, const char* what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    exit(1);
+  }
+}
+
+// The Lab 5 TestHeap of HeapTest.c with the display stubbed out. The
+// thread ends in OS_Kill, after a heap error or after drawing its success.
+static jmp_buf Killed;
+static const char* Drawn;  // last string drawn
+uint32_t ST7735_DrawString(uint16_t x, uint16_t y, char* pt,
+                           int16_t textColor) {
+  Drawn = pt;
+  return 0;
+}
+void ST7735_Message(uint32_t d, uint32_t l, char* pt, int32_t value) {}
+void OS_Kill(void) { longjmp(Killed, 1); }
+
+static void TestLab5Heap(void) {
+  heap_stats_t stats;
+  void* ptr;
+  Drawn = "";
+  if (setjmp(Killed) == 0) TestHeap();
+  check(strcmp(Drawn, "Heap test successful") == 0, "Lab 5 TestHeap");
+  check(Heap_Init() == 0, "Heap_Init");
+  ptr = Heap_Malloc(2);
+  check(ptr && Heap_Free(ptr) == 0, "malloc/free 2");
+  check(Heap_Free(ptr) != 0, "double free detected");
+  check(Heap_Stats(&stats) == 0, "Heap_Stats");
+  check(stats.largestFree == stats.free && stats.used == 0, "all merged");
+  printf("TestHeap passed, %u byte heap, %u bytes allocatable\n", stats.size,
+         stats.free);
+}
+
+// realloc that always moves the block, the baseline Heap_Realloc is
+// compared with; Heap_Realloc when copy is 0. Adds the bytes moved to
+// *copied.
+static void* Realloc(int copy, void* p, int32_t old, int32_t size,
+                     uint32_t* copied) {
+  void* q;
+  if (!copy) return Heap_Realloc(p, size);
+  q = Heap_Malloc(size);
+  if (q == 0) return 0;
+  memcpy(q, p, old < size ? old : size);
+  *copied += old < size ? old : size;
+  Heap_Free(p);
+  return q;
+}
+
+// the realloc calls of the TestHeap sequence, bytes copied
+static uint32_t ReallocTestHeap(int copy) {
+  heap_stats_t stats;
+  uint32_t copied = 0;
+  void* q1;
+  Heap_Init();
+  q1 = Heap_Malloc(1);
+  Heap_Malloc(2);
+  Heap_Malloc(3);
+  Heap_Malloc(4);
+  Heap_Malloc(5);
+  q1 = Realloc(copy, q1, 1, 6, &copied);
+  q1 = Realloc(copy, q1, 6, 2, &copied);
+  check(q1 && Heap_Stats(&stats) == 0, "heap consistent");
+  return copy ? copied : stats.reallocCopied;
+}
+
+// a buffer that grows 16 to 2048 bytes while small messages come and go,
+// bytes copied
+static uint32_t ReallocGrowing(int copy) {
+  heap_stats_t stats;
+  uint32_t copied = 0;
+  void *buf, *msg[8] = {0};
+  int32_t size;
+  int i;
+  Heap_Init();
+  Seed = 7;
+  buf = Heap_Malloc(16);
+  for (size = 16, i = 0; size < 2048; size += 16, i++) {
+    if (msg[i % 8]) Heap_Free(msg[i % 8]);  // messages live for 8 steps
+    msg[i % 8] = Heap_Malloc(4 + Random() % 28);
+    memset(buf, size & 0xFF, size);
+    buf = Realloc(copy, buf, size, size + 16, &copied);
+    check(buf && ((uint8_t*)buf)[0] == (size & 0xFF) &&
+              ((uint8_t*)buf)[size - 1] == (size & 0xFF),
+          "growing buffer keeps its data");
+  }
+  check(Heap_Stats(&stats) == 0, "heap consistent");
+  if (!copy) {
+    check(Heap_Realloc(buf, 100) == buf, "shrink in place");
+    check(Heap_Stats(&stats) == 0 && stats.largestFree > 1900,
+          "shrunk tail merged");
+  }
+  return copy ? copied : stats.reallocCopied;
+}
+
+// bytes Heap_Realloc moves, for the TestHeap sequence and for a growing
+// buffer, against a realloc that always copies to a new block
+static void TestRealloc(void) {
+  uint32_t copied = ReallocTestHeap(0);
+  printf("realloc, TestHeap sequence: %u bytes copied, copy-always %u\n",
+         copied, ReallocTestHeap(1));
+  copied = ReallocGrowing(0);
+  printf("realloc, buffer growing 16 to 2048 bytes: %u bytes copied, "
+         "copy-always %u\n",
+         copied, ReallocGrowing(1));
+}
+
+// fixed-size pools: exhaustion, reuse and statistics
+static void TestPool(void) {
+  pool_t* pool = Pool_Create(10, 4);
+  pool_stats_t stats;
+  void* blocks[5];
+  int i;
+  check(pool != 0, "Pool_Create");
+  for (i = 0; i < 5; i++) blocks[i] = Pool_Alloc(pool);
+  check(blocks[3] && blocks[4] == 0, "pool exhausted after 4 blocks");
+  Pool_Stats(pool, &stats);
+  check(blocks[0] == Pool_Base(pool) &&
+            (uint8_t*)blocks[1] == (uint8_t*)blocks[0] + stats.blockSize,
+        "contiguous blocks");
+  check(Pool_Free(pool, (uint8_t*)blocks[0] + 1) != 0, "bad pointer");
+  check(Pool_Free(pool, blocks[2]) == 0, "Pool_Free");
+  check(Pool_Alloc(pool) == blocks[2], "reuse");
+  Pool_Stats(pool, &stats);
+  check(stats.free == 0 && stats.minFree == 0 && stats.failures == 1,
+        "pool stats");
+  check(Pool_Create(1000, 1000) == 0, "pool region limit");
+  printf("Pool test passed\n");
+}
+
+// arenas as the loader uses them: repeated load/run cycles of a process
+// whose segments, stacks and heap come from one arena, while the kernel
+// keeps allocating in the heap, must leave the heap as it was
+static void TestArena(void) {
+  heap_stats_t before, after, stats;
+  arena_t* arena;
+  void *text, *data, *stack, *p, *kept;
+  int cycle;
+  check(Heap_Init() == 0, "Heap_Init");
+  Heap_Stats(&before);
+  for (cycle = 0; cycle < 100; cycle++) {
+    arena = Arena_Create(400 + 200 + 128 + 1024);
+    check(arena != 0, "Arena_Create");
+    text = Arena_Malloc(arena, 400);
+    data = Arena_Malloc(arena, 200);
+    stack = Arena_Malloc(arena, 128);
+    check(text && data && stack, "segments and stack in the arena");
+    check(Arena_Of(data) == arena && Arena_Of(&cycle) == 0, "Arena_Of");
+    check(Heap_Free(data) != 0 && Heap_Free(arena) != 0,
+          "Heap_Free of arena memory");
+    kept = Heap_Malloc(24 + cycle % 40);  // kernel allocation meanwhile
+    p = Arena_Malloc(arena, 1000);  // Heap_Malloc of the process
+    check(p != 0, "process heap");
+    check(Arena_Malloc(arena, 1000) == 0, "arena full");
+    check(Arena_Free(arena, p) == 0 && Arena_Free(arena, p) != 0,
+          "Arena_Free");
+    check(Arena_Stats(arena, &stats) == 0 && stats.used >= 728,
+          "Arena_Stats");
+    check(Arena_Destroy(arena) == 0, "Arena_Destroy");
+    check(Arena_Of(data) == 0, "destroyed arena unlinked");
+    Heap_Free(kept);
+  }
+  Heap_Stats(&after);
+  check(after.used == before.used && after.free == before.free &&
+            after.largestFree == before.largestFree,
+        "heap unchanged after 100 cycles");
+  check(Arena_Create(HEAP_BYTES) == 0, "arena larger than the heap");
+  printf("Arena test passed\n");
+}
+
+// aligned blocks: every power of two from 8 to 1024, interleaved with
+// small blocks so the payloads start at varying offsets. The padding must
+// go back to the heap: at most a tail too small to split stays with each
+// block compared to the same allocations unaligned. Freeing everything must
+// restore one block.
+static void TestAligned(void) {
+  heap_stats_t before, plain, stats;
+  void *blocks[16], *small[16];
+  int i, align;
+  check(Heap_Init() == 0, "Heap_Init");
+  for (i = 0; i < 8; i++) {
+    Heap_Malloc(1 + 12 * i);
+    Heap_Malloc(40);
+  }
+  Heap_Stats(&plain);
+  check(Heap_Init() == 0, "Heap_Init");
+  Heap_Stats(&before);
+  for (i = 0, align = 8; align <= 1024; i++, align *= 2) {
+    small[i] = Heap_Malloc(1 + 12 * i);
+    blocks[i] = Heap_AlignedMalloc(40, align);
+    check(blocks[i] && ((uintptr_t)blocks[i] & (align - 1)) == 0,
+          "aligned address");
+  }
+  check(Heap_AlignedMalloc(16, 24) == 0, "alignment not a power of two");
+  check(Heap_AlignedMalloc(16, 1 << 15) == 0, "alignment beyond the heap");
+  Heap_Stats(&stats);
+  check(stats.used <= plain.used + i * 4 * sizeof(size_t),
+        "padding returned to the heap");
+  while (i--) {
+    check(Heap_Free(blocks[i]) == 0 && Heap_Free(small[i]) == 0,
+          "Heap_Free of aligned blocks");
+  }
+  Heap_Stats(&stats);
+  check(stats.freeBlocks == 1 && stats.free == before.free, "heap restored");
+  printf("Aligned allocation test passed\n");
+}
+
+static int Notified;  // calls of the Heap_IsrNotify function
+static void Notify(void) { Notified++; }
+
+// buffers for interrupt handlers: two sizes kept ready by Heap_IsrRefill,
+// a request falls back to the larger size when the smaller runs out, every
+// size a request leaves low is notified, and buffers beyond the number
+// kept ready go back to the heap
+static void TestIsr(void) {
+  heap_stats_t before, stats;
+  heap_isr_stats_t isr;
+  void* p[8];
+  int i;
+  check(Heap_Init() == 0, "Heap_Init");
+  Heap_Stats(&before);
+  check(Heap_IsrPool(64, 2) == 0 && Heap_IsrPool(4, 4) == 0, "Heap_IsrPool");
+  check(Heap_IsrPool(4, 1) != 0 && Heap_IsrPool(8, 0) != 0,
+        "Heap_IsrPool arguments");
+  Heap_IsrNotify(&Notify);
+  check(Heap_IsrMalloc(4) == 0 && Notified == 2,
+        "no buffers before the first refill, both sizes low");
+  check(Heap_IsrRefill() == 6 && Heap_IsrRefill() == 0, "Heap_IsrRefill");
+  check(Heap_IsrStats(0, &isr) == 0 && isr.size < 64 && isr.free == 4 &&
+            isr.failures == 1,
+        "Heap_IsrStats sorted by size");
+  check(Heap_IsrStats(2, &isr) != 0, "Heap_IsrStats index");
+  Notified = 0;
+  for (i = 0; i < 6; i++) {
+    p[i] = Heap_IsrMalloc(4);
+    check(p[i] != 0, "Heap_IsrMalloc");
+  }
+  check(Notified == 8, "4 small taken, then 2 tries of both sizes");
+  Heap_IsrNotify(0);
+  check(Heap_IsrMalloc(4) == 0 && Heap_IsrMalloc(100) == 0,
+        "Heap_IsrMalloc when none are ready");
+  check(Heap_IsrStats(0, &isr) == 0 && isr.minFree == 0, "low watermark");
+  p[6] = Heap_Malloc(64);  // a heap block of a kept size is taken too
+  check(Heap_IsrFree(p[6]) == 0, "Heap_IsrFree of a heap block");
+  for (i = 0; i < 6; i++) {
+    check(Heap_IsrFree(p[i]) == 0, "Heap_IsrFree");
+  }
+  check(Heap_IsrFree(&i) != 0, "Heap_IsrFree of a foreign pointer");
+  check(Heap_IsrStats(1, &isr) == 0 && isr.free == 2, "larger size refilled");
+  while ((p[0] = Heap_IsrMalloc(1)) != 0) Heap_Free(p[0]);
+  Heap_Stats(&stats);
+  check(stats.used == before.used && stats.freeBlocks == 1, "heap restored");
+  printf("ISR buffer test passed\n");
+}
+
+//---------------- first-fit baseline, see first_fit.c ----------------
+static size_t FFMemory[HEAP_BYTES / sizeof(size_t)];
+
+//---------------- trace replay ----------------
+typedef struct op {
+  int32_t size;  // > 0 allocate into slot, 0 free slot
+  int slot;
+} op_t;
+
+typedef struct result {
+  double maxTicks, totalTicks;
+  unsigned long ops, failures;
+  unsigned long fitting;  // failures while a large enough block was free
+  double freeBytes;       // sum of the free bytes at each failure
+} result_t;
+
+static uint32_t Random(void) {
+  Seed = 1664525 * Seed + 1013904223;
+  return Seed >> 8;
+}
+
+// mostly small messages and strings, now and then a large buffer
+static int32_t RandomSize(void) {
+  uint32_t r = Random() % 100;
+  if (r < 80) return 1 + Random() % 24;
+  if (r < 98) return 25 + Random() % 104;
+  return 256 + Random() % 512;
+}
+
+static void MakeTrace(op_t* trace, int n) {
+  int live[MAXLIVE], numLive = 0, i, j;
+  int freeSlots[MAXLIVE], numFree = MAXLIVE;
+  for (i = 0; i < MAXLIVE; i++) freeSlots[i] = MAXLIVE - 1 - i;
+  for (i = 0; i < n; i++) {
+    if (numFree && (numLive == 0 || Random() % 100 < 50)) {
+      trace[i].slot = freeSlots[--numFree];
+      trace[i].size = RandomSize();
+      live[numLive++] = trace[i].slot;
+    } else {
+      j = Random() % numLive;
+      trace[i].slot = live[j];
+      trace[i].size = 0;
+      live[j] = live[--numLive];
+      freeSlots[numFree++] = trace[i].slot;
+    }
+  }
+}
+
+// time stamp in ticks: TSC cycles on x86 hosts, otherwise ns; the fences
+// keep the operation timed from moving across the reads
+static double Now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  double t;
+  _mm_lfence();
+  t = (double)__rdtsc();
+  _mm_lfence();
+  return t;
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+#endif
+}
+
+// ticks Now() - Now() takes with nothing in between, the fastest of many
+static double Overhead(void) {
+  double best = 0, start, t;
+  int k;
+  for (k = 0; k < 10000; k++) {
+    start = Now();
+    t = Now() - start;
+    if (k == 0 || t < best) best = t;
+  }
+  return best;
+}
+static double TimerTicks;  // Overhead(), taken off every time measured
+
+// run the trace once, recording the time of each operation in ns[] and
+// counting the failed allocations, and those that failed although a free
+// block was large enough, adding up the free bytes at each failure
+static void Replay(const op_t* trace, int n, int firstFit, double* ns,
+                   unsigned long* failures, unsigned long* fitting,
+                   double* freeBytes) {
+  void* slots[MAXLIVE] = {0};
+  heap_stats_t stats;
+  size_t free, largest;
+  double start;
+  int i;
+  if (firstFit) {
+    FF_Init(FFMemory, sizeof(FFMemory));
+  } else {
+    Heap_Init();
+  }
+  for (i = 0; i < n; i++) {
+    const op_t* o = &trace[i];
+    ns[i] = 0;
+    if (o->size == 0 && slots[o->slot] == 0) continue;  // its malloc failed
+    start = Now();
+    if (o->size) {
+      slots[o->slot] = firstFit ? FF_Malloc(o->size) : Heap_Malloc(o->size);
+    } else if (firstFit) {
+      FF_Free(slots[o->slot]);
+    } else {
+      Heap_Free(slots[o->slot]);
+    }
+    ns[i] = Now() - start - TimerTicks;
+    if (o->size && slots[o->slot] == 0) {
+      (*failures)++;
+      if (firstFit) {
+        FF_Stats(&free, &largest);
+      } else {
+        Heap_Stats(&stats);
+        free = stats.free;
+        largest = stats.largestFree;
+      }
+      if (largest >= (size_t)o->size) (*fitting)++;
+      *freeBytes += free;
+    }
+    if (o->size == 0) slots[o->slot] = 0;
+  }
+}
+
+static void Measure(const op_t* trace, int n, int firstFit, double* ns,
+                    double* best, result_t* r) {
+  unsigned long failures = 0, fitting = 0;
+  double freeBytes = 0;
+  int i, k;
+  for (k = 0; k < REPEAT; k++) {
+    Replay(trace, n, firstFit, ns, &failures, &fitting, &freeBytes);
+    for (i = 0; i < n; i++) {
+      if (k == 0 || ns[i] < best[i]) best[i] = ns[i];
+    }
+  }
+  r->failures += failures / REPEAT;
+  r->fitting += fitting / REPEAT;
+  r->freeBytes += freeBytes / REPEAT;
+  for (i = 0; i < n; i++) {
+    if (best[i] > r->maxTicks) r->maxTicks = best[i];
+    r->totalTicks += best[i];
+  }
+  r->ops += n;
+}
+
+// worst case of first fit: fill the heap with small blocks, free every
+// other one, then ask for a block that fits none of the holes
+static double Comb(int firstFit) {
+  static void* blocks[HEAP_BYTES / 8];
+  double start, best = 0, t;
+  int n, i, k;
+  for (k = 0; k < REPEAT; k++) {
+    if (firstFit) {
+      FF_Init(FFMemory, sizeof(FFMemory));
+    } else {
+      Heap_Init();
+    }
+    for (n = 0; n < HEAP_BYTES / 8; n++) {
+      blocks[n] = firstFit ? FF_Malloc(8) : Heap_Malloc(8);
+      if (!blocks[n]) break;
+    }
+    for (i = 0; i < n; i += 2) {
+      if (firstFit) {
+        FF_Free(blocks[i]);
+      } else {
+        Heap_Free(blocks[i]);
+      }
+    }
+    start = Now();
+    if (firstFit) {
+      FF_Malloc(64);
+    } else {
+      Heap_Malloc(64);
+    }
+    t = Now() - start - TimerTicks;
+    if (k == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  int traces = argc > 1 ? atoi(argv[1]) : 20;
+  int n = argc > 2 ? atoi(argv[2]) : 20000;
+  op_t* trace = malloc(n * sizeof(op_t));
+  double* ns = malloc(n * sizeof(double));
+  double* best = malloc(n * sizeof(double));
+  result_t tlsf = {0}, ff = {0};
+  heap_stats_t stats;
+  int t;
+  TestLab5Heap();
+  TestRealloc();
+  TestPool();
+  TestArena();
+  TestAligned();
+  TestIsr();
+  TimerTicks = Overhead();
+  for (t = 0; t < traces; t++) {
+    Seed = t + 1;
+    MakeTrace(trace, n);
+    Measure(trace, n, 0, ns, best, &tlsf);
+    FFSteps = 0;  // count the searches of one replay
+    Measure(trace, n, 1, ns, best, &ff);
+  }
+  Heap_Stats(&stats);
+  printf("%d traces of %d operations on %d bytes, %d replays each, %.0f "
+         "ticks of timer taken off\n",
+         traces, n, HEAP_BYTES, REPEAT, TimerTicks);
+  printf("          worst  mean ticks  failed allocations, with a block that "
+         "fits free, mean bytes free\n");
+  printf("TLSF      %5.0f %9.1f %10lu %6lu %6.0f\n", tlsf.maxTicks,
+         tlsf.totalTicks / tlsf.ops, tlsf.failures, tlsf.fitting,
+         tlsf.failures ? tlsf.freeBytes / tlsf.failures : 0.0);
+  printf("first fit %5.0f %9.1f %10lu %6lu %6.0f   (blocks searched: worst "
+         "%lu, mean %.1f)\n",
+         ff.maxTicks, ff.totalTicks / ff.ops, ff.failures, ff.fitting,
+         ff.failures ? ff.freeBytes / ff.failures : 0.0, FFMaxSteps,
+         (double)FFSteps / REPEAT / n);
+  printf("comb of small holes, then malloc(64): TLSF %.0f ticks, first fit "
+         "%.0f ticks\n",
+         Comb(0), Comb(1));
+  printf("TLSF end of last trace: %u used, %u free in %u blocks, %u%% "
+         "fragmented\n",
+         stats.used, stats.free, stats.freeBlocks, stats.fragmentation);
+  free(best);
+  free(ns);
+  free(trace);
+  return 0;
+}
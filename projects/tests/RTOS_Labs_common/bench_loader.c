@@ -0,0 +1,204 @@
+/* Host benchmark for the Lab 5 loader on FatFs
+ * Copies the Lab 5 user program, RTOS_Lab5_User/User.axf or the ELF file
+ * given as the argument, onto a RAM disk FatFs formatted, loads it LOADS
+ * times with exec_elf, as the interpreter does, and reports the SD card
+ * commands and sectors that costs and the time a card would take (see
+ * host_disk.h), and checks a file that is not a program is refused
+ * without leaking, and that a file made with eFile_CreateSize and closed
+ * unwritten keeps no clusters. Then it streams STREAMSIZE bytes CHUNK at a
+ * time into a file made with eFile_CreateSize, reads them back, and
+ * reports the rates. The Makefile builds it two ways:
+ *
+ *   bench_loader      the Lab 5 eFile.c on FatFs (ff.c) on the cache
+ *   bench_loader_off  the same with CACHE_BYPASS
+ *
+ * exec_elf stops short of starting the program: OS_AddProcess here only
+ * counts it. The loader relocates the program in the heap with 32-bit
+ * addresses, so both are built without PIE to keep the heap below 4 GB.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../RTOS_Labs_common/OS.h"
+#include "../../RTOS_Labs_common/eCache.h"
+#include "../../RTOS_Labs_common/eFile.h"
+#include "../../RTOS_Labs_common/heap.h"
+#include "../../RTOS_Lab5_ProcessLoader/ff.h"
+#include "../../RTOS_Lab5_ProcessLoader/loader.h"
+#include "ram_disk.h"
+
+#define PROGRAM "../../RTOS_Lab5_User/User.axf"
+#define LOADS 10                 // programs started
+#define STREAMSIZE (256 * 1024)  // bytes streamed
+#define CHUNK 4096               // bytes streamed at a time
+
+// the file system locks the disk, there is a single thread here
+Sema4Type LCDFree;
+void OS_bWait(Sema4Type *semaPt) { semaPt->Value--; }
+void OS_bSignal(Sema4Type *semaPt) { semaPt->Value++; }
+long StartCritical(void) { return 0; }
+void EndCritical(long sr) { (void)sr; }
+void UART_OutString(char *pt) { (void)pt; }
+
+static int Started;  // processes exec_elf would have started
+int OS_AddProcess(void (*entry)(void), void *text, void *data,
+                  unsigned long stackSize, unsigned long priority) {
+  Started++;
+  Arena_Destroy(Arena_Of(text));  // the process exits at once
+  return 1;
+}
+
+// what the program links against
+static void Stub(void) {}
+static const ELFSymbol_t Symbols[] = {
+    {"OS_Id", Stub},    {"OS_AddThread", Stub}, {"OS_Sleep", Stub},
+    {"OS_Kill", Stub},  {"OS_Time", Stub},      {"OS_TimeDifference", Stub},
+    {"Display_Message", Stub}};
+static const ELFEnv_t Env = {Symbols, sizeof(Symbols) / sizeof(Symbols[0])};
+
+static void check(int ok, const char *what) {
+  if (!ok) {
+    printf("FAILED: %s\n", what);
+    exit(1);
+  }
+}
+
+static void Report(const char *phase, host_disk_counts_t *before,
+                   unsigned long bytes) {
+  double ms = (HostDiskCounts.time - before->time) / 1e6;
+  printf(" %s %6lu commands %6lu read %6lu written %8.1f ms", phase,
+         HostDiskCounts.commands - before->commands,
+         HostDiskCounts.reads - before->reads,
+         HostDiskCounts.writes - before->writes, ms);
+  if (bytes) printf(" %6.1f KB/s", bytes / 1024.0 / (ms / 1000));
+  printf("\n");
+  *before = HostDiskCounts;
+}
+
+// copy a file of the host onto the disk
+static unsigned long Copy(const char *file, const char *name) {
+  static char data[64 * 1024];
+  FILE *in = fopen(file, "rb");
+  size_t size;
+  int fd;
+  check(in != 0, "cannot open the program");
+  size = fread(data, 1, sizeof(data), in);
+  fclose(in);
+  check(eFile_CreateSize(name, size) == 0, "eFile_CreateSize program");
+  fd = eFile_Open(name, EFILE_WRITE);
+  check(fd >= 0 && eFile_WriteBuf(fd, data, size) == 0 && eFile_Close(fd) == 0,
+        "eFile_WriteBuf program");
+  return size;
+}
+
+// a file that is not a program: exec_elf refuses it, and leaves no file
+// open and no link map allocated, however many times it is asked
+static void NotElf(void) {
+  heap_stats_t before, after;
+  int i, fd;
+  check(eFile_Create("bad.axf") == 0, "eFile_Create bad.axf");
+  fd = eFile_Open("bad.axf", EFILE_WRITE);
+  check(fd >= 0 && eFile_WriteBuf(fd, "not a program", 13) == 0 &&
+            eFile_Close(fd) == 0,
+        "eFile_WriteBuf bad.axf");
+  Heap_Stats(&before);
+  for (i = 0; i < LOADS; i++) {
+    check(exec_elf("bad.axf", &Env) == -1, "exec_elf of bad.axf");
+  }
+  Heap_Stats(&after);
+  check(after.used == before.used, "link map freed");
+  check(eFile_Delete("bad.axf") == 0, "bad.axf closed");
+  printf(" not a program, %d loads refused\n", LOADS);
+}
+
+// eFile_CreateSize allocates only for the writer, on the disk a file
+// never holds clusters past its size
+static void Unwritten(void) {
+  FATFS *fs;
+  DWORD before, after;
+  char *name;
+  unsigned long size;
+  int fd;
+  check(f_getfree("", &before, &fs) == FR_OK, "f_getfree");
+  check(eFile_CreateSize("empty", STREAMSIZE) == 0, "eFile_CreateSize empty");
+  check(f_getfree("", &after, &fs) == FR_OK && after == before,
+        "no clusters before the file is opened");
+  fd = eFile_Open("empty", EFILE_WRITE);
+  check(fd >= 0 && eFile_Close(fd) == 0, "eFile_Close empty");
+  check(f_getfree("", &after, &fs) == FR_OK && after == before,
+        "clusters freed at eFile_Close");
+  check(eFile_DOpen("") == 0, "eFile_DOpen");
+  while (eFile_DirNext(&name, &size) == 0 && strcmp(name, "EMPTY")) {
+  }
+  check(eFile_DClose() == 0 && size == 0, "empty file has size 0");
+  check(eFile_Delete("empty") == 0, "eFile_Delete empty");
+  printf(" file made with eFile_CreateSize and closed unwritten is empty\n");
+}
+
+// CHUNK at a time into a new file, then back
+static void Stream(host_disk_counts_t *counts) {
+  static char data[CHUNK];
+  unsigned long i;
+  int fd;
+  check(eFile_CreateSize("stream", STREAMSIZE) == 0, "eFile_CreateSize");
+  fd = eFile_Open("stream", EFILE_WRITE);
+  check(fd >= 0, "eFile_Open stream");
+  for (i = 0; i < STREAMSIZE; i += CHUNK) {
+    memset(data, i / CHUNK, CHUNK);
+    check(eFile_WriteBuf(fd, data, CHUNK) == 0, "eFile_WriteBuf stream");
+  }
+  check(eFile_Close(fd) == 0, "eFile_Close stream");
+  Report("  write", counts, STREAMSIZE);
+  fd = eFile_Open("stream", EFILE_READ);
+  for (i = 0; eFile_ReadBuf(fd, data, CHUNK) == CHUNK; i += CHUNK) {
+    check((data[0] == (char)(i / CHUNK)) &&
+              (data[CHUNK - 1] == (char)(i / CHUNK)),
+          "stream contents");
+  }
+  check(i == STREAMSIZE && eFile_Close(fd) == 0, "stream size");
+  Report("  read ", counts, STREAMSIZE);
+}
+
+int main(int argc, char *argv[]) {
+  host_disk_counts_t counts;
+  cache_stats_t before, after;
+  unsigned long size;
+  int i;
+  RamDisk_Erase();
+  HostDisk_Use(&RamDisk);
+  OS_bSignal(&LCDFree);
+  check(Heap_Init() == 0, "Heap_Init");
+  check(eFile_Init() == 0, "eFile_Init");
+  eFile_Mount();  // FatFs formats a mounted volume
+  check(eFile_Format() == 0 && eFile_Mount() == 0, "eFile_Format");
+#ifdef CACHE_BYPASS
+  printf("FatFs, no cache\n");
+#else
+  printf("FatFs, cache of %d sets of %d ways and %d pinned sectors\n",
+         CACHE_SETS, CACHE_WAYS, CACHE_PINNED);
+#endif
+  size = Copy((argc > 1) ? argv[1] : PROGRAM, "user.axf");
+  check(eFile_Unmount() == 0 && eFile_Mount() == 0, "eFile_Mount");
+  printf(" exec_elf, %d loads of a %lu byte program\n", LOADS, size);
+  counts = HostDiskCounts;
+  eCache_Stats(&before);
+  for (i = 0; i < LOADS; i++) {
+    check(exec_elf("user.axf", &Env) == 1, "exec_elf");
+  }
+  eCache_Stats(&after);
+  check(Started == LOADS, "processes started");
+  Report("  load ", &counts, 0);
+  printf("  %lu sectors asked of the cache\n",
+         (unsigned long)(after.hits + after.misses - before.hits -
+                         before.misses));
+  NotElf();
+  Unwritten();
+  printf(" stream, %d KB %d bytes at a time\n", STREAMSIZE / 1024, CHUNK);
+  counts = HostDiskCounts;  // not what the checks above cost
+  Stream(&counts);
+  check(eFile_Unmount() == 0, "eFile_Unmount");
+  return 0;
+}
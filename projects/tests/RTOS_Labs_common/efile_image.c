@@ -0,0 +1,227 @@
+/* Host tool for SD card images in the eFile format
+ * Works on a raw image of the card (see file_disk.h) with the same eFile.c
+ * the target runs, so what it writes the target mounts:
+ *
+ *   efile_image card.img format               make it an empty eFile disk
+ *   efile_image card.img list [DIR]           files and sizes, recursively
+ *   efile_image card.img extract NAME [FILE]  copy a file out, to stdout
+ *                                             without FILE
+ *   efile_image card.img inject FILE [NAME]   copy a file in, replacing one
+ *   efile_image card.img fsck                 check the directory and FAT
+ *   efile_image card.img frag                 fragmentation of every file
+ *
+ * NAME is an eFile path such as "logs/robot0". inject creates the
+ * directories in it, and without NAME uses the last part of FILE. The tool
+ * must be built with the layout of the target, e.g.
+ *
+ *   make efile_image LAYOUT="-DEFILE_LOG=0 -DEFILE_BLOCKS=8192"
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../RTOS_Labs_common/OS.h"
+#include "../../RTOS_Labs_common/eFile.h"
+#include "file_disk.h"
+
+#ifndef EFILE_BLOCKS
+#define EFILE_BLOCKS 4096  // same default as eFile.c, sectors formatted
+#endif
+#define PATHSIZE 256  // longest eFile path
+#define CHUNK 4096    // bytes copied at a time
+
+// what List prints for a file
+#define SIZES 0  // its size
+#define RUNS 1   // its size and the runs of blocks it is in
+#define BAD 2    // nothing, only if its chain is broken
+
+// eFile.c locks the disk, there is a single thread here
+Sema4Type LCDFree;
+void OS_bWait(Sema4Type *semaPt) { semaPt->Value--; }
+void OS_bSignal(Sema4Type *semaPt) { semaPt->Value++; }
+int OS_bTryWait(Sema4Type *semaPt) {
+  if (semaPt->Value <= 0) return 0;
+  semaPt->Value--;
+  return 1;
+}
+
+static int fail(const char *what, const char *name) {
+  fprintf(stderr, "efile_image: %s %s\n", what, name);
+  return 1;
+}
+
+// dir/name, or name in the root directory
+static void Join(char path[PATHSIZE], const char *dir, const char *name) {
+  snprintf(path, PATHSIZE, "%s%s%s", dir, dir[0] ? "/" : "", name);
+}
+
+// names and sizes in a directory, in a list to free; -1 if it is not one
+static int Read(const char *dir, char (**names)[8], unsigned long **sizes) {
+  char *name;
+  unsigned long size;
+  int n = 0;
+  *names = 0;
+  *sizes = 0;
+  if (eFile_DOpen(dir)) return -1;
+  while (eFile_DirNext(&name, &size) == 0) {
+    *names = realloc(*names, (n + 1) * sizeof(**names));
+    *sizes = realloc(*sizes, (n + 1) * sizeof(**sizes));
+    strncpy((*names)[n], name, 8);
+    (*sizes)[n++] = size;
+  }
+  eFile_DClose();
+  return n;
+}
+
+// print the files in a directory and in the ones in it, see SIZES; a
+// file with a broken chain is always printed
+static void List(const char *dir, int mode) {
+  char (*names)[8], path[PATHSIZE];
+  unsigned long *sizes;
+  int i, n = Read(dir, &names, &sizes), runs;
+  for (i = 0; i < n; i++) {
+    Join(path, dir, names[i]);
+    if (eFile_DOpen(path) == 0) {  // a subdirectory
+      eFile_DClose();
+      if (mode == SIZES) printf("%10s  %s/\n", "", path);
+      List(path, mode);
+      continue;
+    }
+    runs = eFile_Fragments(path);
+    if (runs < 0) {
+      printf("%10lu  %s  bad block chain\n", sizes[i], path);
+    } else if (mode == RUNS) {
+      printf("%10lu  %s  %d run%s\n", sizes[i], path, runs,
+             (runs == 1) ? "" : "s");
+    } else if (mode == SIZES) {
+      printf("%10lu  %s\n", sizes[i], path);
+    }
+  }
+  free(names);
+  free(sizes);
+}
+
+static int Extract(const char *name, const char *file) {
+  FILE *out = file ? fopen(file, "wb") : stdout;
+  char buffer[CHUNK];
+  int fd = eFile_Open(name, EFILE_READ), result = 0;
+  int32_t n;
+  if (out == 0) return fail("cannot create", file);
+  if (fd < 0) {
+    result = fail("no file", name);
+  } else {
+    while ((n = eFile_ReadBuf(fd, buffer, CHUNK)) > 0) {
+      if (fwrite(buffer, 1, n, out) != (size_t)n) result = 1;
+    }
+    if ((n < 0) || eFile_Close(fd)) result = 1;
+  }
+  if (file && fclose(out)) result = 1;
+  return result;
+}
+
+static int Inject(const char *file, const char *name) {
+  FILE *in = fopen(file, "rb");
+  char buffer[CHUNK], path[PATHSIZE], *slash;
+  long size;
+  size_t n;
+  int fd, result = 0;
+  if (in == 0) return fail("cannot open", file);
+  fseek(in, 0, SEEK_END);
+  size = ftell(in);
+  rewind(in);
+  snprintf(path, PATHSIZE, "%s", name);
+  for (slash = strchr(path, '/'); slash; slash = strchr(slash + 1, '/')) {
+    *slash = 0;
+    eFile_DCreate(path);  // fails if it is there already
+    *slash = '/';
+  }
+  eFile_Delete(name);  // fails if there is none
+  if (eFile_CreateSize(name, size)) {
+    fclose(in);
+    return fail("cannot create", name);
+  }
+  fd = eFile_Open(name, EFILE_WRITE);
+  if (fd < 0) result = 1;
+  while (!result && (n = fread(buffer, 1, CHUNK, in)) > 0) {
+    result = eFile_WriteBuf(fd, buffer, n);
+  }
+  if ((fd >= 0) && eFile_Close(fd)) result = 1;
+  fclose(in);
+  if (result) return fail("disk full or cannot write", name);
+  return 0;
+}
+
+// check the disk, or with fragments report on its fragmentation
+static int Fsck(int fragments) {
+  efile_check_t check;
+  List("", fragments ? RUNS : BAD);
+  if (eFile_Check(&check)) return fail("cannot read", "the disk");
+  printf("%lu files, %lu directories\n", (unsigned long)check.files,
+         (unsigned long)check.directories);
+  printf("%lu blocks used in %lu runs, %.2f runs per file\n",
+         (unsigned long)check.used, (unsigned long)check.fragments,
+         check.files ? (double)check.fragments / check.files : 0.0);
+  printf("%lu blocks free in %lu runs, the longest %lu\n",
+         (unsigned long)check.free, (unsigned long)check.holes,
+         (unsigned long)check.largest);
+  if (fragments) return 0;
+  printf("%lu blocks lost, %lu errors\n", (unsigned long)check.lost,
+         (unsigned long)check.errors);
+  return check.lost || check.errors;
+}
+
+static int Usage(void) {
+  fprintf(stderr,
+          "usage: efile_image IMAGE format\n"
+          "       efile_image IMAGE list [DIR]\n"
+          "       efile_image IMAGE extract NAME [FILE]\n"
+          "       efile_image IMAGE inject FILE [NAME]\n"
+          "       efile_image IMAGE fsck\n"
+          "       efile_image IMAGE frag\n");
+  return 2;
+}
+
+int main(int argc, char *argv[]) {
+  const char *command = (argc > 2) ? argv[2] : "", *name;
+  int result;
+  if ((argc < 3) || (argc > 5)) return Usage();
+  if (FileDisk_Open(argv[1], strcmp(command, "format") ? 0 : EFILE_BLOCKS)) {
+    return fail("cannot open", argv[1]);
+  }
+  HostDisk_Use(&FileDisk);
+  if (eFile_Init()) return fail("cannot read", argv[1]);
+  if (!strcmp(command, "format")) {
+    result = eFile_Format();
+    FileDisk_Close();
+    return result ? fail("cannot format", argv[1]) : 0;
+  }
+  if (eFile_Mount()) return fail("not an eFile disk of this layout", argv[1]);
+  if (!strcmp(command, "list") && (argc < 5)) {
+    name = (argc > 3) ? argv[3] : "";
+    if (name[0] && eFile_DOpen(name)) {
+      result = fail("no directory", name);
+    } else {
+      if (name[0]) eFile_DClose();
+      List(name, SIZES);
+      result = 0;
+    }
+  } else if (!strcmp(command, "extract") && (argc > 3)) {
+    result = Extract(argv[3], (argc > 4) ? argv[4] : 0);
+  } else if (!strcmp(command, "inject") && (argc > 3)) {
+    name = strrchr(argv[3], '/');
+    name = (argc > 4) ? argv[4] : name ? name + 1 : argv[3];
+    result = Inject(argv[3], name);
+  } else if (!strcmp(command, "fsck") && (argc == 3)) {
+    result = Fsck(0);
+  } else if (!strcmp(command, "frag") && (argc == 3)) {
+    result = Fsck(1);
+  } else {
+    result = Usage();
+  }
+  if (eFile_Unmount() || FileDisk_Close()) {
+    result = fail("cannot write", argv[1]);
+  }
+  return result;
+}
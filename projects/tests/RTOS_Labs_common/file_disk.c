@@ -0,0 +1,53 @@
+/* File-backed disk for host builds of the file systems, see file_disk.h
+ * Every call reads or writes the image at once, a sync is an fsync.
+ */
+
+#include "file_disk.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int Image = -1;  // file descriptor of the image
+static DWORD Size;      // sectors in it
+
+int FileDisk_Open(const char *path, DWORD sectors) {
+  struct stat status;
+  if (Image >= 0) return 1;
+  Image = open(path, sectors ? (O_RDWR | O_CREAT) : O_RDWR, 0644);
+  if ((Image < 0) || fstat(Image, &status)) return 1;
+  Size = status.st_size / 512;
+  if (Size < sectors) {
+    if (ftruncate(Image, (off_t)sectors * 512)) return 1;
+    Size = sectors;
+  }
+  return 0;
+}
+
+int FileDisk_Close(void) {
+  int result;
+  if (Image < 0) return 1;
+  result = fsync(Image) | close(Image);
+  Image = -1;
+  return result != 0;
+}
+
+static DRESULT Read(BYTE *buff, DWORD sector, UINT count) {
+  if (pread(Image, buff, count * 512, (off_t)sector * 512) != count * 512) {
+    return RES_ERROR;
+  }
+  return RES_OK;
+}
+
+static DRESULT Write(const BYTE *buff, DWORD sector, UINT count) {
+  if (pwrite(Image, buff, count * 512, (off_t)sector * 512) != count * 512) {
+    return RES_ERROR;
+  }
+  return RES_OK;
+}
+
+static DRESULT Sync(void) { return fsync(Image) ? RES_ERROR : RES_OK; }
+
+static DWORD Sectors(void) { return Size; }
+
+const host_disk_backend_t FileDisk = {Read, Write, Sync, Sectors};
@@ -0,0 +1,20 @@
+/* File-backed disk for host builds of the file systems
+ * A host_disk.h backend on a raw image of an SD card, e.g., one copied with
+ * dd if=/dev/sdX of=card.img, sector n at byte offset 512 * n.
+ */
+
+#ifndef FILE_DISK_H
+#define FILE_DISK_H
+
+#include "host_disk.h"
+
+extern const host_disk_backend_t FileDisk;
+
+// open the image at path; with sectors nonzero create it if there is none
+// and make it at least that many sectors. Returns 0 if successful.
+int FileDisk_Open(const char *path, DWORD sectors);
+
+// sync and close the image; returns 0 if successful
+int FileDisk_Close(void);
+
+#endif
@@ -0,0 +1,77 @@
+/* First-fit allocator for host comparisons with heap.c, see first_fit.h */
+
+#include "first_fit.h"
+
+#include <stdint.h>
+
+typedef struct ffblock {
+  size_t size;  // bytes including this header
+  struct ffblock* next;
+} ffblock_t;
+static ffblock_t* FFFree;
+unsigned long FFSteps, FFMaxSteps;
+
+void FF_Init(void* memory, size_t bytes) {
+  FFFree = memory;
+  FFFree->size = bytes;
+  FFFree->next = 0;
+}
+
+void* FF_Malloc(size_t bytes) {
+  ffblock_t **link = &FFFree, *b;
+  size_t size = (bytes + sizeof(size_t) + sizeof(size_t) - 1) &
+                ~(sizeof(size_t) - 1);
+  unsigned long steps = 0;
+  if (size < sizeof(ffblock_t)) size = sizeof(ffblock_t);
+  for (b = FFFree; b; link = &b->next, b = b->next) {
+    steps++;
+    if (b->size >= size) {
+      if (b->size - size >= sizeof(ffblock_t)) {
+        ffblock_t* rest = (ffblock_t*)((uint8_t*)b + size);
+        rest->size = b->size - size;
+        rest->next = b->next;
+        *link = rest;
+        b->size = size;
+      } else {
+        *link = b->next;
+      }
+      break;
+    }
+  }
+  FFSteps += steps;
+  if (steps > FFMaxSteps) FFMaxSteps = steps;
+  return b ? (uint8_t*)b + sizeof(size_t) : 0;
+}
+
+void FF_Free(void* p) {
+  ffblock_t* b = (ffblock_t*)((uint8_t*)p - sizeof(size_t));
+  ffblock_t *prev = 0, *next = FFFree;
+  while (next && next < b) {
+    prev = next;
+    next = next->next;
+  }
+  b->next = next;
+  if (next && (uint8_t*)b + b->size == (uint8_t*)next) {
+    b->size += next->size;
+    b->next = next->next;
+  }
+  if (prev && (uint8_t*)prev + prev->size == (uint8_t*)b) {
+    prev->size += b->size;
+    prev->next = b->next;
+  } else if (prev) {
+    prev->next = b;
+  } else {
+    FFFree = b;
+  }
+}
+
+void FF_Stats(size_t* free, size_t* largestFree) {
+  ffblock_t* b;
+  *free = *largestFree = 0;
+  for (b = FFFree; b; b = b->next) {
+    *free += b->size - sizeof(size_t);
+    if (b->size - sizeof(size_t) > *largestFree) {
+      *largestFree = b->size - sizeof(size_t);
+    }
+  }
+}
@@ -0,0 +1,25 @@
+/* First-fit allocator for host comparisons with heap.c
+ * An address ordered free list with a size word in front of every block,
+ * the classic heap the TLSF allocator replaced.
+ */
+
+#ifndef FIRST_FIT_H
+#define FIRST_FIT_H
+
+#include <stddef.h>
+
+extern unsigned long FFSteps, FFMaxSteps;  // blocks visited per FF_Malloc
+
+// manage bytes of memory, aligned to size_t, as one free block
+void FF_Init(void* memory, size_t bytes);
+
+// allocate bytes, NULL if no free block is large enough
+void* FF_Malloc(size_t bytes);
+
+// return a block from FF_Malloc
+void FF_Free(void* p);
+
+// free bytes and the largest free block, as in heap_stats_t
+void FF_Stats(size_t* free, size_t* largestFree);
+
+#endif
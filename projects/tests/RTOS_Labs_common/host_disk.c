@@ -0,0 +1,123 @@
+/* Host disk for host builds of the file systems, see host_disk.h
+ * Commands are counted as eDisk.c sends them to an SDHC card: one for a
+ * single sector, CMD18 and CMD12 for a run read, CMD55, CMD23 and CMD25 for
+ * a run written or an eDisk_WriteBegin stream (CMD25 alone without a
+ * count). The card is busy once after each write command, a stream
+ * included. The initialization sequence is not counted.
+ */
+
+#include "host_disk.h"
+
+#include <string.h>
+#include <time.h>
+
+host_disk_counts_t HostDiskCounts;
+host_disk_timing_t HostDiskTiming = {HOSTDISK_COMMAND, HOSTDISK_BYTE,
+                                     HOSTDISK_BUSY, HOSTDISK_SLEEP};
+int HostDiskOff;
+static const host_disk_backend_t *Disk;
+static DSTATUS Stat = STA_NOINIT;
+static DWORD Stream;  // next sector of an eDisk_WriteBegin stream
+static int Streaming;
+
+void HostDisk_Use(const host_disk_backend_t *backend) {
+  Disk = backend;
+  Stat = STA_NOINIT;
+  Streaming = 0;
+}
+
+void HostDisk_Reset(void) {
+  memset(&HostDiskCounts, 0, sizeof(HostDiskCounts));
+}
+
+// count commands and sectors and the time they take
+static void Count(unsigned long commands, unsigned long reads,
+                  unsigned long writes, int busy) {
+  unsigned long long ns = commands * HostDiskTiming.command +
+                          (reads + writes) * 512ull * HostDiskTiming.byte +
+                          (busy ? HostDiskTiming.busy : 0);
+  struct timespec delay;
+  HostDiskCounts.commands += commands;
+  HostDiskCounts.reads += reads;
+  HostDiskCounts.writes += writes;
+  HostDiskCounts.time += ns;
+  if (HostDiskTiming.sleep && ns) {
+    delay.tv_sec = ns / 1000000000;
+    delay.tv_nsec = ns % 1000000000;
+    nanosleep(&delay, 0);
+  }
+}
+
+DSTATUS eDisk_Init(BYTE drive) {
+  if (drive || (Disk == 0)) return STA_NOINIT;
+  Stat = 0;
+  return Stat;
+}
+
+DSTATUS eDisk_Status(BYTE drive) { return drive ? STA_NOINIT : Stat; }
+
+DRESULT eDisk_Read(BYTE drv, BYTE *buff, DWORD sector, UINT count) {
+  if (drv || !count || (sector + count > Disk->sectors())) return RES_PARERR;
+  if (Stat & STA_NOINIT) return RES_NOTRDY;
+  Count((count == 1) ? 1 : 2, count, 0, 0);
+  return Disk->read(buff, sector, count);
+}
+
+DRESULT eDisk_ReadBlock(BYTE *buff, DWORD sector) {
+  return eDisk_Read(0, buff, sector, 1);
+}
+
+DRESULT eDisk_Write(BYTE drv, const BYTE *buff, DWORD sector, UINT count) {
+  if (drv || !count || (sector + count > Disk->sectors())) return RES_PARERR;
+  if (Stat & STA_NOINIT) return RES_NOTRDY;
+  if (HostDiskOff) return RES_ERROR;
+  Count((count == 1) ? 1 : 3, 0, count, 1);
+  return Disk->write(buff, sector, count);
+}
+
+DRESULT eDisk_WriteBlock(const BYTE *buff, DWORD sector) {
+  return eDisk_Write(0, buff, sector, 1);
+}
+
+DRESULT eDisk_WriteBegin(DWORD sector, UINT count) {
+  if (Stat & STA_NOINIT) return RES_NOTRDY;
+  Streaming = 1;
+  Stream = sector;
+  Count(count ? 3 : 1, 0, 0, 0);
+  return RES_OK;
+}
+
+DRESULT eDisk_WriteNext(const BYTE *buff) {
+  if (!Streaming) return RES_PARERR;
+  if (HostDiskOff || (Stream >= Disk->sectors()) ||
+      (Disk->write(buff, Stream++, 1) != RES_OK)) {
+    Streaming = 0;
+    return RES_ERROR;
+  }
+  Count(0, 0, 1, 0);
+  return RES_OK;
+}
+
+DRESULT eDisk_WriteEnd(void) {
+  if (!Streaming) return RES_PARERR;
+  Streaming = 0;
+  Count(0, 0, 0, 1);
+  return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE drv, BYTE cmd, void *buff) {
+  if (drv) return RES_PARERR;
+  if (Stat & STA_NOINIT) return RES_NOTRDY;
+  switch (cmd) {
+    case CTRL_SYNC:  // eDisk.c waits until the card is not busy
+      return Disk->sync();
+    case GET_SECTOR_COUNT:  // CMD9, read the CSD
+      Count(1, 0, 0, 0);
+      *(DWORD *)buff = Disk->sectors();
+      return RES_OK;
+    case GET_BLOCK_SIZE:
+      *(DWORD *)buff = 1;
+      return RES_OK;
+  }
+  return RES_PARERR;
+}
@@ -0,0 +1,60 @@
+/* Host disk for host builds of the file systems
+ * Implements eDisk.h on a backend that keeps the sectors, the RAM disk of
+ * ram_disk.h or the image file of file_disk.h, and counts the SD card
+ * commands the real eDisk.c would send for the same calls and the time an
+ * SD card would take for them, see HostDiskTiming.
+ */
+
+#ifndef HOST_DISK_H
+#define HOST_DISK_H
+
+#include "../../RTOS_Labs_common/eDisk.h"
+
+#ifndef HOSTDISK_COMMAND
+#define HOSTDISK_COMMAND 100000  // ns per command, until the card responds
+#endif
+#ifndef HOSTDISK_BYTE
+#define HOSTDISK_BYTE 800  // ns per data byte, SPI at 10 MHz
+#endif
+#ifndef HOSTDISK_BUSY
+#define HOSTDISK_BUSY 1000000  // ns the card programs after a write
+#endif
+#ifndef HOSTDISK_SLEEP
+#define HOSTDISK_SLEEP 0  // 1: calls take the time, 0: it is only counted
+#endif
+
+// where the sectors are kept; the calls return RES_OK or RES_ERROR
+typedef struct host_disk_backend {
+  DRESULT (*read)(BYTE *buff, DWORD sector, UINT count);
+  DRESULT (*write)(const BYTE *buff, DWORD sector, UINT count);
+  DRESULT (*sync)(void);   // make the writes durable
+  DWORD (*sectors)(void);  // size of the disk
+} host_disk_backend_t;
+
+// SD card simulated, in ns, HOSTDISK_COMMAND etc. by default
+typedef struct host_disk_timing {
+  unsigned long command;  // per command
+  unsigned long byte;     // per data byte
+  unsigned long busy;     // after a write command or stream
+  int sleep;              // HOSTDISK_SLEEP
+} host_disk_timing_t;
+
+// SD card traffic since the last HostDisk_Reset
+typedef struct host_disk_counts {
+  unsigned long commands;  // CMD17, CMD18+CMD12, CMD24, ACMD23+CMD25, CMD9
+  unsigned long reads;     // sectors read
+  unsigned long writes;    // sectors written
+  unsigned long long time;  // ns, with HostDiskTiming
+} host_disk_counts_t;
+
+extern host_disk_counts_t HostDiskCounts;
+extern host_disk_timing_t HostDiskTiming;
+extern int HostDiskOff;  // nonzero: writes fail, as after a power loss
+
+// use a backend as drive 0, before eDisk_Init
+void HostDisk_Use(const host_disk_backend_t *backend);
+
+// clear HostDiskCounts
+void HostDisk_Reset(void);
+
+#endif
@@ -0,0 +1,27 @@
+/* RAM disk for host builds of the file systems, see ram_disk.h
+ * Writes are durable at once, there is nothing to sync.
+ */
+
+#include "ram_disk.h"
+
+#include <string.h>
+
+static BYTE Disk[RAMDISK_SECTORS][512];
+
+void RamDisk_Erase(void) { memset(Disk, 0, sizeof(Disk)); }
+
+static DRESULT Read(BYTE *buff, DWORD sector, UINT count) {
+  memcpy(buff, Disk[sector], count * 512);
+  return RES_OK;
+}
+
+static DRESULT Write(const BYTE *buff, DWORD sector, UINT count) {
+  memcpy(Disk[sector], buff, count * 512);
+  return RES_OK;
+}
+
+static DRESULT Sync(void) { return RES_OK; }
+
+static DWORD Sectors(void) { return RAMDISK_SECTORS; }
+
+const host_disk_backend_t RamDisk = {Read, Write, Sync, Sectors};
@@ -0,0 +1,19 @@
+/* RAM disk for host builds of the file systems
+ * A host_disk.h backend on an array of RAMDISK_SECTORS sectors.
+ */
+
+#ifndef RAM_DISK_H
+#define RAM_DISK_H
+
+#include "host_disk.h"
+
+#ifndef RAMDISK_SECTORS
+#define RAMDISK_SECTORS 8192  // 4 MB
+#endif
+
+extern const host_disk_backend_t RamDisk;
+
+// erase the disk to zeros
+void RamDisk_Erase(void);
+
+#endif
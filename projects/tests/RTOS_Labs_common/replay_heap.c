@@ -0,0 +1,340 @@
+/* Host replay of a heap trace recorded on the target
+ * Build heap.c with HEAP_PROFILE on the target, capture the output of the
+ * Interpreter's "heap trace" command (drain it often enough that the
+ * "heap" command reports no lost events), then replay the allocations
+ * against the TLSF heap and against first fit, both with HEAP_SIZE bytes.
+ * Reports failed allocations, peak usage, worst fragmentation and the
+ * latency of each strategy in ticks (TSC cycles on x86, else ns), the
+ * size-class histogram, and the call sites that allocate the most. Try
+ * candidate heap sizes by rebuilding:
+ *
+ *   make replay_heap HEAP_SIZE=6144 && ./replay_heap trace.txt
+ *
+ * make run replays heap_trace.txt, a trace of heap.c on the host: a
+ * process loaded into an arena six times while three threads pass small
+ * messages and grow a buffer.
+ *
+ * Only lines "H op size block old thread time caller" are read. Host blocks
+ * are 8-byte aligned, so usage comes out slightly higher than on the target.
+ * Arenas are replayed as arenas on TLSF; first fit has none and gets each
+ * arena as one block, skipping the allocations in it.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../../RTOS_Labs_common/heap.h"
+#include "first_fit.h"
+
+#ifndef HEAP_SIZE
+#define HEAP_SIZE 8192  // same default as heap.c
+#endif
+#define REPEAT 5       // per operation the fastest of this many replays counts
+#define MAXCALLERS 64  // distinct call sites counted
+#define TOPCALLERS 5   // call sites reported
+
+// heap.c runs its operations in critical sections and, with HEAP_PROFILE,
+// time stamps them
+long StartCritical(void) { return 0; }
+void EndCritical(long sr) { (void)sr; }
+uint32_t OS_Time(void) { return 0; }
+uint32_t OS_Id(void) { return 0; }
+
+typedef struct result {
+  unsigned long failures;       // allocations that returned NULL
+  unsigned long unmatched;      // frees of blocks this replay does not have
+  size_t peak;                  // largest number of bytes allocated
+  unsigned worstFragmentation;  // percent, as in heap_stats_t
+  double maxTicks, totalTicks;
+} result_t;
+
+typedef struct caller {
+  uint32_t address;
+  unsigned long calls, bytes;
+} caller_t;
+
+static heap_event_t* Events;
+static int NumEvents;
+static void* Live[65536 / 4];          // replayed block of each target offset
+static uint32_t LiveBytes[65536 / 4];  // bytes asked for it
+static uint16_t LiveArena[65536 / 4];  // target offset of its arena, 0 if none
+static size_t FFMemory[HEAP_SIZE / sizeof(size_t)];
+
+// time stamp in ticks: TSC cycles on x86 hosts, otherwise ns
+static double Now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return (double)__rdtsc();
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+#endif
+}
+
+static int Read(const char* path) {
+  char line[128];
+  unsigned size, block, old, id, time, caller;
+  char op;
+  int max = 0;
+  FILE* f = fopen(path, "r");
+  if (f == 0) return -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (sscanf(line, " H %c %u %x %x %u %x %x", &op, &size, &block, &old, &id,
+               &time, &caller) != 7) {
+      continue;
+    }
+    if (NumEvents == max) {
+      max = max ? 2 * max : 1024;
+      Events = realloc(Events, max * sizeof(heap_event_t));
+    }
+    Events[NumEvents].op = op;
+    Events[NumEvents].size = size;
+    Events[NumEvents].block = block;
+    Events[NumEvents].old = old;
+    Events[NumEvents].id = id;
+    Events[NumEvents].time = time;
+    Events[NumEvents].caller = caller;
+    NumEvents++;
+  }
+  fclose(f);
+  return 0;
+}
+
+// usage after an operation, for the peak and the fragmentation
+static void Sample(int firstFit, result_t* r) {
+  size_t used, free, largest;
+  heap_stats_t stats;
+  if (firstFit) {
+    FF_Stats(&free, &largest);
+    used = sizeof(FFMemory) - free;
+  } else {
+    Heap_Stats(&stats);
+    used = stats.used;
+    free = stats.free;
+    largest = stats.largestFree;
+  }
+  if (used > r->peak) r->peak = used;
+  if (free && (free - largest) * 100 / free > r->worstFragmentation) {
+    r->worstFragmentation = (free - largest) * 100 / free;
+  }
+}
+
+// replay an arena event on TLSF, or on first fit the arena as one block
+// Outputs: 1 if the event was replayed, 0 if its arena or block is unknown
+static int ArenaEvent(int firstFit, const heap_event_t* e, double* ticks,
+                      result_t* r) {
+  void *arena = Live[(e->op == HEAP_ARENA_MALLOC || e->op == HEAP_ARENA_FREE)
+                         ? e->old / 4
+                         : e->block / 4],
+       *p = 0;
+  double start;
+  int i;
+  if ((e->op != HEAP_ARENA) && (arena == 0)) return 0;
+  if (firstFit && (e->op == HEAP_ARENA_MALLOC || e->op == HEAP_ARENA_FREE)) {
+    return 1;  // inside the block, nothing to do
+  }
+  if ((e->op == HEAP_ARENA_FREE) && (Live[e->block / 4] == 0)) return 0;
+  start = Now();
+  switch (e->op) {
+    case HEAP_ARENA:
+      p = firstFit ? FF_Malloc(e->size) : Arena_Create(e->size);
+      break;
+    case HEAP_DESTROY:
+      if (firstFit) {
+        FF_Free(arena);
+      } else {
+        Arena_Destroy(arena);
+      }
+      break;
+    case HEAP_ARENA_MALLOC:
+      p = Arena_Malloc(arena, e->size);
+      break;
+    default:
+      Arena_Free(arena, Live[e->block / 4]);
+  }
+  *ticks = Now() - start;
+  if (e->op == HEAP_DESTROY) {
+    for (i = 0; i < 65536 / 4; i++) {  // its blocks go with it
+      if (LiveArena[i] == e->block) Live[i] = 0;
+    }
+    Live[e->block / 4] = 0;
+  } else if (e->op == HEAP_ARENA_FREE) {
+    Live[e->block / 4] = 0;
+  } else {
+    if (p == 0) r->failures++;
+    Live[e->block / 4] = p;
+    LiveBytes[e->block / 4] = e->size;
+    LiveArena[e->block / 4] = (e->op == HEAP_ARENA) ? 0 : e->old;
+  }
+  return 1;
+}
+
+// run the trace once, recording the time of each operation in ticks[]
+static void Replay(int firstFit, double* ticks, result_t* r) {
+  const heap_event_t* e;
+  void *p, *old;
+  double start;
+  int i;
+  memset(Live, 0, sizeof(Live));
+  memset(LiveArena, 0, sizeof(LiveArena));
+  if (firstFit) {
+    FF_Init(FFMemory, sizeof(FFMemory));
+  } else {
+    Heap_Init();
+  }
+  for (i = 0; i < NumEvents; i++) {
+    e = &Events[i];
+    ticks[i] = 0;
+    if ((e->op == HEAP_ARENA) || (e->op == HEAP_DESTROY) ||
+        (e->op == HEAP_ARENA_MALLOC) || (e->op == HEAP_ARENA_FREE)) {
+      if (!ArenaEvent(firstFit, e, &ticks[i], r)) r->unmatched++;
+    } else if (e->op == HEAP_FREE) {
+      p = Live[e->block / 4];
+      if (p == 0) {
+        r->unmatched++;  // allocated before the trace, or failed here
+        continue;
+      }
+      start = Now();
+      if (firstFit) {
+        FF_Free(p);
+      } else {
+        Heap_Free(p);
+      }
+      ticks[i] = Now() - start;
+      Live[e->block / 4] = 0;
+    } else if (e->op == HEAP_REALLOC) {
+      old = e->old ? Live[e->old / 4] : 0;
+      if (e->old && old == 0) {
+        r->unmatched++;
+        continue;
+      }
+      start = Now();
+      if (firstFit) {
+        p = FF_Malloc(e->size);
+        if (p && old) {
+          memcpy(p, old,
+                 LiveBytes[e->old / 4] < e->size ? LiveBytes[e->old / 4]
+                                                 : e->size);
+          FF_Free(old);
+        }
+      } else {
+        p = Heap_Realloc(old, e->size);
+      }
+      ticks[i] = Now() - start;
+      if (p == 0) r->failures++;
+      if (e->old) Live[e->old / 4] = 0;
+      if (p || e->block) {  // where the target has the block now
+        Live[(e->block ? e->block : e->old) / 4] = p ? p : old;
+        LiveBytes[(e->block ? e->block : e->old) / 4] = e->size;
+      }
+    } else {
+      start = Now();
+      if (firstFit) {
+        p = FF_Malloc(e->size);
+        if (p && e->op == HEAP_CALLOC) memset(p, 0, e->size);
+      } else if (e->op == HEAP_CALLOC) {
+        p = Heap_Calloc(e->size);
+      } else {
+        p = Heap_Malloc(e->size);
+      }
+      ticks[i] = Now() - start;
+      if (p == 0) r->failures++;
+      Live[e->block / 4] = p;  // block 0 if it failed on the target too
+      LiveBytes[e->block / 4] = e->size;
+    }
+    Sample(firstFit, r);
+  }
+}
+
+static void Measure(int firstFit, double* ticks, double* best, result_t* r) {
+  result_t once;
+  int i, k;
+  for (k = 0; k < REPEAT; k++) {
+    memset(&once, 0, sizeof(once));
+    Replay(firstFit, ticks, &once);
+    for (i = 0; i < NumEvents; i++) {
+      if (k == 0 || ticks[i] < best[i]) best[i] = ticks[i];
+    }
+  }
+  *r = once;
+  for (i = 0; i < NumEvents; i++) {
+    if (best[i] > r->maxTicks) r->maxTicks = best[i];
+    r->totalTicks += best[i];
+  }
+}
+
+static int ByBytes(const void* a, const void* b) {
+  const caller_t *x = a, *y = b;
+  return (y->bytes > x->bytes) - (y->bytes < x->bytes);
+}
+
+// the call sites that allocate the most bytes, to look up in the map file
+static void Callers(void) {
+  static caller_t callers[MAXCALLERS];
+  int n = 0, i, j;
+  for (i = 0; i < NumEvents; i++) {
+    if ((Events[i].op == HEAP_FREE) || (Events[i].op == HEAP_DESTROY) ||
+        (Events[i].op == HEAP_ARENA_FREE)) {
+      continue;
+    }
+    for (j = 0; j < n && callers[j].address != Events[i].caller; j++) {
+    }
+    if (j == n) {
+      if (n == MAXCALLERS) continue;
+      callers[n++].address = Events[i].caller;
+    }
+    callers[j].calls++;
+    callers[j].bytes += Events[i].size;
+  }
+  qsort(callers, n, sizeof(caller_t), ByBytes);
+  printf("call sites allocating the most:\n");
+  for (i = 0; i < n && i < TOPCALLERS; i++) {
+    printf("  %08x %lu calls %lu bytes\n", (unsigned)callers[i].address,
+           callers[i].calls, callers[i].bytes);
+  }
+}
+
+static void Print(const char* name, const result_t* r) {
+  printf("%-10s %9lu %9zu %8u%% %11.0f %10.1f\n", name, r->failures, r->peak,
+         r->worstFragmentation, r->maxTicks,
+         NumEvents ? r->totalTicks / NumEvents : 0);
+}
+
+int main(int argc, char** argv) {
+  result_t tlsf, ff;
+  heap_profile_t profile;
+  double *ticks, *best;
+  int c;
+  if (argc < 2 || Read(argv[1])) {
+    printf("usage: replay_heap trace.txt\n");
+    return 1;
+  }
+  ticks = malloc((NumEvents + 1) * sizeof(double));
+  best = malloc((NumEvents + 1) * sizeof(double));
+  Measure(0, ticks, best, &tlsf);
+  Heap_Profile(&profile);  // of the last TLSF replay
+  Measure(1, ticks, best, &ff);
+  printf("%s: %d events replayed on %d bytes, %lu frees skipped (block "
+         "allocated before the trace or not here)\n",
+         argv[1], NumEvents, HEAP_SIZE, tlsf.unmatched);
+  printf("           failures peak used worst frag worst ticks mean ticks\n");
+  Print("TLSF", &tlsf);
+  Print("first fit", &ff);
+  printf("size classes (TLSF blocks with header): allocated, live at end\n");
+  for (c = 0; c < HEAP_CLASSES; c++) {
+    if (profile.allocs[c]) {
+      printf("  %5u-%5u bytes %8u %5u\n", 1u << c, (2u << c) - 1,
+             (unsigned)profile.allocs[c], (unsigned)profile.live[c]);
+    }
+  }
+  Callers();
+  free(best);
+  free(ticks);
+  return 0;
+}